@@ -17,6 +17,7 @@
 
 #include "Firmata.h"
 #include "HardwareSerial.h"
+#include "utility/FirmataFeature.h"
 
 extern "C" {
 #include <string.h>
@@ -37,6 +38,68 @@ void FirmataClass::sendValueAsTwo7bitBytes(int value)
   FirmataStream->write(value >> 7 & 0x7F); // MSB
 }
 
+/**
+ * Write a block of 8-bit data as a packed stream of 7-bit bytes. The data bits are sent
+ * least significant bit first, 7 bits per byte, so every 7 data bytes take 8 bytes on the
+ * wire instead of the 14 bytes needed by sendValueAsTwo7bitBytes. A final partial group is
+ * padded with zero bits. Blocks that are a multiple of 7 bytes long can be sent in separate
+ * calls and are decoded as one continuous stream.
+ * @param bytec The number of data bytes to write.
+ * @param bytev A pointer to the data bytes.
+ */
+void FirmataClass::sendPackedBytes(byte bytec, const byte *bytev)
+{
+  unsigned int bits = 0;
+  byte bitCount = 0;
+
+  for (byte i = 0; i < bytec; i++) {
+    bits |= (unsigned int)bytev[i] << bitCount;
+    bitCount += 8;
+    while (bitCount >= 7) {
+      FirmataStream->write(bits & 0x7F);
+      bits >>= 7;
+      bitCount -= 7;
+    }
+  }
+  if (bitCount > 0) {
+    FirmataStream->write(bits & 0x7F);
+  }
+}
+
+/**
+ * Decode a packed stream of 7-bit bytes (see sendPackedBytes) in place.
+ * @param argc The number of packed 7-bit bytes.
+ * @param argv A pointer to the packed bytes, overwritten with the decoded data.
+ * @return The number of decoded data bytes.
+ */
+byte FirmataClass::decodePackedBytes(byte argc, byte *argv)
+{
+  unsigned int bits = 0;
+  byte bitCount = 0;
+  byte count = 0;
+
+  // the decoded data is never longer than the packed data, so it can share the buffer
+  for (byte i = 0; i < argc; i++) {
+    bits |= (unsigned int)(argv[i] & 0x7F) << bitCount;
+    bitCount += 7;
+    if (bitCount >= 8) {
+      argv[count++] = bits & 0xFF;
+      bits >>= 8;
+      bitCount -= 8;
+    }
+  }
+  return count;
+}
+
+/**
+ * @param bytec A number of data bytes.
+ * @return The number of 7-bit bytes sendPackedBytes writes for bytec data bytes.
+ */
+int FirmataClass::packedLength(byte bytec)
+{
+  return ((unsigned int)bytec * 8 + 6) / 7;
+}
+
 /**
  * A helper method to write the beginning of a Sysex message transmission.
  */
@@ -65,6 +128,8 @@ FirmataClass::FirmataClass()
 {
   firmwareVersionCount = 0;
   firmwareVersionVector = 0;
+  binaryEncoding = BINARY_ENCODING_7BIT_PAIRS;
+  hashingOutput = false;
   systemReset();
 }
 
@@ -238,6 +303,16 @@ void FirmataClass::processSysexMessage(void)
     case REPORT_FIRMWARE:
       printFirmwareVersion();
       break;
+    case BINARY_ENCODING:
+      // the host proposes an encoding, the reply tells which one is in use
+      if (sysexBytesRead > 1) {
+        setBinaryEncoding(storedInputData[1]);
+      }
+      startSysex();
+      FirmataStream->write(BINARY_ENCODING);
+      FirmataStream->write(binaryEncoding);
+      endSysex();
+      break;
     case STRING_DATA:
       if (currentStringCallback) {
         byte bufferLength = (sysexBytesRead - 1) / 2;
@@ -261,9 +336,15 @@ void FirmataClass::processSysexMessage(void)
         (*currentStringCallback)((char *)&storedInputData[0]);
       }
       break;
-    default:
-      if (currentSysexCallback)
+    default: {
+      FirmataFeatureRegistry *registry = featureRegistry();
+      byte feature = registry && storedInputData[0] < 0x80 ? getNibble(registry->sysexFeatures, storedInputData[0]) : 0;
+      if (feature) {
+        registry->features[feature - 1]->handleSysex(storedInputData[0], sysexBytesRead - 1, storedInputData + 1);
+      } else if (currentSysexCallback) {
         (*currentSysexCallback)(storedInputData[0], sysexBytesRead - 1, storedInputData + 1);
+      }
+    }
   }
 }
 
@@ -290,12 +371,17 @@ void FirmataClass::parse(byte inputData)
     if (inputData == END_SYSEX) {
       //stop sysex byte
       parsingSysex = false;
-      //fire off handler function
-      processSysexMessage();
-    } else {
+      //fire off handler function, unless the message did not fit the buffer
+      if (sysexBytesRead <= MAX_DATA_BYTES) {
+        processSysexMessage();
+      }
+    } else if (sysexBytesRead < MAX_DATA_BYTES) {
       //normal data byte - add to buffer
       storedInputData[sysexBytesRead] = inputData;
       sysexBytesRead++;
+    } else {
+      //too long for the buffer, the message is dropped at its end
+      sysexBytesRead = MAX_DATA_BYTES + 1;
     }
   } else if ( (waitForData > 0) && (inputData < 128) ) {
     waitForData--;
@@ -379,6 +465,18 @@ boolean FirmataClass::isParsingMessage(void)
   return (waitForData > 0 || parsingSysex);
 }
 
+/**
+ * Discard a partially received message, for example when the host that sent
+ * it has disconnected. The next byte is parsed as the start of a message.
+ */
+void FirmataClass::resetParser(void)
+{
+  waitForData = 0;
+  executeMultiByteCommand = 0;
+  parsingSysex = false;
+  sysexBytesRead = 0;
+}
+
 //------------------------------------------------------------------------------
 // Output Stream Handling
 
@@ -457,6 +555,141 @@ void FirmataClass::sendSysex(byte command, byte bytec, byte *bytev)
   endSysex();
 }
 
+/**
+ * Set the encoding used for binary sysex payloads. Normally this is negotiated by the host
+ * with a BINARY_ENCODING message and reset to BINARY_ENCODING_7BIT_PAIRS by SYSTEM_RESET.
+ * @param encoding BINARY_ENCODING_7BIT_PAIRS or BINARY_ENCODING_PACKED. Unknown values are
+ * ignored.
+ */
+void FirmataClass::setBinaryEncoding(byte encoding)
+{
+  if (encoding == BINARY_ENCODING_7BIT_PAIRS || encoding == BINARY_ENCODING_PACKED) {
+    binaryEncoding = encoding;
+  }
+}
+
+/**
+ * @return The encoding currently used for binary sysex payloads.
+ */
+byte FirmataClass::getBinaryEncoding(void)
+{
+  return binaryEncoding;
+}
+
+/**
+ * Write binary data (without sysex framing) using the negotiated binary encoding.
+ * @param bytec The number of data bytes to write.
+ * @param bytev A pointer to the data bytes.
+ */
+void FirmataClass::sendBinary(byte bytec, const byte *bytev)
+{
+  if (binaryEncoding == BINARY_ENCODING_PACKED) {
+    sendPackedBytes(bytec, bytev);
+  } else {
+    for (byte i = 0; i < bytec; i++) {
+      sendValueAsTwo7bitBytes(bytev[i]);
+    }
+  }
+}
+
+/**
+ * Send a sysex message with a binary payload using the negotiated binary encoding. With the
+ * default encoding this is the same as sendSysex.
+ * @param command The sysex command byte.
+ * @param bytec The number of data bytes in the message (excludes start, command and end bytes).
+ * @param bytev A pointer to the array of data bytes to send in the message.
+ */
+void FirmataClass::sendBinarySysex(byte command, byte bytec, const byte *bytev)
+{
+  startSysex();
+  FirmataStream->write(command);
+  sendBinary(bytec, bytev);
+  endSysex();
+}
+
+/**
+ * Decode a binary sysex payload in place using the negotiated binary encoding.
+ * @param argc The number of encoded bytes.
+ * @param argv A pointer to the encoded bytes, overwritten with the decoded data.
+ * @return The number of decoded data bytes.
+ */
+byte FirmataClass::decodeBinary(byte argc, byte *argv)
+{
+  if (binaryEncoding == BINARY_ENCODING_PACKED) {
+    return decodePackedBytes(argc, argv);
+  }
+  byte count = argc / 2;
+  for (byte i = 0; i < count; i++) {
+    argv[i] = argv[2 * i] | (argv[2 * i + 1] << 7);
+  }
+  return count;
+}
+
+/**
+ * Send the mode and value of every pin in a single PIN_SNAPSHOT_RESPONSE, so a host can attach
+ * in one round trip. The message contains the capability hash (5 7-bit bytes), the number of
+ * pins, the mode of each pin, a bitmap of the digital pin levels (7 pins per byte, LSB first)
+ * and the value of each analog, PWM and servo pin as 2 7-bit bytes in pin order.
+ * @param capabilityHash A hash of the capability table, see startOutputHash.
+ */
+void FirmataClass::sendPinSnapshot(unsigned long capabilityHash)
+{
+  byte bits = 0;
+
+  startSysex();
+  FirmataStream->write(PIN_SNAPSHOT_RESPONSE);
+  for (byte i = 0; i < 5; i++) {
+    FirmataStream->write((byte)(capabilityHash >> (7 * i)) & 0x7F);
+  }
+  FirmataStream->write(TOTAL_PINS);
+  for (byte pin = 0; pin < TOTAL_PINS; pin++) {
+    FirmataStream->write(pinConfig[pin]);
+  }
+  for (byte pin = 0; pin < TOTAL_PINS; pin++) {
+    byte level = 0;
+    if (IS_PIN_DIGITAL(pin)) {
+      if (pinConfig[pin] == INPUT || pinConfig[pin] == PIN_MODE_PULLUP) {
+        level = digitalRead(PIN_TO_DIGITAL(pin)) ? 1 : 0;
+      } else if (pinConfig[pin] == OUTPUT) {
+        level = pinState[pin] ? 1 : 0;
+      }
+    }
+    bits |= level << (pin % 7);
+    if (pin % 7 == 6 || pin == TOTAL_PINS - 1) {
+      FirmataStream->write(bits);
+      bits = 0;
+    }
+  }
+  for (byte pin = 0; pin < TOTAL_PINS; pin++) {
+    if (pinConfig[pin] == PIN_MODE_ANALOG && IS_PIN_ANALOG(pin)) {
+      sendValueAsTwo7bitBytes(readAnalog(PIN_TO_ANALOG(pin)));
+    } else if (pinConfig[pin] == PIN_MODE_PWM || pinConfig[pin] == PIN_MODE_SERVO) {
+      sendValueAsTwo7bitBytes(pinState[pin]);
+    }
+  }
+  endSysex();
+}
+
+/**
+ * Hash the bytes passed to write() instead of sending them, until endOutputHash is called.
+ * Used to fingerprint a reply (such as the capability table) without sending it.
+ */
+void FirmataClass::startOutputHash(void)
+{
+  outputHash = 2166136261UL;
+  hashingOutput = true;
+}
+
+/**
+ * Stop hashing the output, write() sends to the stream again.
+ * @return The hash of the bytes written since startOutputHash.
+ */
+unsigned long FirmataClass::endOutputHash(void)
+{
+  hashingOutput = false;
+  return outputHash;
+}
+
 /**
  * Send a string to the Firmata host application.
  * @param command Must be STRING_DATA
@@ -485,6 +718,11 @@ void FirmataClass::sendString(const char *string)
  */
 void FirmataClass::write(byte c)
 {
+  if (hashingOutput) {
+    // 32-bit FNV-1a
+    outputHash = ((outputHash ^ c) * 16777619UL) & 0xFFFFFFFFUL;
+    return;
+  }
   FirmataStream->write(c);
 }
 
@@ -569,6 +807,9 @@ byte FirmataClass::getPinMode(byte pin)
  * Set the pin mode/configuration. The pin configuration (or mode) in Firmata represents the
  * current function of the pin. Examples are digital input or output, analog input, pwm, i2c,
  * serial (uart), etc.
+ * A registered feature that used the pin is told about the new mode by handlePinMode(), after
+ * the pin has been configured for it, and keeps the pin only if it returns true. The feature
+ * that claimed the new mode becomes the user of the pin.
  * @param pin The pin to configure.
  * @param config The configuration value for the specified pin.
  */
@@ -578,6 +819,21 @@ void FirmataClass::setPinMode(byte pin, byte config)
     return;
 
   pinConfig[pin] = config;
+
+  FirmataFeatureRegistry *registry = featureRegistry();
+  if (!registry) {
+    return;
+  }
+  byte owner = getNibble(registry->pinFeatures, pin);
+  byte next = config < FIRMATA_FEATURE_PIN_MODES ? getNibble(registry->pinModeFeatures, config) : 0;
+  if (owner && owner != next) {
+    // cleared first, the previous user must not be told twice
+    setNibble(registry->pinFeatures, pin, 0);
+    if (registry->features[owner - 1]->handlePinMode(pin, config) && !next) {
+      next = owner;
+    }
+  }
+  setNibble(registry->pinFeatures, pin, next);
 }
 
 /**
@@ -600,6 +856,130 @@ void FirmataClass::setPinState(byte pin, int state)
   pinState[pin] = state;
 }
 
+/**
+ * Register a feature module. Sysex messages with the claimed command go straight to the
+ * feature instead of the sysex callback, SET_PIN_MODE with the claimed mode is handed to
+ * the feature by handleFeaturePinMode(). Register features once, in setup().
+ * The sketch must define FIRMATA_MAX_FEATURES before including Firmata.h.
+ * @param feature The feature to register.
+ * @param sysexCommand The sysex command handled by the feature, or FIRMATA_NO_SYSEX.
+ * @param pinMode The pin mode handled by the feature, or FIRMATA_NO_PIN_MODE.
+ * @return false if the registry is full or the command or mode is already claimed.
+ */
+boolean FirmataClass::addFeature(FirmataFeature *feature, byte sysexCommand, byte pinMode)
+{
+  FirmataFeatureRegistry *registry = featureRegistry();
+  if (!registry || registry->featureCount >= registry->maxFeatures) {
+    return false;
+  }
+  if (sysexCommand != FIRMATA_NO_SYSEX
+      && (sysexCommand >= 0x80 || getNibble(registry->sysexFeatures, sysexCommand))) {
+    return false;
+  }
+  if (pinMode != FIRMATA_NO_PIN_MODE
+      && (pinMode >= FIRMATA_FEATURE_PIN_MODES || getNibble(registry->pinModeFeatures, pinMode))) {
+    return false;
+  }
+  registry->features[registry->featureCount++] = feature;
+  if (sysexCommand != FIRMATA_NO_SYSEX) {
+    setNibble(registry->sysexFeatures, sysexCommand, registry->featureCount);
+  }
+  if (pinMode != FIRMATA_NO_PIN_MODE) {
+    setNibble(registry->pinModeFeatures, pinMode, registry->featureCount);
+  }
+  return true;
+}
+
+/**
+ * Hand a SET_PIN_MODE request to the feature that claimed the mode. The feature becomes the
+ * user of the pin if it accepts it.
+ * @return true if a feature claimed the mode, even if it refused the pin.
+ */
+boolean FirmataClass::handleFeaturePinMode(byte pin, int mode)
+{
+  FirmataFeatureRegistry *registry = featureRegistry();
+  byte feature = registry && mode >= 0 && mode < FIRMATA_FEATURE_PIN_MODES ? getNibble(registry->pinModeFeatures, mode) : 0;
+  if (feature) {
+    if (registry->features[feature - 1]->handlePinMode(pin, mode)) {
+      setNibble(registry->pinFeatures, pin, feature);
+    }
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Change the mode of a pin the way a SET_PIN_MODE message from the host does, through the
+ * sketch's pin mode callback, so the sketch stops reporting or driving the pin. Features
+ * use it to take pins for themselves. Without a callback the mode goes to its feature.
+ * @return true if the pin is now in the requested mode.
+ */
+boolean FirmataClass::requestPinMode(byte pin, byte mode)
+{
+  if (currentPinModeCallback) {
+    (*currentPinModeCallback)(pin, mode);
+  } else {
+    handleFeaturePinMode(pin, mode);
+  }
+  return getPinMode(pin) == mode;
+}
+
+/**
+ * Record a registered feature as the user of a pin whose mode it did not claim, such as a
+ * filter on an analog input. It is told when the pin changes mode, see setPinMode().
+ */
+void FirmataClass::claimFeaturePin(byte pin, FirmataFeature *feature)
+{
+  FirmataFeatureRegistry *registry = featureRegistry();
+  if (!registry) {
+    return;
+  }
+  for (byte i = 0; i < registry->featureCount; i++) {
+    if (registry->features[i] == feature) {
+      setNibble(registry->pinFeatures, pin, i + 1);
+      return;
+    }
+  }
+}
+
+/**
+ * Write the capabilities of all registered features for a pin, in registration order.
+ */
+void FirmataClass::handleFeatureCapabilities(byte pin)
+{
+  FirmataFeatureRegistry *registry = featureRegistry();
+  for (byte i = 0; registry && i < registry->featureCount; i++) {
+    registry->features[i]->handleCapability(pin);
+  }
+}
+
+/**
+ * Read an analog channel, or its last value from a feature that owns the ADC.
+ * Use instead of analogRead() in code that may run alongside such a feature.
+ */
+int FirmataClass::readAnalog(byte channel)
+{
+  int value;
+  FirmataFeatureRegistry *registry = featureRegistry();
+  for (byte i = 0; registry && i < registry->featureCount; i++) {
+    if (registry->features[i]->readAnalog(channel, value)) {
+      return value;
+    }
+  }
+  return analogRead(channel);
+}
+
+/**
+ * Reset all registered features, in registration order.
+ */
+void FirmataClass::resetFeatures(void)
+{
+  FirmataFeatureRegistry *registry = featureRegistry();
+  for (byte i = 0; registry && i < registry->featureCount; i++) {
+    registry->features[i]->reset();
+  }
+}
+
 // sysex callbacks
 /*
  * this is too complicated for analogReceive, but maybe for Sysex?
@@ -630,21 +1010,47 @@ void FirmataClass::systemReset(void)
 {
   byte i;
 
-  waitForData = 0; // this flag says the next serial input will be data
-  executeMultiByteCommand = 0; // execute this after getting multi-byte data
+  resetParser();
   multiByteChannel = 0; // channel data for multiByteCommands
 
   for (i = 0; i < MAX_DATA_BYTES; i++) {
     storedInputData[i] = 0;
   }
 
-  parsingSysex = false;
-  sysexBytesRead = 0;
+  // the host has to negotiate the binary encoding again
+  binaryEncoding = BINARY_ENCODING_7BIT_PAIRS;
 
   if (currentSystemResetCallback)
     (*currentSystemResetCallback)();
 }
 
+/**
+ * Replaced by the sketch when it defines FIRMATA_MAX_FEATURES, see Firmata.h.
+ * @private
+ */
+__attribute__((weak)) FirmataFeatureRegistry *FirmataClass::featureRegistry(void)
+{
+  return NULL;
+}
+
+/**
+ * Feature lookup tables hold one 4 bit entry per sysex command, pin mode or pin.
+ * @private
+ */
+byte FirmataClass::getNibble(const byte *table, byte index)
+{
+  return index & 1 ? table[index >> 1] >> 4 : table[index >> 1] & 0x0F;
+}
+
+void FirmataClass::setNibble(byte *table, byte index, byte value)
+{
+  if (index & 1) {
+    table[index >> 1] = (table[index >> 1] & 0x0F) | (value << 4);
+  } else {
+    table[index >> 1] = (table[index >> 1] & 0xF0) | (value & 0x0F);
+  }
+}
+
 /**
  * Flashing the pin for the version number
  * @private
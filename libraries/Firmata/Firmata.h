@@ -15,107 +15,15 @@
 #define Firmata_h
 
 #include "Boards.h"  /* Hardware Abstraction Layer + Wiring/Arduino */
-
-/* Version numbers for the protocol.  The protocol is still changing, so these
- * version numbers are important.
- * Query using the REPORT_VERSION message.
- */
-#define FIRMATA_PROTOCOL_MAJOR_VERSION  2 // for non-compatible changes
-#define FIRMATA_PROTOCOL_MINOR_VERSION  5 // for backwards compatible changes
-#define FIRMATA_PROTOCOL_BUGFIX_VERSION 1 // for bugfix releases
-
-/* Version numbers for the Firmata library.
- * The firmware version will not always equal the protocol version going forward.
- * Query using the REPORT_FIRMWARE message.
- */
-#define FIRMATA_FIRMWARE_MAJOR_VERSION  2
-#define FIRMATA_FIRMWARE_MINOR_VERSION  5
-#define FIRMATA_FIRMWARE_BUGFIX_VERSION 3
-
-/* DEPRECATED as of Firmata v2.5.1. As of 2.5.1 there are separate version numbers for
- * the protocol version and the firmware version.
- */
-#define FIRMATA_MAJOR_VERSION           2 // same as FIRMATA_PROTOCOL_MAJOR_VERSION
-#define FIRMATA_MINOR_VERSION           5 // same as FIRMATA_PROTOCOL_MINOR_VERSION
-#define FIRMATA_BUGFIX_VERSION          1 // same as FIRMATA_PROTOCOL_BUGFIX_VERSION
+#include "FirmataConstants.h"
 
 #define MAX_DATA_BYTES                  64 // max number of data bytes in incoming messages
-
-// Arduino 101 also defines SET_PIN_MODE as a macro in scss_registers.h
-#ifdef SET_PIN_MODE
-#undef SET_PIN_MODE
+#ifndef FIRMATA_MAX_FEATURES
+#define FIRMATA_MAX_FEATURES            0 // FirmataFeature modules a sketch can register, up to 15
 #endif
-
-// message command bytes (128-255/0x80-0xFF)
-#define DIGITAL_MESSAGE         0x90 // send data for a digital port (collection of 8 pins)
-#define ANALOG_MESSAGE          0xE0 // send data for an analog pin (or PWM)
-#define REPORT_ANALOG           0xC0 // enable analog input by pin #
-#define REPORT_DIGITAL          0xD0 // enable digital input by port pair
-//
-#define SET_PIN_MODE            0xF4 // set a pin to INPUT/OUTPUT/PWM/etc
-#define SET_DIGITAL_PIN_VALUE   0xF5 // set value of an individual digital pin
-//
-#define REPORT_VERSION          0xF9 // report protocol version
-#define SYSTEM_RESET            0xFF // reset from MIDI
-//
-#define START_SYSEX             0xF0 // start a MIDI Sysex message
-#define END_SYSEX               0xF7 // end a MIDI Sysex message
-
-// extended command set using sysex (0-127/0x00-0x7F)
-/* 0x00-0x0F reserved for user-defined commands */
-#define SERIAL_MESSAGE          0x60 // communicate with serial devices, including other boards
-#define ENCODER_DATA            0x61 // reply with encoders current positions
-#define SERVO_CONFIG            0x70 // set max angle, minPulse, maxPulse, freq
-#define STRING_DATA             0x71 // a string message with 14-bits per char
-#define STEPPER_DATA            0x72 // control a stepper motor
-#define ONEWIRE_DATA            0x73 // send an OneWire read/write/reset/select/skip/search request
-#define SHIFT_DATA              0x75 // a bitstream to/from a shift register
-#define I2C_REQUEST             0x76 // send an I2C read/write request
-#define I2C_REPLY               0x77 // a reply to an I2C read request
-#define I2C_CONFIG              0x78 // config I2C settings such as delay times and power pins
-#define EXTENDED_ANALOG         0x6F // analog write (PWM, Servo, etc) to any pin
-#define PIN_STATE_QUERY         0x6D // ask for a pin's current mode and value
-#define PIN_STATE_RESPONSE      0x6E // reply with pin's current mode and value
-#define CAPABILITY_QUERY        0x6B // ask for supported modes and resolution of all pins
-#define CAPABILITY_RESPONSE     0x6C // reply with supported modes and resolution
-#define ANALOG_MAPPING_QUERY    0x69 // ask for mapping of analog to pin numbers
-#define ANALOG_MAPPING_RESPONSE 0x6A // reply with mapping info
-#define REPORT_FIRMWARE         0x79 // report name and version of the firmware
-#define SAMPLING_INTERVAL       0x7A // set the poll rate of the main loop
-#define SCHEDULER_DATA          0x7B // send a createtask/deletetask/addtotask/schedule/querytasks/querytask request to the scheduler
-#define SYSEX_NON_REALTIME      0x7E // MIDI Reserved for non-realtime messages
-#define SYSEX_REALTIME          0x7F // MIDI Reserved for realtime messages
-// these are DEPRECATED to make the naming more consistent
-#define FIRMATA_STRING          0x71 // same as STRING_DATA
-#define SYSEX_I2C_REQUEST       0x76 // same as I2C_REQUEST
-#define SYSEX_I2C_REPLY         0x77 // same as I2C_REPLY
-#define SYSEX_SAMPLING_INTERVAL 0x7A // same as SAMPLING_INTERVAL
-
-// pin modes
-//#define INPUT                 0x00 // defined in Arduino.h
-//#define OUTPUT                0x01 // defined in Arduino.h
-#define PIN_MODE_ANALOG         0x02 // analog pin in analogInput mode
-#define PIN_MODE_PWM            0x03 // digital pin in PWM output mode
-#define PIN_MODE_SERVO          0x04 // digital pin in Servo output mode
-#define PIN_MODE_SHIFT          0x05 // shiftIn/shiftOut mode
-#define PIN_MODE_I2C            0x06 // pin included in I2C setup
-#define PIN_MODE_ONEWIRE        0x07 // pin configured for 1-wire
-#define PIN_MODE_STEPPER        0x08 // pin configured for stepper motor
-#define PIN_MODE_ENCODER        0x09 // pin configured for rotary encoders
-#define PIN_MODE_SERIAL         0x0A // pin configured for serial communication
-#define PIN_MODE_PULLUP         0x0B // enable internal pull-up resistor for pin
-#define PIN_MODE_IGNORE         0x7F // pin configured to be ignored by digitalWrite and capabilityResponse
-#define TOTAL_PIN_MODES         13
-// DEPRECATED as of Firmata v2.5
-#define ANALOG                  0x02 // same as PIN_MODE_ANALOG
-#define PWM                     0x03 // same as PIN_MODE_PWM
-#define SERVO                   0x04 // same as PIN_MODE_SERVO
-#define SHIFT                   0x05 // same as PIN_MODE_SHIFT
-#define I2C                     0x06 // same as PIN_MODE_I2C
-#define ONEWIRE                 0x07 // same as PIN_MODE_ONEWIRE
-#define STEPPER                 0x08 // same as PIN_MODE_STEPPER
-#define ENCODER                 0x09 // same as PIN_MODE_ENCODER
-#define IGNORE                  0x7F // same as PIN_MODE_IGNORE
+#define FIRMATA_NO_SYSEX                0xFF // a feature that claims no sysex command
+#define FIRMATA_NO_PIN_MODE             0xFF // a feature that claims no pin mode
+#define FIRMATA_FEATURE_PIN_MODES       16 // pin modes below this value can be claimed
 
 extern "C" {
   // callback function types
@@ -125,6 +33,18 @@ extern "C" {
   typedef void (*sysexCallbackFunction)(byte command, byte argc, byte *argv);
 }
 
+class FirmataFeature;
+
+/* registered features, looked up by the nibble tables (index + 1, 0 = none) */
+struct FirmataFeatureRegistry {
+  FirmataFeature **features;
+  byte maxFeatures;
+  byte featureCount;
+  byte sysexFeatures[64];   // sysex commands 0x00 to 0x7F
+  byte pinModeFeatures[FIRMATA_FEATURE_PIN_MODES / 2];
+  byte pinFeatures[(TOTAL_PINS + 1) / 2]; // the feature that uses each pin
+};
+
 // TODO make it a subclass of a generic Serial/Stream base class
 class FirmataClass
 {
@@ -146,6 +66,7 @@ class FirmataClass
     void processInput(void);
     void parse(unsigned char value);
     boolean isParsingMessage(void);
+    void resetParser(void);
     /* serial send handling */
     void sendAnalog(byte pin, int value);
     void sendDigital(byte pin, int value); // TODO implement this
@@ -161,6 +82,16 @@ class FirmataClass
     void attach(byte command, sysexCallbackFunction newFunction);
     void detach(byte command);
 
+    /* FirmataFeature modules */
+    boolean addFeature(FirmataFeature *feature, byte sysexCommand = FIRMATA_NO_SYSEX,
+                       byte pinMode = FIRMATA_NO_PIN_MODE);
+    boolean handleFeaturePinMode(byte pin, int mode);
+    boolean requestPinMode(byte pin, byte mode);
+    void claimFeaturePin(byte pin, FirmataFeature *feature);
+    void handleFeatureCapabilities(byte pin);
+    void resetFeatures(void);
+    int readAnalog(byte channel);
+
     /* access pin state and config */
     byte getPinMode(byte pin);
     void setPinMode(byte pin, byte config);
@@ -168,8 +99,23 @@ class FirmataClass
     int getPinState(byte pin);
     void setPinState(byte pin, int state);
 
+    /* binary sysex payloads */
+    void setBinaryEncoding(byte encoding);
+    byte getBinaryEncoding(void);
+    void sendBinary(byte bytec, const byte *bytev);
+    void sendBinarySysex(byte command, byte bytec, const byte *bytev);
+    byte decodeBinary(byte argc, byte *argv);
+
+    /* pin state snapshot */
+    void sendPinSnapshot(unsigned long capabilityHash);
+    void startOutputHash(void);
+    unsigned long endOutputHash(void);
+
     /* utility methods */
     void sendValueAsTwo7bitBytes(int value);
+    void sendPackedBytes(byte bytec, const byte *bytev);
+    static byte decodePackedBytes(byte argc, byte *argv);
+    static int packedLength(byte bytec);
     void startSysex(void);
     void endSysex(void);
 
@@ -202,11 +148,17 @@ class FirmataClass
     sysexCallbackFunction currentSysexCallback;
 
     boolean blinkVersionDisabled = false;
+    byte binaryEncoding;
+    boolean hashingOutput;
+    unsigned long outputHash;
 
     /* private methods ------------------------------ */
     void processSysexMessage(void);
     void systemReset(void);
     void strobeBlinkPin(byte pin, int count, int onInterval, int offInterval);
+    static FirmataFeatureRegistry *featureRegistry(void);
+    static byte getNibble(const byte *table, byte index);
+    static void setNibble(byte *table, byte index, byte value);
 };
 
 extern FirmataClass Firmata;
@@ -221,4 +173,20 @@ extern FirmataClass Firmata;
  */
 #define setFirmwareVersion(x, y)   setFirmwareNameAndVersion(__FILE__, x, y)
 
+/* The registry is only compiled into a sketch that defines FIRMATA_MAX_FEATURES
+ * before including Firmata.h, in one file of the sketch. Sketches without
+ * features pay no RAM for it.
+ */
+#if FIRMATA_MAX_FEATURES > 15
+#error "FIRMATA_MAX_FEATURES can be at most 15"
+#elif FIRMATA_MAX_FEATURES > 0
+static FirmataFeature *firmataFeatures[FIRMATA_MAX_FEATURES];
+static FirmataFeatureRegistry firmataFeatureRegistry = { firmataFeatures, FIRMATA_MAX_FEATURES };
+
+FirmataFeatureRegistry *FirmataClass::featureRegistry(void)
+{
+  return &firmataFeatureRegistry;
+}
+#endif
+
 #endif /* Firmata_h */
@@ -26,6 +26,7 @@
 #include <Servo.h>
 #include <Wire.h>
 #include <Firmata.h>
+#include "utility/ReportScheduler.h"
 
 #define I2C_WRITE                   B00000000
 #define I2C_READ                    B00001000
@@ -36,7 +37,8 @@
 #define I2C_END_TX_MASK             B01000000
 #define I2C_STOP_TX                 1
 #define I2C_RESTART_TX              0
-#define I2C_MAX_QUERIES             8
+// one report scheduler item per query, boards with more RAM get more
+#define I2C_MAX_QUERIES             REPORT_I2C_ITEMS
 #define I2C_REGISTER_NOT_SPECIFIED  -1
 
 // the minimum interval for sampling analog input
@@ -63,8 +65,11 @@ byte portConfigInputs[TOTAL_PORTS]; // each bit: 1 = pin in INPUT, 0 = anything
 
 /* timer variables */
 unsigned long currentMillis;        // store the current value from millis()
-unsigned long previousMillis;       // for comparison with currentMillis
-unsigned int samplingInterval = 19; // how often to run the main loop (in ms)
+unsigned int samplingInterval = 19; // default report interval (in ms)
+
+/* analog pins, polled ports and continuous i2c reads with their due times */
+ReportScheduler reportScheduler;
+byte i2cReadsLeft;                  // continuous i2c reads left in this pass of loop()
 
 /* i2c data */
 struct i2c_device_info {
@@ -187,7 +192,62 @@ void readAndReportData(byte address, int theRegister, byte numBytes, byte stopTX
   }
 
   // send slave address, register and received bytes
-  Firmata.sendSysex(SYSEX_I2C_REPLY, numBytes + 2, i2cRxData);
+  Firmata.sendBinarySysex(SYSEX_I2C_REPLY, numBytes + 2, i2cRxData);
+}
+
+/* -----------------------------------------------------------------------------
+ * send an analog input that is due if its pin is in analog mode */
+void reportAnalogInput(byte analogPin)
+{
+  for (byte pin = 0; pin < TOTAL_PINS; pin++) {
+    if (IS_PIN_ANALOG(pin) && PIN_TO_ANALOG(pin) == analogPin) {
+      if (Firmata.getPinMode(pin) != PIN_MODE_ANALOG) return;
+      Firmata.sendAnalog(analogPin, analogRead(analogPin));
+      return;
+    }
+  }
+}
+
+/* -----------------------------------------------------------------------------
+ * report callback of the scheduler for an analog pin, port or continuous i2c
+ * query that is due. At most one i2c query is read per pass of loop(), so a
+ * slow device holds up the main loop for no more than one transaction. */
+boolean sendDueReport(byte item)
+{
+  if (item < REPORT_PORT_ITEM(0)) {
+    reportAnalogInput(item);
+  } else if (item < REPORT_I2C_ITEM(0)) {
+    byte port = item - REPORT_PORT_ITEM(0);
+    if (reportPINs[port]) outputPort(port, readPort(port, portConfigInputs[port]), false);
+  } else {
+    if (i2cReadsLeft == 0) return false;
+    i2cReadsLeft--;
+    byte i = item - REPORT_I2C_ITEM(0);
+    readAndReportData(query[i].addr, query[i].reg, query[i].bytes, query[i].stopTX);
+  }
+  return true;
+}
+
+/* -----------------------------------------------------------------------------
+ * set the report interval of an analog pin or port, 0 = samplingInterval.
+ * Ports with an interval are read at that interval instead of every pass of loop() */
+void setReportInterval(byte type, byte index, unsigned int interval)
+{
+  if (interval > 0 && interval < MINIMUM_SAMPLING_INTERVAL) {
+    interval = MINIMUM_SAMPLING_INTERVAL;
+  }
+  if (type == REPORT_TYPE_ANALOG && index < TOTAL_ANALOG_PINS) {
+    reportScheduler.setInterval(REPORT_ANALOG_ITEM(index), interval);
+  } else if (type == REPORT_TYPE_PORT && index < TOTAL_PORTS) {
+    reportScheduler.setInterval(REPORT_PORT_ITEM(index), interval);
+    if (interval == 0) {
+      reportScheduler.stop(REPORT_PORT_ITEM(index));
+    } else if (!reportScheduler.isScheduled(REPORT_PORT_ITEM(index))) {
+      reportScheduler.start(REPORT_PORT_ITEM(index), millis());
+    }
+  } else {
+    Firmata.sendString("Invalid report item");
+  }
 }
 
 void outputPort(byte portNumber, byte portValue, byte forceSend)
@@ -201,6 +261,12 @@ void outputPort(byte portNumber, byte portValue, byte forceSend)
   }
 }
 
+/* ports with their own report interval are polled by the report scheduler */
+boolean isPortPolled(byte port)
+{
+  return reportPINs[port] && !reportScheduler.isScheduled(REPORT_PORT_ITEM(port));
+}
+
 /* -----------------------------------------------------------------------------
  * check all the active digital inputs for change of state, then add any events
  * to the Serial output queue using Serial.print() */
@@ -209,22 +275,22 @@ void checkDigitalInputs(void)
   /* Using non-looping code allows constants to be given to readPort().
    * The compiler will apply substantial optimizations if the inputs
    * to readPort() are compile-time constants. */
-  if (TOTAL_PORTS > 0 && reportPINs[0]) outputPort(0, readPort(0, portConfigInputs[0]), false);
-  if (TOTAL_PORTS > 1 && reportPINs[1]) outputPort(1, readPort(1, portConfigInputs[1]), false);
-  if (TOTAL_PORTS > 2 && reportPINs[2]) outputPort(2, readPort(2, portConfigInputs[2]), false);
-  if (TOTAL_PORTS > 3 && reportPINs[3]) outputPort(3, readPort(3, portConfigInputs[3]), false);
-  if (TOTAL_PORTS > 4 && reportPINs[4]) outputPort(4, readPort(4, portConfigInputs[4]), false);
-  if (TOTAL_PORTS > 5 && reportPINs[5]) outputPort(5, readPort(5, portConfigInputs[5]), false);
-  if (TOTAL_PORTS > 6 && reportPINs[6]) outputPort(6, readPort(6, portConfigInputs[6]), false);
-  if (TOTAL_PORTS > 7 && reportPINs[7]) outputPort(7, readPort(7, portConfigInputs[7]), false);
-  if (TOTAL_PORTS > 8 && reportPINs[8]) outputPort(8, readPort(8, portConfigInputs[8]), false);
-  if (TOTAL_PORTS > 9 && reportPINs[9]) outputPort(9, readPort(9, portConfigInputs[9]), false);
-  if (TOTAL_PORTS > 10 && reportPINs[10]) outputPort(10, readPort(10, portConfigInputs[10]), false);
-  if (TOTAL_PORTS > 11 && reportPINs[11]) outputPort(11, readPort(11, portConfigInputs[11]), false);
-  if (TOTAL_PORTS > 12 && reportPINs[12]) outputPort(12, readPort(12, portConfigInputs[12]), false);
-  if (TOTAL_PORTS > 13 && reportPINs[13]) outputPort(13, readPort(13, portConfigInputs[13]), false);
-  if (TOTAL_PORTS > 14 && reportPINs[14]) outputPort(14, readPort(14, portConfigInputs[14]), false);
-  if (TOTAL_PORTS > 15 && reportPINs[15]) outputPort(15, readPort(15, portConfigInputs[15]), false);
+  if (TOTAL_PORTS > 0 && isPortPolled(0)) outputPort(0, readPort(0, portConfigInputs[0]), false);
+  if (TOTAL_PORTS > 1 && isPortPolled(1)) outputPort(1, readPort(1, portConfigInputs[1]), false);
+  if (TOTAL_PORTS > 2 && isPortPolled(2)) outputPort(2, readPort(2, portConfigInputs[2]), false);
+  if (TOTAL_PORTS > 3 && isPortPolled(3)) outputPort(3, readPort(3, portConfigInputs[3]), false);
+  if (TOTAL_PORTS > 4 && isPortPolled(4)) outputPort(4, readPort(4, portConfigInputs[4]), false);
+  if (TOTAL_PORTS > 5 && isPortPolled(5)) outputPort(5, readPort(5, portConfigInputs[5]), false);
+  if (TOTAL_PORTS > 6 && isPortPolled(6)) outputPort(6, readPort(6, portConfigInputs[6]), false);
+  if (TOTAL_PORTS > 7 && isPortPolled(7)) outputPort(7, readPort(7, portConfigInputs[7]), false);
+  if (TOTAL_PORTS > 8 && isPortPolled(8)) outputPort(8, readPort(8, portConfigInputs[8]), false);
+  if (TOTAL_PORTS > 9 && isPortPolled(9)) outputPort(9, readPort(9, portConfigInputs[9]), false);
+  if (TOTAL_PORTS > 10 && isPortPolled(10)) outputPort(10, readPort(10, portConfigInputs[10]), false);
+  if (TOTAL_PORTS > 11 && isPortPolled(11)) outputPort(11, readPort(11, portConfigInputs[11]), false);
+  if (TOTAL_PORTS > 12 && isPortPolled(12)) outputPort(12, readPort(12, portConfigInputs[12]), false);
+  if (TOTAL_PORTS > 13 && isPortPolled(13)) outputPort(13, readPort(13, portConfigInputs[13]), false);
+  if (TOTAL_PORTS > 14 && isPortPolled(14)) outputPort(14, readPort(14, portConfigInputs[14]), false);
+  if (TOTAL_PORTS > 15 && isPortPolled(15)) outputPort(15, readPort(15, portConfigInputs[15]), false);
 }
 
 // -----------------------------------------------------------------------------
@@ -408,8 +474,12 @@ void reportAnalogCallback(byte analogPin, int value)
   if (analogPin < TOTAL_ANALOG_PINS) {
     if (value == 0) {
       analogInputsToReport = analogInputsToReport & ~ (1 << analogPin);
+      reportScheduler.stop(REPORT_ANALOG_ITEM(analogPin));
     } else {
       analogInputsToReport = analogInputsToReport | (1 << analogPin);
+      if (!reportScheduler.isScheduled(REPORT_ANALOG_ITEM(analogPin))) {
+        reportScheduler.start(REPORT_ANALOG_ITEM(analogPin), millis());
+      }
       // prevent during system reset or all analog pin values will be reported
       // which may report noise for unconnected analog pins
       if (!isResetting) {
@@ -440,6 +510,55 @@ void reportDigitalCallback(byte port, int value)
   // pins configured as analog
 }
 
+/* -----------------------------------------------------------------------------
+ * send the supported modes and resolutions of all pins (CAPABILITY_RESPONSE) */
+void sendCapabilities(void)
+{
+  Firmata.write(START_SYSEX);
+  Firmata.write(CAPABILITY_RESPONSE);
+  for (byte pin = 0; pin < TOTAL_PINS; pin++) {
+    if (IS_PIN_DIGITAL(pin)) {
+      Firmata.write((byte)INPUT);
+      Firmata.write(1);
+      Firmata.write((byte)PIN_MODE_PULLUP);
+      Firmata.write(1);
+      Firmata.write((byte)OUTPUT);
+      Firmata.write(1);
+    }
+    if (IS_PIN_ANALOG(pin)) {
+      Firmata.write(PIN_MODE_ANALOG);
+      Firmata.write(10); // 10 = 10-bit resolution
+    }
+    if (IS_PIN_PWM(pin)) {
+      Firmata.write(PIN_MODE_PWM);
+      Firmata.write(DEFAULT_PWM_RESOLUTION);
+    }
+    if (IS_PIN_DIGITAL(pin)) {
+      Firmata.write(PIN_MODE_SERVO);
+      Firmata.write(14);
+    }
+    if (IS_PIN_I2C(pin)) {
+      Firmata.write(PIN_MODE_I2C);
+      Firmata.write(1);  // TODO: could assign a number to map to SCL or SDA
+    }
+#ifdef FIRMATA_SERIAL_FEATURE
+    serialFeature.handleCapability(pin);
+#endif
+    Firmata.write(127);
+  }
+  Firmata.write(END_SYSEX);
+}
+
+/* hosts can cache the capability table under this hash (sent with
+ * PIN_SNAPSHOT_RESPONSE) instead of querying it, the hash changes whenever
+ * the advertised capabilities change */
+unsigned long capabilityHash(void)
+{
+  Firmata.startOutputHash();
+  sendCapabilities();
+  return Firmata.endOutputHash();
+}
+
 /*==============================================================================
  * SYSEX-BASED commands
  *============================================================================*/
@@ -452,6 +571,7 @@ void sysexCallback(byte command, byte argc, byte *argv)
   byte data;
   int slaveRegister;
   unsigned int delayTime;
+  unsigned int interval;
 
   switch (command) {
     case I2C_REQUEST:
@@ -476,9 +596,12 @@ void sysexCallback(byte command, byte argc, byte *argv)
       switch (mode) {
         case I2C_WRITE:
           Wire.beginTransmission(slaveAddress);
-          for (byte i = 2; i < argc; i += 2) {
-            data = argv[i] + (argv[i + 1] << 7);
-            wireWrite(data);
+          // two 7-bit bytes per data byte, or packed if negotiated with BINARY_ENCODING
+          if (argc > 2) {
+            argc = 2 + Firmata.decodeBinary(argc - 2, argv + 2);
+          }
+          for (byte i = 2; i < argc; i++) {
+            wireWrite(argv[i]);
           }
           Wire.endTransmission();
           delayMicroseconds(70);
@@ -502,7 +625,14 @@ void sysexCallback(byte command, byte argc, byte *argv)
             Firmata.sendString("too many queries");
             break;
           }
-          if (argc == 6) {
+          interval = 0;
+          if (argc == 8) {
+            // a slave register and a read interval for this query are specified
+            slaveRegister = argv[2] + (argv[3] << 7);
+            data = argv[4] + (argv[5] << 7);  // bytes to read
+            interval = argv[6] + (argv[7] << 7);
+          }
+          else if (argc == 6) {
             // a slave register is specified
             slaveRegister = argv[2] + (argv[3] << 7);
             data = argv[4] + (argv[5] << 7);  // bytes to read
@@ -517,6 +647,8 @@ void sysexCallback(byte command, byte argc, byte *argv)
           query[queryIndex].reg = slaveRegister;
           query[queryIndex].bytes = data;
           query[queryIndex].stopTX = stopTX;
+          reportScheduler.setInterval(REPORT_I2C_ITEM(queryIndex), interval);
+          reportScheduler.start(REPORT_I2C_ITEM(queryIndex), millis());
           break;
         case I2C_STOP_READING:
           byte queryIndexToSkip;
@@ -524,6 +656,7 @@ void sysexCallback(byte command, byte argc, byte *argv)
           // read continuous reporting for that device
           if (queryIndex <= 0) {
             queryIndex = -1;
+            reportScheduler.stop(REPORT_I2C_ITEM(0));
           } else {
             queryIndexToSkip = 0;
             // if read continuous mode is enabled for multiple devices,
@@ -537,12 +670,11 @@ void sysexCallback(byte command, byte argc, byte *argv)
             }
 
             for (byte i = queryIndexToSkip; i < queryIndex + 1; i++) {
-              if (i < I2C_MAX_QUERIES) {
-                query[i].addr = query[i + 1].addr;
-                query[i].reg = query[i + 1].reg;
-                query[i].bytes = query[i + 1].bytes;
-                query[i].stopTX = query[i + 1].stopTX;
+              if (i + 1 < I2C_MAX_QUERIES) {
+                query[i] = query[i + 1];
               }
+              // the read schedule moves along with its query
+              reportScheduler.move(REPORT_I2C_ITEM(i + 1), REPORT_I2C_ITEM(i));
             }
             queryIndex--;
           }
@@ -580,11 +712,15 @@ void sysexCallback(byte command, byte argc, byte *argv)
       }
       break;
     case SAMPLING_INTERVAL:
-      if (argc > 1) {
+      if (argc > 3) {
+        // the interval of a single analog pin or port
+        setReportInterval(argv[2], argv[3], argv[0] + (argv[1] << 7));
+      } else if (argc > 1) {
         samplingInterval = argv[0] + (argv[1] << 7);
         if (samplingInterval < MINIMUM_SAMPLING_INTERVAL) {
           samplingInterval = MINIMUM_SAMPLING_INTERVAL;
         }
+        reportScheduler.setDefaultInterval(samplingInterval);
       } else {
         //Firmata.sendString("Not enough data");
       }
@@ -598,39 +734,10 @@ void sysexCallback(byte command, byte argc, byte *argv)
       }
       break;
     case CAPABILITY_QUERY:
-      Firmata.write(START_SYSEX);
-      Firmata.write(CAPABILITY_RESPONSE);
-      for (byte pin = 0; pin < TOTAL_PINS; pin++) {
-        if (IS_PIN_DIGITAL(pin)) {
-          Firmata.write((byte)INPUT);
-          Firmata.write(1);
-          Firmata.write((byte)PIN_MODE_PULLUP);
-          Firmata.write(1);
-          Firmata.write((byte)OUTPUT);
-          Firmata.write(1);
-        }
-        if (IS_PIN_ANALOG(pin)) {
-          Firmata.write(PIN_MODE_ANALOG);
-          Firmata.write(10); // 10 = 10-bit resolution
-        }
-        if (IS_PIN_PWM(pin)) {
-          Firmata.write(PIN_MODE_PWM);
-          Firmata.write(DEFAULT_PWM_RESOLUTION);
-        }
-        if (IS_PIN_DIGITAL(pin)) {
-          Firmata.write(PIN_MODE_SERVO);
-          Firmata.write(14);
-        }
-        if (IS_PIN_I2C(pin)) {
-          Firmata.write(PIN_MODE_I2C);
-          Firmata.write(1);  // TODO: could assign a number to map to SCL or SDA
-        }
-#ifdef FIRMATA_SERIAL_FEATURE
-        serialFeature.handleCapability(pin);
-#endif
-        Firmata.write(127);
-      }
-      Firmata.write(END_SYSEX);
+      sendCapabilities();
+      break;
+    case PIN_SNAPSHOT_QUERY:
+      Firmata.sendPinSnapshot(capabilityHash());
       break;
     case PIN_STATE_QUERY:
       if (argc > 0) {
@@ -686,6 +793,9 @@ void disableI2CPins() {
   isI2CEnabled = false;
   // disable read continuous mode for all devices
   queryIndex = -1;
+  for (byte i = 0; i < I2C_MAX_QUERIES; i++) {
+    reportScheduler.stop(REPORT_I2C_ITEM(i));
+  }
 }
 
 /*==============================================================================
@@ -728,6 +838,7 @@ void systemResetCallback()
   }
   // by default, do not report any analog inputs
   analogInputsToReport = 0;
+  reportScheduler.reset();
 
   detachedServoCount = 0;
   servoCount = 0;
@@ -776,8 +887,6 @@ void setup()
  *============================================================================*/
 void loop()
 {
-  byte pin, analogPin;
-
   /* DIGITALREAD - as fast as possible, check for changes and output them to the
    * FTDI buffer using Serial.print()  */
   checkDigitalInputs();
@@ -789,25 +898,11 @@ void loop()
 
   // TODO - ensure that Stream buffer doesn't go over 60 bytes
 
+  /* ANALOGREAD, ports with their own interval and continuous i2c reads, each
+   * reported when due. Only the items due now are visited. */
   currentMillis = millis();
-  if (currentMillis - previousMillis > samplingInterval) {
-    previousMillis += samplingInterval;
-    /* ANALOGREAD - do all analogReads() at the configured sampling interval */
-    for (pin = 0; pin < TOTAL_PINS; pin++) {
-      if (IS_PIN_ANALOG(pin) && Firmata.getPinMode(pin) == PIN_MODE_ANALOG) {
-        analogPin = PIN_TO_ANALOG(pin);
-        if (analogInputsToReport & (1 << analogPin)) {
-          Firmata.sendAnalog(analogPin, analogRead(analogPin));
-        }
-      }
-    }
-    // report i2c data for all device with read continuous mode enabled
-    if (queryIndex > -1) {
-      for (byte i = 0; i < queryIndex + 1; i++) {
-        readAndReportData(query[i].addr, query[i].reg, query[i].bytes, query[i].stopTX);
-      }
-    }
-  }
+  i2cReadsLeft = 1;
+  reportScheduler.update(currentMillis, sendDueReport);
 
 #ifdef FIRMATA_SERIAL_FEATURE
   serialFeature.update();
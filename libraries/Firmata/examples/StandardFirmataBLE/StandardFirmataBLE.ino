@@ -201,7 +201,7 @@ void readAndReportData(byte address, int theRegister, byte numBytes, byte stopTX
   }
 
   // send slave address, register and received bytes
-  Firmata.sendSysex(SYSEX_I2C_REPLY, numBytes + 2, i2cRxData);
+  Firmata.sendBinarySysex(SYSEX_I2C_REPLY, numBytes + 2, i2cRxData);
 }
 
 void outputPort(byte portNumber, byte portValue, byte forceSend)
@@ -454,6 +454,55 @@ void reportDigitalCallback(byte port, int value)
   // pins configured as analog
 }
 
+/* -----------------------------------------------------------------------------
+ * send the supported modes and resolutions of all pins (CAPABILITY_RESPONSE) */
+void sendCapabilities(void)
+{
+  Firmata.write(START_SYSEX);
+  Firmata.write(CAPABILITY_RESPONSE);
+  for (byte pin = 0; pin < TOTAL_PINS; pin++) {
+    if (IS_PIN_DIGITAL(pin)) {
+      Firmata.write((byte)INPUT);
+      Firmata.write(1);
+      Firmata.write((byte)PIN_MODE_PULLUP);
+      Firmata.write(1);
+      Firmata.write((byte)OUTPUT);
+      Firmata.write(1);
+    }
+    if (IS_PIN_ANALOG(pin)) {
+      Firmata.write(PIN_MODE_ANALOG);
+      Firmata.write(10); // 10 = 10-bit resolution
+    }
+    if (IS_PIN_PWM(pin)) {
+      Firmata.write(PIN_MODE_PWM);
+      Firmata.write(8); // 8 = 8-bit resolution
+    }
+    if (IS_PIN_DIGITAL(pin)) {
+      Firmata.write(PIN_MODE_SERVO);
+      Firmata.write(14);
+    }
+    if (IS_PIN_I2C(pin)) {
+      Firmata.write(PIN_MODE_I2C);
+      Firmata.write(1);  // TODO: could assign a number to map to SCL or SDA
+    }
+#ifdef FIRMATA_SERIAL_FEATURE
+    serialFeature.handleCapability(pin);
+#endif
+    Firmata.write(127);
+  }
+  Firmata.write(END_SYSEX);
+}
+
+/* hosts can cache the capability table under this hash (sent with
+ * PIN_SNAPSHOT_RESPONSE) instead of querying it, the hash changes whenever
+ * the advertised capabilities change */
+unsigned long capabilityHash(void)
+{
+  Firmata.startOutputHash();
+  sendCapabilities();
+  return Firmata.endOutputHash();
+}
+
 /*==============================================================================
  * SYSEX-BASED commands
  *============================================================================*/
@@ -490,9 +539,12 @@ void sysexCallback(byte command, byte argc, byte *argv)
       switch (mode) {
         case I2C_WRITE:
           Wire.beginTransmission(slaveAddress);
-          for (byte i = 2; i < argc; i += 2) {
-            data = argv[i] + (argv[i + 1] << 7);
-            wireWrite(data);
+          // two 7-bit bytes per data byte, or packed if negotiated with BINARY_ENCODING
+          if (argc > 2) {
+            argc = 2 + Firmata.decodeBinary(argc - 2, argv + 2);
+          }
+          for (byte i = 2; i < argc; i++) {
+            wireWrite(argv[i]);
           }
           Wire.endTransmission();
           delayMicroseconds(70);
@@ -612,39 +664,10 @@ void sysexCallback(byte command, byte argc, byte *argv)
       }
       break;
     case CAPABILITY_QUERY:
-      Firmata.write(START_SYSEX);
-      Firmata.write(CAPABILITY_RESPONSE);
-      for (byte pin = 0; pin < TOTAL_PINS; pin++) {
-        if (IS_PIN_DIGITAL(pin)) {
-          Firmata.write((byte)INPUT);
-          Firmata.write(1);
-          Firmata.write((byte)PIN_MODE_PULLUP);
-          Firmata.write(1);
-          Firmata.write((byte)OUTPUT);
-          Firmata.write(1);
-        }
-        if (IS_PIN_ANALOG(pin)) {
-          Firmata.write(PIN_MODE_ANALOG);
-          Firmata.write(10); // 10 = 10-bit resolution
-        }
-        if (IS_PIN_PWM(pin)) {
-          Firmata.write(PIN_MODE_PWM);
-          Firmata.write(8); // 8 = 8-bit resolution
-        }
-        if (IS_PIN_DIGITAL(pin)) {
-          Firmata.write(PIN_MODE_SERVO);
-          Firmata.write(14);
-        }
-        if (IS_PIN_I2C(pin)) {
-          Firmata.write(PIN_MODE_I2C);
-          Firmata.write(1);  // TODO: could assign a number to map to SCL or SDA
-        }
-#ifdef FIRMATA_SERIAL_FEATURE
-        serialFeature.handleCapability(pin);
-#endif
-        Firmata.write(127);
-      }
-      Firmata.write(END_SYSEX);
+      sendCapabilities();
+      break;
+    case PIN_SNAPSHOT_QUERY:
+      Firmata.sendPinSnapshot(capabilityHash());
       break;
     case PIN_STATE_QUERY:
       if (argc > 0) {
@@ -765,7 +788,7 @@ void setup()
 
   // set the BLE connection interval - this is the fastest interval you can read inputs
   stream.setConnectionInterval(FIRMATA_BLE_MIN_INTERVAL, FIRMATA_BLE_MAX_INTERVAL);
-  // set how often the BLE TX buffer is flushed (if not full)
+  // set the longest time output is held back while the BLE link is busy
   stream.setFlushInterval(FIRMATA_BLE_MAX_INTERVAL);
 
 #ifdef BLE_REQ
@@ -790,7 +813,8 @@ void loop()
   byte pin, analogPin;
 
   // do not process data if no BLE connection is established
-  // poll will send the TX buffer at the specified flush interval or when the buffer is full
+  // poll sends pending output right away if the link is idle, otherwise it is packed into
+  // notifications until they are full or the flush interval expires
   if (!stream.poll()) return;
 
   /* DIGITALREAD - as fast as possible, check for changes and output them to the
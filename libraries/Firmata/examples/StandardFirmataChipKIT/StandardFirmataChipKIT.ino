@@ -183,7 +183,7 @@ void readAndReportData(byte address, int theRegister, byte numBytes, byte stopTX
   }
 
   // send slave address, register and received bytes
-  Firmata.sendSysex(SYSEX_I2C_REPLY, numBytes + 2, i2cRxData);
+  Firmata.sendBinarySysex(SYSEX_I2C_REPLY, numBytes + 2, i2cRxData);
 }
 
 void outputPort(byte portNumber, byte portValue, byte forceSend)
@@ -441,6 +441,52 @@ void reportDigitalCallback(byte port, int value)
   // pins configured as analog
 }
 
+/* -----------------------------------------------------------------------------
+ * send the supported modes and resolutions of all pins (CAPABILITY_RESPONSE) */
+void sendCapabilities(void)
+{
+  Firmata.write(START_SYSEX);
+  Firmata.write(CAPABILITY_RESPONSE);
+  for (byte pin = 0; pin < TOTAL_PINS; pin++) {
+    if (IS_PIN_DIGITAL(pin)) {
+      Firmata.write((byte)INPUT);
+      Firmata.write(1);
+      Firmata.write((byte)PIN_MODE_PULLUP);
+      Firmata.write(1);
+      Firmata.write((byte)OUTPUT);
+      Firmata.write(1);
+    }
+    if (IS_PIN_ANALOG(pin)) {
+      Firmata.write(PIN_MODE_ANALOG);
+      Firmata.write(10); // 10 = 10-bit resolution
+    }
+    if (IS_PIN_PWM(pin)) {
+      Firmata.write(PIN_MODE_PWM);
+      Firmata.write(DEFAULT_PWM_RESOLUTION);
+    }
+    if (IS_PIN_DIGITAL(pin)) {
+      Firmata.write(PIN_MODE_SERVO);
+      Firmata.write(14);
+    }
+    if (IS_PIN_I2C(pin)) {
+      Firmata.write(PIN_MODE_I2C);
+      Firmata.write(1);  // TODO: could assign a number to map to SCL or SDA
+    }
+    Firmata.write(127);
+  }
+  Firmata.write(END_SYSEX);
+}
+
+/* hosts can cache the capability table under this hash (sent with
+ * PIN_SNAPSHOT_RESPONSE) instead of querying it, the hash changes whenever
+ * the advertised capabilities change */
+unsigned long capabilityHash(void)
+{
+  Firmata.startOutputHash();
+  sendCapabilities();
+  return Firmata.endOutputHash();
+}
+
 /*==============================================================================
  * SYSEX-BASED commands
  *============================================================================*/
@@ -477,9 +523,12 @@ void sysexCallback(byte command, byte argc, byte *argv)
       switch (mode) {
         case I2C_WRITE:
           Wire.beginTransmission(slaveAddress);
-          for (byte i = 2; i < argc; i += 2) {
-            data = argv[i] + (argv[i + 1] << 7);
-            wireWrite(data);
+          // two 7-bit bytes per data byte, or packed if negotiated with BINARY_ENCODING
+          if (argc > 2) {
+            argc = 2 + Firmata.decodeBinary(argc - 2, argv + 2);
+          }
+          for (byte i = 2; i < argc; i++) {
+            wireWrite(argv[i]);
           }
           Wire.endTransmission();
           delayMicroseconds(70);
@@ -599,36 +648,10 @@ void sysexCallback(byte command, byte argc, byte *argv)
       }
       break;
     case CAPABILITY_QUERY:
-      Firmata.write(START_SYSEX);
-      Firmata.write(CAPABILITY_RESPONSE);
-      for (byte pin = 0; pin < TOTAL_PINS; pin++) {
-        if (IS_PIN_DIGITAL(pin)) {
-          Firmata.write((byte)INPUT);
-          Firmata.write(1);
-          Firmata.write((byte)PIN_MODE_PULLUP);
-          Firmata.write(1);
-          Firmata.write((byte)OUTPUT);
-          Firmata.write(1);
-        }
-        if (IS_PIN_ANALOG(pin)) {
-          Firmata.write(PIN_MODE_ANALOG);
-          Firmata.write(10); // 10 = 10-bit resolution
-        }
-        if (IS_PIN_PWM(pin)) {
-          Firmata.write(PIN_MODE_PWM);
-          Firmata.write(DEFAULT_PWM_RESOLUTION);
-        }
-        if (IS_PIN_DIGITAL(pin)) {
-          Firmata.write(PIN_MODE_SERVO);
-          Firmata.write(14);
-        }
-        if (IS_PIN_I2C(pin)) {
-          Firmata.write(PIN_MODE_I2C);
-          Firmata.write(1);  // TODO: could assign a number to map to SCL or SDA
-        }
-        Firmata.write(127);
-      }
-      Firmata.write(END_SYSEX);
+      sendCapabilities();
+      break;
+    case PIN_SNAPSHOT_QUERY:
+      Firmata.sendPinSnapshot(capabilityHash());
       break;
     case PIN_STATE_QUERY:
       if (argc > 0) {
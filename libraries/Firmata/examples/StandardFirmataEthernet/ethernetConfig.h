@@ -66,6 +66,19 @@ YunClient client;
 // replace with ethernet shield mac. Must be unique for your network
 const byte mac[] = {0x90, 0xA2, 0xDA, 0x00, 0x53, 0xE5};
 
+
+// STEP 6 [OPTIONAL, WIZ5100_ETHERNET only]
+// Uncomment to exchange Firmata messages with the host in UDP datagrams instead of a TCP
+// connection. The board listens on remote_port and sends reports to remote_ip:remote_port.
+// See utility/UDPStream.h for the datagram format.
+//#define UDP_TRANSPORT
+
+//do not modify the following 4 lines
+#ifdef UDP_TRANSPORT
+#include <EthernetUdp.h>
+EthernetUDP udp;
+#endif
+
 /*==============================================================================
  * CONFIGURATION ERROR CHECK (don't change anything here)
  *============================================================================*/
@@ -78,6 +91,10 @@ const byte mac[] = {0x90, 0xA2, 0xDA, 0x00, 0x53, 0xE5};
 #error "cannot define both remote_ip and remote_host at the same time in ethernetConfig.h"
 #endif
 
+#if defined UDP_TRANSPORT && (defined YUN_ETHERNET || !defined remote_ip)
+#error "UDP_TRANSPORT requires WIZ5100_ETHERNET and remote_ip in ethernetConfig.h"
+#endif
+
 /*==============================================================================
  * PIN IGNORE MACROS (don't change anything here)
  *============================================================================*/
@@ -35,17 +35,81 @@
 
   - Ability to interface with serial devices using UART, USART, or SoftwareSerial
     depending on the capatilities of the board.
-
-  At the time of this writing, StandardFirmataPlus will still compile and run
-  on ATMega328p and ATMega32u4-based boards, but future versions of this sketch
-  may not as new features are added.
+  - Timer driven analog sampling at up to several kHz with samples sent to the
+    host in bursts (see utility/AnalogSamplerFirmata.h).
+  - Interrupt driven digital input reporting with timestamps, so pulses shorter
+    than one pass of loop() are reported. Only available on the external
+    interrupt pins (2 and 3 on an Uno, see utility/PinChangeFirmata.h).
+  - On-device task scheduler (SCHEDULER_DATA) that replays uploaded Firmata
+    messages with millisecond delays and loops (see utility/SchedulerFirmata.h).
+  - Non-blocking stepper motors with acceleration and queued moves (see
+    utility/StepperFirmata.h). Uses Timer2 on AVR boards, so PWM on the Timer2
+    pins is unavailable (and not reported) while a stepper is configured.
+  - Interrupt driven quadrature encoders with position and velocity reports,
+    on the external interrupt pins (see utility/EncoderFirmata.h).
+  - Oversampling, moving average and median filters for analog reports (see
+    utility/AnalogFilterFirmata.h).
+  - Trigger armed capture of digital pins and analog channels with pre- and
+    post-trigger samples, uploaded in one message (see utility/CaptureFirmata.h).
+  - Daisy-chained output shift registers with a framebuffer, written with
+    hardware SPI when the data and clock pins are the SPI pins (see
+    utility/ShiftFirmata.h).
+  - 1-Wire buses with non-blocking search, requests and periodic conversions
+    whose waits overlap across buses (see utility/OneWireFirmata.h).
+  - Servo moves interpolated on the board with duration, speed and acceleration
+    limits, with groups of servos starting and finishing together (see
+    utility/ServoMotionFirmata.h).
+  - Optional CRC checked frames with acknowledged commands on the serial port
+    for noisy links such as RS485 or radio modems (uncomment FIRMATA_FRAMED_SERIAL
+    below, see utility/FramedStream.h).
+
+  On boards with 2.5 KB of RAM or less, such as the ATMega328p and ATMega32u4,
+  the analog sampler, capture, scheduler, stepper, 1-Wire and servo motion
+  features are left out so the sketch still fits, see FIRMATA_SMALL_RAM below.
+  Even then little RAM is left for the stack on these boards.
 */
 
 #include <Servo.h>
 #include <Wire.h>
+
+// boards with 2.5 KB of RAM or less only get the features without large buffers
+#if defined(RAMEND) && RAMEND < 0xB00
+#define FIRMATA_SMALL_RAM
+#define FIRMATA_MAX_FEATURES        5
+#else
+#define FIRMATA_MAX_FEATURES        11
+#endif
+
 #include <Firmata.h>
 
+// compile the interrupt handlers and the SPI shift output of these features
+// into this sketch
+#define FIRMATA_SAMPLER_ISR
+#define FIRMATA_STEPPER_ISR
+#define FIRMATA_SHIFT_SPI
+
+#include "utility/ReportScheduler.h"
 #include "utility/SerialFirmata.h"
+#include "utility/PinChangeFirmata.h"
+#include "utility/EncoderFirmata.h"
+#include "utility/AnalogFilterFirmata.h"
+#include "utility/ShiftFirmata.h"
+#ifndef FIRMATA_SMALL_RAM
+#include "utility/AnalogSamplerFirmata.h"
+#include "utility/SchedulerFirmata.h"
+#include "utility/StepperFirmata.h"
+#include "utility/CaptureFirmata.h"
+#include "utility/OneWireFirmata.h"
+#include "utility/ServoMotionFirmata.h"
+#endif
+
+// Uncomment to wrap the serial port in CRC checked frames. The host must speak
+// the FramedStream protocol, see utility/FramedStream.h.
+//#define FIRMATA_FRAMED_SERIAL
+
+#ifdef FIRMATA_FRAMED_SERIAL
+#include "utility/FramedStream.h"
+#endif
 
 #define I2C_WRITE                   B00000000
 #define I2C_READ                    B00001000
@@ -56,7 +120,8 @@
 #define I2C_END_TX_MASK             B01000000
 #define I2C_STOP_TX                 1
 #define I2C_RESTART_TX              0
-#define I2C_MAX_QUERIES             8
+// one report scheduler item per query, boards with more RAM get more
+#define I2C_MAX_QUERIES             REPORT_I2C_ITEMS
 #define I2C_REGISTER_NOT_SPECIFIED  -1
 
 // the minimum interval for sampling analog input
@@ -71,6 +136,46 @@
 SerialFirmata serialFeature;
 #endif
 
+#ifdef FIRMATA_ANALOG_SAMPLER_FEATURE
+AnalogSamplerFirmata analogSamplerFeature;
+#endif
+
+#ifdef FIRMATA_PIN_CHANGE_FEATURE
+PinChangeFirmata pinChangeFeature;
+#endif
+
+#ifdef FIRMATA_SCHEDULER_FEATURE
+SchedulerFirmata schedulerFeature;
+#endif
+
+#ifdef FIRMATA_STEPPER_FEATURE
+StepperFirmata stepperFeature;
+#endif
+
+#ifdef FIRMATA_ENCODER_FEATURE
+EncoderFirmata encoderFeature;
+#endif
+
+#ifdef FIRMATA_ANALOG_FILTER_FEATURE
+AnalogFilterFirmata analogFilterFeature;
+#endif
+
+#ifdef FIRMATA_CAPTURE_FEATURE
+CaptureFirmata captureFeature;
+#endif
+
+#ifdef FIRMATA_SHIFT_FEATURE
+ShiftFirmata shiftFeature;
+#endif
+
+#ifdef FIRMATA_ONEWIRE_FEATURE
+OneWireFirmata oneWireFeature;
+#endif
+
+#ifdef FIRMATA_FRAMED_SERIAL
+FramedStream framedSerial(Serial);
+#endif
+
 /* analog inputs */
 int analogInputsToReport = 0; // bitwise array to store pin reporting
 
@@ -83,8 +188,11 @@ byte portConfigInputs[TOTAL_PORTS]; // each bit: 1 = pin in INPUT, 0 = anything
 
 /* timer variables */
 unsigned long currentMillis;        // store the current value from millis()
-unsigned long previousMillis;       // for comparison with currentMillis
-unsigned int samplingInterval = 19; // how often to run the main loop (in ms)
+unsigned int samplingInterval = 19; // default report interval (in ms)
+
+/* analog pins, polled ports and continuous i2c reads with their due times */
+ReportScheduler reportScheduler;
+byte i2cReadsLeft;                  // continuous i2c reads left in this pass of loop()
 
 /* i2c data */
 struct i2c_device_info {
@@ -109,6 +217,10 @@ byte detachedServos[MAX_SERVOS];
 byte detachedServoCount = 0;
 byte servoCount = 0;
 
+#ifdef FIRMATA_SERVO_MOTION_FEATURE
+ServoMotionFirmata servoMotionFeature(servos, servoPinMap);
+#endif
+
 boolean isResetting = false;
 
 
@@ -131,6 +243,46 @@ byte wireRead(void)
 #endif
 }
 
+/* analogRead() must not be used while the sampler owns the ADC */
+boolean isAnalogSamplerRunning(void)
+{
+#ifdef FIRMATA_ANALOG_SAMPLER_FEATURE
+  return analogSamplerFeature.isRunning();
+#else
+  return false;
+#endif
+}
+
+/* the stepper takes over the timer of some PWM pins while it is configured */
+boolean isPwmAvailable(byte pin)
+{
+#ifdef FIRMATA_STEPPER_FEATURE
+  return IS_PIN_PWM(pin) && !stepperFeature.isTimerPin(pin);
+#else
+  return IS_PIN_PWM(pin);
+#endif
+}
+
+/* ports reported by pin change interrupts must not be polled, and ports with
+ * their own report interval are polled by the report scheduler */
+boolean isPortPolled(byte port)
+{
+#ifdef FIRMATA_PIN_CHANGE_FEATURE
+  return reportPINs[port] && !pinChangeFeature.isMonitoring(port)
+         && !reportScheduler.isScheduled(REPORT_PORT_ITEM(port));
+#else
+  return reportPINs[port] && !reportScheduler.isScheduled(REPORT_PORT_ITEM(port));
+#endif
+}
+
+/* hand the reported input pins of a port to the pin change feature */
+void updatePinChangePort(byte port)
+{
+#ifdef FIRMATA_PIN_CHANGE_FEATURE
+  pinChangeFeature.setPortMask(port, reportPINs[port] ? portConfigInputs[port] : 0);
+#endif
+}
+
 /*==============================================================================
  * FUNCTIONS
  *============================================================================*/
@@ -158,6 +310,9 @@ void attachServo(byte pin, int minPulse, int maxPulse)
 
 void detachServo(byte pin)
 {
+#ifdef FIRMATA_SERVO_MOTION_FEATURE
+  servoMotionFeature.cancel(pin);
+#endif
   servos[servoPinMap[pin]].detach();
   // if we're detaching the last servo, decrement the count
   // otherwise store the index of the detached servo
@@ -207,7 +362,72 @@ void readAndReportData(byte address, int theRegister, byte numBytes, byte stopTX
   }
 
   // send slave address, register and received bytes
-  Firmata.sendSysex(SYSEX_I2C_REPLY, numBytes + 2, i2cRxData);
+  Firmata.sendBinarySysex(SYSEX_I2C_REPLY, numBytes + 2, i2cRxData);
+}
+
+/* -----------------------------------------------------------------------------
+ * send an analog input that is due if its pin is in analog mode */
+void reportAnalogInput(byte analogPin)
+{
+  if (isAnalogSamplerRunning()) {
+    // the ADC belongs to the sampler while it is running
+    return;
+  }
+  for (byte pin = 0; pin < TOTAL_PINS; pin++) {
+    if (IS_PIN_ANALOG(pin) && PIN_TO_ANALOG(pin) == analogPin) {
+      if (Firmata.getPinMode(pin) != PIN_MODE_ANALOG) return;
+#ifdef FIRMATA_ANALOG_FILTER_FEATURE
+      if (analogFilterFeature.report(analogPin)) return;
+#endif
+      Firmata.sendAnalog(analogPin, analogRead(analogPin));
+      return;
+    }
+  }
+}
+
+/* -----------------------------------------------------------------------------
+ * report callback of the scheduler for an analog pin, port or continuous i2c
+ * query that is due. At most one i2c query is read per pass of loop(), so a
+ * slow device holds up the main loop for no more than one transaction. */
+boolean sendDueReport(byte item)
+{
+  if (item < REPORT_PORT_ITEM(0)) {
+    reportAnalogInput(item);
+  } else if (item < REPORT_I2C_ITEM(0)) {
+    byte port = item - REPORT_PORT_ITEM(0);
+#ifdef FIRMATA_PIN_CHANGE_FEATURE
+    if (pinChangeFeature.isMonitoring(port)) return true;
+#endif
+    if (reportPINs[port]) outputPort(port, readPort(port, portConfigInputs[port]), false);
+  } else {
+    if (i2cReadsLeft == 0) return false;
+    i2cReadsLeft--;
+    byte i = item - REPORT_I2C_ITEM(0);
+    readAndReportData(query[i].addr, query[i].reg, query[i].bytes, query[i].stopTX);
+  }
+  return true;
+}
+
+/* -----------------------------------------------------------------------------
+ * set the report interval of an analog pin or port, 0 = samplingInterval.
+ * Ports with an interval are read at that interval instead of every pass of loop() */
+void setReportInterval(byte type, byte index, unsigned int interval)
+{
+  if (interval > 0 && interval < MINIMUM_SAMPLING_INTERVAL) {
+    interval = MINIMUM_SAMPLING_INTERVAL;
+  }
+  if (type == REPORT_TYPE_ANALOG && index < TOTAL_ANALOG_PINS) {
+    reportScheduler.setInterval(REPORT_ANALOG_ITEM(index), interval);
+  } else if (type == REPORT_TYPE_PORT && index < TOTAL_PORTS) {
+    reportScheduler.setInterval(REPORT_PORT_ITEM(index), interval);
+    if (interval == 0) {
+      reportScheduler.stop(REPORT_PORT_ITEM(index));
+    } else if (!reportScheduler.isScheduled(REPORT_PORT_ITEM(index))) {
+      reportScheduler.start(REPORT_PORT_ITEM(index), millis());
+    }
+  } else {
+    Firmata.sendString("Invalid report item");
+  }
 }
 
 void outputPort(byte portNumber, byte portValue, byte forceSend)
@@ -229,22 +449,22 @@ void checkDigitalInputs(void)
   /* Using non-looping code allows constants to be given to readPort().
    * The compiler will apply substantial optimizations if the inputs
    * to readPort() are compile-time constants. */
-  if (TOTAL_PORTS > 0 && reportPINs[0]) outputPort(0, readPort(0, portConfigInputs[0]), false);
-  if (TOTAL_PORTS > 1 && reportPINs[1]) outputPort(1, readPort(1, portConfigInputs[1]), false);
-  if (TOTAL_PORTS > 2 && reportPINs[2]) outputPort(2, readPort(2, portConfigInputs[2]), false);
-  if (TOTAL_PORTS > 3 && reportPINs[3]) outputPort(3, readPort(3, portConfigInputs[3]), false);
-  if (TOTAL_PORTS > 4 && reportPINs[4]) outputPort(4, readPort(4, portConfigInputs[4]), false);
-  if (TOTAL_PORTS > 5 && reportPINs[5]) outputPort(5, readPort(5, portConfigInputs[5]), false);
-  if (TOTAL_PORTS > 6 && reportPINs[6]) outputPort(6, readPort(6, portConfigInputs[6]), false);
-  if (TOTAL_PORTS > 7 && reportPINs[7]) outputPort(7, readPort(7, portConfigInputs[7]), false);
-  if (TOTAL_PORTS > 8 && reportPINs[8]) outputPort(8, readPort(8, portConfigInputs[8]), false);
-  if (TOTAL_PORTS > 9 && reportPINs[9]) outputPort(9, readPort(9, portConfigInputs[9]), false);
-  if (TOTAL_PORTS > 10 && reportPINs[10]) outputPort(10, readPort(10, portConfigInputs[10]), false);
-  if (TOTAL_PORTS > 11 && reportPINs[11]) outputPort(11, readPort(11, portConfigInputs[11]), false);
-  if (TOTAL_PORTS > 12 && reportPINs[12]) outputPort(12, readPort(12, portConfigInputs[12]), false);
-  if (TOTAL_PORTS > 13 && reportPINs[13]) outputPort(13, readPort(13, portConfigInputs[13]), false);
-  if (TOTAL_PORTS > 14 && reportPINs[14]) outputPort(14, readPort(14, portConfigInputs[14]), false);
-  if (TOTAL_PORTS > 15 && reportPINs[15]) outputPort(15, readPort(15, portConfigInputs[15]), false);
+  if (TOTAL_PORTS > 0 && isPortPolled(0)) outputPort(0, readPort(0, portConfigInputs[0]), false);
+  if (TOTAL_PORTS > 1 && isPortPolled(1)) outputPort(1, readPort(1, portConfigInputs[1]), false);
+  if (TOTAL_PORTS > 2 && isPortPolled(2)) outputPort(2, readPort(2, portConfigInputs[2]), false);
+  if (TOTAL_PORTS > 3 && isPortPolled(3)) outputPort(3, readPort(3, portConfigInputs[3]), false);
+  if (TOTAL_PORTS > 4 && isPortPolled(4)) outputPort(4, readPort(4, portConfigInputs[4]), false);
+  if (TOTAL_PORTS > 5 && isPortPolled(5)) outputPort(5, readPort(5, portConfigInputs[5]), false);
+  if (TOTAL_PORTS > 6 && isPortPolled(6)) outputPort(6, readPort(6, portConfigInputs[6]), false);
+  if (TOTAL_PORTS > 7 && isPortPolled(7)) outputPort(7, readPort(7, portConfigInputs[7]), false);
+  if (TOTAL_PORTS > 8 && isPortPolled(8)) outputPort(8, readPort(8, portConfigInputs[8]), false);
+  if (TOTAL_PORTS > 9 && isPortPolled(9)) outputPort(9, readPort(9, portConfigInputs[9]), false);
+  if (TOTAL_PORTS > 10 && isPortPolled(10)) outputPort(10, readPort(10, portConfigInputs[10]), false);
+  if (TOTAL_PORTS > 11 && isPortPolled(11)) outputPort(11, readPort(11, portConfigInputs[11]), false);
+  if (TOTAL_PORTS > 12 && isPortPolled(12)) outputPort(12, readPort(12, portConfigInputs[12]), false);
+  if (TOTAL_PORTS > 13 && isPortPolled(13)) outputPort(13, readPort(13, portConfigInputs[13]), false);
+  if (TOTAL_PORTS > 14 && isPortPolled(14)) outputPort(14, readPort(14, portConfigInputs[14]), false);
+  if (TOTAL_PORTS > 15 && isPortPolled(15)) outputPort(15, readPort(15, portConfigInputs[15]), false);
 }
 
 // -----------------------------------------------------------------------------
@@ -275,6 +495,7 @@ void setPinModeCallback(byte pin, int mode)
     } else {
       portConfigInputs[pin / 8] &= ~(1 << (pin & 7));
     }
+    updatePinChangePort(pin / 8);
   }
   Firmata.setPinState(pin, 0);
   switch (mode) {
@@ -315,7 +536,7 @@ void setPinModeCallback(byte pin, int mode)
       }
       break;
     case PIN_MODE_PWM:
-      if (IS_PIN_PWM(pin)) {
+      if (isPwmAvailable(pin)) {
         pinMode(PIN_TO_PWM(pin), OUTPUT);
         analogWrite(PIN_TO_PWM(pin), 0);
         Firmata.setPinMode(pin, PIN_MODE_PWM);
@@ -338,13 +559,10 @@ void setPinModeCallback(byte pin, int mode)
         Firmata.setPinMode(pin, PIN_MODE_I2C);
       }
       break;
-    case PIN_MODE_SERIAL:
-#ifdef FIRMATA_SERIAL_FEATURE
-      serialFeature.handlePinMode(pin, PIN_MODE_SERIAL);
-#endif
-      break;
     default:
-      Firmata.sendString("Unknown pin mode"); // TODO: put error msgs in EEPROM
+      if (!Firmata.handleFeaturePinMode(pin, mode)) {
+        Firmata.sendString("Unknown pin mode"); // TODO: put error msgs in EEPROM
+      }
   }
   // TODO: save status to EEPROM here, if changed
 }
@@ -370,12 +588,16 @@ void analogWriteCallback(byte pin, int value)
   if (pin < TOTAL_PINS) {
     switch (Firmata.getPinMode(pin)) {
       case PIN_MODE_SERVO:
+#ifdef FIRMATA_SERVO_MOTION_FEATURE
+        // a direct write overrides an interpolated move
+        servoMotionFeature.cancel(pin);
+#endif
         if (IS_PIN_DIGITAL(pin))
           servos[servoPinMap[pin]].write(value);
         Firmata.setPinState(pin, value);
         break;
       case PIN_MODE_PWM:
-        if (IS_PIN_PWM(pin))
+        if (isPwmAvailable(pin))
           analogWrite(PIN_TO_PWM(pin), value);
         Firmata.setPinState(pin, value);
         break;
@@ -428,11 +650,15 @@ void reportAnalogCallback(byte analogPin, int value)
   if (analogPin < TOTAL_ANALOG_PINS) {
     if (value == 0) {
       analogInputsToReport = analogInputsToReport & ~ (1 << analogPin);
+      reportScheduler.stop(REPORT_ANALOG_ITEM(analogPin));
     } else {
       analogInputsToReport = analogInputsToReport | (1 << analogPin);
+      if (!reportScheduler.isScheduled(REPORT_ANALOG_ITEM(analogPin))) {
+        reportScheduler.start(REPORT_ANALOG_ITEM(analogPin), millis());
+      }
       // prevent during system reset or all analog pin values will be reported
       // which may report noise for unconnected analog pins
-      if (!isResetting) {
+      if (!isResetting && !isAnalogSamplerRunning()) {
         // Send pin value immediately. This is helpful when connected via
         // ethernet, wi-fi or bluetooth so pin states can be known upon
         // reconnecting.
@@ -447,6 +673,7 @@ void reportDigitalCallback(byte port, int value)
 {
   if (port < TOTAL_PORTS) {
     reportPINs[port] = (byte)value;
+    updatePinChangePort(port);
     // Send port value immediately. This is helpful when connected via
     // ethernet, wi-fi or bluetooth so pin states can be known upon
     // reconnecting.
@@ -460,6 +687,53 @@ void reportDigitalCallback(byte port, int value)
   // pins configured as analog
 }
 
+/* -----------------------------------------------------------------------------
+ * send the supported modes and resolutions of all pins (CAPABILITY_RESPONSE) */
+void sendCapabilities(void)
+{
+  Firmata.write(START_SYSEX);
+  Firmata.write(CAPABILITY_RESPONSE);
+  for (byte pin = 0; pin < TOTAL_PINS; pin++) {
+    if (IS_PIN_DIGITAL(pin)) {
+      Firmata.write((byte)INPUT);
+      Firmata.write(1);
+      Firmata.write((byte)PIN_MODE_PULLUP);
+      Firmata.write(1);
+      Firmata.write((byte)OUTPUT);
+      Firmata.write(1);
+    }
+    if (IS_PIN_ANALOG(pin)) {
+      Firmata.write(PIN_MODE_ANALOG);
+      Firmata.write(10); // 10 = 10-bit resolution
+    }
+    if (isPwmAvailable(pin)) {
+      Firmata.write(PIN_MODE_PWM);
+      Firmata.write(DEFAULT_PWM_RESOLUTION);
+    }
+    if (IS_PIN_DIGITAL(pin)) {
+      Firmata.write(PIN_MODE_SERVO);
+      Firmata.write(14);
+    }
+    if (IS_PIN_I2C(pin)) {
+      Firmata.write(PIN_MODE_I2C);
+      Firmata.write(1);  // TODO: could assign a number to map to SCL or SDA
+    }
+    Firmata.handleFeatureCapabilities(pin);
+    Firmata.write(127);
+  }
+  Firmata.write(END_SYSEX);
+}
+
+/* hosts can cache the capability table under this hash (sent with
+ * PIN_SNAPSHOT_RESPONSE) instead of querying it, the hash changes whenever
+ * the advertised capabilities change */
+unsigned long capabilityHash(void)
+{
+  Firmata.startOutputHash();
+  sendCapabilities();
+  return Firmata.endOutputHash();
+}
+
 /*==============================================================================
  * SYSEX-BASED commands
  *============================================================================*/
@@ -472,6 +746,7 @@ void sysexCallback(byte command, byte argc, byte *argv)
   byte data;
   int slaveRegister;
   unsigned int delayTime;
+  unsigned int interval;
 
   switch (command) {
     case I2C_REQUEST:
@@ -496,9 +771,12 @@ void sysexCallback(byte command, byte argc, byte *argv)
       switch (mode) {
         case I2C_WRITE:
           Wire.beginTransmission(slaveAddress);
-          for (byte i = 2; i < argc; i += 2) {
-            data = argv[i] + (argv[i + 1] << 7);
-            wireWrite(data);
+          // two 7-bit bytes per data byte, or packed if negotiated with BINARY_ENCODING
+          if (argc > 2) {
+            argc = 2 + Firmata.decodeBinary(argc - 2, argv + 2);
+          }
+          for (byte i = 2; i < argc; i++) {
+            wireWrite(argv[i]);
           }
           Wire.endTransmission();
           delayMicroseconds(70);
@@ -522,7 +800,14 @@ void sysexCallback(byte command, byte argc, byte *argv)
             Firmata.sendString("too many queries");
             break;
           }
-          if (argc == 6) {
+          interval = 0;
+          if (argc == 8) {
+            // a slave register and a read interval for this query are specified
+            slaveRegister = argv[2] + (argv[3] << 7);
+            data = argv[4] + (argv[5] << 7);  // bytes to read
+            interval = argv[6] + (argv[7] << 7);
+          }
+          else if (argc == 6) {
             // a slave register is specified
             slaveRegister = argv[2] + (argv[3] << 7);
             data = argv[4] + (argv[5] << 7);  // bytes to read
@@ -537,6 +822,8 @@ void sysexCallback(byte command, byte argc, byte *argv)
           query[queryIndex].reg = slaveRegister;
           query[queryIndex].bytes = data;
           query[queryIndex].stopTX = stopTX;
+          reportScheduler.setInterval(REPORT_I2C_ITEM(queryIndex), interval);
+          reportScheduler.start(REPORT_I2C_ITEM(queryIndex), millis());
           break;
         case I2C_STOP_READING:
           byte queryIndexToSkip;
@@ -544,6 +831,7 @@ void sysexCallback(byte command, byte argc, byte *argv)
           // read continuous reporting for that device
           if (queryIndex <= 0) {
             queryIndex = -1;
+            reportScheduler.stop(REPORT_I2C_ITEM(0));
           } else {
             queryIndexToSkip = 0;
             // if read continuous mode is enabled for multiple devices,
@@ -557,12 +845,11 @@ void sysexCallback(byte command, byte argc, byte *argv)
             }
 
             for (byte i = queryIndexToSkip; i < queryIndex + 1; i++) {
-              if (i < I2C_MAX_QUERIES) {
-                query[i].addr = query[i + 1].addr;
-                query[i].reg = query[i + 1].reg;
-                query[i].bytes = query[i + 1].bytes;
-                query[i].stopTX = query[i + 1].stopTX;
+              if (i + 1 < I2C_MAX_QUERIES) {
+                query[i] = query[i + 1];
               }
+              // the read schedule moves along with its query
+              reportScheduler.move(REPORT_I2C_ITEM(i + 1), REPORT_I2C_ITEM(i));
             }
             queryIndex--;
           }
@@ -600,11 +887,15 @@ void sysexCallback(byte command, byte argc, byte *argv)
       }
       break;
     case SAMPLING_INTERVAL:
-      if (argc > 1) {
+      if (argc > 3) {
+        // the interval of a single analog pin or port
+        setReportInterval(argv[2], argv[3], argv[0] + (argv[1] << 7));
+      } else if (argc > 1) {
         samplingInterval = argv[0] + (argv[1] << 7);
         if (samplingInterval < MINIMUM_SAMPLING_INTERVAL) {
           samplingInterval = MINIMUM_SAMPLING_INTERVAL;
         }
+        reportScheduler.setDefaultInterval(samplingInterval);
       } else {
         //Firmata.sendString("Not enough data");
       }
@@ -618,39 +909,10 @@ void sysexCallback(byte command, byte argc, byte *argv)
       }
       break;
     case CAPABILITY_QUERY:
-      Firmata.write(START_SYSEX);
-      Firmata.write(CAPABILITY_RESPONSE);
-      for (byte pin = 0; pin < TOTAL_PINS; pin++) {
-        if (IS_PIN_DIGITAL(pin)) {
-          Firmata.write((byte)INPUT);
-          Firmata.write(1);
-          Firmata.write((byte)PIN_MODE_PULLUP);
-          Firmata.write(1);
-          Firmata.write((byte)OUTPUT);
-          Firmata.write(1);
-        }
-        if (IS_PIN_ANALOG(pin)) {
-          Firmata.write(PIN_MODE_ANALOG);
-          Firmata.write(10); // 10 = 10-bit resolution
-        }
-        if (IS_PIN_PWM(pin)) {
-          Firmata.write(PIN_MODE_PWM);
-          Firmata.write(DEFAULT_PWM_RESOLUTION);
-        }
-        if (IS_PIN_DIGITAL(pin)) {
-          Firmata.write(PIN_MODE_SERVO);
-          Firmata.write(14);
-        }
-        if (IS_PIN_I2C(pin)) {
-          Firmata.write(PIN_MODE_I2C);
-          Firmata.write(1);  // TODO: could assign a number to map to SCL or SDA
-        }
-#ifdef FIRMATA_SERIAL_FEATURE
-        serialFeature.handleCapability(pin);
-#endif
-        Firmata.write(127);
-      }
-      Firmata.write(END_SYSEX);
+      sendCapabilities();
+      break;
+    case PIN_SNAPSHOT_QUERY:
+      Firmata.sendPinSnapshot(capabilityHash());
       break;
     case PIN_STATE_QUERY:
       if (argc > 0) {
@@ -676,9 +938,14 @@ void sysexCallback(byte command, byte argc, byte *argv)
       Firmata.write(END_SYSEX);
       break;
 
-    case SERIAL_MESSAGE:
-#ifdef FIRMATA_SERIAL_FEATURE
-      serialFeature.handleSysex(command, argc, argv);
+    case CAPTURE_DATA:
+#ifdef FIRMATA_CAPTURE_FEATURE
+      // a capture may read analog channels
+      if (isAnalogSamplerRunning()) {
+        Firmata.sendString("Capture: ADC in use by the sampler");
+      } else {
+        captureFeature.handleSysex(command, argc, argv);
+      }
 #endif
       break;
   }
@@ -706,6 +973,9 @@ void disableI2CPins() {
   isI2CEnabled = false;
   // disable read continuous mode for all devices
   queryIndex = -1;
+  for (byte i = 0; i < I2C_MAX_QUERIES; i++) {
+    reportScheduler.stop(REPORT_I2C_ITEM(i));
+  }
 }
 
 /*==============================================================================
@@ -719,9 +989,7 @@ void systemResetCallback()
   // initialize a defalt state
   // TODO: option to load config from EEPROM instead of default
 
-#ifdef FIRMATA_SERIAL_FEATURE
-  serialFeature.reset();
-#endif
+  Firmata.resetFeatures();
 
   if (isI2CEnabled) {
     disableI2CPins();
@@ -748,6 +1016,7 @@ void systemResetCallback()
   }
   // by default, do not report any analog inputs
   analogInputsToReport = 0;
+  reportScheduler.reset();
 
   detachedServoCount = 0;
   servoCount = 0;
@@ -764,6 +1033,17 @@ void systemResetCallback()
   isResetting = false;
 }
 
+/*
+ * Registers a feature, reports a feature that does not fit into FIRMATA_MAX_FEATURES or
+ * claims a sysex command or pin mode twice.
+ */
+void addFeature(FirmataFeature *feature, byte sysexCommand, byte pinMode)
+{
+  if (!Firmata.addFeature(feature, sysexCommand, pinMode)) {
+    Firmata.sendString("Feature not registered");
+  }
+}
+
 void setup()
 {
   Firmata.setFirmwareVersion(FIRMATA_FIRMWARE_MAJOR_VERSION, FIRMATA_FIRMWARE_MINOR_VERSION);
@@ -786,11 +1066,53 @@ void setup()
   // Firmata.begin(Serial1);
   // However do not do this if you are using SERIAL_MESSAGE
 
+#ifdef FIRMATA_FRAMED_SERIAL
+  Serial.begin(57600);
+  Firmata.begin(framedSerial);
+#else
   Firmata.begin(57600);
+#endif
   while (!Serial) {
     ; // wait for serial port to connect. Needed for ATmega32u4-based boards and Arduino 101
   }
 
+  // features get their sysex messages and pin modes from Firmata directly,
+  // they are reset and report capabilities in this order
+#ifdef FIRMATA_SERIAL_FEATURE
+  addFeature(&serialFeature, SERIAL_MESSAGE, PIN_MODE_SERIAL);
+#endif
+#ifdef FIRMATA_ANALOG_SAMPLER_FEATURE
+  addFeature(&analogSamplerFeature, ANALOG_SAMPLER_DATA, FIRMATA_NO_PIN_MODE);
+#endif
+#ifdef FIRMATA_PIN_CHANGE_FEATURE
+  addFeature(&pinChangeFeature, PIN_CHANGE_DATA, FIRMATA_NO_PIN_MODE);
+#endif
+#ifdef FIRMATA_SCHEDULER_FEATURE
+  addFeature(&schedulerFeature, SCHEDULER_DATA, FIRMATA_NO_PIN_MODE);
+#endif
+#ifdef FIRMATA_STEPPER_FEATURE
+  addFeature(&stepperFeature, STEPPER_DATA, PIN_MODE_STEPPER);
+#endif
+#ifdef FIRMATA_ENCODER_FEATURE
+  addFeature(&encoderFeature, ENCODER_DATA, PIN_MODE_ENCODER);
+#endif
+#ifdef FIRMATA_ANALOG_FILTER_FEATURE
+  addFeature(&analogFilterFeature, ANALOG_FILTER_DATA, FIRMATA_NO_PIN_MODE);
+#endif
+#ifdef FIRMATA_CAPTURE_FEATURE
+  // CAPTURE_DATA stays with sysexCallback, which checks the sampler first
+  addFeature(&captureFeature, FIRMATA_NO_SYSEX, FIRMATA_NO_PIN_MODE);
+#endif
+#ifdef FIRMATA_SHIFT_FEATURE
+  addFeature(&shiftFeature, SHIFT_DATA, PIN_MODE_SHIFT);
+#endif
+#ifdef FIRMATA_ONEWIRE_FEATURE
+  addFeature(&oneWireFeature, ONEWIRE_DATA, PIN_MODE_ONEWIRE);
+#endif
+#ifdef FIRMATA_SERVO_MOTION_FEATURE
+  addFeature(&servoMotionFeature, SERVO_MOTION_DATA, FIRMATA_NO_PIN_MODE);
+#endif
+
   systemResetCallback();  // reset to default config
 }
 
@@ -799,12 +1121,20 @@ void setup()
  *============================================================================*/
 void loop()
 {
-  byte pin, analogPin;
-
   /* DIGITALREAD - as fast as possible, check for changes and output them to the
    * FTDI buffer using Serial.print()  */
   checkDigitalInputs();
 
+#ifdef FIRMATA_PIN_CHANGE_FEATURE
+  /* report digital changes latched by pin interrupts */
+  pinChangeFeature.update();
+#endif
+
+#ifdef FIRMATA_SCHEDULER_FEATURE
+  /* replay the scheduled tasks that are due */
+  schedulerFeature.update();
+#endif
+
   /* STREAMREAD - processing incoming messagse as soon as possible, while still
    * checking digital inputs.  */
   while (Firmata.available())
@@ -812,27 +1142,52 @@ void loop()
 
   // TODO - ensure that Stream buffer doesn't go over 60 bytes
 
+  /* ANALOGREAD, ports with their own interval and continuous i2c reads, each
+   * reported when due. Only the items due now are visited. */
   currentMillis = millis();
-  if (currentMillis - previousMillis > samplingInterval) {
-    previousMillis += samplingInterval;
-    /* ANALOGREAD - do all analogReads() at the configured sampling interval */
-    for (pin = 0; pin < TOTAL_PINS; pin++) {
-      if (IS_PIN_ANALOG(pin) && Firmata.getPinMode(pin) == PIN_MODE_ANALOG) {
-        analogPin = PIN_TO_ANALOG(pin);
-        if (analogInputsToReport & (1 << analogPin)) {
-          Firmata.sendAnalog(analogPin, analogRead(analogPin));
-        }
-      }
-    }
-    // report i2c data for all device with read continuous mode enabled
-    if (queryIndex > -1) {
-      for (byte i = 0; i < queryIndex + 1; i++) {
-        readAndReportData(query[i].addr, query[i].reg, query[i].bytes, query[i].stopTX);
-      }
-    }
-  }
+  i2cReadsLeft = 1;
+  reportScheduler.update(currentMillis, sendDueReport);
 
 #ifdef FIRMATA_SERIAL_FEATURE
   serialFeature.update();
 #endif
+
+#ifdef FIRMATA_ANALOG_SAMPLER_FEATURE
+  analogSamplerFeature.update();
+#endif
+
+#ifdef FIRMATA_STEPPER_FEATURE
+  stepperFeature.update();
+#endif
+
+#ifdef FIRMATA_ENCODER_FEATURE
+  encoderFeature.update();
+#endif
+
+#ifdef FIRMATA_ANALOG_FILTER_FEATURE
+  /* feed the analog filters between reports (the ADC belongs to the sampler while it is running) */
+  if (!isAnalogSamplerRunning()) {
+    analogFilterFeature.update();
+  }
+#endif
+
+#ifdef FIRMATA_CAPTURE_FEATURE
+  /* take the capture samples that are due, for at most CAPTURE_SLICE_MICROS */
+  captureFeature.update();
+#endif
+
+#ifdef FIRMATA_ONEWIRE_FEATURE
+  /* one bus primitive per bus, conversion waits do not block */
+  oneWireFeature.update();
+#endif
+
+#ifdef FIRMATA_SERVO_MOTION_FEATURE
+  /* write the next positions of the interpolated servo moves */
+  servoMotionFeature.update();
+#endif
+
+#ifdef FIRMATA_FRAMED_SERIAL
+  /* send the output of this pass as one frame */
+  framedSerial.maintain();
+#endif
 }
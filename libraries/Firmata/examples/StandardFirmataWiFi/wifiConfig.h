@@ -30,7 +30,7 @@
  */
 //#define WIFI_101
 
-//do not modify the following 11 lines
+//do not modify the following 12 lines
 #if defined(ARDUINO_SAMD_MKR1000) && !defined(WIFI_101)
 // automatically include if compiling for MRK1000
 #define WIFI_101
@@ -39,6 +39,7 @@
 #include <WiFi101.h>
 #include "utility/WiFiClientStream.h"
 #include "utility/WiFiServerStream.h"
+#include "utility/WiFiMultiServerStream.h"
   #define WIFI_LIB_INCLUDED
 #endif
 
@@ -54,11 +55,12 @@
  */
 //#define ARDUINO_WIFI_SHIELD
 
-//do not modify the following 10 lines
+//do not modify the following 11 lines
 #ifdef ARDUINO_WIFI_SHIELD
 #include <WiFi.h>
 #include "utility/WiFiClientStream.h"
 #include "utility/WiFiServerStream.h"
+#include "utility/WiFiMultiServerStream.h"
   #ifdef WIFI_LIB_INCLUDED
   #define MULTIPLE_WIFI_LIB_INCLUDES
   #else
@@ -78,7 +80,7 @@
  * IMPORTANT: You must have the esp8266 board support installed. To easily install this board see
  * the instructions here: https://github.com/esp8266/Arduino#installing-with-boards-manager.
  */
-//do not modify the following 14 lines
+//do not modify the following 15 lines
 #ifdef ESP8266
 // automatically include if compiling for ESP8266
 #define ESP8266_WIFI
@@ -87,6 +89,7 @@
 #include <ESP8266WiFi.h>
 #include "utility/WiFiClientStream.h"
 #include "utility/WiFiServerStream.h"
+#include "utility/WiFiMultiServerStream.h"
   #ifdef WIFI_LIB_INCLUDED
   #define MULTIPLE_WIFI_LIB_INCLUDES
   #else
@@ -133,6 +136,13 @@ char ssid[] = "your_network_name";
 #define SERVER_PORT 3030
 
 
+// STEP 5b [OPTIONAL for all boards and shields]
+// If more than one host (e.g. a controller and a dashboard) should be able to connect to the board
+// at the same time, uncomment the following define. Incoming commands are processed one complete
+// message at a time and every connected host receives all reports. Not used with SERVER_IP.
+//#define SERVER_MULTI_CLIENT
+
+
 // STEP 6 [REQUIRED for all boards and shields]
 // determine your network security type (OPTION A, B, or C). Option A is the most common, and the
 // default.
@@ -212,6 +222,8 @@ char wep_key[] = "your_wep_key";
 
 #ifdef SERVER_IP
   WiFiClientStream stream(IPAddress(SERVER_IP), SERVER_PORT);
+#elif defined(SERVER_MULTI_CLIENT)
+  WiFiMultiServerStream stream(SERVER_PORT);
 #else
   WiFiServerStream stream(SERVER_PORT);
 #endif
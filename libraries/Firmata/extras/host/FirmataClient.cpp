@@ -0,0 +1,673 @@
+/*
+  FirmataClient.cpp - asynchronous Firmata client for Linux hosts
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "FirmataClient.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+#include <stdexcept>
+
+// I2C_REQUEST mode bits, see StandardFirmata
+#define CLIENT_I2C_WRITE        0x00
+#define CLIENT_I2C_READ         0x08
+
+#define CLIENT_POLL_INTERVAL    100 // ms between timeout checks while queries are pending
+
+static uint32_t replyKey(uint8_t command, uint16_t index)
+{
+  return ((uint32_t)command << 16) | index;
+}
+
+static void appendPair(std::vector<uint8_t> &message, unsigned int value)
+{
+  message.push_back(value & 0x7F);
+  message.push_back((value >> 7) & 0x7F);
+}
+
+static std::vector<uint8_t> sysexMessage(uint8_t command, const uint8_t *data, size_t length)
+{
+  std::vector<uint8_t> message;
+  message.reserve(length + 3);
+  message.push_back(START_SYSEX);
+  message.push_back(command);
+  message.insert(message.end(), data, data + length);
+  message.push_back(END_SYSEX);
+  return message;
+}
+
+static speed_t baudConstant(long baud)
+{
+  switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    default: return B57600;
+  }
+}
+
+FirmataClient::FirmataClient()
+{
+  fd = -1;
+  wakeFds[0] = wakeFds[1] = -1;
+  running = false;
+  connected = false;
+  timeout = FIRMATA_CLIENT_TIMEOUT;
+  dropped = 0;
+  parsingSysex = false;
+  messageCommand = 0;
+  messageCount = 0;
+}
+
+FirmataClient::~FirmataClient()
+{
+  close();
+}
+
+//******************************************************************************
+//* Connection
+//******************************************************************************
+
+/*
+ * Open a serial port or the slave side of a pseudo terminal in raw mode.
+ */
+bool FirmataClient::openSerial(const char *path, long baud)
+{
+  int port = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (port < 0) {
+    return false;
+  }
+  termios options;
+  if (tcgetattr(port, &options) == 0) {
+    cfmakeraw(&options);
+    options.c_cflag |= CLOCAL | CREAD;
+    cfsetispeed(&options, baudConstant(baud));
+    cfsetospeed(&options, baudConstant(baud));
+    tcsetattr(port, TCSANOW, &options);
+  }
+  if (!open(port)) {
+    ::close(port);
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Connect to a board behind a TCP server (StandardFirmataWiFi, StandardFirmataEthernet
+ * or a serial to TCP bridge).
+ */
+bool FirmataClient::openTcp(const char *host, uint16_t port)
+{
+  addrinfo hints = addrinfo();
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addresses;
+  char service[8];
+  snprintf(service, sizeof(service), "%u", port);
+  if (getaddrinfo(host, service, &hints, &addresses) != 0) {
+    return false;
+  }
+  int socketFd = -1;
+  for (addrinfo *address = addresses; address; address = address->ai_next) {
+    socketFd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+    if (socketFd < 0) {
+      continue;
+    }
+    if (connect(socketFd, address->ai_addr, address->ai_addrlen) == 0) {
+      break;
+    }
+    ::close(socketFd);
+    socketFd = -1;
+  }
+  freeaddrinfo(addresses);
+  if (socketFd < 0) {
+    return false;
+  }
+  if (!open(socketFd)) {
+    ::close(socketFd);
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Take over an open file descriptor and start the I/O thread. The descriptor
+ * is closed by close(). A lost connection can be replaced by opening again.
+ */
+bool FirmataClient::open(int connection)
+{
+  if (running || connection < 0) {
+    return false;
+  }
+  // the I/O thread of a lost connection has ended, release it
+  close();
+  if (pipe2(wakeFds, O_NONBLOCK | O_CLOEXEC) != 0) {
+    return false;
+  }
+  fcntl(connection, F_SETFL, fcntl(connection, F_GETFL) | O_NONBLOCK);
+  fd = connection;
+  txBuffer.clear();
+  parsingSysex = false;
+  messageCommand = 0;
+  connected = true;
+  running = true;
+  thread = std::thread(&FirmataClient::run, this);
+  return true;
+}
+
+/*
+ * Stop the I/O thread, close the connection and fail all pending queries.
+ * Commands that were not written yet are dropped.
+ */
+void FirmataClient::close()
+{
+  if (!thread.joinable()) {
+    return;
+  }
+  running = false;
+  wake();
+  thread.join();
+  ::close(fd);
+  ::close(wakeFds[0]);
+  ::close(wakeFds[1]);
+  fd = wakeFds[0] = wakeFds[1] = -1;
+}
+
+/*
+ * @return false once the connection is closed or lost.
+ */
+bool FirmataClient::isConnected() const
+{
+  return connected;
+}
+
+void FirmataClient::setTimeout(unsigned int ms)
+{
+  timeout = ms;
+}
+
+//******************************************************************************
+//* Reports
+//******************************************************************************
+
+void FirmataClient::onReport(reportCallbackFunction callback)
+{
+  reportCallback = callback;
+}
+
+/*
+ * Receives sysex messages that answer no pending query, such as continuous
+ * I2C reads, feature replies and the firmware report of a board that starts.
+ */
+void FirmataClient::onSysex(sysexCallbackFunction callback)
+{
+  sysexCallback = callback;
+}
+
+void FirmataClient::onString(stringCallbackFunction callback)
+{
+  stringCallback = callback;
+}
+
+/*
+ * Take the oldest report from the queue, call from one thread only.
+ * @return false if the queue is empty.
+ */
+bool FirmataClient::readReport(FirmataReport &report)
+{
+  return reports.pop(report);
+}
+
+/*
+ * @return The number of reports dropped because the queue was full.
+ */
+unsigned long FirmataClient::droppedReports() const
+{
+  return dropped;
+}
+
+//******************************************************************************
+//* Commands
+//******************************************************************************
+
+void FirmataClient::setPinMode(uint8_t pin, uint8_t mode)
+{
+  send({SET_PIN_MODE, (uint8_t)(pin & 0x7F), (uint8_t)(mode & 0x7F)});
+}
+
+void FirmataClient::digitalWrite(uint8_t pin, bool value)
+{
+  send({SET_DIGITAL_PIN_VALUE, (uint8_t)(pin & 0x7F), (uint8_t)(value ? 1 : 0)});
+}
+
+/*
+ * Write a PWM or servo value, with EXTENDED_ANALOG for pins above 15 or
+ * values above 14 bits.
+ */
+void FirmataClient::analogWrite(uint8_t pin, uint32_t value)
+{
+  std::vector<uint8_t> message;
+  if (pin < 16 && value < 0x4000) {
+    message.push_back(ANALOG_MESSAGE | pin);
+    appendPair(message, value);
+  } else {
+    uint8_t data[5] = {(uint8_t)(pin & 0x7F), (uint8_t)(value & 0x7F), (uint8_t)((value >> 7) & 0x7F),
+                       (uint8_t)((value >> 14) & 0x7F), (uint8_t)((value >> 21) & 0x7F)};
+    message = sysexMessage(EXTENDED_ANALOG, data, value < 0x200000 ? 4 : 5);
+  }
+  send(message);
+}
+
+void FirmataClient::reportAnalog(uint8_t channel, bool enable)
+{
+  send({(uint8_t)(REPORT_ANALOG | (channel & 0x0F)), (uint8_t)(enable ? 1 : 0)});
+}
+
+void FirmataClient::reportDigital(uint8_t port, bool enable)
+{
+  send({(uint8_t)(REPORT_DIGITAL | (port & 0x0F)), (uint8_t)(enable ? 1 : 0)});
+}
+
+void FirmataClient::setSamplingInterval(unsigned int ms)
+{
+  std::vector<uint8_t> data;
+  appendPair(data, ms);
+  send(sysexMessage(SAMPLING_INTERVAL, data.data(), data.size()));
+}
+
+void FirmataClient::i2cConfig(unsigned int delayMicros)
+{
+  std::vector<uint8_t> data;
+  appendPair(data, delayMicros);
+  send(sysexMessage(I2C_CONFIG, data.data(), data.size()));
+}
+
+void FirmataClient::i2cWrite(uint8_t address, const uint8_t *bytes, size_t length)
+{
+  std::vector<uint8_t> data;
+  data.push_back(address & 0x7F);
+  data.push_back(CLIENT_I2C_WRITE);
+  for (size_t i = 0; i < length; i++) {
+    appendPair(data, bytes[i]);
+  }
+  send(sysexMessage(I2C_REQUEST, data.data(), data.size()));
+}
+
+void FirmataClient::sendSysex(uint8_t command, const uint8_t *data, size_t length)
+{
+  send(sysexMessage(command, data, length));
+}
+
+void FirmataClient::systemReset()
+{
+  send({SYSTEM_RESET});
+}
+
+//******************************************************************************
+//* Queries
+//******************************************************************************
+
+/*
+ * @return The protocol version: major, minor.
+ */
+std::future<FirmataReply> FirmataClient::queryVersion()
+{
+  return query(replyKey(REPORT_VERSION, 0), {REPORT_VERSION});
+}
+
+/*
+ * @return The firmware version and name: major, minor, name as 7-bit pairs.
+ */
+std::future<FirmataReply> FirmataClient::queryFirmware()
+{
+  return query(replyKey(REPORT_FIRMWARE, 0), sysexMessage(REPORT_FIRMWARE, NULL, 0));
+}
+
+std::future<FirmataReply> FirmataClient::queryCapabilities()
+{
+  return query(replyKey(CAPABILITY_RESPONSE, 0), sysexMessage(CAPABILITY_QUERY, NULL, 0));
+}
+
+std::future<FirmataReply> FirmataClient::queryAnalogMapping()
+{
+  return query(replyKey(ANALOG_MAPPING_RESPONSE, 0), sysexMessage(ANALOG_MAPPING_QUERY, NULL, 0));
+}
+
+/*
+ * @return pin, mode, state (one or more 7-bit bytes, LSB first).
+ */
+std::future<FirmataReply> FirmataClient::queryPinState(uint8_t pin)
+{
+  uint8_t data = pin & 0x7F;
+  return query(replyKey(PIN_STATE_RESPONSE, data), sysexMessage(PIN_STATE_QUERY, &data, 1));
+}
+
+/*
+ * Read count bytes from an I2C device, after writing reg to it unless reg is
+ * FIRMATA_CLIENT_NO_REGISTER.
+ * @return The bytes read.
+ */
+std::future<FirmataReply> FirmataClient::i2cRead(uint8_t address, int reg, uint8_t count)
+{
+  std::vector<uint8_t> data;
+  data.push_back(address & 0x7F);
+  data.push_back(CLIENT_I2C_READ);
+  if (reg != FIRMATA_CLIENT_NO_REGISTER) {
+    appendPair(data, reg);
+  }
+  appendPair(data, count);
+  // the board replies with register 0 if none was written
+  uint16_t index = ((address & 0x7F) << 8) | (reg != FIRMATA_CLIENT_NO_REGISTER ? reg & 0xFF : 0);
+  return query(replyKey(I2C_REPLY, index), sysexMessage(I2C_REQUEST, data.data(), data.size()));
+}
+
+/*
+ * Send a sysex message and wait for the next sysex reply with replyCommand,
+ * for features without a dedicated query method.
+ */
+std::future<FirmataReply> FirmataClient::request(uint8_t command, const uint8_t *data, size_t length,
+                                                 uint8_t replyCommand)
+{
+  return query(replyKey(replyCommand, 0), sysexMessage(command, data, length));
+}
+
+//******************************************************************************
+//* Private Methods
+//******************************************************************************
+
+void FirmataClient::send(const std::vector<uint8_t> &message)
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!running) {
+      return;
+    }
+    txBuffer.insert(txBuffer.end(), message.begin(), message.end());
+  }
+  wake();
+}
+
+/*
+ * Register a pending query and queue its message in one step, so a reply
+ * can never arrive before the query it answers is known. running is checked
+ * under the lock, so the I/O thread fails every query it let in before it
+ * ends.
+ */
+std::future<FirmataReply> FirmataClient::query(uint32_t key, const std::vector<uint8_t> &message)
+{
+  std::promise<FirmataReply> promise;
+  std::future<FirmataReply> future = promise.get_future();
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!running) {
+      promise.set_exception(std::make_exception_ptr(std::runtime_error("Firmata: not connected")));
+      return future;
+    }
+    pending.push_back(pending_query());
+    pending.back().key = key;
+    pending.back().deadline = clock::now() + std::chrono::milliseconds(timeout);
+    pending.back().promise = std::move(promise);
+    txBuffer.insert(txBuffer.end(), message.begin(), message.end());
+  }
+  wake();
+  return future;
+}
+
+void FirmataClient::wake()
+{
+  if (wakeFds[1] >= 0) {
+    uint8_t c = 0;
+    // a full pipe already wakes the thread up
+    if (write(wakeFds[1], &c, 1) < 0) {
+    }
+  }
+}
+
+/*
+ * The I/O thread: write queued bytes, parse received bytes and expire
+ * queries, until close() or until the connection is lost.
+ */
+void FirmataClient::run()
+{
+  uint8_t buffer[512];
+  while (running) {
+    bool writing;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      writing = !txBuffer.empty();
+    }
+    pollfd fds[2];
+    fds[0].fd = fd;
+    fds[0].events = POLLIN | (writing ? POLLOUT : 0);
+    fds[1].fd = wakeFds[0];
+    fds[1].events = POLLIN;
+    if (poll(fds, 2, pollTimeout()) < 0 && errno != EINTR) {
+      break;
+    }
+    if (fds[1].revents & POLLIN) {
+      while (read(wakeFds[0], buffer, sizeof(buffer)) > 0) {
+      }
+    }
+    if ((fds[0].revents & POLLOUT) && !flush()) {
+      break;
+    }
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      ssize_t count = read(fd, buffer, sizeof(buffer));
+      if (count > 0) {
+        for (ssize_t i = 0; i < count; i++) {
+          parse(buffer[i]);
+        }
+      } else if (count == 0 || (errno != EAGAIN && errno != EINTR)) {
+        break;
+      }
+    }
+    expire(false, "Firmata: reply timeout");
+  }
+  bool lost;
+  {
+    // from here on queries fail right away instead of waiting for this thread
+    std::lock_guard<std::mutex> guard(lock);
+    lost = running;
+    running = false;
+  }
+  connected = false;
+  expire(true, lost ? "Firmata: connection lost" : "Firmata: connection closed");
+}
+
+/*
+ * Write as much of the queued bytes as the connection takes.
+ * @return false if the connection failed.
+ */
+bool FirmataClient::flush()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  while (!txBuffer.empty()) {
+    ssize_t count = write(fd, txBuffer.data(), txBuffer.size());
+    if (count < 0) {
+      return errno == EAGAIN || errno == EINTR;
+    }
+    txBuffer.erase(txBuffer.begin(), txBuffer.begin() + count);
+  }
+  return true;
+}
+
+void FirmataClient::parse(uint8_t c)
+{
+  if (parsingSysex) {
+    if (c == END_SYSEX) {
+      parsingSysex = false;
+      dispatchSysex();
+      return;
+    }
+    if (c < 0x80) {
+      if (sysex.size() < FIRMATA_CLIENT_MAX_SYSEX) {
+        sysex.push_back(c);
+      }
+      return;
+    }
+    // a command byte aborts an unterminated sysex message
+    parsingSysex = false;
+  }
+
+  if (c >= 0x80) {
+    messageCommand = 0;
+    messageCount = 0;
+    if (c == START_SYSEX) {
+      parsingSysex = true;
+      sysex.clear();
+    } else if ((c & 0xF0) == ANALOG_MESSAGE || (c & 0xF0) == DIGITAL_MESSAGE || c == REPORT_VERSION) {
+      messageCommand = c;
+    }
+    return;
+  }
+  if (messageCommand) {
+    messageData[messageCount++] = c;
+    if (messageCount == 2) {
+      dispatchMessage();
+      messageCommand = 0;
+      messageCount = 0;
+    }
+  }
+}
+
+void FirmataClient::dispatchMessage()
+{
+  FirmataReport report;
+  report.index = messageCommand & 0x0F;
+  report.value = messageData[0] | (messageData[1] << 7);
+  switch (messageCommand & 0xF0) {
+    case ANALOG_MESSAGE:
+      report.type = ANALOG_MESSAGE;
+      deliver(report);
+      break;
+    case DIGITAL_MESSAGE:
+      report.type = DIGITAL_MESSAGE;
+      report.value &= 0xFF;
+      deliver(report);
+      break;
+    default:
+      // REPORT_VERSION, also sent unasked when the board starts
+      complete(replyKey(REPORT_VERSION, 0), FirmataReply(messageData, messageData + 2));
+  }
+}
+
+void FirmataClient::dispatchSysex()
+{
+  if (sysex.empty()) {
+    return;
+  }
+  uint8_t command = sysex[0];
+  FirmataReply data(sysex.begin() + 1, sysex.end());
+  bool answered = false;
+
+  switch (command) {
+    case STRING_DATA:
+      if (stringCallback) {
+        std::string text;
+        for (size_t i = 0; i + 1 < data.size(); i += 2) {
+          char c = data[i] | (data[i + 1] << 7);
+          if (c) {
+            text += c;
+          }
+        }
+        stringCallback(text);
+      }
+      return;
+    case PIN_STATE_RESPONSE:
+      answered = !data.empty() && complete(replyKey(command, data[0]), data);
+      break;
+    case I2C_REPLY:
+      if (data.size() >= 4) {
+        FirmataReply bytes;
+        for (size_t i = 0; i + 1 < data.size(); i += 2) {
+          bytes.push_back(data[i] | (data[i + 1] << 7));
+        }
+        uint16_t index = ((bytes[0] & 0x7F) << 8) | bytes[1];
+        answered = complete(replyKey(command, index), FirmataReply(bytes.begin() + 2, bytes.end()));
+      }
+      break;
+    default:
+      answered = complete(replyKey(command, 0), data);
+  }
+  if (!answered && sysexCallback) {
+    sysexCallback(command, data);
+  }
+}
+
+void FirmataClient::deliver(const FirmataReport &report)
+{
+  if (reportCallback) {
+    reportCallback(report);
+  } else if (!reports.push(report)) {
+    dropped++;
+  }
+}
+
+/*
+ * Complete the oldest pending query with key.
+ * @return false if no query was waiting for the reply.
+ */
+bool FirmataClient::complete(uint32_t key, const FirmataReply &reply)
+{
+  std::promise<FirmataReply> promise;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    std::list<pending_query>::iterator query = pending.begin();
+    while (query != pending.end() && query->key != key) {
+      ++query;
+    }
+    if (query == pending.end()) {
+      return false;
+    }
+    promise = std::move(query->promise);
+    pending.erase(query);
+  }
+  promise.set_value(reply);
+  return true;
+}
+
+/*
+ * Fail the queries that are past their deadline, or all of them.
+ */
+void FirmataClient::expire(bool all, const char *reason)
+{
+  std::list<pending_query> expired;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    clock::time_point now = clock::now();
+    std::list<pending_query>::iterator query = pending.begin();
+    while (query != pending.end()) {
+      std::list<pending_query>::iterator next = query;
+      ++next;
+      if (all || query->deadline <= now) {
+        expired.splice(expired.end(), pending, query);
+      }
+      query = next;
+    }
+  }
+  for (std::list<pending_query>::iterator query = expired.begin(); query != expired.end(); ++query) {
+    query->promise.set_exception(std::make_exception_ptr(std::runtime_error(reason)));
+  }
+}
+
+int FirmataClient::pollTimeout()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return pending.empty() ? -1 : CLIENT_POLL_INTERVAL;
+}
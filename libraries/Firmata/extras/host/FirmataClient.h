@@ -0,0 +1,194 @@
+/*
+  FirmataClient.h - asynchronous Firmata client for Linux hosts
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+
+  Talks to a board running StandardFirmata (or one of its variants) over a
+  serial port, a pseudo terminal or a TCP connection. A background thread
+  owns the connection: commands and queries are queued and written without
+  waiting for replies, so any number of queries can be in flight at once.
+
+  Firmata replies carry no request id, but a board answers in order, so a
+  reply completes the oldest pending query it can answer: the one with the
+  same reply command and the same pin (PIN_STATE_RESPONSE) or I2C address
+  and register (I2C_REPLY). Queries that get no reply fail after a timeout.
+  Once the connection is lost, queries fail right away and the client can
+  be opened again.
+
+  Analog and digital reports go to a lock-free queue drained with
+  readReport(), or to a callback on the I/O thread if one is set.
+*/
+
+#ifndef FirmataClient_h
+#define FirmataClient_h
+
+#include <FirmataConstants.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define FIRMATA_CLIENT_REPORT_QUEUE   1024 // reports, a power of 2
+#define FIRMATA_CLIENT_TIMEOUT        1000 // default reply timeout in ms
+#define FIRMATA_CLIENT_MAX_SYSEX      4096 // longer sysex messages are truncated
+#define FIRMATA_CLIENT_NO_REGISTER    -1   // i2cRead() without a register write
+
+struct FirmataReport {
+  uint8_t type;     // ANALOG_MESSAGE or DIGITAL_MESSAGE
+  uint8_t index;    // analog channel or digital port
+  uint16_t value;   // 14 bit analog value or the 8 pins of the port
+};
+
+/*
+ * The data of a reply, without the command byte. I2C replies are decoded to
+ * the bytes read, everything else is left as sent by the board.
+ */
+typedef std::vector<uint8_t> FirmataReply;
+
+/*
+ * A bounded queue for exactly one producer thread and one consumer thread.
+ */
+template <typename T, size_t SIZE>
+class FirmataQueue
+{
+  public:
+    FirmataQueue() : head(0), tail(0) {}
+
+    bool push(const T &item)
+    {
+      size_t h = head.load(std::memory_order_relaxed);
+      if (h - tail.load(std::memory_order_acquire) == SIZE) {
+        return false;
+      }
+      items[h & (SIZE - 1)] = item;
+      head.store(h + 1, std::memory_order_release);
+      return true;
+    }
+
+    bool pop(T &item)
+    {
+      size_t t = tail.load(std::memory_order_relaxed);
+      if (t == head.load(std::memory_order_acquire)) {
+        return false;
+      }
+      item = items[t & (SIZE - 1)];
+      tail.store(t + 1, std::memory_order_release);
+      return true;
+    }
+
+  private:
+    T items[SIZE];
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+};
+
+class FirmataClient
+{
+  public:
+    typedef std::function<void(const FirmataReport &report)> reportCallbackFunction;
+    typedef std::function<void(uint8_t command, const FirmataReply &data)> sysexCallbackFunction;
+    typedef std::function<void(const std::string &text)> stringCallbackFunction;
+
+    FirmataClient();
+    ~FirmataClient();
+
+    /* connection */
+    bool openSerial(const char *path, long baud = 57600);
+    bool openTcp(const char *host, uint16_t port);
+    bool open(int fd);
+    void close();
+    bool isConnected() const;
+    void setTimeout(unsigned int ms);
+
+    /* reports and unsolicited messages, callbacks are called on the I/O
+     * thread and must be set before the connection is opened */
+    void onReport(reportCallbackFunction callback);
+    void onSysex(sysexCallbackFunction callback);
+    void onString(stringCallbackFunction callback);
+    bool readReport(FirmataReport &report);
+    unsigned long droppedReports() const;
+
+    /* commands, queued without waiting */
+    void setPinMode(uint8_t pin, uint8_t mode);
+    void digitalWrite(uint8_t pin, bool value);
+    void analogWrite(uint8_t pin, uint32_t value);
+    void reportAnalog(uint8_t channel, bool enable);
+    void reportDigital(uint8_t port, bool enable);
+    void setSamplingInterval(unsigned int ms);
+    void i2cConfig(unsigned int delayMicros = 0);
+    void i2cWrite(uint8_t address, const uint8_t *data, size_t length);
+    void sendSysex(uint8_t command, const uint8_t *data, size_t length);
+    void systemReset();
+
+    /* queries, the future is completed by the matching reply or fails with
+     * a std::runtime_error after the timeout or when the connection closes */
+    std::future<FirmataReply> queryVersion();
+    std::future<FirmataReply> queryFirmware();
+    std::future<FirmataReply> queryCapabilities();
+    std::future<FirmataReply> queryAnalogMapping();
+    std::future<FirmataReply> queryPinState(uint8_t pin);
+    std::future<FirmataReply> i2cRead(uint8_t address, int reg, uint8_t count);
+    std::future<FirmataReply> request(uint8_t command, const uint8_t *data, size_t length,
+                                      uint8_t replyCommand);
+
+  private:
+    typedef std::chrono::steady_clock clock;
+
+    struct pending_query {
+      uint32_t key;                   // reply command and pin or I2C address and register
+      clock::time_point deadline;
+      std::promise<FirmataReply> promise;
+    };
+
+    int fd;
+    int wakeFds[2];                   // written to wake the I/O thread up
+    std::thread thread;
+    std::atomic<bool> running;
+    std::atomic<bool> connected;
+    unsigned int timeout;
+
+    std::mutex lock;                  // guards txBuffer and pending
+    std::vector<uint8_t> txBuffer;
+    std::list<pending_query> pending;
+
+    FirmataQueue<FirmataReport, FIRMATA_CLIENT_REPORT_QUEUE> reports;
+    std::atomic<unsigned long> dropped;
+    reportCallbackFunction reportCallback;
+    sysexCallbackFunction sysexCallback;
+    stringCallbackFunction stringCallback;
+
+    /* parser state, only used by the I/O thread */
+    bool parsingSysex;
+    std::vector<uint8_t> sysex;
+    uint8_t messageCommand;
+    uint8_t messageData[2];
+    uint8_t messageCount;
+
+    void send(const std::vector<uint8_t> &message);
+    std::future<FirmataReply> query(uint32_t key, const std::vector<uint8_t> &message);
+    void run();
+    bool flush();
+    void parse(uint8_t c);
+    void dispatchMessage();
+    void dispatchSysex();
+    void deliver(const FirmataReport &report);
+    bool complete(uint32_t key, const FirmataReply &reply);
+    void expire(bool all, const char *reason);
+    int pollTimeout();
+    void wake();
+};
+
+#endif /* FirmataClient_h */
@@ -10,6 +10,7 @@ cp -r utility temp/Firmata
 cp Boards.h temp/Firmata
 cp Firmata.cpp temp/Firmata
 cp Firmata.h temp/Firmata
+cp FirmataConstants.h temp/Firmata
 cp keywords.txt temp/Firmata
 cp readme.md temp/Firmata
 cd temp
@@ -26,6 +27,7 @@ mkdir src
 mv Boards.h ./src/
 mv Firmata.cpp ./src/
 mv Firmata.h ./src/
+mv FirmataConstants.h ./src/
 mv utility ./src/
 cd ..
 find . -name "*.DS_Store" -type f -delete
@@ -6,7 +6,11 @@
  */
 
 #include <ArduinoUnit.h>
+
+#define FIRMATA_MAX_FEATURES 2
 #include <Firmata.h>
+#include <utility/FirmataFeature.h>
+#include <utility/SchedulerFirmata.h>
 
 void setup()
 {
@@ -134,3 +138,238 @@ test(setFirmwareVersionDoesNotLeakMemory)
 
   assertEqual(0, initialMemory - freeMemory());
 }
+
+test(sendPackedBytesPacksSevenBytesIntoEight)
+{
+  FakeStream stream;
+  Firmata.begin(stream);
+  stream.reset();
+
+  byte data[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+  Firmata.sendPackedBytes(7, data);
+
+  char expected[] = { 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0 };
+  assertEqual(expected, stream.bytesWritten());
+}
+
+test(decodePackedBytesReversesSendPackedBytes)
+{
+  byte packed[] = { 0x01, 0x00, 0x7E, 0x07 };  // 0x01, 0x80, 0xFF
+
+  byte count = Firmata.decodePackedBytes(sizeof(packed), packed);
+
+  assertEqual(3, count);
+  assertEqual(0x01, packed[0]);
+  assertEqual(0x80, packed[1]);
+  assertEqual(0xFF, packed[2]);
+}
+
+test(outputHashDoesNotWriteToStream)
+{
+  FakeStream stream;
+  Firmata.begin(stream);
+  stream.reset();
+
+  Firmata.startOutputHash();
+  Firmata.write(CAPABILITY_RESPONSE);
+  Firmata.write(127);
+  unsigned long hash = Firmata.endOutputHash();
+
+  char expected[] = { 0 };
+  assertEqual(expected, stream.bytesWritten());
+  assertTrue(hash != 2166136261UL);
+}
+
+test(outputHashIsRepeatable)
+{
+  Firmata.startOutputHash();
+  Firmata.write(CAPABILITY_RESPONSE);
+  unsigned long first = Firmata.endOutputHash();
+
+  Firmata.startOutputHash();
+  Firmata.write(CAPABILITY_RESPONSE);
+
+  assertEqual(first, Firmata.endOutputHash());
+}
+
+class CountingFeature: public FirmataFeature
+{
+  public:
+    byte sysexCount;
+    byte lastArgc;
+    byte pinModeCount;
+    int lastMode;
+    void handleCapability(byte pin) {}
+    boolean handlePinMode(byte pin, int mode)
+    {
+      pinModeCount++;
+      lastMode = mode;
+      return mode == 0x0C;
+    }
+    boolean handleSysex(byte command, byte argc, byte *argv)
+    {
+      sysexCount++;
+      lastArgc = argc;
+      return true;
+    }
+    void reset() {}
+    boolean readAnalog(byte channel, int &value)
+    {
+      if (channel != 5) return false;
+      value = 321;
+      return true;
+    }
+};
+
+CountingFeature _feature;
+boolean _featureAdded;
+void setupFeature()
+{
+  // features are registered once, like in setup() of a sketch
+  if (!_featureAdded) {
+    _featureAdded = Firmata.addFeature(&_feature, 0x0E, 0x0C);
+  }
+  _feature.sysexCount = 0;
+  _feature.pinModeCount = 0;
+}
+
+test(featureReceivesClaimedSysex)
+{
+  setupFeature();
+  byte message[] = { START_SYSEX, 0x0E, 1, 2, END_SYSEX };
+  processMessage(message, 5);
+
+  assertTrue(_featureAdded);
+  assertEqual(1, _feature.sysexCount);
+  assertEqual(2, _feature.lastArgc);
+}
+
+test(featureReceivesClaimedPinMode)
+{
+  setupFeature();
+
+  assertTrue(Firmata.handleFeaturePinMode(2, 0x0C));
+  assertFalse(Firmata.handleFeaturePinMode(2, 0x0D));
+  assertEqual(1, _feature.pinModeCount);
+}
+
+test(featureIsToldWhenItsPinChangesMode)
+{
+  setupFeature();
+  Firmata.handleFeaturePinMode(3, 0x0C);
+
+  Firmata.setPinMode(3, OUTPUT);
+  assertEqual(2, _feature.pinModeCount);
+  assertEqual(OUTPUT, _feature.lastMode);
+
+  // the feature let go of the pin
+  Firmata.setPinMode(3, INPUT);
+  assertEqual(2, _feature.pinModeCount);
+}
+
+test(featureAnswersAnalogRead)
+{
+  setupFeature();
+
+  assertEqual(321, Firmata.readAnalog(5));
+}
+
+test(claimedSysexCannotBeAddedTwice)
+{
+  setupFeature();
+  CountingFeature other;
+
+  assertFalse(Firmata.addFeature(&other, 0x0E));
+  assertFalse(Firmata.addFeature(&other, FIRMATA_NO_SYSEX, 0x0C));
+}
+
+test(sysexTooLongForTheBufferIsDropped)
+{
+  setupFeature();
+  byte message[MAX_DATA_BYTES + 3] = { START_SYSEX, 0x0E };
+  message[sizeof(message) - 1] = END_SYSEX;
+  processMessage(message, sizeof(message));
+  assertEqual(0, _feature.sysexCount);
+
+  // the longest message that fits still arrives
+  message[sizeof(message) - 2] = END_SYSEX;
+  processMessage(message, sizeof(message) - 1);
+  assertEqual(1, _feature.sysexCount);
+  assertEqual(MAX_DATA_BYTES - 1, _feature.lastArgc);
+}
+
+SchedulerFirmata _scheduler;
+
+// Upload data as task id and schedule it to run at once.
+void scheduleTask(byte id, const byte *data, byte len)
+{
+  byte create[] = { CREATE_FIRMATA_TASK, id, len, 0 };
+  _scheduler.handleSysex(SCHEDULER_DATA, sizeof(create), create);
+
+  // packed 7 bytes into 8, least significant bit first
+  byte add[2 + (MAX_DATA_BYTES * 8 + 6) / 7] = { ADD_TO_FIRMATA_TASK, id };
+  byte argc = 2;
+  unsigned int bits = 0;
+  byte bitCount = 0;
+  for (byte i = 0; i < len; i++) {
+    bits |= (unsigned int)data[i] << bitCount;
+    bitCount += 8;
+    while (bitCount >= 7) {
+      add[argc++] = bits & 0x7F;
+      bits >>= 7;
+      bitCount -= 7;
+    }
+  }
+  if (bitCount > 0) {
+    add[argc++] = bits & 0x7F;
+  }
+  _scheduler.handleSysex(SCHEDULER_DATA, argc, add);
+
+  byte schedule[] = { SCHEDULE_FIRMATA_TASK, id, 0 };
+  _scheduler.handleSysex(SCHEDULER_DATA, sizeof(schedule), schedule);
+}
+
+test(scheduledTaskRuns)
+{
+  FakeStream stream;
+  Firmata.begin(stream);
+  setupDigitalPort();
+  Firmata.attach(DIGITAL_MESSAGE, writeToDigitalPort);
+  _scheduler.reset();
+
+  byte task[] = { DIGITAL_MESSAGE | 1, 5, 0 };
+  scheduleTask(1, task, sizeof(task));
+  _scheduler.update();
+
+  assertEqual(1, _digitalPort);
+  assertEqual(5, _digitalPortValue);
+}
+
+test(truncatedTaskIsRefusedAndHostMessagesStillArrive)
+{
+  FakeStream stream;
+  Firmata.begin(stream);
+  setupDigitalPort();
+  Firmata.attach(DIGITAL_MESSAGE, writeToDigitalPort);
+  _scheduler.reset();
+
+  // a command missing a data byte, and a sysex message without its end
+  byte command[] = { DIGITAL_MESSAGE | 1, 5 };
+  byte sysex[] = { START_SYSEX, SCHEDULER_DATA, QUERY_ALL_FIRMATA_TASKS };
+  stream.reset();
+  scheduleTask(1, command, sizeof(command));
+  assertEqual(ERROR_TASK_REPLY, stream.bytesWritten()[2]);
+  stream.reset();
+  scheduleTask(2, sysex, sizeof(sysex));
+  assertEqual(ERROR_TASK_REPLY, stream.bytesWritten()[2]);
+  _scheduler.update();
+  assertFalse(Firmata.isParsingMessage());
+
+  byte message[] = { DIGITAL_MESSAGE | 2, 0x7F, 0x01 };
+  for (size_t i = 0; i < sizeof(message); i++) {
+    stream.nextByte(message[i]);
+    Firmata.processInput();
+  }
+  assertEqual(2, _digitalPort);
+  assertEqual(255, _digitalPortValue);
+}
@@ -0,0 +1,42 @@
+/*
+  StandardFirmata.cpp - builds the StandardFirmata sketch for the host
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include <Arduino.h>
+
+// the prototypes the Arduino IDE generates for the sketch
+void wireWrite(byte data);
+byte wireRead(void);
+void attachServo(byte pin, int minPulse, int maxPulse);
+void detachServo(byte pin);
+void readAndReportData(byte address, int theRegister, byte numBytes, byte stopTX);
+void reportAnalogInput(byte analogPin);
+boolean sendDueReport(byte item);
+void setReportInterval(byte type, byte index, unsigned int interval);
+void outputPort(byte portNumber, byte portValue, byte forceSend);
+boolean isPortPolled(byte port);
+void checkDigitalInputs(void);
+void setPinModeCallback(byte pin, int mode);
+void setPinValueCallback(byte pin, int value);
+void analogWriteCallback(byte pin, int value);
+void digitalWriteCallback(byte port, int value);
+void reportAnalogCallback(byte analogPin, int value);
+void reportDigitalCallback(byte port, int value);
+void sendCapabilities(void);
+unsigned long capabilityHash(void);
+void sysexCallback(byte command, byte argc, byte *argv);
+void enableI2CPins();
+void disableI2CPins();
+void systemResetCallback();
+void setup();
+void loop();
+
+#include "../../examples/StandardFirmata/StandardFirmata.ino"
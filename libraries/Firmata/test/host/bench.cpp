@@ -0,0 +1,144 @@
+/*
+  bench.cpp - Firmata host benchmarks
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+
+  Replays recorded host sessions through StandardFirmata and reports:
+  - parse throughput: the session fed to Firmata.parse() in a tight loop,
+    including the sketch callbacks it triggers
+  - bytes emitted per report cycle: the session is sent to the sketch over
+    Serial, then the virtual clock is advanced one sampling interval per
+    loop() call and the output of each call is counted
+  - worst case loop latency: the longest loop() call (host CPU time) seen
+    while replaying and reporting
+
+  A session file holds hex bytes as sent by the host, '#' starts a comment.
+*/
+
+#include <Firmata.h>
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+
+#define BENCH_MIN_BYTES         2000000UL // parsed per session for the throughput figure
+#define BENCH_REPORT_CYCLES     1000
+
+extern unsigned int samplingInterval;
+void setup();
+void loop();
+void systemResetCallback();
+
+typedef std::chrono::steady_clock benchClock;
+
+static double elapsedMicros(benchClock::time_point start)
+{
+  return std::chrono::duration<double, std::micro>(benchClock::now() - start).count();
+}
+
+static bool loadSession(const char *path, std::vector<byte> &session)
+{
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    return false;
+  }
+  char line[512];
+  while (fgets(line, sizeof(line), file)) {
+    char *p = line;
+    while (*p && *p != '#') {
+      char *end;
+      unsigned long value = strtoul(p, &end, 16);
+      if (end == p) {
+        p++;
+        continue;
+      }
+      session.push_back((byte)value);
+      p = end;
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+/*
+ * Run loop() once and keep track of its worst case duration.
+ */
+static void timedLoop(double &worstMicros)
+{
+  benchClock::time_point start = benchClock::now();
+  loop();
+  double duration = elapsedMicros(start);
+  if (duration > worstMicros) {
+    worstMicros = duration;
+  }
+}
+
+static void benchSession(const char *path, const std::vector<byte> &session)
+{
+  // parse throughput
+  systemResetCallback();
+  unsigned long parsed = 0;
+  benchClock::time_point start = benchClock::now();
+  while (parsed < BENCH_MIN_BYTES) {
+    for (size_t i = 0; i < session.size(); i++) {
+      Firmata.parse(session[i]);
+    }
+    parsed += session.size();
+  }
+  double parseMicros = elapsedMicros(start);
+
+  // replay the session over Serial, in chunks the size of a UART buffer
+  systemResetCallback();
+  double worstMicros = 0;
+  for (size_t i = 0; i < session.size(); i += 64) {
+    size_t count = session.size() - i < 64 ? session.size() - i : 64;
+    Serial.mockInput(&session[i], count);
+    timedLoop(worstMicros);
+  }
+  timedLoop(worstMicros);
+
+  // report cycles
+  unsigned long total = 0;
+  unsigned long most = 0;
+  for (int cycle = 0; cycle < BENCH_REPORT_CYCLES; cycle++) {
+    for (byte pin = 0; pin < TOTAL_ANALOG_PINS; pin++) {
+      mockSetAnalog(pin, (cycle * 37 + pin * 101) & 0x3FF);
+    }
+    mockAdvanceMicros((samplingInterval + 1) * 1000UL);
+    unsigned long before = Serial.bytesWritten;
+    timedLoop(worstMicros);
+    unsigned long emitted = Serial.bytesWritten - before;
+    total += emitted;
+    if (emitted > most) {
+      most = emitted;
+    }
+  }
+
+  printf("%-32s %6u bytes  parse %8.2f MB/s  report %6.1f bytes/cycle (max %lu)  worst loop %7.1f us\n",
+         path, (unsigned)session.size(), parsed / parseMicros,
+         (double)total / BENCH_REPORT_CYCLES, most, worstMicros);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s session.txt...\n", argv[0]);
+    return 2;
+  }
+
+  setup();
+  for (int i = 1; i < argc; i++) {
+    std::vector<byte> session;
+    if (!loadSession(argv[i], session) || session.empty()) {
+      fprintf(stderr, "%s: cannot read session\n", argv[i]);
+      return 1;
+    }
+    benchSession(argv[i], session);
+  }
+  return 0;
+}
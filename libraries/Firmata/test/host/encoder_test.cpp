@@ -0,0 +1,90 @@
+/*
+  encoder_test.cpp - EncoderFirmata taking pins from the digital inputs
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include <ArduinoUnit.h>
+#define FIRMATA_MAX_FEATURES 2
+#include <Firmata.h>
+#include <PinChangeFirmata.h>
+#include <EncoderFirmata.h>
+
+PinChangeFirmata pinChange;
+EncoderFirmata encoder;
+FakeStream stream;
+
+// the digital input handling of StandardFirmataPlus
+byte reportPINs[TOTAL_PORTS];
+byte portConfigInputs[TOTAL_PORTS];
+
+void setPinModeCallback(byte pin, int mode)
+{
+  if (mode == INPUT || mode == PIN_MODE_PULLUP) {
+    portConfigInputs[pin / 8] |= (1 << (pin & 7));
+  } else {
+    portConfigInputs[pin / 8] &= ~(1 << (pin & 7));
+  }
+  pinChange.setPortMask(pin / 8, reportPINs[pin / 8] ? portConfigInputs[pin / 8] : 0);
+  switch (mode) {
+    case INPUT:
+      pinMode(PIN_TO_DIGITAL(pin), INPUT);
+      Firmata.setPinMode(pin, INPUT);
+      break;
+    default:
+      Firmata.handleFeaturePinMode(pin, mode);
+  }
+}
+
+void reportDigitalCallback(byte port, int value)
+{
+  reportPINs[port] = (byte)value;
+  pinChange.setPortMask(port, value ? portConfigInputs[port] : 0);
+}
+
+void sendSysex(FirmataFeature *feature, byte command, const byte *argv, byte argc)
+{
+  feature->handleSysex(command, argc, (byte *)argv);
+}
+
+test(encoderTakesReportedInputPins)
+{
+  const byte setInput[] = { SET_PIN_MODE, 2, INPUT, REPORT_DIGITAL | 0, 1 };
+  for (byte i = 0; i < sizeof(setInput); i++) {
+    Firmata.parse(setInput[i]);
+  }
+  const byte interrupts[] = { PIN_CHANGE_CONFIG, PIN_CHANGE_MODE_COALESCE };
+  sendSysex(&pinChange, PIN_CHANGE_DATA, interrupts, sizeof(interrupts));
+  assertTrue(pinChange.isMonitoring(0));
+  mockInterruptHandler pinChangeHandler = mockGetInterrupt(0);
+  assertTrue(pinChangeHandler != NULL);
+
+  const byte attach[] = { ENCODER_ATTACH, 0, 2, 3 };
+  sendSysex(&encoder, ENCODER_DATA, attach, sizeof(attach));
+  assertEqual(PIN_MODE_ENCODER, Firmata.getPinMode(2));
+  assertEqual(PIN_MODE_ENCODER, Firmata.getPinMode(3));
+  // the pin is no longer an input: not polled, not watched for changes
+  assertEqual(0, portConfigInputs[0]);
+  assertFalse(pinChange.isMonitoring(0));
+  // both pins run the encoder handler
+  assertTrue(mockGetInterrupt(0) != NULL);
+  assertTrue(mockGetInterrupt(0) != pinChangeHandler);
+  assertTrue(mockGetInterrupt(0) == mockGetInterrupt(1));
+}
+
+int main()
+{
+  Firmata.addFeature(&pinChange, PIN_CHANGE_DATA);
+  Firmata.addFeature(&encoder, ENCODER_DATA, PIN_MODE_ENCODER);
+  Firmata.attach(SET_PIN_MODE, setPinModeCallback);
+  Firmata.attach(REPORT_DIGITAL, reportDigitalCallback);
+  Firmata.begin(stream);
+  Test::run();
+  return Test::failed > 0 ? 1 : 0;
+}
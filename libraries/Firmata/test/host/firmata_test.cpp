@@ -0,0 +1,20 @@
+/*
+  firmata_test.cpp - runs test/firmata_test natively
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "../firmata_test/firmata_test.ino"
+
+int main()
+{
+  setup();
+  Test::run();
+  return Test::failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,291 @@
+/*
+  framed_test.cpp - FramedStream over an in-memory link, with the test
+  standing in for the host and corrupting frames on the way
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include <ArduinoUnit.h>
+#include <Firmata.h>
+#include <FramedStream.h>
+#include <deque>
+#include <vector>
+
+/*
+ * Both directions of a serial link, seen from the board.
+ */
+class LinkStream : public Stream
+{
+  public:
+    std::deque<uint8_t> toBoard;
+    std::deque<uint8_t> toHost;
+
+    int available() { return (int)toBoard.size(); }
+    int read()
+    {
+      if (toBoard.empty()) return -1;
+      int c = toBoard.front();
+      toBoard.pop_front();
+      return c;
+    }
+    int peek() { return toBoard.empty() ? -1 : toBoard.front(); }
+    size_t write(uint8_t c) { toHost.push_back(c); return 1; }
+    using Print::write;
+};
+
+struct HostFrame {
+  uint8_t type;
+  uint8_t sequence;
+  std::vector<uint8_t> payload;
+};
+
+LinkStream link;
+FramedStream stream(link);
+std::string strings;
+
+/*
+ * Build a COMMAND frame as it goes over the wire, optionally with one byte
+ * of the escaped frame flipped on the way.
+ */
+std::vector<uint8_t> hostFrame(uint8_t sequence, const std::vector<uint8_t> &payload, int corrupt = -1)
+{
+  std::vector<uint8_t> frame;
+  frame.push_back(FRAMEDSTREAM_COMMAND);
+  frame.push_back(sequence);
+  frame.push_back((uint8_t)payload.size());
+  frame.insert(frame.end(), payload.begin(), payload.end());
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < frame.size(); i++) {
+    crc = FramedStream::crc16(crc, frame[i]);
+  }
+  frame.push_back(crc & 0xFF);
+  frame.push_back(crc >> 8);
+
+  std::vector<uint8_t> wire;
+  wire.push_back(FRAMEDSTREAM_FLAG);
+  for (size_t i = 0; i < frame.size(); i++) {
+    if (frame[i] == FRAMEDSTREAM_FLAG || frame[i] == FRAMEDSTREAM_ESCAPE) {
+      wire.push_back(FRAMEDSTREAM_ESCAPE);
+      wire.push_back(frame[i] ^ 0x20);
+    } else {
+      wire.push_back(frame[i]);
+    }
+  }
+  wire.push_back(FRAMEDSTREAM_FLAG);
+  if (corrupt >= 0) {
+    wire[1 + corrupt] ^= 0x04;
+  }
+  return wire;
+}
+
+void hostSend(uint8_t sequence, const std::vector<uint8_t> &payload, int corrupt = -1)
+{
+  std::vector<uint8_t> wire = hostFrame(sequence, payload, corrupt);
+  link.toBoard.insert(link.toBoard.end(), wire.begin(), wire.end());
+}
+
+std::vector<uint8_t> stringMessage(const char *text)
+{
+  std::vector<uint8_t> message;
+  message.push_back(START_SYSEX);
+  message.push_back(STRING_DATA);
+  for (; *text; text++) {
+    message.push_back(*text);
+    message.push_back(0);
+  }
+  message.push_back(END_SYSEX);
+  return message;
+}
+
+size_t flags(const std::vector<uint8_t> &wire)
+{
+  size_t count = 0;
+  for (size_t i = 0; i < wire.size(); i++) {
+    count += wire[i] == FRAMEDSTREAM_FLAG;
+  }
+  return count;
+}
+
+/*
+ * Decode the frames the board sent, frames with a bad CRC are dropped.
+ */
+std::vector<HostFrame> hostReceive()
+{
+  std::vector<HostFrame> frames;
+  std::vector<uint8_t> frame;
+  bool escaped = false;
+  while (!link.toHost.empty()) {
+    uint8_t c = link.toHost.front();
+    link.toHost.pop_front();
+    if (c == FRAMEDSTREAM_FLAG) {
+      if (frame.size() >= FRAMEDSTREAM_HEADER_SIZE + FRAMEDSTREAM_CRC_SIZE) {
+        uint16_t crc = 0xFFFF;
+        for (size_t i = 0; i < frame.size() - 2; i++) {
+          crc = FramedStream::crc16(crc, frame[i]);
+        }
+        if (frame[frame.size() - 2] == (crc & 0xFF) && frame[frame.size() - 1] == (crc >> 8)
+            && frame[2] == frame.size() - 5) {
+          HostFrame received;
+          received.type = frame[0];
+          received.sequence = frame[1];
+          received.payload.assign(frame.begin() + 3, frame.end() - 2);
+          frames.push_back(received);
+        }
+      }
+      frame.clear();
+    } else if (c == FRAMEDSTREAM_ESCAPE) {
+      escaped = true;
+    } else {
+      frame.push_back(escaped ? c ^ 0x20 : c);
+      escaped = false;
+    }
+  }
+  return frames;
+}
+
+/*
+ * One pass of a sketch loop(): process input, then send buffered output.
+ */
+void boardLoop()
+{
+  while (Firmata.available()) {
+    Firmata.processInput();
+  }
+  stream.maintain();
+}
+
+void stringCallback(char *text)
+{
+  strings += text;
+}
+
+test(flagAndEscapeAreEscapedInPayloadAndCrc)
+{
+  strings.clear();
+  // "~}q" as frame 0 has 0x7E as the low byte of its CRC
+  std::vector<uint8_t> wire = hostFrame(0, stringMessage("~}q"));
+  assertEqual(2, flags(wire));
+  assertEqual(FRAMEDSTREAM_ESCAPE, wire[wire.size() - 4]);
+  link.toBoard.insert(link.toBoard.end(), wire.begin(), wire.end());
+  boardLoop();
+
+  std::vector<HostFrame> frames = hostReceive();
+  assertEqual(1, frames.size());
+  assertEqual(FRAMEDSTREAM_ACK, frames[0].type);
+  assertEqual(0, frames[0].sequence);
+  assertTrue(strings == "~}q");
+
+  // and the same on the way to the host
+  Firmata.sendString("~}");
+  stream.flush();
+  std::vector<uint8_t> sent(link.toHost.begin(), link.toHost.end());
+  assertEqual(2, flags(sent));
+  frames = hostReceive();
+  assertEqual(1, frames.size());
+  assertTrue(frames[0].payload == stringMessage("~}"));
+}
+
+test(corruptedFrameIsDroppedAndRetransmissionAccepted)
+{
+  strings.clear();
+  uint16_t bad = stream.badFrames();
+  hostSend(1, stringMessage("a"), 5);
+  boardLoop();
+
+  assertEqual(0, hostReceive().size());
+  assertEqual(bad + 1, stream.badFrames());
+  assertTrue(strings.empty());
+
+  hostSend(1, stringMessage("a"));
+  boardLoop();
+  std::vector<HostFrame> frames = hostReceive();
+  assertEqual(1, frames.size());
+  assertEqual(FRAMEDSTREAM_ACK, frames[0].type);
+  assertEqual(1, frames[0].sequence);
+  assertTrue(strings == "a");
+}
+
+test(framesAfterAGapWaitForTheMissingOne)
+{
+  strings.clear();
+  // frame 2 is lost on the way
+  hostSend(3, stringMessage("c"));
+  hostSend(4, stringMessage("d"));
+  boardLoop();
+
+  std::vector<HostFrame> frames = hostReceive();
+  assertEqual(3, frames.size());
+  assertEqual(FRAMEDSTREAM_ACK, frames[0].type);
+  assertEqual(3, frames[0].sequence);
+  assertEqual(FRAMEDSTREAM_NAK, frames[1].type);
+  assertEqual(2, frames[1].sequence);
+  assertEqual(FRAMEDSTREAM_ACK, frames[2].type);
+  assertEqual(4, frames[2].sequence);
+  assertTrue(strings.empty());
+
+  // only the missing frame is sent again
+  hostSend(2, stringMessage("b"));
+  boardLoop();
+  frames = hostReceive();
+  assertEqual(1, frames.size());
+  assertEqual(2, frames[0].sequence);
+  assertTrue(strings == "bcd");
+}
+
+test(frameSplitAcrossReadsIsReassembled)
+{
+  strings.clear();
+  std::vector<uint8_t> wire = hostFrame(5, stringMessage("}"));
+  // cut right after the escape byte
+  size_t cut = 0;
+  while (wire[cut] != FRAMEDSTREAM_ESCAPE) {
+    cut++;
+  }
+  cut++;
+  link.toBoard.insert(link.toBoard.end(), wire.begin(), wire.begin() + cut);
+  boardLoop();
+  assertEqual(0, hostReceive().size());
+
+  link.toBoard.insert(link.toBoard.end(), wire.begin() + cut, wire.end());
+  boardLoop();
+  std::vector<HostFrame> frames = hostReceive();
+  assertEqual(1, frames.size());
+  assertEqual(5, frames[0].sequence);
+  assertTrue(strings == "}");
+}
+
+test(overLengthFrameIsDroppedAndTheNextOneAccepted)
+{
+  strings.clear();
+  uint16_t bad = stream.badFrames();
+  link.toBoard.push_back(FRAMEDSTREAM_FLAG);
+  for (int i = 0; i < FRAMEDSTREAM_HEADER_SIZE + FRAMEDSTREAM_MAX_PAYLOAD + FRAMEDSTREAM_CRC_SIZE + 10; i++) {
+    link.toBoard.push_back(FRAMEDSTREAM_COMMAND);
+  }
+  hostSend(6, stringMessage("f"));
+  boardLoop();
+
+  std::vector<HostFrame> frames = hostReceive();
+  assertEqual(1, frames.size());
+  assertEqual(FRAMEDSTREAM_ACK, frames[0].type);
+  assertEqual(6, frames[0].sequence);
+  assertEqual(bad + 1, stream.badFrames());
+  assertTrue(strings == "f");
+}
+
+int main()
+{
+  Firmata.attach(STRING_DATA, stringCallback);
+  Firmata.begin(stream);
+  // drop the version and firmware report sent on begin()
+  stream.flush();
+  hostReceive();
+  Test::run();
+  return Test::failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,223 @@
+/*
+  Arduino.cpp - minimal Arduino core for the Firmata host build
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "Arduino.h"
+#include "Wire.h"
+#include <errno.h>
+#include <unistd.h>
+
+HardwareSerial Serial;
+HardwareSerial Serial1;
+TwoWire Wire;
+
+static unsigned long long clockMicros = 0;
+static int digitalLevels[MOCK_TOTAL_PINS];
+static int analogLevels[MOCK_TOTAL_PINS];
+static void (*interruptHandlers[MOCK_INTERRUPTS])(void);
+
+//******************************************************************************
+//* Virtual clock
+//******************************************************************************
+
+unsigned long millis(void)
+{
+  return (unsigned long)(clockMicros / 1000);
+}
+
+unsigned long micros(void)
+{
+  return (unsigned long)clockMicros;
+}
+
+void delay(unsigned long ms)
+{
+  clockMicros += (unsigned long long)ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  clockMicros += us;
+}
+
+void mockAdvanceMicros(unsigned long us)
+{
+  clockMicros += us;
+}
+
+//******************************************************************************
+//* Pins
+//******************************************************************************
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  if (pin < MOCK_TOTAL_PINS && mode == INPUT_PULLUP) {
+    digitalLevels[pin] = HIGH;
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  if (pin < MOCK_TOTAL_PINS) {
+    digitalLevels[pin] = value ? HIGH : LOW;
+  }
+}
+
+int digitalRead(uint8_t pin)
+{
+  return pin < MOCK_TOTAL_PINS ? digitalLevels[pin] : LOW;
+}
+
+int analogRead(uint8_t pin)
+{
+  return pin < MOCK_TOTAL_PINS ? analogLevels[pin] : 0;
+}
+
+void analogWrite(uint8_t pin, int value)
+{
+  digitalWrite(pin, value > 0 ? HIGH : LOW);
+}
+
+void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t value)
+{
+  for (uint8_t i = 0; i < 8; i++) {
+    digitalWrite(dataPin, bitOrder == LSBFIRST ? (value >> i) & 1 : (value >> (7 - i)) & 1);
+    digitalWrite(clockPin, HIGH);
+    digitalWrite(clockPin, LOW);
+  }
+}
+
+void attachInterrupt(uint8_t interrupt, void (*handler)(void), int mode)
+{
+  if (interrupt < MOCK_INTERRUPTS) {
+    interruptHandlers[interrupt] = handler;
+  }
+}
+
+void detachInterrupt(uint8_t interrupt)
+{
+  if (interrupt < MOCK_INTERRUPTS) {
+    interruptHandlers[interrupt] = NULL;
+  }
+}
+
+void mockSetAnalog(uint8_t pin, int value)
+{
+  if (pin < MOCK_TOTAL_PINS) {
+    analogLevels[pin] = value;
+  }
+}
+
+void mockSetDigital(uint8_t pin, int value)
+{
+  digitalWrite(pin, value);
+}
+
+int mockGetDigital(uint8_t pin)
+{
+  return digitalRead(pin);
+}
+
+mockInterruptHandler mockGetInterrupt(uint8_t interrupt)
+{
+  return interrupt < MOCK_INTERRUPTS ? interruptHandlers[interrupt] : NULL;
+}
+
+//******************************************************************************
+//* Serial
+//******************************************************************************
+
+HardwareSerial::HardwareSerial()
+{
+  bytesWritten = 0;
+  fd = -1;
+  head = tail = 0;
+  capture = NULL;
+  captureSize = captured = 0;
+}
+
+void HardwareSerial::begin(long baud)
+{
+}
+
+void HardwareSerial::end()
+{
+}
+
+int HardwareSerial::available()
+{
+  if (fd >= 0 && head - tail < sizeof(input)) {
+    // fill the receive buffer up to the wrap around point
+    size_t space = sizeof(input) - (head - tail);
+    size_t contiguous = sizeof(input) - head % sizeof(input);
+    ssize_t count = ::read(fd, input + head % sizeof(input), space < contiguous ? space : contiguous);
+    if (count > 0) {
+      head += count;
+    }
+  }
+  return (int)(head - tail);
+}
+
+int HardwareSerial::read()
+{
+  if (tail == head) {
+    return -1;
+  }
+  int c = input[tail++ % sizeof(input)];
+  return c;
+}
+
+int HardwareSerial::peek()
+{
+  return tail == head ? -1 : input[tail % sizeof(input)];
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  bytesWritten++;
+  if (capture && captured < captureSize) {
+    capture[captured++] = c;
+  }
+  // like a UART with a full transmit buffer, wait until the host reads
+  while (fd >= 0 && ::write(fd, &c, 1) < 0 && errno == EAGAIN) {
+    usleep(100);
+  }
+  return 1;
+}
+
+/*
+ * Queue bytes for the board to read. Bytes that do not fit the receive buffer
+ * are dropped, like on a real UART.
+ */
+void HardwareSerial::mockInput(const uint8_t *data, size_t size)
+{
+  for (size_t i = 0; i < size && head - tail < sizeof(input); i++) {
+    input[head++ % sizeof(input)] = data[i];
+  }
+}
+
+/*
+ * Read from and write to a non-blocking file descriptor, -1 detaches.
+ */
+void HardwareSerial::mockAttach(int descriptor)
+{
+  fd = descriptor;
+}
+
+/*
+ * Copy the following output into buffer (up to size bytes), NULL stops.
+ */
+void HardwareSerial::mockCapture(uint8_t *buffer, size_t size)
+{
+  capture = buffer;
+  captureSize = size;
+  captured = 0;
+}
@@ -0,0 +1,159 @@
+/*
+  Arduino.h - minimal Arduino core for the Firmata host build
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+
+  Only what the Firmata library and the StandardFirmata sketches use. Time
+  is a virtual clock that only moves when a test or benchmark advances it
+  (or calls delay()), pins are plain arrays and Serial is an in-memory
+  stream.
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH                    0x1
+#define LOW                     0x0
+
+#define INPUT                   0x0
+#define OUTPUT                  0x1
+#define INPUT_PULLUP            0x2
+
+#define CHANGE                  1
+#define FALLING                 2
+#define RISING                  3
+
+#define LSBFIRST                0
+#define MSBFIRST                1
+
+#define NOT_AN_INTERRUPT        -1
+#define digitalPinToInterrupt(p) ((p) == 2 ? 0 : ((p) == 3 ? 1 : NOT_AN_INTERRUPT))
+
+// Arduino Uno pin names
+#define SS                      10
+#define MOSI                    11
+#define MISO                    12
+#define SCK                     13
+#define SDA                     18
+#define SCL                     19
+#define A0                      14
+
+#define F_CPU                   16000000UL
+#define F(string)               (string)
+
+#define B00000000               0
+#define B00001000               8
+#define B00010000               16
+#define B00011000               24
+#define B00100000               32
+#define B01000000               64
+
+#define noInterrupts()
+#define interrupts()
+#define cli()
+#define sei()
+
+#define MOCK_TOTAL_PINS         64
+#define MOCK_INTERRUPTS         2
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t value);
+void attachInterrupt(uint8_t interrupt, void (*handler)(void), int mode);
+void detachInterrupt(uint8_t interrupt);
+
+class Print
+{
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size)
+    {
+      size_t n = 0;
+      while (size--) n += write(*buffer++);
+      return n;
+    }
+    size_t write(const char *str)
+    {
+      return write((const uint8_t *)str, strlen(str));
+    }
+    virtual void flush() {}
+};
+
+class Stream : public Print
+{
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+/*
+ * An in-memory serial port: the host side queues input with mockInput() and
+ * counts (and optionally captures) what the board writes. Attached to a file
+ * descriptor (the master side of a pty) it exchanges bytes with a real host
+ * program instead.
+ */
+class HardwareSerial : public Stream
+{
+  public:
+    HardwareSerial();
+    void begin(long baud);
+    void end();
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t c);
+    using Print::write;
+    operator bool() { return true; }
+
+    void mockInput(const uint8_t *data, size_t size);
+    void mockCapture(uint8_t *buffer, size_t size);
+    void mockAttach(int fd);
+    unsigned long bytesWritten;
+
+  private:
+    int fd;
+    uint8_t input[1024];
+    size_t head;
+    size_t tail;
+    uint8_t *capture;
+    size_t captureSize;
+    size_t captured;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+
+/* host build extensions */
+void mockAdvanceMicros(unsigned long us);
+void mockSetAnalog(uint8_t pin, int value);
+void mockSetDigital(uint8_t pin, int value);
+int mockGetDigital(uint8_t pin);
+// the handler attached to an interrupt, NULL if none
+typedef void (*mockInterruptHandler)(void);
+mockInterruptHandler mockGetInterrupt(uint8_t interrupt);
+
+#endif /* Arduino_h */
@@ -0,0 +1,61 @@
+/*
+  ArduinoUnit.cpp - test runner for the Firmata host build
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "ArduinoUnit.h"
+#include <malloc.h>
+
+Test *Test::first = NULL;
+Test *Test::current = NULL;
+bool Test::currentFailed = false;
+int Test::failed = 0;
+int Test::passed = 0;
+
+Test::Test(const char *name, void (*body)(void))
+{
+  this->name = name;
+  this->body = body;
+  // keep the declaration order of the sketch
+  next = NULL;
+  Test **last = &first;
+  while (*last) last = &(*last)->next;
+  *last = this;
+}
+
+void Test::run(void)
+{
+  for (current = first; current; current = current->next) {
+    currentFailed = false;
+    current->body();
+    if (currentFailed) {
+      failed++;
+    } else {
+      passed++;
+    }
+    printf("Test %s %s.\n", current->name, currentFailed ? "failed" : "passed");
+  }
+  printf("Test summary: %d passed, %d failed, out of %d test(s).\n", passed, failed, passed + failed);
+}
+
+void Test::fail(const char *file, int line, const char *assertion)
+{
+  printf("Assertion failed: (%s), file %s, line %d.\n", assertion, file, line);
+  currentFailed = true;
+}
+
+/*
+ * The heap in use stands in for the free memory of a board, so allocations
+ * that are not released show up the same way.
+ */
+int freeMemory(void)
+{
+  return -(int)mallinfo2().uordblks;
+}
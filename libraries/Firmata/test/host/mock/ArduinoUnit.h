@@ -0,0 +1,78 @@
+/*
+  ArduinoUnit.h - the part of ArduinoUnit used by test/firmata_test, so the
+  test sketch also runs in the Firmata host build
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#ifndef ArduinoUnit_h
+#define ArduinoUnit_h
+
+#include <stdio.h>
+#include <string>
+#include "Arduino.h"
+
+class Test
+{
+  public:
+    Test(const char *name, void (*body)(void));
+    static void run(void);
+    static void fail(const char *file, int line, const char *assertion);
+    static int failed;
+    static int passed;
+
+  private:
+    const char *name;
+    void (*body)(void);
+    Test *next;
+    static Test *first;
+    static Test *current;
+    static bool currentFailed;
+};
+
+#define test(name) \
+  static void test_##name(void); \
+  static Test test_##name##_instance(#name, test_##name); \
+  static void test_##name(void)
+
+#define assertEqual(expected, actual) \
+  do { if (!((expected) == (actual))) { Test::fail(__FILE__, __LINE__, #expected " == " #actual); return; } } while (0)
+
+#define assertTrue(condition) \
+  do { if (!(condition)) { Test::fail(__FILE__, __LINE__, #condition); return; } } while (0)
+
+#define assertFalse(condition) \
+  do { if (condition) { Test::fail(__FILE__, __LINE__, "!(" #condition ")"); return; } } while (0)
+
+/*
+ * A stream fed one byte at a time that records everything written to it.
+ */
+class FakeStream : public Stream
+{
+  public:
+    FakeStream() : hasNext(false), next(0) {}
+    void nextByte(byte c) { next = c; hasNext = true; }
+    void reset() { written.clear(); hasNext = false; }
+    std::string bytesWritten() { return written; }
+
+    int available() { return hasNext ? 1 : 0; }
+    int read() { if (!hasNext) return -1; hasNext = false; return next; }
+    int peek() { return hasNext ? next : -1; }
+    size_t write(uint8_t c) { written += (char)c; return 1; }
+    using Print::write;
+
+  private:
+    bool hasNext;
+    byte next;
+    std::string written;
+};
+
+int freeMemory(void);
+
+#endif /* ArduinoUnit_h */
@@ -0,0 +1,35 @@
+/*
+  IPAddress.h - Firmata host build, an IPv4 address
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#ifndef IPAddress_h
+#define IPAddress_h
+
+#include "Arduino.h"
+
+class IPAddress
+{
+  public:
+    IPAddress() { address = 0; }
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+    {
+      address = (uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) | ((uint32_t)d << 24);
+    }
+    IPAddress(uint32_t address) : address(address) {}
+    operator uint32_t() const { return address; }
+    uint8_t operator[](int index) const { return (address >> (index * 8)) & 0xFF; }
+
+  private:
+    // network byte order, as in the Arduino core
+    uint32_t address;
+};
+
+#endif /* IPAddress_h */
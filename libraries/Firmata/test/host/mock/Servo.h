@@ -0,0 +1,39 @@
+/*
+  Servo.h - Firmata host build, servos only remember their settings
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#ifndef Servo_h
+#define Servo_h
+
+#include "Arduino.h"
+
+#define MAX_SERVOS              12
+
+class Servo
+{
+  public:
+    Servo() : pin(0), value(0), isAttached(false) {}
+    uint8_t attach(int p) { pin = p; isAttached = true; return 0; }
+    uint8_t attach(int p, int min, int max) { return attach(p); }
+    void detach() { isAttached = false; }
+    void write(int v) { value = v; }
+    void writeMicroseconds(int v) { value = v; }
+    int read() { return value; }
+    int readMicroseconds() { return value; }
+    bool attached() { return isAttached; }
+
+  private:
+    int pin;
+    int value;
+    bool isAttached;
+};
+
+#endif /* Servo_h */
@@ -0,0 +1,149 @@
+/*
+  SocketUDP.cpp - Firmata host build, see SocketUDP.h
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "SocketUDP.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+SocketUDP::SocketUDP()
+{
+  fd = -1;
+  rxLength = rxPosition = txLength = 0;
+  rxAddress = txAddress = 0;
+  rxPort = txPort = 0;
+}
+
+SocketUDP::~SocketUDP()
+{
+  stop();
+}
+
+uint8_t SocketUDP::begin(uint16_t port)
+{
+  stop();
+  fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    return 0;
+  }
+  sockaddr_in local = sockaddr_in();
+  local.sin_family = AF_INET;
+  local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  local.sin_port = htons(port);
+  if (bind(fd, (sockaddr *)&local, sizeof(local)) < 0) {
+    stop();
+    return 0;
+  }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  return 1;
+}
+
+void SocketUDP::stop()
+{
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+int SocketUDP::beginPacket(IPAddress ip, uint16_t port)
+{
+  txAddress = ip;
+  txPort = port;
+  txLength = 0;
+  return 1;
+}
+
+int SocketUDP::endPacket()
+{
+  sockaddr_in remote = sockaddr_in();
+  remote.sin_family = AF_INET;
+  remote.sin_addr.s_addr = txAddress;
+  remote.sin_port = htons(txPort);
+  ssize_t sent = sendto(fd, txBuffer, txLength, 0, (sockaddr *)&remote, sizeof(remote));
+  txLength = 0;
+  return sent >= 0 ? 1 : 0;
+}
+
+size_t SocketUDP::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t SocketUDP::write(const uint8_t *buffer, size_t size)
+{
+  if (size > sizeof(txBuffer) - txLength) {
+    size = sizeof(txBuffer) - txLength;
+  }
+  memcpy(txBuffer + txLength, buffer, size);
+  txLength += size;
+  return size;
+}
+
+/*
+ * Receive the next datagram, the rest of the previous one is discarded.
+ */
+int SocketUDP::parsePacket()
+{
+  sockaddr_in remote;
+  socklen_t remoteLength = sizeof(remote);
+  rxLength = rxPosition = 0;
+  ssize_t received = recvfrom(fd, rxBuffer, sizeof(rxBuffer), 0, (sockaddr *)&remote, &remoteLength);
+  if (received <= 0) {
+    return 0;
+  }
+  rxLength = received;
+  rxAddress = remote.sin_addr.s_addr;
+  rxPort = ntohs(remote.sin_port);
+  return (int)rxLength;
+}
+
+int SocketUDP::available()
+{
+  return (int)(rxLength - rxPosition);
+}
+
+int SocketUDP::read()
+{
+  return rxPosition < rxLength ? rxBuffer[rxPosition++] : -1;
+}
+
+int SocketUDP::read(unsigned char *buffer, size_t len)
+{
+  size_t count = rxLength - rxPosition;
+  if (count == 0) {
+    return -1;
+  }
+  if (count > len) {
+    count = len;
+  }
+  memcpy(buffer, rxBuffer + rxPosition, count);
+  rxPosition += count;
+  return (int)count;
+}
+
+int SocketUDP::peek()
+{
+  return rxPosition < rxLength ? rxBuffer[rxPosition] : -1;
+}
+
+IPAddress SocketUDP::remoteIP()
+{
+  return IPAddress(rxAddress);
+}
+
+uint16_t SocketUDP::remotePort()
+{
+  return rxPort;
+}
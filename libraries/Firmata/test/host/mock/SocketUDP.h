@@ -0,0 +1,54 @@
+/*
+  SocketUDP.h - Firmata host build, the Arduino UDP interface on top of a
+  non-blocking POSIX socket, so network transports run over loopback
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#ifndef SocketUDP_h
+#define SocketUDP_h
+
+#include "Udp.h"
+
+#define SOCKET_UDP_MAX_DATAGRAM 1500
+
+class SocketUDP : public UDP
+{
+  public:
+    SocketUDP();
+    ~SocketUDP();
+    uint8_t begin(uint16_t port);
+    void stop();
+    int beginPacket(IPAddress ip, uint16_t port);
+    int endPacket();
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+    int parsePacket();
+    int available();
+    int read();
+    int read(unsigned char *buffer, size_t len);
+    int peek();
+    IPAddress remoteIP();
+    uint16_t remotePort();
+
+  private:
+    int fd;
+    uint8_t rxBuffer[SOCKET_UDP_MAX_DATAGRAM];
+    size_t rxLength;
+    size_t rxPosition;
+    uint32_t rxAddress;
+    uint16_t rxPort;
+    uint8_t txBuffer[SOCKET_UDP_MAX_DATAGRAM];
+    size_t txLength;
+    uint32_t txAddress;
+    uint16_t txPort;
+};
+
+#endif /* SocketUDP_h */
@@ -0,0 +1,113 @@
+/*
+  WiFi.h - Firmata host build, in-memory TCP connections for the WiFi streams
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+
+  The access point is always connected. A test opens a connection with
+  WiFiServer::mockConnect(), queues the host's bytes with send() and closes
+  it by clearing open.
+*/
+
+#ifndef WiFi_h
+#define WiFi_h
+
+#include <deque>
+#include <vector>
+#include "Arduino.h"
+#include "IPAddress.h"
+
+#define WL_CONNECTED    3
+
+struct MockConnection
+{
+  std::deque<uint8_t> rx;     // sent by the host, read by the board
+  std::vector<uint8_t> tx;    // written by the board
+  bool open;
+
+  void send(const uint8_t *bytes, size_t length) { rx.insert(rx.end(), bytes, bytes + length); }
+};
+
+class WiFiClient
+{
+  public:
+    WiFiClient() : connection(NULL) {}
+    WiFiClient(MockConnection *connection) : connection(connection) {}
+    uint8_t connected() { return connection != NULL && connection->open; }
+    void stop() { if (connection) connection->open = false; }
+    int available() { return connected() ? (int)connection->rx.size() : 0; }
+    int peek() { return available() ? connection->rx.front() : -1; }
+    int read()
+    {
+      int value = peek();
+      if (value >= 0) connection->rx.pop_front();
+      return value;
+    }
+    size_t write(const uint8_t *buffer, size_t size)
+    {
+      if (!connected()) return 0;
+      connection->tx.insert(connection->tx.end(), buffer, buffer + size);
+      return size;
+    }
+    size_t write(uint8_t value) { return write(&value, 1); }
+    void flush() {}
+    operator bool() { return connection != NULL; }
+    bool operator==(const WiFiClient &other) const { return connection == other.connection; }
+
+  private:
+    MockConnection *connection;
+};
+
+class WiFiServer
+{
+  public:
+    WiFiServer(uint16_t port) {}
+    void begin() {}
+
+    // the next connection that has not been accepted yet
+    WiFiClient available()
+    {
+      if (pending().empty()) return WiFiClient();
+      MockConnection *connection = pending().front();
+      pending().pop_front();
+      return WiFiClient(connection);
+    }
+
+    static MockConnection *mockConnect()
+    {
+      // a deque keeps its elements in place as it grows
+      static std::deque<MockConnection> connections;
+      connections.push_back(MockConnection());
+      connections.back().open = true;
+      pending().push_back(&connections.back());
+      return &connections.back();
+    }
+
+  private:
+    static std::deque<MockConnection *> &pending()
+    {
+      static std::deque<MockConnection *> queue;
+      return queue;
+    }
+};
+
+class WiFiClass
+{
+  public:
+    void config(IPAddress local_ip) {}
+    void config(IPAddress local_ip, IPAddress dns, IPAddress gateway, IPAddress subnet) {}
+    IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+    int begin(const char *ssid) { return WL_CONNECTED; }
+    int begin(const char *ssid, uint8_t key_idx, const char *key) { return WL_CONNECTED; }
+    int begin(const char *ssid, const char *passphrase) { return WL_CONNECTED; }
+    int status() { return WL_CONNECTED; }
+};
+
+static WiFiClass WiFi;
+
+#endif /* WiFi_h */
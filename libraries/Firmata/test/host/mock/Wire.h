@@ -0,0 +1,43 @@
+/*
+  Wire.h - Firmata host build, every device returns the requested number of
+  zero bytes
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#ifndef TwoWire_h
+#define TwoWire_h
+
+#include "Arduino.h"
+
+class TwoWire : public Stream
+{
+  public:
+    TwoWire() : pending(0) {}
+    void begin() {}
+    void beginTransmission(uint8_t address) {}
+    uint8_t endTransmission(uint8_t stop = true) { return 0; }
+    uint8_t requestFrom(int address, int quantity, int stop = true)
+    {
+      pending = quantity;
+      return quantity;
+    }
+    size_t write(uint8_t c) { return 1; }
+    using Print::write;
+    int available() { return pending; }
+    int read() { return pending > 0 ? (pending--, 0) : -1; }
+    int peek() { return pending > 0 ? 0 : -1; }
+
+  private:
+    int pending;
+};
+
+extern TwoWire Wire;
+
+#endif /* TwoWire_h */
@@ -0,0 +1,209 @@
+/*
+  pty_test.cpp - FirmataClient against StandardFirmata over a pseudo
+  terminal, with the sketch running on its own thread like a real board
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include <ArduinoUnit.h>
+#include <Firmata.h>
+#include <FirmataClient.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <stdexcept>
+
+#define REPLY_WAIT  std::chrono::seconds(2)
+
+void setup();
+void loop();
+
+FirmataClient client;
+std::atomic<bool> boardRunning(false);
+std::atomic<int> firmwareReports(0);
+
+/*
+ * The board: loop() with the virtual clock following real time.
+ */
+void runBoard()
+{
+  std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+  while (boardRunning) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    mockAdvanceMicros(std::chrono::duration_cast<std::chrono::microseconds>(now - last).count());
+    last = now;
+    loop();
+    usleep(200);
+  }
+}
+
+bool ready(std::future<FirmataReply> &reply)
+{
+  return reply.wait_for(REPLY_WAIT) == std::future_status::ready;
+}
+
+test(pipelinedQueriesAreMatchedToTheirReplies)
+{
+  client.setPinMode(4, OUTPUT);
+  client.digitalWrite(4, true);
+  client.setPinMode(5, INPUT);
+  std::future<FirmataReply> version = client.queryVersion();
+  std::future<FirmataReply> capabilities = client.queryCapabilities();
+  std::future<FirmataReply> state5 = client.queryPinState(5);
+  std::future<FirmataReply> state4 = client.queryPinState(4);
+  std::future<FirmataReply> mapping = client.queryAnalogMapping();
+  std::future<FirmataReply> firmware = client.queryFirmware();
+
+  assertTrue(ready(firmware));
+  assertTrue(ready(version) && ready(capabilities) && ready(state5) && ready(state4) && ready(mapping));
+
+  FirmataReply reply = state4.get();
+  assertEqual(3, reply.size());
+  assertEqual(4, reply[0]);
+  assertEqual(OUTPUT, reply[1]);
+  assertEqual(1, reply[2]);
+  reply = state5.get();
+  assertEqual(5, reply[0]);
+  assertEqual(INPUT, reply[1]);
+
+  assertEqual(FIRMATA_PROTOCOL_MAJOR_VERSION, version.get()[0]);
+  assertEqual(FIRMATA_FIRMWARE_MAJOR_VERSION, firmware.get()[0]);
+  // one mode list per pin
+  reply = capabilities.get();
+  size_t pins = 0;
+  for (size_t i = 0; i < reply.size(); i++) {
+    pins += reply[i] == 127;
+  }
+  assertEqual(TOTAL_PINS, pins);
+  assertEqual(TOTAL_PINS, mapping.get().size());
+}
+
+test(i2cReadsAreMatchedByAddressAndRegister)
+{
+  client.i2cConfig();
+  std::future<FirmataReply> first = client.i2cRead(0x20, 0x01, 2);
+  std::future<FirmataReply> second = client.i2cRead(0x21, FIRMATA_CLIENT_NO_REGISTER, 5);
+  std::future<FirmataReply> third = client.i2cRead(0x20, 0x02, 3);
+
+  assertTrue(ready(first) && ready(second) && ready(third));
+  assertEqual(2, first.get().size());
+  assertEqual(5, second.get().size());
+  assertEqual(3, third.get().size());
+}
+
+test(analogReportsReachTheQueue)
+{
+  FirmataReport report;
+  while (client.readReport(report)) {
+  }
+  client.setSamplingInterval(10);
+  client.reportAnalog(0, true);
+
+  bool received = false;
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + REPLY_WAIT;
+  while (!received && std::chrono::steady_clock::now() < end) {
+    received = client.readReport(report);
+    if (!received) {
+      usleep(1000);
+    }
+  }
+  client.reportAnalog(0, false);
+
+  assertTrue(received);
+  assertEqual(ANALOG_MESSAGE, report.type);
+  assertEqual(0, report.index);
+  assertEqual(321, report.value);
+  assertEqual(0UL, client.droppedReports());
+}
+
+test(unansweredQueryTimesOut)
+{
+  client.setTimeout(100);
+  // a user defined sysex command StandardFirmata ignores
+  std::future<FirmataReply> reply = client.request(0x01, NULL, 0, 0x02);
+  client.setTimeout(FIRMATA_CLIENT_TIMEOUT);
+
+  assertTrue(ready(reply));
+  bool failed = false;
+  try {
+    reply.get();
+  } catch (const std::runtime_error &) {
+    failed = true;
+  }
+  assertTrue(failed);
+  assertTrue(client.isConnected());
+}
+
+test(lostConnectionFailsQueriesAndCanBeReopened)
+{
+  FirmataClient other;
+  int ends[2];
+  assertEqual(0, socketpair(AF_UNIX, SOCK_STREAM, 0, ends));
+  assertTrue(other.open(ends[0]));
+  close(ends[1]);
+  for (int i = 0; i < 200 && other.isConnected(); i++) {
+    usleep(10000);
+  }
+  assertFalse(other.isConnected());
+
+  // fails without waiting for a timeout
+  std::future<FirmataReply> reply = other.queryVersion();
+  assertTrue(reply.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+
+  assertEqual(0, socketpair(AF_UNIX, SOCK_STREAM, 0, ends));
+  assertTrue(other.open(ends[0]));
+  assertTrue(other.isConnected());
+  other.close();
+  close(ends[1]);
+}
+
+int main()
+{
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+    printf("no pseudo terminal available\n");
+    return 1;
+  }
+  fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+  // the host opens the port (in raw mode) before the board starts talking
+  client.onSysex([](uint8_t command, const FirmataReply &data) {
+    if (command == REPORT_FIRMWARE) {
+      firmwareReports++;
+    }
+  });
+  if (!client.openSerial(ptsname(master))) {
+    printf("cannot open %s\n", ptsname(master));
+    return 1;
+  }
+
+  mockSetAnalog(0, 321);
+  Serial.mockAttach(master);
+  setup();
+  boardRunning = true;
+  std::thread board(runBoard);
+
+  // the board announces itself when it starts
+  for (int i = 0; i < 200 && firmwareReports == 0; i++) {
+    usleep(10000);
+  }
+  if (firmwareReports == 0) {
+    printf("no firmware report from the board\n");
+    Test::failed++;
+  } else {
+    Test::run();
+  }
+
+  client.close();
+  boardRunning = false;
+  board.join();
+  close(master);
+  return Test::failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,181 @@
+/*
+  servo_test.cpp - ServoMotionFirmata moving servos on the virtual clock
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include <ArduinoUnit.h>
+#include <Servo.h>
+#include <Firmata.h>
+#include <ServoMotionFirmata.h>
+
+Servo servos[MAX_SERVOS];
+byte servoPinMap[TOTAL_PINS];
+ServoMotionFirmata motion(servos, servoPinMap);
+FakeStream stream;
+
+void setupServo(byte pin, byte index, int position)
+{
+  Firmata.setPinMode(pin, PIN_MODE_SERVO);
+  servoPinMap[pin] = index;
+  servos[index].attach(pin);
+  servos[index].writeMicroseconds(position);
+}
+
+void setupServos()
+{
+  motion.reset();
+  setupServo(2, 0, 1000);
+  setupServo(3, 1, 1500);
+  stream.reset();
+}
+
+/*
+ * SERVO_MOTION_MOVE of group 1 with a speed limit and an acceleration in
+ * SERVO_MOTION_ACCEL_UNIT, two servos.
+ */
+void move(byte pin1, unsigned int to1, byte pin2, unsigned int to2, unsigned int speed,
+          unsigned int accel = 0)
+{
+  byte argv[] = {
+    SERVO_MOTION_MOVE, 1, 0, 0, 0, (byte)(speed & 0x7F), (byte)(speed >> 7),
+    (byte)(accel & 0x7F), (byte)(accel >> 7),
+    pin1, (byte)(to1 & 0x7F), (byte)(to1 >> 7),
+    pin2, (byte)(to2 & 0x7F), (byte)(to2 >> 7)
+  };
+  motion.handleSysex(SERVO_MOTION_DATA, sizeof(argv), argv);
+}
+
+/*
+ * Run update() for ms milliseconds of virtual time.
+ */
+void run(unsigned long ms)
+{
+  for (unsigned long i = 0; i < ms; i++) {
+    mockAdvanceMicros(1000);
+    motion.update();
+  }
+}
+
+bool stringSent()
+{
+  std::string message;
+  message += (char)START_SYSEX;
+  message += (char)STRING_DATA;
+  return stream.bytesWritten().find(message) != std::string::npos;
+}
+
+bool doneSent()
+{
+  std::string done;
+  done += (char)START_SYSEX;
+  done += (char)SERVO_MOTION_DATA;
+  done += (char)SERVO_MOTION_DONE;
+  done += (char)1;
+  done += (char)END_SYSEX;
+  return stream.bytesWritten().find(done) != std::string::npos;
+}
+
+test(groupFinishesTogether)
+{
+  setupServos();
+  // 1000 us at 1000 us/s take 1 s, the shorter move is stretched to match
+  move(2, 2000, 3, 1700, 1000);
+  run(500);
+  // positions are written every SERVO_MOTION_INTERVAL ms
+  assertTrue(abs(servos[0].readMicroseconds() - 1500) <= 10);
+  assertTrue(abs(servos[1].readMicroseconds() - 1600) <= 3);
+  assertFalse(doneSent());
+
+  run(510);
+  assertEqual(2000, servos[0].readMicroseconds());
+  assertEqual(1700, servos[1].readMicroseconds());
+  assertTrue(doneSent());
+}
+
+test(movingServoIsNotMovedAgainInItsGroup)
+{
+  setupServos();
+  move(2, 2000, 3, 1700, 1000);
+  run(500);
+
+  move(2, 1200, 3, 1700, 1000);
+  assertTrue(stringSent());
+  run(510);
+  assertEqual(2000, servos[0].readMicroseconds());
+  assertEqual(1700, servos[1].readMicroseconds());
+  assertTrue(doneSent());
+}
+
+test(trapezoidRampReachesTopSpeedAtItsEnd)
+{
+  setupServos();
+  // 1000 us at 1000 us/s and 2000 us/s^2: 500 ms ramps around 500 ms at top speed
+  move(2, 2000, 3, 1500, 1000, 20);
+  run(250);
+  // a quarter of the ramp time covers 1/16 of its distance
+  assertTrue(abs(servos[0].readMicroseconds() - 1063) <= 5);
+  run(250);
+  // the ramps cover 250 us each
+  assertTrue(abs(servos[0].readMicroseconds() - 1250) <= 10);
+  run(250);
+  assertTrue(abs(servos[0].readMicroseconds() - 1500) <= 10);
+  run(500);
+  assertTrue(abs(servos[0].readMicroseconds() - 1938) <= 5);
+  assertFalse(doneSent());
+
+  run(260);
+  assertEqual(2000, servos[0].readMicroseconds());
+  assertEqual(1500, servos[1].readMicroseconds());
+  assertTrue(doneSent());
+}
+
+test(triangularRampWithoutSpeedLimit)
+{
+  setupServos();
+  // 1000 us at 2000 us/s^2 take 2 * sqrt(0.5) s, half of it accelerating
+  move(2, 2000, 3, 1500, 0, 20);
+  run(707);
+  assertTrue(abs(servos[0].readMicroseconds() - 1500) <= 15);
+  run(700);
+  assertFalse(doneSent());
+
+  run(20);
+  assertEqual(2000, servos[0].readMicroseconds());
+  assertTrue(doneSent());
+}
+
+test(groupWithAccelerationFinishesTogether)
+{
+  setupServos();
+  // the 200 us move could end in 632 ms, it is stretched to the 1500 ms of
+  // the longer one with 70 ms ramps
+  move(2, 2000, 3, 1700, 1000, 20);
+  run(750);
+  assertTrue(abs(servos[0].readMicroseconds() - 1500) <= 10);
+  assertTrue(abs(servos[1].readMicroseconds() - 1600) <= 2);
+  run(700);
+  // both are still slowing down
+  assertTrue(servos[0].readMicroseconds() < 2000);
+  assertTrue(servos[1].readMicroseconds() < 1700);
+  run(40);
+  assertFalse(doneSent());
+
+  run(20);
+  assertEqual(2000, servos[0].readMicroseconds());
+  assertEqual(1700, servos[1].readMicroseconds());
+  assertTrue(doneSent());
+}
+
+int main()
+{
+  Firmata.begin(stream);
+  Test::run();
+  return Test::failed > 0 ? 1 : 0;
+}
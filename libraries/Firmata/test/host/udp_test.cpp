@@ -0,0 +1,172 @@
+/*
+  udp_test.cpp - UDPStream over Linux loopback, with a plain socket standing
+  in for the host
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include <ArduinoUnit.h>
+#include <Firmata.h>
+#include <SocketUDP.h>
+#include <UDPStream.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define BOARD_PORT  37401
+#define HOST_PORT   37402
+
+SocketUDP boardUdp;
+UDPStream stream(boardUdp, BOARD_PORT);
+int host = -1;
+uint16_t hostSequence = 0;
+
+void openHost()
+{
+  host = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in local = sockaddr_in();
+  local.sin_family = AF_INET;
+  local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  local.sin_port = htons(HOST_PORT);
+  bind(host, (sockaddr *)&local, sizeof(local));
+  timeval timeout = {1, 0};
+  setsockopt(host, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+void hostSend(uint16_t sequence, uint8_t flags, const uint8_t *payload, size_t length)
+{
+  uint8_t datagram[UDPSTREAM_HEADER_SIZE + 64];
+  datagram[0] = flags;
+  datagram[1] = sequence & 0xFF;
+  datagram[2] = sequence >> 8;
+  memcpy(datagram + UDPSTREAM_HEADER_SIZE, payload, length);
+  sockaddr_in board = sockaddr_in();
+  board.sin_family = AF_INET;
+  board.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  board.sin_port = htons(BOARD_PORT);
+  sendto(host, datagram, UDPSTREAM_HEADER_SIZE + length, 0, (sockaddr *)&board, sizeof(board));
+}
+
+/*
+ * Receive one datagram from the board, -1 if none arrives within a second.
+ */
+int hostReceive(uint8_t *datagram, size_t size)
+{
+  return (int)recv(host, datagram, size, 0);
+}
+
+/*
+ * One pass of a sketch loop(): process input, then send buffered output.
+ */
+void boardLoop()
+{
+  // loopback delivery is immediate but not synchronous
+  usleep(1000);
+  while (Firmata.available()) {
+    Firmata.processInput();
+  }
+  stream.maintain();
+}
+
+int stringCommands = 0;
+
+void stringCallback(char *text)
+{
+  stringCommands++;
+}
+
+test(commandIsAcknowledgedAndAnswered)
+{
+  const uint8_t command[] = {REPORT_VERSION};
+  hostSend(++hostSequence, UDPSTREAM_FLAG_ACK_REQUEST, command, sizeof(command));
+  boardLoop();
+
+  uint8_t datagram[64];
+  assertEqual(UDPSTREAM_HEADER_SIZE, hostReceive(datagram, sizeof(datagram)));
+  assertEqual(UDPSTREAM_FLAG_ACK, datagram[0]);
+  assertEqual(hostSequence, datagram[1] | (datagram[2] << 8));
+
+  assertEqual(UDPSTREAM_HEADER_SIZE + 3, hostReceive(datagram, sizeof(datagram)));
+  assertEqual(0, datagram[0]);
+  assertEqual(REPORT_VERSION, datagram[3]);
+  assertEqual(FIRMATA_PROTOCOL_MAJOR_VERSION, datagram[4]);
+}
+
+test(duplicateCommandIsAcknowledgedButDropped)
+{
+  uint8_t command[] = {START_SYSEX, STRING_DATA, 'a', 0, END_SYSEX};
+  int before = stringCommands;
+  hostSend(++hostSequence, UDPSTREAM_FLAG_ACK_REQUEST, command, sizeof(command));
+  hostSend(hostSequence, UDPSTREAM_FLAG_ACK_REQUEST, command, sizeof(command));
+  hostSend(hostSequence - 1, 0, command, sizeof(command));
+  uint16_t stale = stream.staleDatagrams();
+  boardLoop();
+
+  uint8_t datagram[64];
+  assertEqual(UDPSTREAM_HEADER_SIZE, hostReceive(datagram, sizeof(datagram)));
+  assertEqual(UDPSTREAM_HEADER_SIZE, hostReceive(datagram, sizeof(datagram)));
+  assertEqual(hostSequence, datagram[1] | (datagram[2] << 8));
+  assertEqual(before + 1, stringCommands);
+  assertEqual(stale + 2, stream.staleDatagrams());
+}
+
+test(lateCommandIsExecutedOnce)
+{
+  uint8_t command[] = {START_SYSEX, STRING_DATA, 'b', 0, END_SYSEX};
+  int before = stringCommands;
+  uint16_t late = ++hostSequence;
+  hostSend(++hostSequence, UDPSTREAM_FLAG_ACK_REQUEST, command, sizeof(command));
+  hostSend(late, UDPSTREAM_FLAG_ACK_REQUEST, command, sizeof(command));
+  hostSend(late, UDPSTREAM_FLAG_ACK_REQUEST, command, sizeof(command));
+  uint16_t stale = stream.staleDatagrams();
+  boardLoop();
+
+  uint8_t datagram[64];
+  assertEqual(UDPSTREAM_HEADER_SIZE, hostReceive(datagram, sizeof(datagram)));
+  assertEqual(hostSequence, datagram[1] | (datagram[2] << 8));
+  assertEqual(UDPSTREAM_HEADER_SIZE, hostReceive(datagram, sizeof(datagram)));
+  assertEqual(late, datagram[1] | (datagram[2] << 8));
+  assertEqual(UDPSTREAM_HEADER_SIZE, hostReceive(datagram, sizeof(datagram)));
+  assertEqual(late, datagram[1] | (datagram[2] << 8));
+  assertEqual(before + 2, stringCommands);
+  assertEqual(stale + 1, stream.staleDatagrams());
+}
+
+test(reportsArePackedWholeWithSequenceNumbers)
+{
+  // more analog messages than fit one datagram
+  const int messages = UDPSTREAM_MAX_PAYLOAD / 3 + 10;
+  for (int i = 0; i < messages; i++) {
+    Firmata.sendAnalog(i & 0x0F, i);
+  }
+  stream.maintain();
+
+  uint8_t datagram[UDPSTREAM_HEADER_SIZE + UDPSTREAM_MAX_PAYLOAD + 1];
+  int first = hostReceive(datagram, sizeof(datagram));
+  assertTrue(first > UDPSTREAM_HEADER_SIZE);
+  assertEqual(0, (first - UDPSTREAM_HEADER_SIZE) % 3);
+  uint16_t sequence = datagram[1] | (datagram[2] << 8);
+  int second = hostReceive(datagram, sizeof(datagram));
+  assertEqual(0, (second - UDPSTREAM_HEADER_SIZE) % 3);
+  assertEqual(sequence + 1, datagram[1] | (datagram[2] << 8));
+  assertEqual(ANALOG_MESSAGE | ((messages - 1) & 0x0F), datagram[second - 3]);
+  assertEqual(messages * 3, first + second - 2 * UDPSTREAM_HEADER_SIZE);
+}
+
+int main()
+{
+  openHost();
+  stream.begin();
+  Firmata.attach(STRING_DATA, stringCallback);
+  Firmata.begin(stream);
+  Test::run();
+  close(host);
+  return Test::failed > 0 ? 1 : 0;
+}
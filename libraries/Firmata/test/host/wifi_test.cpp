@@ -0,0 +1,132 @@
+/*
+  wifi_test.cpp - WiFiMultiServerStream with in-memory host connections
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include <ArduinoUnit.h>
+#include <Firmata.h>
+#include <WiFi.h>
+#include <WiFiMultiServerStream.h>
+
+WiFiMultiServerStream stream(3030);
+
+int stringCommands = 0;
+char lastString[16];
+int abandonedMessages = 0;
+
+void stringCallback(char *text)
+{
+  stringCommands++;
+  strncpy(lastString, text, sizeof(lastString) - 1);
+}
+
+/*
+ * As in StandardFirmataWiFi.
+ */
+void hostConnectionCallback(byte state)
+{
+  if (state == HOST_CONNECTION_ABANDONED) {
+    abandonedMessages++;
+    Firmata.resetParser();
+  }
+}
+
+/*
+ * One pass of a sketch loop(): process input, then send buffered output.
+ */
+void boardLoop()
+{
+  while (Firmata.available()) {
+    Firmata.processInput();
+  }
+  stream.maintain();
+}
+
+void setupConnections()
+{
+  stream.stop();
+  stringCommands = 0;
+  lastString[0] = 0;
+  abandonedMessages = 0;
+}
+
+test(sysexFromDroppedHostIsDiscarded)
+{
+  setupConnections();
+  MockConnection *first = WiFiServer::mockConnect();
+  MockConnection *second = WiFiServer::mockConnect();
+  boardLoop();
+  boardLoop();
+  assertEqual(2, stream.clientCount());
+
+  const uint8_t partial[] = {START_SYSEX, STRING_DATA, 'x', 0};
+  first->send(partial, sizeof(partial));
+  boardLoop();
+  assertTrue(Firmata.isParsingMessage());
+
+  first->open = false;
+  const uint8_t whole[] = {START_SYSEX, STRING_DATA, 'o', 0, 'k', 0, END_SYSEX};
+  second->send(whole, sizeof(whole));
+  boardLoop();
+
+  assertEqual(1, abandonedMessages);
+  assertEqual(1, stringCommands);
+  assertEqual(0, strcmp("ok", lastString));
+  assertFalse(Firmata.isParsingMessage());
+}
+
+test(otherHostDroppingKeepsTheMessage)
+{
+  setupConnections();
+  MockConnection *first = WiFiServer::mockConnect();
+  MockConnection *second = WiFiServer::mockConnect();
+  boardLoop();
+  boardLoop();
+
+  const uint8_t partial[] = {START_SYSEX, STRING_DATA, 'o', 0};
+  first->send(partial, sizeof(partial));
+  boardLoop();
+  second->open = false;
+  boardLoop();
+  const uint8_t rest[] = {'k', 0, END_SYSEX};
+  first->send(rest, sizeof(rest));
+  boardLoop();
+
+  assertEqual(0, abandonedMessages);
+  assertEqual(1, stringCommands);
+  assertEqual(0, strcmp("ok", lastString));
+}
+
+test(reportsReachEveryHost)
+{
+  setupConnections();
+  MockConnection *first = WiFiServer::mockConnect();
+  MockConnection *second = WiFiServer::mockConnect();
+  boardLoop();
+  boardLoop();
+
+  Firmata.sendAnalog(1, 300);
+  stream.maintain();
+
+  const uint8_t report[] = {ANALOG_MESSAGE | 1, 300 & 0x7F, 300 >> 7};
+  assertEqual(sizeof(report), first->tx.size());
+  assertEqual(0, memcmp(report, first->tx.data(), sizeof(report)));
+  assertEqual(sizeof(report), second->tx.size());
+  assertEqual(0, memcmp(report, second->tx.data(), sizeof(report)));
+}
+
+int main()
+{
+  stream.attach(hostConnectionCallback);
+  Firmata.attach(STRING_DATA, stringCallback);
+  Firmata.begin(stream);
+  Test::run();
+  return Test::failed > 0 ? 1 : 0;
+}
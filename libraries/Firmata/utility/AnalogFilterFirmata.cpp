@@ -0,0 +1,235 @@
+/*
+  AnalogFilterFirmata.cpp
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "AnalogFilterFirmata.h"
+
+AnalogFilterFirmata::AnalogFilterFirmata()
+{
+  reset();
+}
+
+/*
+ * A pin that leaves PIN_MODE_ANALOG loses its filter.
+ */
+boolean AnalogFilterFirmata::handlePinMode(byte pin, int mode)
+{
+  analog_filter *filter = IS_PIN_ANALOG(pin) ? find(PIN_TO_ANALOG(pin)) : NULL;
+  if (!filter) {
+    return false;
+  }
+  if (mode == PIN_MODE_ANALOG) {
+    return true;
+  }
+  filter->channel = ANALOG_FILTER_UNUSED;
+  return false;
+}
+
+void AnalogFilterFirmata::handleCapability(byte pin)
+{
+}
+
+boolean AnalogFilterFirmata::handleSysex(byte command, byte argc, byte *argv)
+{
+  if (command != ANALOG_FILTER_DATA) {
+    return false;
+  }
+  if (argc < 2) {
+    return true;
+  }
+
+  switch (argv[0]) {
+    case ANALOG_FILTER_CONFIG:
+      if (argc > 2) {
+        configure(argv[1], argv[2], argc > 3 ? argv[3] : 0);
+      }
+      break;
+    case ANALOG_FILTER_QUERY:
+      sendConfig(argv[1]);
+      break;
+  }
+  return true;
+}
+
+/*
+ * Take one sample of the next filtered pin, call as often as possible.
+ */
+void AnalogFilterFirmata::update()
+{
+  for (byte i = 0; i < ANALOG_FILTER_MAX_FILTERS; i++) {
+    analog_filter *filter = &filters[nextFilter];
+    nextFilter = (nextFilter + 1) % ANALOG_FILTER_MAX_FILTERS;
+    if (filter->channel != ANALOG_FILTER_UNUSED) {
+      addSample(filter, analogRead(filter->channel));
+      return;
+    }
+  }
+}
+
+void AnalogFilterFirmata::reset()
+{
+  for (byte i = 0; i < ANALOG_FILTER_MAX_FILTERS; i++) {
+    filters[i].channel = ANALOG_FILTER_UNUSED;
+  }
+  nextFilter = 0;
+}
+
+/*
+ * Send the filter output of an analog channel, call in place of sending
+ * analogRead() at the sampling interval.
+ * @return false if the channel is not filtered and should be reported raw
+ */
+boolean AnalogFilterFirmata::report(byte channel)
+{
+  analog_filter *filter = find(channel);
+  if (!filter) {
+    return false;
+  }
+  if (filter->fresh) {
+    Firmata.sendAnalog(channel, filter->result);
+    // averages and medians are reported every interval, decimated values once
+    filter->fresh = filter->type != ANALOG_FILTER_OVERSAMPLE;
+  }
+  return true;
+}
+
+//******************************************************************************
+//* Private Methods
+//******************************************************************************
+
+analog_filter *AnalogFilterFirmata::find(byte channel)
+{
+  for (byte i = 0; i < ANALOG_FILTER_MAX_FILTERS; i++) {
+    if (filters[i].channel == channel) {
+      return &filters[i];
+    }
+  }
+  return NULL;
+}
+
+void AnalogFilterFirmata::configure(byte channel, byte type, byte parameter)
+{
+  if (channel >= TOTAL_ANALOG_PINS) {
+    Firmata.sendString("Filter: invalid analog pin");
+    return;
+  }
+  analog_filter *filter = find(channel);
+  if (type == ANALOG_FILTER_NONE) {
+    if (filter) {
+      filter->channel = ANALOG_FILTER_UNUSED;
+    }
+    return;
+  }
+
+  boolean valid;
+  switch (type) {
+    case ANALOG_FILTER_OVERSAMPLE:
+      valid = parameter >= 1 && parameter <= ANALOG_FILTER_MAX_EXTRA_BITS;
+      break;
+    case ANALOG_FILTER_AVERAGE:
+    case ANALOG_FILTER_MEDIAN:
+      valid = parameter >= 2 && parameter <= ANALOG_FILTER_MAX_WINDOW;
+      break;
+    default:
+      valid = false;
+      break;
+  }
+  if (!valid) {
+    Firmata.sendString("Filter: invalid type or parameter");
+    return;
+  }
+  if (!filter) {
+    filter = find(ANALOG_FILTER_UNUSED);
+    if (!filter) {
+      Firmata.sendString("Filter: too many filters");
+      return;
+    }
+  }
+
+  filter->type = type;
+  filter->parameter = parameter;
+  filter->count = 0;
+  filter->next = 0;
+  filter->fresh = false;
+  filter->sum = 0;
+  filter->result = 0;
+  filter->channel = channel;
+
+  // to hear about the pin leaving PIN_MODE_ANALOG
+  for (byte pin = 0; pin < TOTAL_PINS; pin++) {
+    if (IS_PIN_ANALOG(pin) && PIN_TO_ANALOG(pin) == channel) {
+      Firmata.claimFeaturePin(pin, this);
+    }
+  }
+}
+
+void AnalogFilterFirmata::sendConfig(byte channel)
+{
+  analog_filter *filter = find(channel);
+  Firmata.startSysex();
+  Firmata.write(ANALOG_FILTER_DATA);
+  Firmata.write(ANALOG_FILTER_QUERY);
+  Firmata.write(channel);
+  Firmata.write(filter ? filter->type : ANALOG_FILTER_NONE);
+  Firmata.write(filter ? filter->parameter : 0);
+  Firmata.write(ANALOG_FILTER_RESOLUTION
+                + (filter && filter->type == ANALOG_FILTER_OVERSAMPLE ? filter->parameter : 0));
+  Firmata.endSysex();
+}
+
+void AnalogFilterFirmata::addSample(analog_filter *filter, unsigned int value)
+{
+  if (filter->type == ANALOG_FILTER_OVERSAMPLE) {
+    // 4^n samples carry n extra bits once the noise is averaged out
+    filter->sum += value;
+    if (++filter->count == (1U << (2 * filter->parameter))) {
+      filter->result = filter->sum >> filter->parameter;
+      filter->fresh = true;
+      filter->sum = 0;
+      filter->count = 0;
+    }
+    return;
+  }
+
+  // both window filters keep the last samples in a ring
+  if (filter->count == filter->parameter) {
+    filter->sum -= filter->window[filter->next];
+  } else {
+    filter->count++;
+  }
+  filter->window[filter->next] = value;
+  filter->sum += value;
+  filter->next = (filter->next + 1) % filter->parameter;
+
+  if (filter->type == ANALOG_FILTER_AVERAGE) {
+    filter->result = (filter->sum + filter->count / 2) / filter->count;
+  } else {
+    filter->result = median(filter);
+  }
+  filter->fresh = true;
+}
+
+unsigned int AnalogFilterFirmata::median(analog_filter *filter)
+{
+  unsigned int sorted[ANALOG_FILTER_MAX_WINDOW];
+  byte count = filter->count;
+  // insertion sort, the window is short
+  for (byte i = 0; i < count; i++) {
+    unsigned int value = filter->window[i];
+    byte j = i;
+    while (j > 0 && sorted[j - 1] > value) {
+      sorted[j] = sorted[j - 1];
+      j--;
+    }
+    sorted[j] = value;
+  }
+  return sorted[(count - 1) / 2];
+}
@@ -0,0 +1,91 @@
+/*
+  AnalogFilterFirmata.h
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+
+  Per pin filtering of analog reports. Filtered pins are sampled
+  continuously from update() (one conversion per call, round robin) and
+  the sketch reports the filter output instead of a raw analogRead() at
+  the sampling interval:
+
+  - oversampling: 4^n samples are summed and decimated by n bits, giving
+    10 + n bit results (n = 1..4). A result is only reported once per
+    decimation, so slow pins also use less bandwidth.
+  - moving average over the last N samples.
+  - median of the last N samples, to reject spikes.
+
+  All arithmetic is integer only.
+*/
+
+#ifndef AnalogFilterFirmata_h
+#define AnalogFilterFirmata_h
+
+#include <Firmata.h>
+#include "FirmataFeature.h"
+
+#define FIRMATA_ANALOG_FILTER_FEATURE
+
+// ANALOG_FILTER_DATA sub-commands
+#define ANALOG_FILTER_CONFIG        0x00 // channel, type, parameter
+#define ANALOG_FILTER_QUERY         0x01 // query: channel / reply: channel, type, parameter, resolution
+
+// filter types
+#define ANALOG_FILTER_NONE          0x00
+#define ANALOG_FILTER_OVERSAMPLE    0x01 // parameter: extra bits of resolution
+#define ANALOG_FILTER_AVERAGE       0x02 // parameter: window length
+#define ANALOG_FILTER_MEDIAN        0x03 // parameter: window length
+
+#define ANALOG_FILTER_MAX_EXTRA_BITS 4   // keeps results within the 14 bits of ANALOG_MESSAGE
+#define ANALOG_FILTER_RESOLUTION    10
+#define ANALOG_FILTER_UNUSED        0x7F
+
+#if defined(RAMEND) && RAMEND < 0x900
+#define ANALOG_FILTER_MAX_FILTERS   4
+#define ANALOG_FILTER_MAX_WINDOW    8
+#else
+#define ANALOG_FILTER_MAX_FILTERS   8
+#define ANALOG_FILTER_MAX_WINDOW    16
+#endif
+
+struct analog_filter {
+  byte channel;         // analog channel or ANALOG_FILTER_UNUSED
+  byte type;
+  byte parameter;
+  unsigned int count;   // samples in the window, or summed for oversampling
+  byte next;            // window slot for the next sample
+  boolean fresh;        // result not reported yet
+  unsigned long sum;
+  unsigned int result;
+  unsigned int window[ANALOG_FILTER_MAX_WINDOW];
+};
+
+class AnalogFilterFirmata: public FirmataFeature
+{
+  public:
+    AnalogFilterFirmata();
+    boolean handlePinMode(byte pin, int mode);
+    void handleCapability(byte pin);
+    boolean handleSysex(byte command, byte argc, byte *argv);
+    void update();
+    void reset();
+
+    boolean report(byte channel);
+
+  private:
+    analog_filter filters[ANALOG_FILTER_MAX_FILTERS];
+    byte nextFilter;
+
+    analog_filter *find(byte channel);
+    void configure(byte channel, byte type, byte parameter);
+    void sendConfig(byte channel);
+    void addSample(analog_filter *filter, unsigned int value);
+    unsigned int median(analog_filter *filter);
+};
+
+#endif /* AnalogFilterFirmata_h */
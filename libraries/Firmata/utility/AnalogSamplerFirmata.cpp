@@ -0,0 +1,413 @@
+/*
+  AnalogSamplerFirmata.cpp
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "AnalogSamplerFirmata.h"
+
+#if defined(SAMPLER_USE_FREE_RUNNING_ADC)
+#ifndef SAMPLER_ADC_REFERENCE
+#define SAMPLER_ADC_REFERENCE       DEFAULT
+#endif
+
+// the ADC interrupt can only be routed to a single sampler
+static AnalogSamplerFirmata *activeSampler = NULL;
+
+void AnalogSamplerFirmata::adcInterrupt()
+{
+  activeSampler->storeConversion(ADC);
+}
+#endif
+
+/*
+ * Replaced by the sketch when it defines FIRMATA_SAMPLER_ISR, see
+ * AnalogSamplerFirmata.h.
+ */
+__attribute__((weak)) boolean AnalogSamplerFirmata::hasAdcInterrupt()
+{
+  return false;
+}
+
+AnalogSamplerFirmata::AnalogSamplerFirmata()
+{
+  running = false;
+#if defined(SAMPLER_USE_FREE_RUNNING_ADC)
+  freeRunning = hasAdcInterrupt();
+#else
+  freeRunning = false;
+#endif
+  reset();
+}
+
+boolean AnalogSamplerFirmata::handlePinMode(byte pin, int mode)
+{
+  // the sampler works on pins already configured as PIN_MODE_ANALOG
+  return false;
+}
+
+void AnalogSamplerFirmata::handleCapability(byte pin)
+{
+}
+
+boolean AnalogSamplerFirmata::handleSysex(byte command, byte argc, byte *argv)
+{
+  if (command != ANALOG_SAMPLER_DATA) {
+    return false;
+  }
+  if (argc < 1) {
+    return true;
+  }
+
+  switch (argv[0]) {
+    case SAMPLER_CONFIG:
+      if (argc > 5) {
+        unsigned long period = (unsigned long)argv[1] | ((unsigned long)argv[2] << 7)
+                               | ((unsigned long)argv[3] << 14);
+        byte count = argv[5];
+
+        if (count == 0 || count > SAMPLER_MAX_CHANNELS || argc < 6 + count) {
+          Firmata.sendString("Sampler: invalid channel list");
+          break;
+        }
+        for (byte i = 0; i < count; i++) {
+          if (argv[6 + i] >= TOTAL_ANALOG_PINS) {
+            Firmata.sendString("Sampler: invalid analog pin");
+            return true;
+          }
+        }
+
+        stop();
+        for (byte i = 0; i < count; i++) {
+#if defined(analogPinToChannel)
+          channels[i] = analogPinToChannel(argv[6 + i]);
+#else
+          channels[i] = argv[6 + i];
+#endif
+        }
+        channelCount = count;
+        burstFrames = argv[4] > 0 ? argv[4] : SAMPLER_DEFAULT_BURST;
+        // a burst must fit into the ring buffer
+        if ((unsigned int)burstFrames * channelCount > SAMPLER_BUFFER_SIZE / 2) {
+          burstFrames = (SAMPLER_BUFFER_SIZE / 2) / channelCount;
+        }
+        configure(period);
+      }
+      // a config message without arguments reports the current configuration
+      sendConfig();
+      break;
+    case SAMPLER_START:
+      start();
+      break;
+    case SAMPLER_STOP:
+      stop();
+      break;
+  }
+  return true;
+}
+
+/*
+ * Ship buffered frames to the host. At most one burst is sent per call so the
+ * main loop stays responsive even when the link is slower than the sampler.
+ */
+void AnalogSamplerFirmata::update()
+{
+  if (channelCount == 0) {
+    return;
+  }
+
+  if (running && !freeRunning) {
+    while ((long)(micros() - nextSampleMicros) >= 0) {
+      if (!overflowed && SAMPLER_BUFFER_SIZE - 1 - bufferedSamples() >= channelCount) {
+        for (byte i = 0; i < channelCount; i++) {
+          lastValue[i] = analogRead(channels[i]);
+          buffer[head] = lastValue[i];
+          head = (head + 1) % SAMPLER_BUFFER_SIZE;
+        }
+      } else {
+        overflowed = true;
+      }
+      frameCount++;
+      nextSampleMicros += periodMicros;
+    }
+  }
+
+  byte frames = bufferedSamples() / channelCount;
+  if (frames >= burstFrames) {
+    sendBurst(burstFrames);
+  } else if (overflowed && frames > 0) {
+    // nothing is stored after an overrun, so drain what is left
+    sendBurst(frames);
+  } else if (overflowed) {
+    // the buffer has been drained after an overrun, resume storing frames and
+    // restart the frame numbering at the next frame produced by the sampler
+    noInterrupts();
+    readFrame = frameCount;
+    overflowed = false;
+    interrupts();
+    if (overruns < 127) overruns++;
+  }
+}
+
+void AnalogSamplerFirmata::reset()
+{
+  stop();
+  channelCount = 0;
+  burstFrames = SAMPLER_DEFAULT_BURST;
+  framePeriodNanos = 0;
+  head = tail = 0;
+}
+
+boolean AnalogSamplerFirmata::isRunning()
+{
+  return running;
+}
+
+/*
+ * An analogRead() would stop the free-running ADC, so while sampling the last
+ * conversion of a sampled channel is returned and other channels read as 0.
+ */
+boolean AnalogSamplerFirmata::readAnalog(byte channel, int &value)
+{
+  if (!running) {
+    return false;
+  }
+  value = 0;
+  for (byte i = 0; i < channelCount; i++) {
+    if (channels[i] == channel) {
+      noInterrupts();
+      value = lastValue[i];
+      interrupts();
+    }
+  }
+  return true;
+}
+
+//******************************************************************************
+//* Private Methods
+//******************************************************************************
+
+#if defined(SAMPLER_USE_FREE_RUNNING_ADC)
+/*
+ * Store one ADC conversion. Runs in interrupt context.
+ */
+void AnalogSamplerFirmata::storeConversion(unsigned int value)
+{
+  // In free-running mode the conversion following the one that just completed
+  // has already started, so a new mux setting applies to the one after that.
+  byte index = convIndex;
+  convIndex = muxIndex;
+  if (channelCount > 1) {
+    muxIndex = (muxIndex + 1 == channelCount) ? 0 : muxIndex + 1;
+    selectChannel(muxIndex);
+  }
+
+  if (discardConversion) {
+    // the first conversion after enabling free-running mode
+    discardConversion = false;
+    return;
+  }
+  lastValue[index] = value;
+
+  if (index == 0) {
+    // first channel of a frame, decide whether this frame is kept
+    storingFrame = false;
+    if (frameTick == 0) {
+      if (!overflowed) {
+        if (SAMPLER_BUFFER_SIZE - 1 - bufferedSamples() >= channelCount) {
+          storingFrame = true;
+        } else {
+          overflowed = true;
+        }
+      }
+      frameCount++;
+    }
+    if (++frameTick >= frameDivider) {
+      frameTick = 0;
+    }
+  }
+
+  if (storingFrame) {
+    buffer[head] = value;
+    head = (head + 1) % SAMPLER_BUFFER_SIZE;
+  }
+}
+#endif
+
+/*
+ * Choose the ADC clock and decimation closest to the requested frame period.
+ * On AVR the frame period is a whole multiple of the conversion time, which is
+ * 13 ADC clock cycles.
+ */
+void AnalogSamplerFirmata::configure(unsigned long period)
+{
+  if (period < 1) period = 1;
+  if (period > 2000000UL) period = 2000000UL;
+  periodMicros = period;
+  framePeriodNanos = period * 1000UL;
+
+#if defined(SAMPLER_USE_FREE_RUNNING_ADC)
+  if (!freeRunning) {
+    return;
+  }
+
+  // ADC clock prescalers from slowest (most accurate) to fastest
+  static const byte prescalers[] = { 128, 64, 32, 16 };
+  static const byte prescalerSelect[] = { 7, 6, 5, 4 };
+  unsigned long requested = period * 1000UL;
+  unsigned long rawFrame = 0;
+
+  for (byte i = 0; i < sizeof(prescalers); i++) {
+    rawFrame = (13000UL * prescalers[i] / (F_CPU / 1000000UL)) * channelCount;
+    prescalerBits = prescalerSelect[i];
+    if (rawFrame <= requested) {
+      break;
+    }
+  }
+
+  unsigned long divider = (requested + rawFrame / 2) / rawFrame;
+  if (divider < 1) divider = 1;
+  if (divider > 0xFFFF) divider = 0xFFFF;
+  frameDivider = divider;
+  framePeriodNanos = rawFrame * divider;
+#endif
+}
+
+void AnalogSamplerFirmata::start()
+{
+  if (channelCount == 0) {
+    Firmata.sendString("Sampler: not configured");
+    return;
+  }
+  stop();
+
+  head = tail = 0;
+  overflowed = false;
+  frameCount = 0;
+  readFrame = 0;
+  overruns = 0;
+  for (byte i = 0; i < channelCount; i++) {
+    lastValue[i] = 0;
+  }
+
+#if defined(SAMPLER_USE_FREE_RUNNING_ADC)
+  if (freeRunning) {
+    noInterrupts();
+    activeSampler = this;
+    frameTick = 0;
+    storingFrame = false;
+    // The mux is latched when a conversion starts, so select the first
+    // channel before starting. The second conversion starts on the same
+    // channel, the interrupt of the first one queues the next channel.
+    convIndex = 0;
+    muxIndex = 0;
+    discardConversion = true;
+    selectChannel(0);
+    // free-running mode: no auto trigger source
+    ADCSRB &= ~((1 << ADTS2) | (1 << ADTS1) | (1 << ADTS0));
+    ADCSRA = (1 << ADEN) | (1 << ADATE) | (1 << ADIE) | prescalerBits;
+    ADCSRA |= (1 << ADSC);
+    running = true;
+    interrupts();
+    return;
+  }
+#endif
+  nextSampleMicros = micros();
+  running = true;
+}
+
+/*
+ * Stop sampling, hand the ADC back to analogRead() and flush complete frames.
+ */
+void AnalogSamplerFirmata::stop()
+{
+  if (!running) {
+    return;
+  }
+
+#if defined(SAMPLER_USE_FREE_RUNNING_ADC)
+  if (freeRunning) {
+    noInterrupts();
+    // restore the configuration set by the Arduino core (ADC clock / 128)
+    ADCSRA = (1 << ADEN) | (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0);
+    interrupts();
+  }
+#endif
+  running = false;
+
+  byte frames = bufferedSamples() / channelCount;
+  while (frames > 0) {
+    byte count = frames < burstFrames ? frames : burstFrames;
+    sendBurst(count);
+    frames -= count;
+  }
+  head = tail = 0;
+}
+
+#if defined(SAMPLER_USE_FREE_RUNNING_ADC)
+void AnalogSamplerFirmata::selectChannel(byte index)
+{
+  byte channel = channels[index];
+#if defined(MUX5)
+  if (channel & 0x08) {
+    ADCSRB |= (1 << MUX5);
+  } else {
+    ADCSRB &= ~(1 << MUX5);
+  }
+#endif
+  ADMUX = (SAMPLER_ADC_REFERENCE << 6) | (channel & 0x07);
+}
+#endif
+
+byte AnalogSamplerFirmata::bufferedSamples()
+{
+  byte h = head;
+  return (h + SAMPLER_BUFFER_SIZE - tail) % SAMPLER_BUFFER_SIZE;
+}
+
+/*
+ * SAMPLER_CONFIG reply: frame period in nanoseconds (5 x 7 bits), frames per
+ * burst, number of channels.
+ */
+void AnalogSamplerFirmata::sendConfig()
+{
+  Firmata.startSysex();
+  Firmata.write(ANALOG_SAMPLER_DATA);
+  Firmata.write(SAMPLER_CONFIG);
+  for (byte i = 0; i < 5; i++) {
+    Firmata.write((byte)(framePeriodNanos >> (7 * i)) & 0x7F);
+  }
+  Firmata.write(burstFrames);
+  Firmata.write(channelCount);
+  Firmata.endSysex();
+}
+
+/*
+ * SAMPLER_BURST: frame number of the first frame (4 x 7 bits), overrun count,
+ * number of channels, number of frames, then each sample as 2 7-bit bytes in
+ * channel order.
+ */
+void AnalogSamplerFirmata::sendBurst(byte frames)
+{
+  Firmata.startSysex();
+  Firmata.write(ANALOG_SAMPLER_DATA);
+  Firmata.write(SAMPLER_BURST);
+  for (byte i = 0; i < 4; i++) {
+    Firmata.write((byte)(readFrame >> (7 * i)) & 0x7F);
+  }
+  Firmata.write(overruns);
+  Firmata.write(channelCount);
+  Firmata.write(frames);
+  for (int i = frames * channelCount; i > 0; i--) {
+    Firmata.sendValueAsTwo7bitBytes(buffer[tail]);
+    tail = (tail + 1) % SAMPLER_BUFFER_SIZE;
+  }
+  Firmata.endSysex();
+  readFrame += frames;
+}
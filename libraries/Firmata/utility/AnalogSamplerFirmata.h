@@ -0,0 +1,125 @@
+/*
+  AnalogSamplerFirmata.h
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+
+  Timer driven analog sampling engine. On AVR boards the ADC runs in
+  free-running mode and an interrupt stores each conversion in a ring
+  buffer, so samples are taken at a fixed, crystal derived rate regardless
+  of what the main loop is doing. Samples are grouped in frames (one sample
+  per configured channel) and shipped to the host in bulk sysex bursts. The
+  burst header carries the frame number of its first frame, so the host can
+  compute the exact time of every sample as frameNumber * framePeriod.
+
+  The ADC interrupt handler is only compiled into sketches that ask for it,
+  so a sketch or library with its own ADC_vect still links. Define
+  FIRMATA_SAMPLER_ISR before including this file, in one file of the
+  sketch. Without it, and on other architectures, update() polls micros()
+  and calls analogRead().
+*/
+
+#ifndef AnalogSamplerFirmata_h
+#define AnalogSamplerFirmata_h
+
+#include <Firmata.h>
+#include "FirmataFeature.h"
+
+#define FIRMATA_ANALOG_SAMPLER_FEATURE
+
+// ANALOG_SAMPLER_DATA sub-commands
+#define SAMPLER_CONFIG              0x00 // query: period, burst size, channels / reply: actual period
+#define SAMPLER_START               0x01
+#define SAMPLER_STOP                0x02
+#define SAMPLER_BURST               0x03 // reply: a block of consecutive frames
+
+#define SAMPLER_MAX_CHANNELS        8
+#define SAMPLER_DEFAULT_BURST       16 // frames per burst
+
+// number of 16-bit samples held between the ISR and the main loop
+#ifndef SAMPLER_BUFFER_SIZE
+#if defined(RAMEND) && RAMEND < 0x900
+#define SAMPLER_BUFFER_SIZE         96  // ATmega328p and smaller
+#else
+#define SAMPLER_BUFFER_SIZE         255
+#endif
+#endif
+
+#if defined(ARDUINO_ARCH_AVR) && defined(ADCSRA) && defined(ADATE)
+#define SAMPLER_USE_FREE_RUNNING_ADC
+#endif
+
+class AnalogSamplerFirmata: public FirmataFeature
+{
+  public:
+    AnalogSamplerFirmata();
+    boolean handlePinMode(byte pin, int mode);
+    void handleCapability(byte pin);
+    boolean handleSysex(byte command, byte argc, byte *argv);
+    void update();
+    void reset();
+    boolean isRunning();
+    boolean readAnalog(byte channel, int &value);
+
+    // called from the ADC interrupt, do not use directly
+    static void adcInterrupt();
+    static boolean hasAdcInterrupt();
+
+  private:
+    byte channels[SAMPLER_MAX_CHANNELS];
+    byte channelCount;
+    byte burstFrames;
+    unsigned long framePeriodNanos;
+    volatile boolean running;
+
+    // ring buffer shared with the ISR
+    unsigned int buffer[SAMPLER_BUFFER_SIZE];
+    unsigned int lastValue[SAMPLER_MAX_CHANNELS];
+    volatile byte head;
+    volatile byte tail;
+    volatile boolean overflowed;
+    volatile unsigned long frameCount; // frames produced since start (stored or not)
+    unsigned long readFrame;           // frame number of the sample at tail
+    byte overruns;
+
+    boolean freeRunning;      // the ADC interrupt stores the samples
+#if defined(SAMPLER_USE_FREE_RUNNING_ADC)
+    byte prescalerBits;
+    unsigned int frameDivider;
+    volatile unsigned int frameTick;
+    volatile byte convIndex;  // channel index of the conversion in progress
+    volatile byte muxIndex;   // channel index selected for the following conversion
+    volatile boolean storingFrame;
+    volatile boolean discardConversion;
+    void selectChannel(byte index);
+    void storeConversion(unsigned int value);
+#endif
+    unsigned long periodMicros;
+    unsigned long nextSampleMicros;
+
+    void configure(unsigned long periodMicros);
+    void start();
+    void stop();
+    byte bufferedSamples();
+    void sendConfig();
+    void sendBurst(byte frames);
+};
+
+#if defined(FIRMATA_SAMPLER_ISR) && defined(SAMPLER_USE_FREE_RUNNING_ADC)
+ISR(ADC_vect)
+{
+  AnalogSamplerFirmata::adcInterrupt();
+}
+
+boolean AnalogSamplerFirmata::hasAdcInterrupt()
+{
+  return true;
+}
+#endif
+
+#endif /* AnalogSamplerFirmata_h */
@@ -22,6 +22,17 @@
 #define BLESTREAM_TXBUFFER_FLUSH_INTERVAL 80
 #define BLESTREAM_MIN_FLUSH_INTERVAL 8 // minimum interval for flushing the TX buffer
 
+// largest notification payload, raise it only if the BLE stack supports longer attributes
+#ifndef BLESTREAM_MAX_PAYLOAD
+#define BLESTREAM_MAX_PAYLOAD _MAX_ATTR_DATA_LEN_
+#endif
+
+// number of notifications that can wait for the link, so several can go out
+// in one connection interval
+#ifndef BLESTREAM_TX_QUEUE_LENGTH
+#define BLESTREAM_TX_QUEUE_LENGTH 4
+#endif
+
 // #define BLE_SERIAL_DEBUG
 
 class BLEStream : public BLEPeripheral, public Stream
@@ -33,6 +44,7 @@ class BLEStream : public BLEPeripheral, public Stream
     bool poll();
     void end();
     void setFlushInterval(int);
+    void setMtu(uint16_t mtu);
 
     virtual int available(void);
     virtual int peek(void);
@@ -44,7 +56,7 @@ class BLEStream : public BLEPeripheral, public Stream
 
   private:
     bool _connected;
-    unsigned long _flushed;
+    unsigned long _txStarted; // when the notification being filled got its first byte
     int _flushInterval;
     static BLEStream* _instance;
 
@@ -52,16 +64,24 @@ class BLEStream : public BLEPeripheral, public Stream
     size_t _rxTail;
     size_t _rxCount() const;
     unsigned char _rxBuffer[256];
-    size_t _txCount;
-    unsigned char _txBuffer[_MAX_ATTR_DATA_LEN_];
+    size_t _txCount;          // bytes in the notification being filled
+    size_t _txPayload;        // notification size allowed by the ATT MTU
+    uint8_t _txHead;          // notification being filled
+    uint8_t _txTail;          // oldest notification waiting for the link
+    uint8_t _txQueued;        // complete notifications waiting for the link
+    size_t _txLength[BLESTREAM_TX_QUEUE_LENGTH];
+    unsigned char _txBuffer[BLESTREAM_TX_QUEUE_LENGTH][BLESTREAM_MAX_PAYLOAD];
 
     BLEService _uartService = BLEService("6E400001-B5A3-F393-E0A9-E50E24DCCA9E");
     BLEDescriptor _uartNameDescriptor = BLEDescriptor("2901", "UART");
-    BLECharacteristic _rxCharacteristic = BLECharacteristic("6E400002-B5A3-F393-E0A9-E50E24DCCA9E", BLEWriteWithoutResponse, _MAX_ATTR_DATA_LEN_);
+    BLECharacteristic _rxCharacteristic = BLECharacteristic("6E400002-B5A3-F393-E0A9-E50E24DCCA9E", BLEWriteWithoutResponse, BLESTREAM_MAX_PAYLOAD);
     BLEDescriptor _rxNameDescriptor = BLEDescriptor("2901", "RX - Receive Data (Write)");
-    BLECharacteristic _txCharacteristic = BLECharacteristic("6E400003-B5A3-F393-E0A9-E50E24DCCA9E", BLENotify, _MAX_ATTR_DATA_LEN_);
+    BLECharacteristic _txCharacteristic = BLECharacteristic("6E400003-B5A3-F393-E0A9-E50E24DCCA9E", BLENotify, BLESTREAM_MAX_PAYLOAD);
     BLEDescriptor _txNameDescriptor = BLEDescriptor("2901", "TX - Transfer Data (Notify)");
 
+    bool _canNotify();
+    void _queueTx();
+    void _sendQueued();
     void _received(const unsigned char* data, size_t size);
     static void _received(BLECentral& /*central*/, BLECharacteristic& rxCharacteristic);
 };
@@ -83,8 +103,10 @@ BLEStream::BLEStream(unsigned char req, unsigned char rdy, unsigned char rst) :
 #endif
 {
   this->_txCount = 0;
+  this->_txPayload = BLESTREAM_MAX_PAYLOAD;
+  this->_txHead = this->_txTail = this->_txQueued = 0;
   this->_rxHead = this->_rxTail = 0;
-  this->_flushed = 0;
+  this->_txStarted = 0;
   this->_flushInterval = BLESTREAM_TXBUFFER_FLUSH_INTERVAL;
   BLEStream::_instance = this;
 
@@ -106,12 +128,21 @@ void BLEStream::begin(...)
 #endif
 }
 
+/*
+ * Sends pending output adaptively: a partly filled notification goes out right away if nothing
+ * is waiting for the link, otherwise it keeps collecting output until it is full or the flush
+ * interval expires.
+ */
 bool BLEStream::poll()
 {
   // BLEPeripheral::poll is called each time connected() is called
   this->_connected = BLEPeripheral::connected();
-  if (millis() > this->_flushed + this->_flushInterval) {
-    flush();
+  _sendQueued();
+  if (this->_txCount > 0) {
+    if ((this->_txQueued == 0 && _canNotify()) || millis() - this->_txStarted >= (unsigned long)this->_flushInterval) {
+      _queueTx();
+      _sendQueued();
+    }
   }
   return this->_connected;
 }
@@ -171,18 +202,18 @@ int BLEStream::read(void)
   return byte;
 }
 
+/*
+ * Sends all pending output, waiting for the link if necessary.
+ */
 void BLEStream::flush(void)
 {
-  if (this->_txCount == 0) return;
+  _queueTx();
+  while (this->_txQueued > 0) {
 #ifndef _VARIANT_ARDUINO_101_X_
-  // ensure there are available packets before sending
-  while(!this->_txCharacteristic.canNotify()) {
     BLEPeripheral::poll();
-  }
 #endif
-  this->_txCharacteristic.setValue(this->_txBuffer, this->_txCount);
-  this->_flushed = millis();
-  this->_txCount = 0;
+    _sendQueued();
+  }
 #ifdef BLE_SERIAL_DEBUG
   Serial.println(F("BLEStream::flush()"));
 #endif
@@ -194,8 +225,12 @@ size_t BLEStream::write(uint8_t byte)
   BLEPeripheral::poll();
 #endif
   if (this->_txCharacteristic.subscribed() == false) return 0;
-  this->_txBuffer[this->_txCount++] = byte;
-  if (this->_txCount == sizeof(this->_txBuffer)) flush();
+  if (this->_txCount == 0) this->_txStarted = millis();
+  this->_txBuffer[this->_txHead][this->_txCount++] = byte;
+  if (this->_txCount >= this->_txPayload) {
+    _queueTx();
+    _sendQueued();
+  }
 #ifdef BLE_SERIAL_DEBUG
   Serial.print(F("BLEStream::write( 0x"));
   Serial.print(byte, HEX);
@@ -221,6 +256,59 @@ void BLEStream::setFlushInterval(int interval)
   }
 }
 
+/*
+ * Limit notifications to the ATT MTU negotiated with the central (the payload is mtu - 3 bytes),
+ * as far as BLESTREAM_MAX_PAYLOAD allows.
+ */
+void BLEStream::setMtu(uint16_t mtu)
+{
+  size_t payload = mtu > 3 ? mtu - 3 : 1;
+  if (payload > BLESTREAM_MAX_PAYLOAD) payload = BLESTREAM_MAX_PAYLOAD;
+  if (this->_txCount >= payload) _queueTx();
+  this->_txPayload = payload;
+}
+
+bool BLEStream::_canNotify()
+{
+#ifdef _VARIANT_ARDUINO_101_X_
+  // CurieBLE queues notifications internally
+  return true;
+#else
+  return this->_txCharacteristic.canNotify();
+#endif
+}
+
+/*
+ * Close the notification being filled and queue it, waiting for the link only if the queue is
+ * full.
+ */
+void BLEStream::_queueTx()
+{
+  if (this->_txCount == 0) return;
+  while (this->_txQueued == BLESTREAM_TX_QUEUE_LENGTH - 1) {
+#ifndef _VARIANT_ARDUINO_101_X_
+    BLEPeripheral::poll();
+#endif
+    _sendQueued();
+  }
+  this->_txLength[this->_txHead] = this->_txCount;
+  this->_txHead = (this->_txHead + 1) % BLESTREAM_TX_QUEUE_LENGTH;
+  this->_txQueued++;
+  this->_txCount = 0;
+}
+
+/*
+ * Hand queued notifications to the BLE stack for as long as it has buffers for them.
+ */
+void BLEStream::_sendQueued()
+{
+  while (this->_txQueued > 0 && _canNotify()) {
+    this->_txCharacteristic.setValue(this->_txBuffer[this->_txTail], this->_txLength[this->_txTail]);
+    this->_txTail = (this->_txTail + 1) % BLESTREAM_TX_QUEUE_LENGTH;
+    this->_txQueued--;
+  }
+}
+
 void BLEStream::_received(const unsigned char* data, size_t size)
 {
   for (size_t i = 0; i < size; i++) {
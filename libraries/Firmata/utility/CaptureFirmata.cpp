@@ -0,0 +1,346 @@
+/*
+  CaptureFirmata.cpp
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "CaptureFirmata.h"
+
+// bytes per sendBinary() call, a multiple of 7 keeps the packed encoding continuous
+#define CAPTURE_UPLOAD_CHUNK        56
+
+CaptureFirmata::CaptureFirmata()
+{
+  reset();
+}
+
+boolean CaptureFirmata::handlePinMode(byte pin, int mode)
+{
+  // pins are captured in whatever mode they are in
+  return false;
+}
+
+void CaptureFirmata::handleCapability(byte pin)
+{
+}
+
+boolean CaptureFirmata::handleSysex(byte command, byte argc, byte *argv)
+{
+  if (command != CAPTURE_DATA) {
+    return false;
+  }
+  if (argc < 1) {
+    return true;
+  }
+
+  switch (argv[0]) {
+    case CAPTURE_CONFIG:
+      configure(argc, argv);
+      break;
+    case CAPTURE_ARM:
+      arm(argc, argv);
+      break;
+  }
+  return true;
+}
+
+/*
+ * Take the samples of a running capture that are due, for at most
+ * CAPTURE_SLICE_MICROS (plus one wait and one sample).
+ */
+void CaptureFirmata::update()
+{
+  unsigned long start = micros();
+  while (running) {
+    unsigned long now = micros();
+    long wait = (long)(nextMicros - now);
+    if (wait > CAPTURE_MAX_WAIT_MICROS || now - start >= CAPTURE_SLICE_MICROS) {
+      return;
+    }
+    while ((long)(micros() - nextMicros) < 0);
+    takeSample();
+  }
+}
+
+void CaptureFirmata::reset()
+{
+  running = false;
+  recordSize = 0;
+  digitalCount = 0;
+  analogCount = 0;
+}
+
+boolean CaptureFirmata::isRunning()
+{
+  return running;
+}
+
+//******************************************************************************
+//* Private Methods
+//******************************************************************************
+
+void CaptureFirmata::configure(byte argc, byte *argv)
+{
+  // a running capture is abandoned
+  running = false;
+  recordSize = 0;
+  if (argc < 10) {
+    Firmata.sendString("Capture: invalid configuration");
+    return;
+  }
+  periodMicros = (unsigned long)argv[1] | ((unsigned long)argv[2] << 7)
+                 | ((unsigned long)argv[3] << 14);
+  preSamples = argv[4] | (argv[5] << 7);
+  postSamples = argv[6] | (argv[7] << 7);
+
+  byte count = argv[8];
+  byte index = 9;
+  if (count > CAPTURE_MAX_DIGITAL || argc < index + count + 1) {
+    Firmata.sendString("Capture: invalid pin list");
+    return;
+  }
+  for (byte i = 0; i < count; i++) {
+    byte pin = argv[index++];
+    if (!IS_PIN_DIGITAL(pin)) {
+      Firmata.sendString("Capture: invalid pin");
+      return;
+    }
+    digitalPins[i] = pin;
+#if defined(ARDUINO_ARCH_AVR)
+    inputRegister[i] = portInputRegister(digitalPinToPort(PIN_TO_DIGITAL(pin)));
+    inputMask[i] = digitalPinToBitMask(PIN_TO_DIGITAL(pin));
+#endif
+  }
+  digitalCount = count;
+
+  count = argv[index++];
+  if (count > CAPTURE_MAX_ANALOG || argc < index + count) {
+    Firmata.sendString("Capture: invalid channel list");
+    return;
+  }
+  for (byte i = 0; i < count; i++) {
+    byte channel = argv[index++];
+    if (channel >= TOTAL_ANALOG_PINS) {
+      Firmata.sendString("Capture: invalid analog pin");
+      return;
+    }
+    analogChannels[i] = channel;
+  }
+  analogCount = count;
+
+  byte size = (digitalCount + 7) / 8 + 2 * analogCount;
+  if (size == 0 || periodMicros == 0 || postSamples == 0
+      || (unsigned long)(preSamples + postSamples) * size > CAPTURE_BUFFER_SIZE) {
+    Firmata.sendString("Capture: does not fit the buffer");
+    return;
+  }
+  if (periodMicros > CAPTURE_MAX_DURATION * 1000UL / (preSamples + postSamples)) {
+    Firmata.sendString("Capture: takes too long");
+    return;
+  }
+  recordSize = size;
+}
+
+/*
+ * Start a capture, or restart the running one with the new trigger.
+ */
+void CaptureFirmata::arm(byte argc, byte *argv)
+{
+  running = false;
+  if (recordSize == 0) {
+    Firmata.sendString("Capture: not configured");
+    return;
+  }
+  if (argc < 3) {
+    return;
+  }
+  triggerType = argv[1];
+  byte source = argv[2];
+  threshold = argc > 4 ? argv[3] | (argv[4] << 7) : 0;
+  timeoutMillis = argc > 6 ? argv[5] | (argv[6] << 7) : 0;
+  if (timeoutMillis == 0) {
+    timeoutMillis = CAPTURE_DEFAULT_TIMEOUT;
+  }
+
+  // the trigger source has to be one of the captured pins or channels
+  byte count = 0;
+  const byte *list = NULL;
+  switch (triggerType) {
+    case CAPTURE_TRIGGER_NOW:
+      break;
+    case CAPTURE_TRIGGER_RISING:
+    case CAPTURE_TRIGGER_FALLING:
+    case CAPTURE_TRIGGER_CHANGE:
+      list = digitalPins;
+      count = digitalCount;
+      break;
+    case CAPTURE_TRIGGER_ABOVE:
+    case CAPTURE_TRIGGER_BELOW:
+      list = analogChannels;
+      count = analogCount;
+      break;
+    default:
+      Firmata.sendString("Capture: unknown trigger");
+      return;
+  }
+  if (list) {
+    for (triggerIndex = 0; triggerIndex < count && list[triggerIndex] != source; triggerIndex++);
+    if (triggerIndex == count) {
+      Firmata.sendString("Capture: trigger source is not captured");
+      return;
+    }
+  }
+
+  head = 0;
+  before = 0;
+  after = 0;
+  late = 0;
+  previous = -1;
+  fired = false;
+  startMillis = millis();
+  nextMicros = micros();
+  running = true;
+}
+
+/*
+ * Store the current state of all captured pins and channels.
+ */
+void CaptureFirmata::record(byte *sample)
+{
+  byte bits = 0;
+  for (byte i = 0; i < digitalCount; i++) {
+#if defined(ARDUINO_ARCH_AVR)
+    boolean high = (*inputRegister[i] & inputMask[i]) != 0;
+#else
+    boolean high = digitalRead(PIN_TO_DIGITAL(digitalPins[i])) == HIGH;
+#endif
+    if (high) {
+      bits |= 1 << (i & 7);
+    }
+    if ((i & 7) == 7 || i == digitalCount - 1) {
+      *sample++ = bits;
+      bits = 0;
+    }
+  }
+  for (byte i = 0; i < analogCount; i++) {
+    // the sampler may take over the ADC during a capture
+    unsigned int value = Firmata.readAnalog(analogChannels[i]);
+    *sample++ = value & 0xFF;
+    *sample++ = value >> 8;
+  }
+}
+
+/*
+ * @return the level of the trigger source in a recorded sample
+ */
+int CaptureFirmata::sourceValue(const byte *sample)
+{
+  if (triggerType >= CAPTURE_TRIGGER_ABOVE) {
+    const byte *value = sample + (digitalCount + 7) / 8 + 2 * triggerIndex;
+    return value[0] | (value[1] << 8);
+  }
+  return (sample[triggerIndex / 8] >> (triggerIndex & 7)) & 1;
+}
+
+/*
+ * Take the sample that is due and check the trigger. Sends the result once
+ * the post-trigger samples are recorded or the arm timeout expired.
+ */
+void CaptureFirmata::takeSample()
+{
+  unsigned int capacity = preSamples + postSamples;
+  unsigned long now = micros();
+  if (now - nextMicros >= periodMicros) {
+    // delayed by the rest of the loop, do not catch up with a burst
+    if (late < 0x3FFF) late++;
+    nextMicros = now;
+  }
+  nextMicros += periodMicros;
+
+  byte *sample = buffer + head * recordSize;
+  record(sample);
+  head = (head + 1) % capacity;
+
+  if (fired) {
+    after++;
+  } else {
+    int value = triggerType == CAPTURE_TRIGGER_NOW ? 0 : sourceValue(sample);
+    switch (triggerType) {
+      case CAPTURE_TRIGGER_NOW:
+        fired = true;
+        break;
+      case CAPTURE_TRIGGER_RISING:
+        fired = previous == 0 && value == 1;
+        break;
+      case CAPTURE_TRIGGER_FALLING:
+        fired = previous == 1 && value == 0;
+        break;
+      case CAPTURE_TRIGGER_CHANGE:
+        fired = previous >= 0 && previous != value;
+        break;
+      case CAPTURE_TRIGGER_ABOVE:
+        fired = previous >= 0 && previous < (int)threshold && value >= (int)threshold;
+        break;
+      case CAPTURE_TRIGGER_BELOW:
+        fired = previous >= (int)threshold && value < (int)threshold;
+        break;
+    }
+    previous = value;
+    if (fired) {
+      after = 1;
+    } else {
+      before++;
+    }
+  }
+
+  if (fired ? after >= postSamples : millis() - startMillis >= timeoutMillis) {
+    running = false;
+    // after a timeout the host gets the last pre-trigger samples
+    unsigned int pre = before < preSamples ? before : preSamples;
+    unsigned int count = pre + after;
+    sendResult(fired ? CAPTURE_TRIGGERED : CAPTURE_TIMEOUT, late, capacity,
+               (head + capacity - count) % capacity, pre, count);
+  }
+}
+
+/*
+ * Send a CAPTURE_RESULT with count records starting at record slot first.
+ */
+void CaptureFirmata::sendResult(byte status, unsigned int late, unsigned int capacity,
+                                unsigned int first, unsigned int pre, unsigned int count)
+{
+  Firmata.startSysex();
+  Firmata.write(CAPTURE_DATA);
+  Firmata.write(CAPTURE_RESULT);
+  Firmata.write(status);
+  Firmata.write(late & 0x7F);
+  Firmata.write(late >> 7);
+  Firmata.write(periodMicros & 0x7F);
+  Firmata.write((periodMicros >> 7) & 0x7F);
+  Firmata.write((periodMicros >> 14) & 0x7F);
+  Firmata.write(pre & 0x7F);
+  Firmata.write(pre >> 7);
+  Firmata.write(count & 0x7F);
+  Firmata.write(count >> 7);
+  Firmata.write(recordSize);
+
+  byte chunk[CAPTURE_UPLOAD_CHUNK];
+  byte used = 0;
+  unsigned int size = capacity * recordSize;
+  unsigned int position = first * recordSize;
+  for (unsigned int remaining = count * recordSize; remaining > 0; remaining--) {
+    chunk[used++] = buffer[position];
+    position = (position + 1) % size;
+    if (used == CAPTURE_UPLOAD_CHUNK || remaining == 1) {
+      Firmata.sendBinary(used, chunk);
+      used = 0;
+    }
+  }
+  Firmata.endSysex();
+}
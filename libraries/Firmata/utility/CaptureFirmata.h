@@ -0,0 +1,126 @@
+/*
+  CaptureFirmata.h
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+
+  Trigger armed capture of digital pins and analog channels, like a
+  simple logic analyzer or scope. Once armed, the configured pins are
+  sampled at a fixed period into a RAM ring buffer until the trigger fired
+  and the post-trigger samples are recorded (or the arm timeout expires),
+  then the pre- and post-trigger samples are uploaded in one
+  CAPTURE_RESULT message using the negotiated binary encoding.
+
+  Sampling is paced by micros() from update() rather than by a timer
+  interrupt (the spare timers already belong to Servo, the stepper and the
+  analog sampler). Each call takes the samples that are due, waits for
+  one due within CAPTURE_MAX_WAIT_MICROS and returns after
+  CAPTURE_SLICE_MICROS, so the sketch keeps processing input during a
+  capture. A sample the rest of loop() delayed by more than one period is
+  taken at once and counted as late in the result, the following samples
+  keep the period from there. A recording (pre- and post-trigger samples)
+  may last at most CAPTURE_MAX_DURATION.
+
+  Each sample is recorded as the digital pins packed 8 per byte (in
+  configuration order, LSB first) followed by each analog channel as a
+  16 bit little endian value.
+*/
+
+#ifndef CaptureFirmata_h
+#define CaptureFirmata_h
+
+#include <Firmata.h>
+#include "FirmataFeature.h"
+
+#define FIRMATA_CAPTURE_FEATURE
+
+// CAPTURE_DATA sub-commands
+#define CAPTURE_CONFIG              0x00 // period, pre and post trigger samples, pins, channels
+#define CAPTURE_ARM                 0x01 // trigger, source, threshold, timeout
+#define CAPTURE_RESULT              0x02 // reply: status, timing and the recorded samples
+
+// CAPTURE_ARM trigger types
+#define CAPTURE_TRIGGER_NOW         0x00
+#define CAPTURE_TRIGGER_RISING      0x01 // digital pin goes high
+#define CAPTURE_TRIGGER_FALLING     0x02 // digital pin goes low
+#define CAPTURE_TRIGGER_CHANGE      0x03 // digital pin changes
+#define CAPTURE_TRIGGER_ABOVE       0x04 // analog channel rises to the threshold or above
+#define CAPTURE_TRIGGER_BELOW       0x05 // analog channel falls below the threshold
+
+// CAPTURE_RESULT status
+#define CAPTURE_TRIGGERED           0x00
+#define CAPTURE_TIMEOUT             0x01
+
+#define CAPTURE_MAX_DIGITAL         16
+#define CAPTURE_MAX_ANALOG          4
+#define CAPTURE_DEFAULT_TIMEOUT     1000 // ms
+#define CAPTURE_MAX_DURATION        10000 // ms, period * (pre + post trigger samples)
+#define CAPTURE_SLICE_MICROS        2000 // longest sampling run of one update()
+#define CAPTURE_MAX_WAIT_MICROS     200 // update() waits for a sample due this soon
+
+#ifndef CAPTURE_BUFFER_SIZE
+#if defined(RAMEND) && RAMEND < 0x900
+#define CAPTURE_BUFFER_SIZE         256
+#else
+#define CAPTURE_BUFFER_SIZE         2048
+#endif
+#endif
+
+class CaptureFirmata: public FirmataFeature
+{
+  public:
+    CaptureFirmata();
+    boolean handlePinMode(byte pin, int mode);
+    void handleCapability(byte pin);
+    boolean handleSysex(byte command, byte argc, byte *argv);
+    void update();
+    void reset();
+    boolean isRunning();
+
+  private:
+    unsigned long periodMicros;
+    unsigned int preSamples;
+    unsigned int postSamples;
+    byte digitalPins[CAPTURE_MAX_DIGITAL];
+    byte digitalCount;
+    byte analogChannels[CAPTURE_MAX_ANALOG];
+    byte analogCount;
+    byte recordSize;
+#if defined(ARDUINO_ARCH_AVR)
+    volatile uint8_t *inputRegister[CAPTURE_MAX_DIGITAL];
+    uint8_t inputMask[CAPTURE_MAX_DIGITAL];
+#endif
+
+    boolean running;
+    byte triggerType;
+    byte triggerIndex;          // position of the source in the digital pins or analog channels
+    unsigned int threshold;
+    unsigned int timeoutMillis;
+
+    // progress of the running capture
+    unsigned long startMillis;
+    unsigned long nextMicros;
+    unsigned int head;          // record slot for the next sample
+    unsigned int before;        // samples taken before the trigger
+    unsigned int after;         // samples taken from the trigger on
+    unsigned int late;          // samples taken more than one period late
+    int previous;               // trigger source level of the last sample
+    boolean fired;
+
+    byte buffer[CAPTURE_BUFFER_SIZE];
+
+    void configure(byte argc, byte *argv);
+    void arm(byte argc, byte *argv);
+    void record(byte *sample);
+    int sourceValue(const byte *sample);
+    void takeSample();
+    void sendResult(byte status, unsigned int late, unsigned int capacity,
+                    unsigned int first, unsigned int pre, unsigned int count);
+};
+
+#endif /* CaptureFirmata_h */
@@ -0,0 +1,312 @@
+/*
+  EncoderFirmata.cpp
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "EncoderFirmata.h"
+
+#define ENCODER_NOT_ATTACHED        0xFF
+
+/*
+ * Position change for each transition, indexed by the new B, new A, old B and
+ * old A pin states (bit 3 to 0). Transitions across two states happen when an
+ * edge was missed and count as 2.
+ */
+static const signed char transitions[16] = {
+  0, 1, -1, 2, -1, 0, -2, 1, 1, -2, 0, -1, 2, -1, 1, 0
+};
+
+// interrupt handlers cannot take arguments, so they are routed to one instance
+static EncoderFirmata *activeEncoder = NULL;
+
+static void encoderInterrupt()
+{
+  if (activeEncoder) {
+    activeEncoder->updatePositions();
+  }
+}
+
+EncoderFirmata::EncoderFirmata()
+{
+  activeEncoder = this;
+  for (byte i = 0; i < MAX_ENCODERS; i++) {
+    encoders[i].pins[0] = ENCODER_NOT_ATTACHED;
+  }
+  reportMode = ENCODER_REPORT_OFF;
+  reportFlags = 0;
+  reportInterval = ENCODER_DEFAULT_INTERVAL;
+}
+
+boolean EncoderFirmata::handlePinMode(byte pin, int mode)
+{
+  if (mode == PIN_MODE_ENCODER && isInterruptPin(pin)) {
+    pinMode(PIN_TO_DIGITAL(pin), INPUT_PULLUP);
+    Firmata.setPinMode(pin, PIN_MODE_ENCODER);
+    return true;
+  }
+  return false;
+}
+
+void EncoderFirmata::handleCapability(byte pin)
+{
+  if (isInterruptPin(pin)) {
+    Firmata.write(PIN_MODE_ENCODER);
+    Firmata.write(28); // 28 bits of position
+  }
+}
+
+boolean EncoderFirmata::handleSysex(byte command, byte argc, byte *argv)
+{
+  if (command != ENCODER_DATA) {
+    return false;
+  }
+  if (argc < 1) {
+    return true;
+  }
+
+  byte encoderNum = argc > 1 ? argv[1] : 0;
+  switch (argv[0]) {
+    case ENCODER_ATTACH:
+      if (argc > 3) {
+        attach(encoderNum, argv[2], argv[3]);
+      }
+      break;
+    case ENCODER_REPORT_POSITION:
+      if (argc > 1 && isAttached(encoderNum)) {
+        Firmata.startSysex();
+        Firmata.write(ENCODER_DATA);
+        sendPosition(encoderNum);
+        Firmata.endSysex();
+      }
+      break;
+    case ENCODER_REPORT_POSITIONS:
+      Firmata.startSysex();
+      Firmata.write(ENCODER_DATA);
+      for (byte i = 0; i < MAX_ENCODERS; i++) {
+        if (isAttached(i)) {
+          sendPosition(i);
+        }
+      }
+      Firmata.endSysex();
+      break;
+    case ENCODER_RESET_POSITION:
+      if (argc > 1 && isAttached(encoderNum)) {
+        noInterrupts();
+        encoders[encoderNum].position = 0;
+        interrupts();
+        encoders[encoderNum].lastPosition = 0;
+      }
+      break;
+    case ENCODER_REPORT_AUTO:
+      if (argc > 1) {
+        // a legacy enable flag of 1 is the interval mode
+        reportMode = argv[1] <= ENCODER_REPORT_ON_CHANGE ? argv[1] : ENCODER_REPORT_OFF;
+        reportInterval = ENCODER_DEFAULT_INTERVAL;
+        if (argc > 3 && (argv[2] | argv[3]) != 0) {
+          reportInterval = argv[2] | (argv[3] << 7);
+        }
+        reportFlags = argc > 4 ? argv[4] : 0;
+        lastReportMillis = millis();
+      }
+      break;
+    case ENCODER_DETACH:
+      if (argc > 1 && isAttached(encoderNum)) {
+        detach(encoderNum);
+      }
+      break;
+  }
+  return true;
+}
+
+/*
+ * Send the automatic reports.
+ */
+void EncoderFirmata::update()
+{
+  if (reportMode == ENCODER_REPORT_OFF) {
+    return;
+  }
+  unsigned long now = millis();
+  unsigned long elapsed = now - lastReportMillis;
+  if (elapsed < reportInterval || elapsed == 0) {
+    return;
+  }
+  lastReportMillis = now;
+
+  boolean started = false;
+  for (byte i = 0; i < MAX_ENCODERS; i++) {
+    if (!isAttached(i)) continue;
+    encoder_device *encoder = &encoders[i];
+    long position = readPosition(i);
+    long delta = position - encoder->lastPosition;
+    encoder->lastPosition = position;
+    encoder->velocity = delta * 1000 / (long)elapsed;
+
+    if (reportMode == ENCODER_REPORT_ON_CHANGE && delta == 0) continue;
+    if (!started) {
+      Firmata.startSysex();
+      Firmata.write(ENCODER_DATA);
+      started = true;
+    }
+    sendPosition(i);
+  }
+  if (started) {
+    Firmata.endSysex();
+  }
+}
+
+void EncoderFirmata::reset()
+{
+  for (byte i = 0; i < MAX_ENCODERS; i++) {
+    if (isAttached(i)) {
+      detach(i);
+    }
+  }
+  reportMode = ENCODER_REPORT_OFF;
+  reportFlags = 0;
+  reportInterval = ENCODER_DEFAULT_INTERVAL;
+}
+
+/*
+ * Follow the pin changes of all encoders. Runs in interrupt context.
+ */
+void EncoderFirmata::updatePositions()
+{
+  for (byte i = 0; i < MAX_ENCODERS; i++) {
+    encoder_device *encoder = &encoders[i];
+    if (encoder->pins[0] == ENCODER_NOT_ATTACHED) continue;
+
+    byte state = (encoder->state & 0x03) | (readPins(encoder) << 2);
+    encoder->state = state >> 2;
+    encoder->position += transitions[state];
+  }
+}
+
+//******************************************************************************
+//* Private Methods
+//******************************************************************************
+
+void EncoderFirmata::attach(byte encoderNum, byte pinA, byte pinB)
+{
+  if (encoderNum >= MAX_ENCODERS) {
+    Firmata.sendString("Encoder: invalid encoder number");
+    return;
+  }
+  if (!IS_PIN_DIGITAL(pinA) || !IS_PIN_DIGITAL(pinB) || pinA == pinB) {
+    Firmata.sendString("Encoder: invalid pins");
+    return;
+  }
+  if (!isInterruptPin(pinA) || !isInterruptPin(pinB)) {
+    Firmata.sendString("Encoder: pins without interrupt");
+    return;
+  }
+  for (byte i = 0; i < MAX_ENCODERS; i++) {
+    if (i != encoderNum && isAttached(i)
+        && (encoders[i].pins[0] == pinA || encoders[i].pins[0] == pinB
+            || encoders[i].pins[1] == pinA || encoders[i].pins[1] == pinB)) {
+      Firmata.sendString("Encoder: pin in use");
+      return;
+    }
+  }
+  if (isAttached(encoderNum)) {
+    detach(encoderNum);
+  }
+
+  encoder_device *encoder = &encoders[encoderNum];
+  encoder->pins[1] = pinB;
+  for (byte i = 0; i < 2; i++) {
+    byte pin = i == 0 ? pinA : pinB;
+    // through the sketch, so it stops reporting the pin and watching it for changes
+    if (!Firmata.requestPinMode(pin, PIN_MODE_ENCODER)) {
+      handlePinMode(pin, PIN_MODE_ENCODER);
+    }
+#if defined(ARDUINO_ARCH_AVR)
+    encoder->in[i] = portInputRegister(digitalPinToPort(PIN_TO_DIGITAL(pin)));
+    encoder->mask[i] = digitalPinToBitMask(PIN_TO_DIGITAL(pin));
+#endif
+  }
+  encoder->position = 0;
+  encoder->lastPosition = 0;
+  encoder->velocity = 0;
+
+  noInterrupts();
+  encoder->pins[0] = pinA;
+  encoder->state = readPins(encoder);
+  interrupts();
+
+  for (byte i = 0; i < 2; i++) {
+    attachInterrupt(digitalPinToInterrupt(PIN_TO_DIGITAL(encoder->pins[i])), encoderInterrupt, CHANGE);
+  }
+}
+
+void EncoderFirmata::detach(byte encoderNum)
+{
+  encoder_device *encoder = &encoders[encoderNum];
+  for (byte i = 0; i < 2; i++) {
+    detachInterrupt(digitalPinToInterrupt(PIN_TO_DIGITAL(encoder->pins[i])));
+  }
+  noInterrupts();
+  encoder->pins[0] = ENCODER_NOT_ATTACHED;
+  interrupts();
+}
+
+boolean EncoderFirmata::isAttached(byte encoderNum)
+{
+  return encoderNum < MAX_ENCODERS && encoders[encoderNum].pins[0] != ENCODER_NOT_ATTACHED;
+}
+
+boolean EncoderFirmata::isInterruptPin(byte pin)
+{
+  return IS_PIN_DIGITAL(pin) && digitalPinToInterrupt(PIN_TO_DIGITAL(pin)) != NOT_AN_INTERRUPT;
+}
+
+long EncoderFirmata::readPosition(byte encoderNum)
+{
+  noInterrupts();
+  long position = encoders[encoderNum].position;
+  interrupts();
+  return position;
+}
+
+/*
+ * @return The state of pin A in bit 0 and pin B in bit 1.
+ */
+byte EncoderFirmata::readPins(encoder_device *encoder)
+{
+#if defined(ARDUINO_ARCH_AVR)
+  return ((*encoder->in[0] & encoder->mask[0]) ? 0x01 : 0)
+         | ((*encoder->in[1] & encoder->mask[1]) ? 0x02 : 0);
+#else
+  return (digitalRead(PIN_TO_DIGITAL(encoder->pins[0])) ? 0x01 : 0)
+         | (digitalRead(PIN_TO_DIGITAL(encoder->pins[1])) ? 0x02 : 0);
+#endif
+}
+
+/*
+ * Encoder number with the sign of the position in bit 6, the absolute position
+ * as 4 7-bit bytes and, with ENCODER_REPORT_VELOCITY, the velocity in counts/s
+ * as 3 7-bit bytes (21-bit two's complement).
+ */
+void EncoderFirmata::sendPosition(byte encoderNum)
+{
+  long position = readPosition(encoderNum);
+  unsigned long absValue = position < 0 ? -position : position;
+
+  Firmata.write((position < 0 ? 0x40 : 0x00) | encoderNum);
+  for (byte i = 0; i < 4; i++) {
+    Firmata.write((byte)(absValue >> (7 * i)) & 0x7F);
+  }
+  if (reportFlags & ENCODER_REPORT_VELOCITY) {
+    unsigned long velocity = (unsigned long)encoders[encoderNum].velocity;
+    for (byte i = 0; i < 3; i++) {
+      Firmata.write((byte)(velocity >> (7 * i)) & 0x7F);
+    }
+  }
+}
@@ -0,0 +1,95 @@
+/*
+  EncoderFirmata.h
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+
+  Quadrature encoder decoding. The encoder pins are attached to CHANGE
+  interrupts; each change looks up the previous and current pin states in
+  a transition table, which also recovers an edge missed while interrupts
+  were disabled. The positions of all encoders, optionally with their
+  velocities, are reported in one sysex at a configurable interval or
+  whenever they change.
+
+  Both pins of an encoder need an external interrupt (pins 2 and 3 on an
+  Uno), the capability response only lists those. As with
+  PinChangeFirmata the AVR pin change vectors are left to SoftwareSerial.
+
+  The protocol is compatible with the ConfigurableFirmata encoder feature,
+  the report mode and velocities are additions.
+*/
+
+#ifndef EncoderFirmata_h
+#define EncoderFirmata_h
+
+#include <Firmata.h>
+#include "FirmataFeature.h"
+
+#define FIRMATA_ENCODER_FEATURE
+
+// ENCODER_DATA sub-commands
+#define ENCODER_ATTACH              0x00
+#define ENCODER_REPORT_POSITION     0x01
+#define ENCODER_REPORT_POSITIONS    0x02
+#define ENCODER_RESET_POSITION      0x03
+#define ENCODER_REPORT_AUTO         0x04 // report mode, interval (ms) and flags
+#define ENCODER_DETACH              0x05
+
+// ENCODER_REPORT_AUTO modes
+#define ENCODER_REPORT_OFF          0x00
+#define ENCODER_REPORT_INTERVAL     0x01 // all encoders every interval
+#define ENCODER_REPORT_ON_CHANGE    0x02 // the encoders that moved, checked every interval
+
+// ENCODER_REPORT_AUTO flags
+#define ENCODER_REPORT_VELOCITY     0x01 // append the velocity to each position
+
+#define MAX_ENCODERS                5
+#define ENCODER_DEFAULT_INTERVAL    19 // ms, the default sampling interval
+
+struct encoder_device {
+  byte pins[2];             // A and B, pins[0] is 0xFF if the encoder is not attached
+#if defined(ARDUINO_ARCH_AVR)
+  volatile uint8_t *in[2];
+  uint8_t mask[2];
+#endif
+  volatile byte state;      // last pin states, bit 0 is A
+  volatile long position;
+  long lastPosition;        // position at the previous interval
+  long velocity;            // counts/s over the previous interval
+};
+
+class EncoderFirmata: public FirmataFeature
+{
+  public:
+    EncoderFirmata();
+    boolean handlePinMode(byte pin, int mode);
+    void handleCapability(byte pin);
+    boolean handleSysex(byte command, byte argc, byte *argv);
+    void update();
+    void reset();
+
+    // called from the pin interrupts, do not use directly
+    void updatePositions();
+
+  private:
+    encoder_device encoders[MAX_ENCODERS];
+    byte reportMode;
+    byte reportFlags;
+    unsigned int reportInterval;
+    unsigned long lastReportMillis;
+
+    void attach(byte encoderNum, byte pinA, byte pinB);
+    void detach(byte encoderNum);
+    boolean isAttached(byte encoderNum);
+    boolean isInterruptPin(byte pin);
+    long readPosition(byte encoderNum);
+    byte readPins(encoder_device *encoder);
+    void sendPosition(byte encoderNum);
+};
+
+#endif /* EncoderFirmata_h */
@@ -17,6 +17,9 @@
   version in the following ways:
 
   - Imports Firmata.h rather than ConfigurableFirmata.h
+  - A feature that owns the ADC can answer analog reads (readAnalog)
+  - A feature is told by handlePinMode when a pin it uses changes mode, and
+    keeps the pin if it returns true
 
   See file LICENSE.txt for further informations on licensing terms.
 */
@@ -33,6 +36,7 @@ class FirmataFeature
     virtual boolean handlePinMode(byte pin, int mode) = 0;
     virtual boolean handleSysex(byte command, byte argc, byte* argv) = 0;
     virtual void reset() = 0;
+    virtual boolean readAnalog(byte channel, int &value) { return false; }
 };
 
 #endif
@@ -0,0 +1,53 @@
+/*
+  FirmataMessageTracker.h
+  Follows the Firmata messages in a byte stream sent to the host, so a
+  transport that packs output into datagrams or frames can cut it between
+  messages.
+
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+ */
+
+#ifndef FIRMATAMESSAGETRACKER_H
+#define FIRMATAMESSAGETRACKER_H
+
+#include <inttypes.h>
+
+class FirmataMessageTracker
+{
+  public:
+    FirmataMessageTracker() : inSysex(false), pending(0) {}
+
+    /**
+     * Follow one byte written to the host.
+     * @return true if the byte ends a message
+     */
+    bool track(uint8_t c)
+    {
+      if (c & 0x80) {
+        inSysex = (c == 0xF0);
+        if (inSysex || c > 0xF0) {
+          // REPORT_VERSION (0xF9) replies with two data bytes
+          pending = (c == 0xF9) ? 2 : 0;
+        } else {
+          // REPORT_ANALOG (0xC0) and REPORT_DIGITAL (0xD0) carry one data byte
+          pending = ((c & 0xF0) == 0xC0 || (c & 0xF0) == 0xD0) ? 1 : 2;
+        }
+      } else if (pending > 0) {
+        pending--;
+      }
+      return !inSysex && pending == 0;
+    }
+
+  private:
+    bool inSysex;
+    uint8_t pending;      // data bytes still expected by a midi style message
+};
+
+#endif
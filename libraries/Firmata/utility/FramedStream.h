@@ -0,0 +1,384 @@
+/*
+  FramedStream.h
+  An Arduino-Stream that wraps another Stream (a UART driving an RS485
+  transceiver or a radio modem) in CRC checked frames, so a corrupted byte
+  is dropped instead of becoming a wrong pin write.
+
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+
+  Frames are delimited by FRAMEDSTREAM_FLAG (0x7E). Inside a frame, 0x7E and
+  FRAMEDSTREAM_ESCAPE (0x7D) are sent as 0x7D followed by the byte XOR 0x20.
+  Unescaped, a frame is:
+
+    0  type     DATA, COMMAND, ACK or NAK
+    1  sequence number
+    2  payload length
+    3  payload (Firmata messages)
+    n  CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF) of bytes 0 to
+       n - 1, LSB first
+
+  Frames with a bad length or CRC are dropped and counted.
+
+  Board -> host: output is collected and sent as one DATA frame on flush() /
+  maintain() or when the buffer is full, messages are only split if they are
+  larger than FRAMEDSTREAM_MAX_PAYLOAD. DATA frames are not retransmitted,
+  a host that sees a gap in their sequence numbers asks for the state it
+  missed (REPORT_DIGITAL, PIN_STATE_QUERY).
+
+  Host -> board: COMMAND frames must contain complete messages, at least one
+  byte. Every COMMAND frame the board receives intact is acknowledged with an
+  ACK frame carrying its sequence number. Frames up to FRAMEDSTREAM_WINDOW - 1
+  ahead of the next expected one are kept and delivered in order once the gap
+  is filled, and a gap is reported once with a NAK frame carrying the missing
+  sequence number. The host retransmits only the frames that got no ACK (or
+  were NAKed), the board acknowledges and drops duplicates. Sequence numbers
+  start at 0.
+ */
+
+#ifndef FRAMEDSTREAM_H
+#define FRAMEDSTREAM_H
+
+#include <inttypes.h>
+#include <Stream.h>
+#include "FirmataMessageTracker.h"
+
+#define FRAMEDSTREAM_FLAG           0x7E
+#define FRAMEDSTREAM_ESCAPE         0x7D
+#define FRAMEDSTREAM_HEADER_SIZE    3
+#define FRAMEDSTREAM_CRC_SIZE       2
+
+// frame types
+#define FRAMEDSTREAM_DATA           0x01 // board -> host, not acknowledged
+#define FRAMEDSTREAM_COMMAND        0x02 // host -> board, acknowledged
+#define FRAMEDSTREAM_ACK            0x03 // board -> host, a COMMAND frame arrived
+#define FRAMEDSTREAM_NAK            0x04 // board -> host, a COMMAND frame is missing
+
+#ifndef FRAMEDSTREAM_MAX_PAYLOAD
+#if defined(RAMEND) && RAMEND < 0x900
+#define FRAMEDSTREAM_MAX_PAYLOAD    64
+#define FRAMEDSTREAM_WINDOW         1
+#else
+#define FRAMEDSTREAM_MAX_PAYLOAD    128
+#define FRAMEDSTREAM_WINDOW         4
+#endif
+#endif
+
+#ifndef FRAMEDSTREAM_WINDOW
+#define FRAMEDSTREAM_WINDOW         1
+#endif
+
+class FramedStream : public Stream
+{
+  public:
+    FramedStream(Stream &link);
+    int available();
+    int read();
+    int peek();
+    void flush();
+    size_t write(uint8_t);
+    void maintain();
+    uint16_t badFrames();
+    uint16_t duplicateFrames();
+    static uint16_t crc16(uint16_t crc, uint8_t data);
+
+  private:
+    Stream &link;
+
+    // frame being received, unescaped
+    uint8_t frame[FRAMEDSTREAM_HEADER_SIZE + FRAMEDSTREAM_MAX_PAYLOAD + FRAMEDSTREAM_CRC_SIZE];
+    uint16_t frameLength;
+    bool frameEscaped;
+    bool frameOverflow;
+    uint16_t rxBad;
+    uint16_t rxDuplicates;
+
+    // command payloads, slot sequence % FRAMEDSTREAM_WINDOW
+    uint8_t rxSlots[FRAMEDSTREAM_WINDOW][FRAMEDSTREAM_MAX_PAYLOAD];
+    uint8_t rxSlotLength[FRAMEDSTREAM_WINDOW];
+    bool rxSlotUsed[FRAMEDSTREAM_WINDOW];
+    uint8_t rxSequence;   // next command frame to deliver
+    uint8_t rxPosition;   // in the slot of rxSequence
+    bool nakSent;         // for the current gap
+
+    uint8_t txBuffer[FRAMEDSTREAM_MAX_PAYLOAD];
+    uint8_t txLength;     // payload bytes buffered
+    uint8_t txComplete;   // payload bytes up to the end of the last complete message
+    uint8_t txSequence;
+    FirmataMessageTracker txMessages;
+
+    bool deliverable();
+    void receive();
+    void receiveFrame();
+    void sendFrame(uint8_t type, uint8_t sequence, const uint8_t *payload, uint8_t length);
+    void sendByte(uint8_t c, uint16_t *crc);
+    void send(uint8_t length);
+};
+
+
+/*
+ * FramedStream.cpp
+ * Kept in the header like UDPStream, so only sketches that include it
+ * compile it.
+ */
+FramedStream::FramedStream(Stream &link)
+  : link(link),
+    frameLength(0),
+    frameEscaped(false),
+    frameOverflow(false),
+    rxBad(0),
+    rxDuplicates(0),
+    rxSequence(0),
+    rxPosition(0),
+    nakSent(false),
+    txLength(0),
+    txComplete(0),
+    txSequence(0)
+{
+  for (uint8_t i = 0; i < FRAMEDSTREAM_WINDOW; i++) {
+    rxSlotUsed[i] = false;
+  }
+}
+
+int
+FramedStream::available()
+{
+  if (!deliverable()) {
+    receive();
+    if (!deliverable())
+      return 0;
+  }
+  uint8_t slot = rxSequence % FRAMEDSTREAM_WINDOW;
+  return rxSlotLength[slot] - rxPosition;
+}
+
+int
+FramedStream::read()
+{
+  if (!available())
+    return -1;
+  uint8_t slot = rxSequence % FRAMEDSTREAM_WINDOW;
+  uint8_t c = rxSlots[slot][rxPosition++];
+  if (rxPosition >= rxSlotLength[slot]) {
+    // the frame is consumed, the next one may already be waiting
+    rxSlotUsed[slot] = false;
+    rxPosition = 0;
+    rxSequence++;
+  }
+  return c;
+}
+
+int
+FramedStream::peek()
+{
+  return available() ? rxSlots[rxSequence % FRAMEDSTREAM_WINDOW][rxPosition] : -1;
+}
+
+/**
+ * Send everything buffered so far as one frame.
+ */
+void
+FramedStream::flush()
+{
+  if (txLength > 0)
+    send(txLength);
+}
+
+size_t
+FramedStream::write(uint8_t c)
+{
+  if (txLength == FRAMEDSTREAM_MAX_PAYLOAD) {
+    // keep messages whole unless a single message fills the frame
+    send(txComplete > 0 ? txComplete : txLength);
+  }
+  txBuffer[txLength++] = c;
+  if (txMessages.track(c))
+    txComplete = txLength;
+  return 1;
+}
+
+/**
+ * Receive frames and send buffered output, call once per loop().
+ */
+void
+FramedStream::maintain()
+{
+  receive();
+  flush();
+}
+
+/**
+ * @return number of frames dropped for a bad length or CRC
+ */
+uint16_t
+FramedStream::badFrames()
+{
+  return rxBad;
+}
+
+/**
+ * @return number of command frames that arrived again and were dropped
+ */
+uint16_t
+FramedStream::duplicateFrames()
+{
+  return rxDuplicates;
+}
+
+/**
+ * Add a byte to a CRC-16/CCITT.
+ */
+uint16_t
+FramedStream::crc16(uint16_t crc, uint8_t data)
+{
+  crc ^= (uint16_t)data << 8;
+  for (uint8_t i = 0; i < 8; i++) {
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+bool
+FramedStream::deliverable()
+{
+  return rxSlotUsed[rxSequence % FRAMEDSTREAM_WINDOW];
+}
+
+/**
+ * Unescape the bytes the link has and handle every frame that ends.
+ */
+void
+FramedStream::receive()
+{
+  while (link.available() > 0) {
+    int c = link.read();
+    if (c < 0)
+      return;
+    if (c == FRAMEDSTREAM_FLAG) {
+      if (frameOverflow || frameEscaped) {
+        rxBad++;
+      } else if (frameLength > 0) {
+        receiveFrame();
+      }
+      frameLength = 0;
+      frameEscaped = false;
+      frameOverflow = false;
+      continue;
+    }
+    if (frameOverflow)
+      continue;
+    if (c == FRAMEDSTREAM_ESCAPE) {
+      frameEscaped = true;
+      continue;
+    }
+    if (frameEscaped) {
+      c ^= 0x20;
+      frameEscaped = false;
+    }
+    if (frameLength == sizeof(frame)) {
+      frameOverflow = true;
+    } else {
+      frame[frameLength++] = c;
+    }
+  }
+}
+
+void
+FramedStream::receiveFrame()
+{
+  if (frameLength < FRAMEDSTREAM_HEADER_SIZE + FRAMEDSTREAM_CRC_SIZE
+      || frame[2] != frameLength - FRAMEDSTREAM_HEADER_SIZE - FRAMEDSTREAM_CRC_SIZE) {
+    rxBad++;
+    return;
+  }
+  uint16_t crc = 0xFFFF;
+  for (uint16_t i = 0; i < frameLength - FRAMEDSTREAM_CRC_SIZE; i++) {
+    crc = crc16(crc, frame[i]);
+  }
+  if ((crc & 0xFF) != frame[frameLength - 2] || (crc >> 8) != frame[frameLength - 1]) {
+    rxBad++;
+    return;
+  }
+  if (frame[0] != FRAMEDSTREAM_COMMAND || frame[2] == 0)
+    return;
+
+  uint8_t sequence = frame[1];
+  uint8_t distance = sequence - rxSequence;
+  if (distance >= 0x80 || (distance < FRAMEDSTREAM_WINDOW && rxSlotUsed[sequence % FRAMEDSTREAM_WINDOW])) {
+    // delivered or already waiting, the ACK got lost
+    rxDuplicates++;
+    sendFrame(FRAMEDSTREAM_ACK, sequence, NULL, 0);
+    return;
+  }
+  if (distance >= FRAMEDSTREAM_WINDOW) {
+    // no room, the host sends it again
+    if (!nakSent) {
+      sendFrame(FRAMEDSTREAM_NAK, rxSequence, NULL, 0);
+      nakSent = true;
+    }
+    return;
+  }
+
+  uint8_t slot = sequence % FRAMEDSTREAM_WINDOW;
+  memcpy(rxSlots[slot], frame + FRAMEDSTREAM_HEADER_SIZE, frame[2]);
+  rxSlotLength[slot] = frame[2];
+  rxSlotUsed[slot] = true;
+  sendFrame(FRAMEDSTREAM_ACK, sequence, NULL, 0);
+  if (distance == 0) {
+    nakSent = false;
+  } else if (!nakSent) {
+    sendFrame(FRAMEDSTREAM_NAK, rxSequence, NULL, 0);
+    nakSent = true;
+  }
+}
+
+void
+FramedStream::sendFrame(uint8_t type, uint8_t sequence, const uint8_t *payload, uint8_t length)
+{
+  uint16_t crc = 0xFFFF;
+  link.write(FRAMEDSTREAM_FLAG);
+  sendByte(type, &crc);
+  sendByte(sequence, &crc);
+  sendByte(length, &crc);
+  for (uint8_t i = 0; i < length; i++) {
+    sendByte(payload[i], &crc);
+  }
+  uint16_t check = crc;
+  sendByte(check & 0xFF, NULL);
+  sendByte(check >> 8, NULL);
+  link.write(FRAMEDSTREAM_FLAG);
+}
+
+void
+FramedStream::sendByte(uint8_t c, uint16_t *crc)
+{
+  if (crc)
+    *crc = crc16(*crc, c);
+  if (c == FRAMEDSTREAM_FLAG || c == FRAMEDSTREAM_ESCAPE) {
+    link.write(FRAMEDSTREAM_ESCAPE);
+    c ^= 0x20;
+  }
+  link.write(c);
+}
+
+/**
+ * Send the first length bytes of the buffered payload as one DATA frame and
+ * keep the rest for the next one.
+ */
+void
+FramedStream::send(uint8_t length)
+{
+  sendFrame(FRAMEDSTREAM_DATA, txSequence++, txBuffer, length);
+
+  txLength -= length;
+  memmove(txBuffer, txBuffer + length, txLength);
+  txComplete = (txComplete > length) ? txComplete - length : 0;
+}
+
+#endif /* FRAMEDSTREAM_H */
@@ -0,0 +1,669 @@
+/*
+  OneWireFirmata.cpp
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "OneWireFirmata.h"
+
+// command kinds
+#define ONEWIRE_KIND_REQUEST        0 // from the host, reads are replied
+#define ONEWIRE_KIND_SEARCH         1 // data[0] is the search ROM command
+#define ONEWIRE_KIND_CONVERT        2 // conversion of a periodic convert request
+#define ONEWIRE_KIND_COLLECT        3 // scratchpad read of one device after a conversion
+
+// execution phases, the steps in the order they run
+#define ONEWIRE_PHASE_IDLE          0
+#define ONEWIRE_PHASE_RESET         1
+#define ONEWIRE_PHASE_SKIP          2
+#define ONEWIRE_PHASE_SELECT        3
+#define ONEWIRE_PHASE_WRITE         4
+#define ONEWIRE_PHASE_READ          5
+#define ONEWIRE_PHASE_DELAY         6
+#define ONEWIRE_PHASE_SEARCH        7
+
+// ROM and function commands
+#define ONEWIRE_MATCH_ROM           0x55
+#define ONEWIRE_SKIP_ROM            0xCC
+#define ONEWIRE_SEARCH_ROM          0xF0
+#define ONEWIRE_ALARM_SEARCH        0xEC
+#define ONEWIRE_CONVERT_T           0x44
+#define ONEWIRE_READ_SCRATCHPAD     0xBE
+
+static const byte stepBits[] = {
+  ONEWIRE_RESET_REQUEST_BIT,
+  ONEWIRE_SKIP_REQUEST_BIT,
+  ONEWIRE_SELECT_REQUEST_BIT,
+  ONEWIRE_WRITE_REQUEST_BIT,
+  ONEWIRE_READ_REQUEST_BIT,
+  ONEWIRE_DELAY_REQUEST_BIT
+};
+
+OneWireFirmata::OneWireFirmata()
+{
+  for (byte i = 0; i < ONEWIRE_MAX_BUSES; i++) {
+    buses[i].pin = ONEWIRE_UNUSED;
+  }
+}
+
+/*
+ * A pin that leaves PIN_MODE_ONEWIRE loses its bus.
+ */
+boolean OneWireFirmata::handlePinMode(byte pin, int mode)
+{
+  if (mode == PIN_MODE_ONEWIRE) {
+    return configure(pin, false) != NULL;
+  }
+  // the pin is already configured for its new mode, the bus just lets go
+  onewire_bus *bus = find(pin);
+  if (bus) {
+    bus->pin = ONEWIRE_UNUSED;
+  }
+  return false;
+}
+
+void OneWireFirmata::handleCapability(byte pin)
+{
+  if (IS_PIN_DIGITAL(pin)) {
+    Firmata.write(PIN_MODE_ONEWIRE);
+    Firmata.write(1);
+  }
+}
+
+boolean OneWireFirmata::handleSysex(byte command, byte argc, byte *argv)
+{
+  if (command != ONEWIRE_DATA) {
+    return false;
+  }
+  if (argc < 2) {
+    return true;
+  }
+
+  byte subcommand = argv[0];
+  byte pin = argv[1];
+  if (subcommand == ONEWIRE_CONFIG_REQUEST) {
+    configure(pin, argc > 2 && argv[2] != 0);
+    return true;
+  }
+
+  // buses are configured on first use
+  onewire_bus *bus = find(pin);
+  if (!bus) {
+    bus = configure(pin, false);
+    if (!bus) {
+      return true;
+    }
+  }
+
+  switch (subcommand) {
+    case ONEWIRE_SEARCH_REQUEST:
+    case ONEWIRE_SEARCH_ALARMS_REQUEST: {
+      byte searchCommand = subcommand == ONEWIRE_SEARCH_REQUEST ? ONEWIRE_SEARCH_ROM : ONEWIRE_ALARM_SEARCH;
+      enqueue(bus, ONEWIRE_KIND_SEARCH, 0, 1, &searchCommand);
+      break;
+    }
+    case ONEWIRE_CONVERT_REQUEST: {
+      unsigned long interval = argc > 4 ? (unsigned long)argv[2] | ((unsigned long)argv[3] << 7)
+                               | ((unsigned long)argv[4] << 14) : 0;
+      bus->convertInterval = interval;
+      bus->lastConvert = millis() - interval;
+      // conversions read the devices of the last search
+      if (interval > 0 && bus->deviceCount == 0) {
+        byte searchCommand = ONEWIRE_SEARCH_ROM;
+        enqueue(bus, ONEWIRE_KIND_SEARCH, 0, 1, &searchCommand);
+      }
+      break;
+    }
+    default: {
+      if (subcommand > 0x3F) {
+        break;
+      }
+      byte length = argc > 2 ? Firmata.decodePackedBytes(argc - 2, argv + 2) : 0;
+      onewire_command request;
+      request.flags = subcommand;
+      request.length = length;
+      byte needed = dataOffset(&request, ONEWIRE_WRITE_REQUEST_BIT);
+      if (length < needed || length > ONEWIRE_MAX_DATA) {
+        Firmata.sendString("OneWire: invalid request");
+        break;
+      }
+      if (subcommand & ONEWIRE_READ_REQUEST_BIT) {
+        byte offset = dataOffset(&request, ONEWIRE_READ_REQUEST_BIT);
+        if ((argv[2 + offset] | (argv[3 + offset] << 8)) > ONEWIRE_MAX_DATA) {
+          Firmata.sendString("OneWire: read too long");
+          break;
+        }
+      }
+      enqueue(bus, ONEWIRE_KIND_REQUEST, subcommand, length, argv + 2);
+      break;
+    }
+  }
+  return true;
+}
+
+/*
+ * Advance every bus by one primitive, call as often as possible.
+ */
+void OneWireFirmata::update()
+{
+  for (byte i = 0; i < ONEWIRE_MAX_BUSES; i++) {
+    if (buses[i].pin != ONEWIRE_UNUSED) {
+      step(&buses[i]);
+    }
+  }
+}
+
+void OneWireFirmata::reset()
+{
+  for (byte i = 0; i < ONEWIRE_MAX_BUSES; i++) {
+    if (buses[i].pin != ONEWIRE_UNUSED) {
+      release(&buses[i]);
+    }
+  }
+}
+
+//******************************************************************************
+//* Private Methods
+//******************************************************************************
+
+onewire_bus *OneWireFirmata::find(byte pin)
+{
+  for (byte i = 0; i < ONEWIRE_MAX_BUSES; i++) {
+    if (buses[i].pin == pin) {
+      return &buses[i];
+    }
+  }
+  return NULL;
+}
+
+onewire_bus *OneWireFirmata::configure(byte pin, boolean power)
+{
+  if (!IS_PIN_DIGITAL(pin)) {
+    Firmata.sendString("OneWire: invalid pin");
+    return NULL;
+  }
+  onewire_bus *bus = find(pin);
+  if (bus) {
+    bus->power = power;
+    return bus;
+  }
+  bus = find(ONEWIRE_UNUSED);
+  if (!bus) {
+    Firmata.sendString("OneWire: too many buses");
+    return NULL;
+  }
+
+  bus->pin = pin;
+  bus->power = power;
+#if defined(ARDUINO_ARCH_AVR)
+  byte port = digitalPinToPort(PIN_TO_DIGITAL(pin));
+  bus->modeRegister = portModeRegister(port);
+  bus->outputRegister = portOutputRegister(port);
+  bus->inputRegister = portInputRegister(port);
+  bus->mask = digitalPinToBitMask(PIN_TO_DIGITAL(pin));
+#endif
+  bus->queueHead = 0;
+  bus->queueCount = 0;
+  bus->phase = ONEWIRE_PHASE_IDLE;
+  bus->deviceCount = 0;
+  bus->convertInterval = 0;
+  Firmata.setPinMode(pin, PIN_MODE_ONEWIRE);
+  // the bus needs an external pull-up resistor
+  releaseLine(bus);
+  return bus;
+}
+
+void OneWireFirmata::release(onewire_bus *bus)
+{
+  releaseLine(bus);
+  bus->pin = ONEWIRE_UNUSED;
+}
+
+void OneWireFirmata::enqueue(onewire_bus *bus, byte kind, byte flags, byte length, const byte *data)
+{
+  if (bus->queueCount == ONEWIRE_QUEUE_LENGTH) {
+    Firmata.sendString("OneWire: queue full");
+    return;
+  }
+  onewire_command *command = &bus->queue[(bus->queueHead + bus->queueCount) % ONEWIRE_QUEUE_LENGTH];
+  command->kind = kind;
+  command->flags = flags;
+  command->length = length;
+  memcpy(command->data, data, length);
+  bus->queueCount++;
+}
+
+/*
+ * @return the position of the data of a request step, or the length of the
+ * data that precedes the bytes to write for ONEWIRE_WRITE_REQUEST_BIT
+ */
+byte OneWireFirmata::dataOffset(const onewire_command *command, byte flag)
+{
+  byte offset = 0;
+  if (flag == ONEWIRE_SELECT_REQUEST_BIT) {
+    return offset;
+  }
+  if (command->flags & ONEWIRE_SELECT_REQUEST_BIT) {
+    offset += 8;
+  }
+  if (flag == ONEWIRE_READ_REQUEST_BIT) {
+    return offset;
+  }
+  if (command->flags & ONEWIRE_READ_REQUEST_BIT) {
+    offset += 4;
+  }
+  if (flag == ONEWIRE_DELAY_REQUEST_BIT) {
+    return offset;
+  }
+  if (command->flags & ONEWIRE_DELAY_REQUEST_BIT) {
+    offset += 4;
+  }
+  return offset;
+}
+
+void OneWireFirmata::step(onewire_bus *bus)
+{
+  onewire_command *command = &bus->command;
+  switch (bus->phase) {
+    case ONEWIRE_PHASE_IDLE:
+      if (bus->queueCount > 0) {
+        *command = bus->queue[bus->queueHead];
+        bus->queueHead = (bus->queueHead + 1) % ONEWIRE_QUEUE_LENGTH;
+        bus->queueCount--;
+        startCommand(bus);
+      } else if (bus->convertInterval > 0 && bus->deviceCount > 0
+                 && millis() - bus->lastConvert >= bus->convertInterval) {
+        bus->lastConvert = millis();
+        // all devices convert at once, the wait does not block the other buses
+        command->kind = ONEWIRE_KIND_CONVERT;
+        command->flags = ONEWIRE_RESET_REQUEST_BIT | ONEWIRE_SKIP_REQUEST_BIT
+                         | ONEWIRE_WRITE_REQUEST_BIT | ONEWIRE_DELAY_REQUEST_BIT;
+        command->data[0] = ONEWIRE_CONVERSION_MILLIS & 0xFF;
+        command->data[1] = ONEWIRE_CONVERSION_MILLIS >> 8;
+        command->data[2] = 0;
+        command->data[3] = 0;
+        command->data[4] = ONEWIRE_CONVERT_T;
+        command->length = 5;
+        startCommand(bus);
+      }
+      break;
+
+    case ONEWIRE_PHASE_RESET:
+      // a missing presence pulse is not an error, the reads return 0xFF
+      resetPulse(bus);
+      nextStep(bus);
+      break;
+
+    case ONEWIRE_PHASE_SKIP:
+      writeByte(bus, ONEWIRE_SKIP_ROM);
+      nextStep(bus);
+      break;
+
+    case ONEWIRE_PHASE_SELECT:
+      writeByte(bus, bus->position == 0 ? ONEWIRE_MATCH_ROM : command->data[bus->position - 1]);
+      if (++bus->position > 8) {
+        nextStep(bus);
+      }
+      break;
+
+    case ONEWIRE_PHASE_WRITE: {
+      byte offset = dataOffset(command, ONEWIRE_WRITE_REQUEST_BIT) + bus->position;
+      if (offset < command->length) {
+        writeByte(bus, command->data[offset]);
+        bus->position++;
+      }
+      if (offset + 1 >= command->length) {
+        nextStep(bus);
+      }
+      break;
+    }
+
+    case ONEWIRE_PHASE_READ:
+      if (bus->position < bus->readCount) {
+        bus->reply[2 + bus->position++] = readByte(bus);
+      }
+      if (bus->position >= bus->readCount) {
+        if (command->kind == ONEWIRE_KIND_COLLECT) {
+          memcpy(bus->scratchpads[bus->collectDevice], bus->reply + 2, ONEWIRE_SCRATCHPAD_SIZE);
+        } else {
+          Firmata.startSysex();
+          Firmata.write(ONEWIRE_DATA);
+          Firmata.write(ONEWIRE_READ_REPLY);
+          Firmata.write(bus->pin);
+          Firmata.sendPackedBytes(2 + bus->readCount, bus->reply);
+          Firmata.endSysex();
+        }
+        nextStep(bus);
+      }
+      break;
+
+    case ONEWIRE_PHASE_DELAY: {
+      const byte *delay = command->data + dataOffset(command, ONEWIRE_DELAY_REQUEST_BIT);
+      unsigned long delayMillis = (unsigned long)delay[0] | ((unsigned long)delay[1] << 8)
+                                  | ((unsigned long)delay[2] << 16) | ((unsigned long)delay[3] << 24);
+      if (millis() - bus->waitStart >= delayMillis) {
+        nextStep(bus);
+      }
+      break;
+    }
+
+    case ONEWIRE_PHASE_SEARCH:
+      searchStep(bus);
+      break;
+  }
+}
+
+void OneWireFirmata::startCommand(onewire_bus *bus)
+{
+  if (bus->command.kind == ONEWIRE_KIND_SEARCH) {
+    bus->phase = ONEWIRE_PHASE_SEARCH;
+    bus->searchBit = 0;
+    bus->lastDiscrepancy = 0;
+    bus->lastDevice = false;
+    bus->deviceCount = 0;
+  } else {
+    bus->pendingSteps = bus->command.flags;
+    nextStep(bus);
+  }
+}
+
+/*
+ * Enter the next pending step of the command, or finish it.
+ */
+void OneWireFirmata::nextStep(onewire_bus *bus)
+{
+  onewire_command *command = &bus->command;
+  for (byte i = 0; i < sizeof(stepBits); i++) {
+    if (bus->pendingSteps & stepBits[i]) {
+      bus->pendingSteps &= ~stepBits[i];
+      bus->phase = ONEWIRE_PHASE_RESET + i;
+      bus->position = 0;
+      if (stepBits[i] == ONEWIRE_READ_REQUEST_BIT) {
+        // the reply starts with the correlation id
+        const byte *read = command->data + dataOffset(command, ONEWIRE_READ_REQUEST_BIT);
+        bus->readCount = read[0] | (read[1] << 8);
+        bus->reply[0] = read[2];
+        bus->reply[1] = read[3];
+      } else if (stepBits[i] == ONEWIRE_DELAY_REQUEST_BIT) {
+        bus->waitStart = millis();
+      }
+      return;
+    }
+  }
+  finishCommand(bus);
+}
+
+void OneWireFirmata::finishCommand(onewire_bus *bus)
+{
+  bus->phase = ONEWIRE_PHASE_IDLE;
+  switch (bus->command.kind) {
+    case ONEWIRE_KIND_CONVERT:
+      bus->collectDevice = 0;
+      startCollect(bus);
+      break;
+    case ONEWIRE_KIND_COLLECT:
+      if (++bus->collectDevice < bus->deviceCount) {
+        startCollect(bus);
+      } else {
+        sendScratchpads(bus);
+      }
+      break;
+  }
+}
+
+/*
+ * Read the scratchpad of the device at collectDevice.
+ */
+void OneWireFirmata::startCollect(onewire_bus *bus)
+{
+  onewire_command *command = &bus->command;
+  command->kind = ONEWIRE_KIND_COLLECT;
+  command->flags = ONEWIRE_RESET_REQUEST_BIT | ONEWIRE_SELECT_REQUEST_BIT
+                   | ONEWIRE_WRITE_REQUEST_BIT | ONEWIRE_READ_REQUEST_BIT;
+  memcpy(command->data, bus->addresses[bus->collectDevice], 8);
+  command->data[8] = ONEWIRE_SCRATCHPAD_SIZE;
+  command->data[9] = 0;
+  command->data[10] = 0;
+  command->data[11] = 0;
+  command->data[12] = ONEWIRE_READ_SCRATCHPAD;
+  command->length = 13;
+  bus->pendingSteps = command->flags;
+  nextStep(bus);
+}
+
+/*
+ * Run one step of the search: the reset and search command, or eight bits
+ * of the ROM code. Found addresses are sent when the search is complete.
+ */
+void OneWireFirmata::searchStep(onewire_bus *bus)
+{
+  if (bus->searchBit == 0) {
+    if (bus->lastDevice || bus->deviceCount == ONEWIRE_MAX_DEVICES || !resetPulse(bus)) {
+      sendAddresses(bus);
+      bus->phase = ONEWIRE_PHASE_IDLE;
+      return;
+    }
+    writeByte(bus, bus->command.data[0]);
+    bus->searchBit = 1;
+    bus->lastZero = 0;
+    return;
+  }
+
+  for (byte i = 0; i < 8; i++) {
+    byte index = (bus->searchBit - 1) / 8;
+    byte mask = 1 << ((bus->searchBit - 1) & 7);
+    boolean id = readBit(bus);
+    boolean complement = readBit(bus);
+    boolean direction;
+    if (id && complement) {
+      // no device is taking part (any more)
+      sendAddresses(bus);
+      bus->phase = ONEWIRE_PHASE_IDLE;
+      return;
+    }
+    if (id != complement) {
+      direction = id;
+    } else {
+      // discrepancy, take the other branch than last time up to the last discrepancy
+      if (bus->searchBit < bus->lastDiscrepancy) {
+        direction = (bus->rom[index] & mask) != 0;
+      } else {
+        direction = bus->searchBit == bus->lastDiscrepancy;
+      }
+      if (!direction) {
+        bus->lastZero = bus->searchBit;
+      }
+    }
+    if (direction) {
+      bus->rom[index] |= mask;
+    } else {
+      bus->rom[index] &= ~mask;
+    }
+    writeBit(bus, direction);
+    bus->searchBit++;
+  }
+
+  if (bus->searchBit > 64) {
+    bus->lastDiscrepancy = bus->lastZero;
+    bus->lastDevice = bus->lastDiscrepancy == 0;
+    if (crc8(bus->rom, 7) == bus->rom[7]) {
+      memcpy(bus->addresses[bus->deviceCount++], bus->rom, 8);
+    }
+    bus->searchBit = 0;
+  }
+}
+
+void OneWireFirmata::sendAddresses(onewire_bus *bus)
+{
+  Firmata.startSysex();
+  Firmata.write(ONEWIRE_DATA);
+  Firmata.write(bus->command.data[0] == ONEWIRE_SEARCH_ROM ? ONEWIRE_SEARCH_REPLY : ONEWIRE_SEARCH_ALARMS_REPLY);
+  Firmata.write(bus->pin);
+  Firmata.sendPackedBytes(bus->deviceCount * 8, bus->addresses[0]);
+  Firmata.endSysex();
+}
+
+/*
+ * Report the scratchpads of all devices in one message, in the order of the
+ * addresses of the last search reply.
+ */
+void OneWireFirmata::sendScratchpads(onewire_bus *bus)
+{
+  Firmata.startSysex();
+  Firmata.write(ONEWIRE_DATA);
+  Firmata.write(ONEWIRE_CONVERT_REPLY);
+  Firmata.write(bus->pin);
+  Firmata.write(bus->deviceCount);
+  Firmata.sendPackedBytes(bus->deviceCount * ONEWIRE_SCRATCHPAD_SIZE, bus->scratchpads[0]);
+  Firmata.endSysex();
+}
+
+//******************************************************************************
+//* Bus Primitives
+//******************************************************************************
+
+// the port registers are shared with other pins, so the callers keep
+// interrupts from modifying them meanwhile
+
+void OneWireFirmata::driveLow(onewire_bus *bus)
+{
+#if defined(ARDUINO_ARCH_AVR)
+  *bus->outputRegister &= ~bus->mask;
+  *bus->modeRegister |= bus->mask;
+#else
+  digitalWrite(PIN_TO_DIGITAL(bus->pin), LOW);
+  pinMode(PIN_TO_DIGITAL(bus->pin), OUTPUT);
+#endif
+}
+
+void OneWireFirmata::releaseLine(onewire_bus *bus)
+{
+#if defined(ARDUINO_ARCH_AVR)
+  *bus->modeRegister &= ~bus->mask;
+  *bus->outputRegister &= ~bus->mask;
+#else
+  pinMode(PIN_TO_DIGITAL(bus->pin), INPUT);
+#endif
+}
+
+void OneWireFirmata::driveHigh(onewire_bus *bus)
+{
+#if defined(ARDUINO_ARCH_AVR)
+  *bus->outputRegister |= bus->mask;
+  *bus->modeRegister |= bus->mask;
+#else
+  digitalWrite(PIN_TO_DIGITAL(bus->pin), HIGH);
+  pinMode(PIN_TO_DIGITAL(bus->pin), OUTPUT);
+#endif
+}
+
+boolean OneWireFirmata::readLine(onewire_bus *bus)
+{
+#if defined(ARDUINO_ARCH_AVR)
+  return (*bus->inputRegister & bus->mask) != 0;
+#else
+  return digitalRead(PIN_TO_DIGITAL(bus->pin)) == HIGH;
+#endif
+}
+
+/*
+ * @return true if a device answered with a presence pulse
+ */
+boolean OneWireFirmata::resetPulse(onewire_bus *bus)
+{
+  noInterrupts();
+  releaseLine(bus);
+  interrupts();
+  // the line may take a while to come up after parasitic power was removed
+  byte retries = 125;
+  while (!readLine(bus)) {
+    if (--retries == 0) {
+      return false;
+    }
+    delayMicroseconds(2);
+  }
+  noInterrupts();
+  driveLow(bus);
+  interrupts();
+  // a longer low pulse is harmless, so interrupts may run meanwhile
+  delayMicroseconds(480);
+  noInterrupts();
+  releaseLine(bus);
+  delayMicroseconds(70);
+  boolean present = !readLine(bus);
+  interrupts();
+  delayMicroseconds(410);
+  return present;
+}
+
+void OneWireFirmata::writeBit(onewire_bus *bus, boolean bit)
+{
+  noInterrupts();
+  driveLow(bus);
+  delayMicroseconds(bit ? 10 : 65);
+  releaseLine(bus);
+  interrupts();
+  delayMicroseconds(bit ? 55 : 5);
+}
+
+boolean OneWireFirmata::readBit(onewire_bus *bus)
+{
+  noInterrupts();
+  driveLow(bus);
+  delayMicroseconds(3);
+  releaseLine(bus);
+  delayMicroseconds(10);
+  boolean bit = readLine(bus);
+  interrupts();
+  delayMicroseconds(53);
+  return bit;
+}
+
+void OneWireFirmata::writeByte(onewire_bus *bus, byte value)
+{
+  for (byte i = 0; i < 8; i++) {
+    writeBit(bus, (value >> i) & 1);
+  }
+  if (bus->power) {
+    noInterrupts();
+    driveHigh(bus);
+    interrupts();
+  }
+}
+
+byte OneWireFirmata::readByte(onewire_bus *bus)
+{
+  byte value = 0;
+  for (byte i = 0; i < 8; i++) {
+    if (readBit(bus)) {
+      value |= 1 << i;
+    }
+  }
+  return value;
+}
+
+/*
+ * Dallas/Maxim CRC of ROM codes and scratchpads (polynomial x^8 + x^5 + x^4 + 1).
+ */
+byte OneWireFirmata::crc8(const byte *data, byte length)
+{
+  byte crc = 0;
+  while (length--) {
+    byte value = *data++;
+    for (byte i = 0; i < 8; i++) {
+      byte mix = (crc ^ value) & 0x01;
+      crc >>= 1;
+      if (mix) {
+        crc ^= 0x8C;
+      }
+      value >>= 1;
+    }
+  }
+  return crc;
+}
@@ -0,0 +1,159 @@
+/*
+  OneWireFirmata.h
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+
+  1-Wire buses (DS18B20 and similar) on any digital pin, speaking the
+  ONEWIRE_DATA protocol of ConfigurableFirmata: search, alarm search and
+  command requests made of reset, skip, select, write, read and delay steps.
+
+  Requests are queued per bus and executed by update() as a state machine
+  that performs one bus primitive (a reset, one byte, or one byte worth of
+  search triplets) per bus and call, so loop() is never blocked for more
+  than about 2ms. Interrupts are only disabled for the duration of a single
+  bit slot. A DELAY step waits without blocking, so temperature conversions
+  on several buses overlap and the rest of the firmware keeps running.
+
+  In addition to the standard protocol, ONEWIRE_CONVERT_REQUEST makes a bus
+  start a conversion on all devices at a fixed interval, wait for it without
+  blocking and read the scratchpad of every device found by the last search.
+  The scratchpads are reported together in one ONEWIRE_CONVERT_REPLY.
+*/
+
+#ifndef OneWireFirmata_h
+#define OneWireFirmata_h
+
+#include <Firmata.h>
+#include "FirmataFeature.h"
+
+#define FIRMATA_ONEWIRE_FEATURE
+
+// ONEWIRE_DATA sub-commands
+#define ONEWIRE_SEARCH_REQUEST          0x40 // pin
+#define ONEWIRE_CONFIG_REQUEST          0x41 // pin, parasitic power
+#define ONEWIRE_SEARCH_REPLY            0x42 // pin, packed 8 byte addresses
+#define ONEWIRE_READ_REPLY              0x43 // pin, packed correlation id and data
+#define ONEWIRE_SEARCH_ALARMS_REQUEST   0x44 // pin
+#define ONEWIRE_SEARCH_ALARMS_REPLY     0x45 // pin, packed 8 byte addresses
+#define ONEWIRE_CONVERT_REQUEST         0x46 // pin, interval in ms (3 bytes, 0 stops)
+#define ONEWIRE_CONVERT_REPLY           0x47 // pin, device count, packed 9 byte scratchpads
+
+// command request bits (sub-commands 0x01 to 0x3F), followed by the pin and
+// packed data: address (select), read count and correlation id (read),
+// delay in ms (delay), then the bytes to write (write)
+#define ONEWIRE_RESET_REQUEST_BIT       0x01
+#define ONEWIRE_SKIP_REQUEST_BIT        0x02
+#define ONEWIRE_SELECT_REQUEST_BIT      0x04
+#define ONEWIRE_READ_REQUEST_BIT        0x08
+#define ONEWIRE_DELAY_REQUEST_BIT       0x10
+#define ONEWIRE_WRITE_REQUEST_BIT       0x20
+
+#define ONEWIRE_CONVERSION_MILLIS       750 // 12 bit DS18B20 conversion
+#define ONEWIRE_SCRATCHPAD_SIZE         9
+#define ONEWIRE_UNUSED                  0x7F
+
+#if defined(RAMEND) && RAMEND < 0x900
+#define ONEWIRE_MAX_BUSES               2
+#define ONEWIRE_MAX_DEVICES             4
+#define ONEWIRE_QUEUE_LENGTH            2
+#define ONEWIRE_MAX_DATA                24
+#else
+#define ONEWIRE_MAX_BUSES               4
+#define ONEWIRE_MAX_DEVICES             12
+#define ONEWIRE_QUEUE_LENGTH            4
+#define ONEWIRE_MAX_DATA                48
+#endif
+
+struct onewire_command {
+  byte kind;            // request, search, conversion or scratchpad read
+  byte flags;           // request bits
+  byte length;          // decoded data bytes
+  byte data[ONEWIRE_MAX_DATA];
+};
+
+struct onewire_bus {
+  byte pin;             // Firmata pin or ONEWIRE_UNUSED
+  boolean power;        // drive the bus high after writes for parasitic power
+#if defined(ARDUINO_ARCH_AVR)
+  volatile uint8_t *modeRegister;
+  volatile uint8_t *outputRegister;
+  volatile uint8_t *inputRegister;
+  uint8_t mask;
+#endif
+
+  onewire_command queue[ONEWIRE_QUEUE_LENGTH];
+  byte queueHead;
+  byte queueCount;
+
+  onewire_command command;  // the command being executed
+  byte pendingSteps;        // request bits of the steps still to run
+  byte phase;
+  byte position;            // byte within the current step
+  unsigned long waitStart;  // start of a delay step
+
+  byte readCount;
+  byte reply[ONEWIRE_MAX_DATA + 2];
+
+  // search state (Maxim application note 187)
+  byte searchBit;           // 1 to 64, 0 before the search command is sent
+  byte lastDiscrepancy;
+  byte lastZero;
+  boolean lastDevice;
+  byte rom[8];
+
+  byte deviceCount;
+  byte addresses[ONEWIRE_MAX_DEVICES][8];
+  byte scratchpads[ONEWIRE_MAX_DEVICES][ONEWIRE_SCRATCHPAD_SIZE];
+  byte collectDevice;
+
+  unsigned long convertInterval;
+  unsigned long lastConvert;
+};
+
+class OneWireFirmata: public FirmataFeature
+{
+  public:
+    OneWireFirmata();
+    boolean handlePinMode(byte pin, int mode);
+    void handleCapability(byte pin);
+    boolean handleSysex(byte command, byte argc, byte *argv);
+    void update();
+    void reset();
+
+  private:
+    onewire_bus buses[ONEWIRE_MAX_BUSES];
+
+    onewire_bus *find(byte pin);
+    onewire_bus *configure(byte pin, boolean power);
+    void release(onewire_bus *bus);
+    void enqueue(onewire_bus *bus, byte kind, byte flags, byte length, const byte *data);
+    void step(onewire_bus *bus);
+    void startCommand(onewire_bus *bus);
+    void nextStep(onewire_bus *bus);
+    void finishCommand(onewire_bus *bus);
+    void startCollect(onewire_bus *bus);
+    void searchStep(onewire_bus *bus);
+    void sendAddresses(onewire_bus *bus);
+    void sendScratchpads(onewire_bus *bus);
+    byte dataOffset(const onewire_command *command, byte flag);
+
+    // bus primitives
+    void driveLow(onewire_bus *bus);
+    void releaseLine(onewire_bus *bus);
+    void driveHigh(onewire_bus *bus);
+    boolean readLine(onewire_bus *bus);
+    boolean resetPulse(onewire_bus *bus);
+    void writeBit(onewire_bus *bus, boolean bit);
+    boolean readBit(onewire_bus *bus);
+    void writeByte(onewire_bus *bus, byte value);
+    byte readByte(onewire_bus *bus);
+    static byte crc8(const byte *data, byte length);
+};
+
+#endif /* OneWireFirmata_h */
@@ -0,0 +1,294 @@
+/*
+  PinChangeFirmata.cpp
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "PinChangeFirmata.h"
+
+// interrupt handlers cannot take arguments, so they are routed to one instance
+static PinChangeFirmata *activePinChange = NULL;
+
+static void pinChangeInterrupt()
+{
+  if (activePinChange) {
+    activePinChange->latchChanges();
+  }
+}
+
+PinChangeFirmata::PinChangeFirmata()
+{
+  activePinChange = this;
+  mode = PIN_CHANGE_MODE_OFF;
+  for (byte i = 0; i < TOTAL_PORTS; i++) {
+    portMask[i] = 0;
+    attachedMask[i] = 0;
+  }
+  head = tail = 0;
+  lost = 0;
+}
+
+boolean PinChangeFirmata::handlePinMode(byte pin, int mode)
+{
+  // ports are handed over by the sketch with setPortMask
+  return false;
+}
+
+void PinChangeFirmata::handleCapability(byte pin)
+{
+}
+
+boolean PinChangeFirmata::handleSysex(byte command, byte argc, byte *argv)
+{
+  if (command != PIN_CHANGE_DATA) {
+    return false;
+  }
+
+  if (argc > 1 && argv[0] == PIN_CHANGE_CONFIG) {
+    if (argv[1] <= PIN_CHANGE_MODE_EVENTS) {
+      mode = argv[1];
+      for (byte port = 0; port < TOTAL_PORTS; port++) {
+        applyPort(port);
+      }
+    }
+  }
+  if (argc > 0 && argv[0] == PIN_CHANGE_CONFIG) {
+    Firmata.startSysex();
+    Firmata.write(PIN_CHANGE_DATA);
+    Firmata.write(PIN_CHANGE_CONFIG);
+    Firmata.write(mode);
+    // changes on other pins are only seen when the sketch polls them
+    for (byte pin = 0; pin < TOTAL_PINS; pin++) {
+      if (isInterruptPin(pin)) {
+        Firmata.write(pin);
+      }
+    }
+    Firmata.endSysex();
+  }
+  return true;
+}
+
+/*
+ * Report the changes latched since the last call.
+ */
+void PinChangeFirmata::update()
+{
+  if (mode == PIN_CHANGE_MODE_OFF) {
+    return;
+  }
+
+  if (lost > 0) {
+    // the queue overflowed: report what is queued, then resynchronize the
+    // host with the latched state of every monitored port
+    byte count;
+    noInterrupts();
+    count = lost;
+    lost = 0;
+    interrupts();
+    if (mode == PIN_CHANGE_MODE_EVENTS) {
+      drainEvents();
+    } else {
+      drainCoalesced();
+    }
+    Firmata.startSysex();
+    Firmata.write(PIN_CHANGE_DATA);
+    Firmata.write(PIN_CHANGE_OVERFLOW);
+    Firmata.write(count > 127 ? 127 : count);
+    Firmata.endSysex();
+    for (byte port = 0; port < TOTAL_PORTS; port++) {
+      if (attachedMask[port]) {
+        reported[port] = latched[port];
+        Firmata.sendDigitalPort(port, reported[port]);
+      }
+    }
+    return;
+  }
+
+  if (mode == PIN_CHANGE_MODE_EVENTS) {
+    drainEvents();
+  } else {
+    drainCoalesced();
+  }
+}
+
+void PinChangeFirmata::reset()
+{
+  mode = PIN_CHANGE_MODE_OFF;
+  for (byte port = 0; port < TOTAL_PORTS; port++) {
+    portMask[port] = 0;
+    applyPort(port);
+  }
+  head = tail = 0;
+  lost = 0;
+}
+
+/*
+ * Set the input pins of a port that the host wants reported. A mask of 0 stops
+ * reporting the port.
+ */
+void PinChangeFirmata::setPortMask(byte port, byte mask)
+{
+  if (port < TOTAL_PORTS && portMask[port] != mask) {
+    portMask[port] = mask;
+    applyPort(port);
+  }
+}
+
+/*
+ * @return true if changes on the port are reported by this feature, in which
+ * case the sketch must not poll it.
+ */
+boolean PinChangeFirmata::isMonitoring(byte port)
+{
+  return port < TOTAL_PORTS && attachedMask[port] != 0;
+}
+
+/*
+ * Compare the monitored ports with the last latched values and queue every
+ * change. Runs in interrupt context.
+ */
+void PinChangeFirmata::latchChanges()
+{
+  unsigned long now = micros();
+
+  for (byte port = 0; port < TOTAL_PORTS; port++) {
+    byte mask = attachedMask[port];
+    if (mask == 0) continue;
+    byte value = readPort(port, mask);
+    if (value == latched[port]) continue;
+    latched[port] = value;
+
+    byte next = (head + 1) % PIN_CHANGE_QUEUE_SIZE;
+    if (next == tail) {
+      if (lost < 255) lost++;
+      continue;
+    }
+    events[head].port = port;
+    events[head].value = value;
+    events[head].time = now;
+    head = next;
+  }
+}
+
+//******************************************************************************
+//* Private Methods
+//******************************************************************************
+
+/*
+ * Attach or detach the pin interrupts of a port to match the reporting mode
+ * and the pins requested by the sketch.
+ */
+void PinChangeFirmata::applyPort(byte port)
+{
+  byte mask = portMask[port];
+  if (mode == PIN_CHANGE_MODE_OFF || !canInterrupt(port, mask)) {
+    mask = 0;
+  }
+  if (mask == attachedMask[port]) {
+    return;
+  }
+
+  for (byte bit = 0; bit < 8; bit++) {
+    byte pin = port * 8 + bit;
+    byte pinBit = 1 << bit;
+    if ((attachedMask[port] & pinBit) && !(mask & pinBit)) {
+      detachInterrupt(digitalPinToInterrupt(PIN_TO_DIGITAL(pin)));
+    }
+  }
+
+  noInterrupts();
+  attachedMask[port] = mask;
+  latched[port] = readPort(port, mask);
+  reported[port] = latched[port];
+  interrupts();
+
+  for (byte bit = 0; bit < 8; bit++) {
+    byte pin = port * 8 + bit;
+    if (mask & (1 << bit)) {
+      attachInterrupt(digitalPinToInterrupt(PIN_TO_DIGITAL(pin)), pinChangeInterrupt, CHANGE);
+    }
+  }
+}
+
+boolean PinChangeFirmata::canInterrupt(byte port, byte mask)
+{
+  if (mask == 0) {
+    return false;
+  }
+  for (byte bit = 0; bit < 8; bit++) {
+    if ((mask & (1 << bit)) && !isInterruptPin(port * 8 + bit)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+boolean PinChangeFirmata::isInterruptPin(byte pin)
+{
+  return IS_PIN_DIGITAL(pin) && digitalPinToInterrupt(PIN_TO_DIGITAL(pin)) != NOT_AN_INTERRUPT;
+}
+
+/*
+ * Send one DIGITAL_MESSAGE per changed port. A pulse that ended before the
+ * queue was drained shows up as toggled bits with an unchanged final value, it
+ * is reported as the pulse value followed by the final value.
+ */
+void PinChangeFirmata::drainCoalesced()
+{
+  byte value[TOTAL_PORTS];
+  byte toggled[TOTAL_PORTS];
+
+  for (byte port = 0; port < TOTAL_PORTS; port++) {
+    value[port] = reported[port];
+    toggled[port] = 0;
+  }
+
+  while (tail != head) {
+    pin_change_event *event = &events[tail];
+    toggled[event->port] |= event->value ^ value[event->port];
+    value[event->port] = event->value;
+    tail = (tail + 1) % PIN_CHANGE_QUEUE_SIZE;
+  }
+
+  for (byte port = 0; port < TOTAL_PORTS; port++) {
+    if (toggled[port] == 0) continue;
+    if (value[port] == reported[port]) {
+      Firmata.sendDigitalPort(port, reported[port] ^ toggled[port]);
+    }
+    Firmata.sendDigitalPort(port, value[port]);
+    reported[port] = value[port];
+  }
+}
+
+/*
+ * PIN_CHANGE_EVENTS: for each queued change the port, the port value as two
+ * 7-bit bytes and the micros() timestamp as 5 7-bit bytes.
+ */
+void PinChangeFirmata::drainEvents()
+{
+  if (tail == head) {
+    return;
+  }
+
+  Firmata.startSysex();
+  Firmata.write(PIN_CHANGE_DATA);
+  Firmata.write(PIN_CHANGE_EVENTS);
+  // limit the message size, the rest is sent on the next call
+  for (byte count = 0; tail != head && count < 8; count++) {
+    pin_change_event *event = &events[tail];
+    Firmata.write(event->port);
+    Firmata.sendValueAsTwo7bitBytes(event->value);
+    for (byte i = 0; i < 5; i++) {
+      Firmata.write((byte)(event->time >> (7 * i)) & 0x7F);
+    }
+    reported[event->port] = event->value;
+    tail = (tail + 1) % PIN_CHANGE_QUEUE_SIZE;
+  }
+  Firmata.endSysex();
+}
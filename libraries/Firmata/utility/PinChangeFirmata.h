@@ -0,0 +1,92 @@
+/*
+  PinChangeFirmata.h
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+
+  Interrupt driven digital input reporting. Every input pin of a reported
+  port is attached to a CHANGE interrupt that latches the new port value
+  and a micros() timestamp into a queue, so pulses shorter than one pass
+  of loop() are not lost. update() drains the queue and either sends
+  coalesced DIGITAL_MESSAGEs per port or timestamped change events.
+
+  Only pins with an external interrupt (INTn, pins 2 and 3 on an Uno) are
+  reported this way, the pin change vectors are owned by SoftwareSerial.
+  The PIN_CHANGE_CONFIG reply lists these pins. A port is only taken over
+  when all of its reported input pins are in that list, other ports are
+  left to the polling code in the sketch and can miss short pulses.
+*/
+
+#ifndef PinChangeFirmata_h
+#define PinChangeFirmata_h
+
+#include <Firmata.h>
+#include "FirmataFeature.h"
+
+#define FIRMATA_PIN_CHANGE_FEATURE
+
+// PIN_CHANGE_DATA sub-commands
+#define PIN_CHANGE_CONFIG           0x00 // query: reporting mode and interrupt pins
+#define PIN_CHANGE_EVENTS           0x01 // reply: list of timestamped port changes
+#define PIN_CHANGE_OVERFLOW         0x02 // reply: number of changes lost since the last report
+
+// PIN_CHANGE_CONFIG reporting modes
+#define PIN_CHANGE_MODE_OFF         0x00 // ports are polled by the sketch
+#define PIN_CHANGE_MODE_COALESCE    0x01 // DIGITAL_MESSAGE per changed port, pulses are kept
+#define PIN_CHANGE_MODE_EVENTS      0x02 // every change with its timestamp
+
+#ifndef PIN_CHANGE_QUEUE_SIZE
+#if defined(RAMEND) && RAMEND < 0x900
+#define PIN_CHANGE_QUEUE_SIZE       16
+#else
+#define PIN_CHANGE_QUEUE_SIZE       64
+#endif
+#endif
+
+struct pin_change_event {
+  byte port;
+  byte value;
+  unsigned long time;  // micros() when the change was latched
+};
+
+class PinChangeFirmata: public FirmataFeature
+{
+  public:
+    PinChangeFirmata();
+    boolean handlePinMode(byte pin, int mode);
+    void handleCapability(byte pin);
+    boolean handleSysex(byte command, byte argc, byte *argv);
+    void update();
+    void reset();
+
+    void setPortMask(byte port, byte mask);
+    boolean isMonitoring(byte port);
+
+    // called from the pin interrupts, do not use directly
+    void latchChanges();
+
+  private:
+    byte mode;
+    byte portMask[TOTAL_PORTS];       // input pins the sketch wants reported
+    byte attachedMask[TOTAL_PORTS];   // pins attached to an interrupt
+    volatile byte latched[TOTAL_PORTS];
+    byte reported[TOTAL_PORTS];
+
+    pin_change_event events[PIN_CHANGE_QUEUE_SIZE];
+    volatile byte head;
+    byte tail;
+    volatile byte lost;
+
+    void applyPort(byte port);
+    boolean canInterrupt(byte port, byte mask);
+    boolean isInterruptPin(byte pin);
+    void drainCoalesced();
+    void drainEvents();
+};
+
+#endif /* PinChangeFirmata_h */
@@ -0,0 +1,190 @@
+/*
+  ReportScheduler.cpp
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "ReportScheduler.h"
+
+ReportScheduler::ReportScheduler()
+{
+  defaultInterval = 19;
+  reset();
+}
+
+/*
+ * Stop all items and forget their intervals, the default interval is kept.
+ */
+void ReportScheduler::reset()
+{
+  for (byte i = 0; i < REPORT_MAX_ITEMS; i++) {
+    items[i].interval = 0;
+    items[i].slot = REPORT_NOT_SCHEDULED;
+  }
+  for (byte i = 0; i < REPORT_WHEEL_SLOTS; i++) {
+    slots[i] = REPORT_NO_ITEM;
+  }
+  wheelTime = millis();
+}
+
+void ReportScheduler::setDefaultInterval(unsigned int interval)
+{
+  defaultInterval = interval;
+}
+
+/*
+ * @param interval The report period in ms, 0 to follow the default interval.
+ * A scheduled item starts over with the new period.
+ */
+void ReportScheduler::setInterval(byte item, unsigned int interval)
+{
+  if (item < REPORT_MAX_ITEMS) {
+    items[item].interval = interval;
+    if (isScheduled(item)) {
+      start(item, millis());
+    }
+  }
+}
+
+unsigned int ReportScheduler::getInterval(byte item)
+{
+  return item < REPORT_MAX_ITEMS ? items[item].interval : 0;
+}
+
+/*
+ * Schedule an item with its first report due one period after now.
+ */
+void ReportScheduler::start(byte item, unsigned long now)
+{
+  if (item >= REPORT_MAX_ITEMS) {
+    return;
+  }
+  stop(item);
+  items[item].due = now + period(item);
+  link(item, items[item].due);
+}
+
+void ReportScheduler::stop(byte item)
+{
+  if (item >= REPORT_MAX_ITEMS) {
+    return;
+  }
+  byte slot = items[item].slot;
+  items[item].slot = REPORT_NOT_SCHEDULED;
+  if (slot >= REPORT_WHEEL_SLOTS) {
+    return;
+  }
+  byte *link = &slots[slot];
+  while (*link != REPORT_NO_ITEM && *link != item) {
+    link = &items[*link].next;
+  }
+  if (*link == item) {
+    *link = items[item].next;
+  }
+}
+
+/*
+ * Hand the interval and schedule of item from over to item to, for lists
+ * that are compacted when an entry is removed. Item from is stopped.
+ */
+void ReportScheduler::move(byte from, byte to)
+{
+  if (to >= REPORT_MAX_ITEMS) {
+    return;
+  }
+  if (from >= REPORT_MAX_ITEMS) {
+    stop(to);
+    items[to].interval = 0;
+    return;
+  }
+  boolean scheduled = isScheduled(from);
+  stop(from);
+  stop(to);
+  items[to].interval = items[from].interval;
+  items[to].due = items[from].due;
+  if (scheduled) {
+    link(to, items[to].due);
+  }
+}
+
+boolean ReportScheduler::isScheduled(byte item)
+{
+  return item < REPORT_MAX_ITEMS && items[item].slot != REPORT_NOT_SCHEDULED;
+}
+
+/*
+ * Call the callback for every scheduled item that is due at now, call on
+ * every pass of loop(). The callback may stop the item it reports, but must
+ * not start or stop other items.
+ */
+void ReportScheduler::update(unsigned long now, reportCallbackFunction callback)
+{
+  if ((long)(now - wheelTime) < 0) {
+    return;
+  }
+  // after a long pass of loop() every slot is visited once
+  if (now - wheelTime >= REPORT_WHEEL_SLOTS) {
+    wheelTime = now - (REPORT_WHEEL_SLOTS - 1);
+  }
+
+  for (; (long)(now - wheelTime) >= 0; wheelTime++) {
+    byte slot = wheelTime & (REPORT_WHEEL_SLOTS - 1);
+    byte item = slots[slot];
+    slots[slot] = REPORT_NO_ITEM;
+    while (item != REPORT_NO_ITEM) {
+      report_item *entry = &items[item];
+      byte next = entry->next;
+      // items in the slot that are due in a later turn of the wheel stay
+      if ((long)(now - entry->due) >= 0) {
+        entry->slot = REPORT_FIRING;
+        boolean done = callback(item);
+        if (entry->slot != REPORT_FIRING) {
+          // stopped by the callback
+        } else if (done) {
+          entry->due += period(item);
+          // skip missed reports rather than sending them back to back
+          if ((long)(now - entry->due) >= 0) {
+            entry->due = now + period(item);
+          }
+          link(item, entry->due);
+        } else {
+          // keep the due time (and so the phase) but retry on the next call
+          link(item, now + 1);
+        }
+      } else {
+        link(item, entry->due);
+      }
+      item = next;
+    }
+  }
+}
+
+//******************************************************************************
+//* Private Methods
+//******************************************************************************
+
+unsigned int ReportScheduler::period(byte item)
+{
+  return items[item].interval > 0 ? items[item].interval : defaultInterval;
+}
+
+/*
+ * Put an item in the slot of time, or in the next slot to visit when that
+ * time has passed.
+ */
+void ReportScheduler::link(byte item, unsigned long time)
+{
+  if ((long)(time - wheelTime) < 0) {
+    time = wheelTime;
+  }
+  byte slot = time & (REPORT_WHEEL_SLOTS - 1);
+  items[item].slot = slot;
+  items[item].next = slots[slot];
+  slots[slot] = item;
+}
@@ -0,0 +1,85 @@
+/*
+  ReportScheduler.h
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+
+  Per item report periods for the analog pins, digital ports and
+  continuous I2C queries of a sketch. Items without their own interval
+  follow the default interval (the SAMPLING_INTERVAL of the host).
+
+  Scheduled items sit in a timing wheel with one slot per millisecond, so
+  update() only visits the slots that passed since the last call and the
+  items in them, not every pin and query on every pass of loop().
+*/
+
+#ifndef ReportScheduler_h
+#define ReportScheduler_h
+
+#include <Firmata.h>
+
+// SAMPLING_INTERVAL item types (interval LSB, MSB, type, index)
+#define REPORT_TYPE_ANALOG          0x00 // index: analog channel
+#define REPORT_TYPE_PORT            0x01 // index: digital port
+
+#if defined(RAMEND) && RAMEND < 0x900
+#define REPORT_I2C_ITEMS            8
+#define REPORT_WHEEL_SLOTS          16
+#else
+#define REPORT_I2C_ITEMS            24
+#define REPORT_WHEEL_SLOTS          64   // a power of 2
+#endif
+
+// item numbers
+#define REPORT_ANALOG_ITEM(channel) (channel)
+#define REPORT_PORT_ITEM(port)      (TOTAL_ANALOG_PINS + (port))
+#define REPORT_I2C_ITEM(query)      (TOTAL_ANALOG_PINS + TOTAL_PORTS + (query))
+#define REPORT_MAX_ITEMS            (TOTAL_ANALOG_PINS + TOTAL_PORTS + REPORT_I2C_ITEMS)
+
+#define REPORT_NO_ITEM              0xFF
+#define REPORT_NOT_SCHEDULED        0xFF
+#define REPORT_FIRING               0xFE
+
+/*
+ * Sends the report of an item that is due.
+ * @return false to try again on the next call of update()
+ */
+typedef boolean (*reportCallbackFunction)(byte item);
+
+struct report_item {
+  unsigned int interval;    // ms, 0 = the default interval
+  unsigned long due;        // millis() value of the next report
+  byte slot;                // wheel slot, REPORT_NOT_SCHEDULED or REPORT_FIRING
+  byte next;                // next item in the slot
+};
+
+class ReportScheduler
+{
+  public:
+    ReportScheduler();
+    void reset();
+    void setDefaultInterval(unsigned int interval);
+    void setInterval(byte item, unsigned int interval);
+    unsigned int getInterval(byte item);
+    void start(byte item, unsigned long now);
+    void stop(byte item);
+    void move(byte from, byte to);
+    boolean isScheduled(byte item);
+    void update(unsigned long now, reportCallbackFunction callback);
+
+  private:
+    report_item items[REPORT_MAX_ITEMS];
+    byte slots[REPORT_WHEEL_SLOTS];
+    unsigned long wheelTime;  // the next slot to visit
+    unsigned int defaultInterval;
+
+    unsigned int period(byte item);
+    void link(byte item, unsigned long time);
+};
+
+#endif /* ReportScheduler_h */
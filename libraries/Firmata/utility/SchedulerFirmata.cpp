@@ -0,0 +1,396 @@
+/*
+  SchedulerFirmata.cpp
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "SchedulerFirmata.h"
+
+/*
+ * Decode a packed little endian unsigned long (4 bytes, 5 7-bit bytes).
+ */
+static unsigned long decodeTime(byte argc, byte *argv)
+{
+  unsigned long value = 0;
+  byte count = Firmata.decodePackedBytes(argc > 5 ? 5 : argc, argv);
+  for (byte i = count; i > 0; i--) {
+    value = (value << 8) | argv[i - 1];
+  }
+  return value;
+}
+
+/*
+ * Check that task data holds whole messages, read the way Firmata.parse()
+ * reads them. A task ending partway through a message would leave the parser
+ * waiting for the rest from the host, and a sysex message must fit the
+ * parser's buffer.
+ */
+static boolean holdsWholeMessages(const byte *data, unsigned int len)
+{
+  boolean sysex = false;
+  byte sysexBytes = 0;
+  byte waitForData = 0;
+
+  for (unsigned int i = 0; i < len; i++) {
+    byte value = data[i];
+    if (sysex) {
+      if (value == END_SYSEX) {
+        sysex = false;
+      } else if (++sysexBytes > MAX_DATA_BYTES) {
+        return false;
+      }
+    } else if (waitForData > 0 && value < 128) {
+      waitForData--;
+    } else {
+      switch (value < 0xF0 ? value & 0xF0 : value) {
+        case ANALOG_MESSAGE:
+        case DIGITAL_MESSAGE:
+        case SET_PIN_MODE:
+        case SET_DIGITAL_PIN_VALUE:
+          waitForData = 2;
+          break;
+        case REPORT_ANALOG:
+        case REPORT_DIGITAL:
+          waitForData = 1;
+          break;
+        case START_SYSEX:
+          sysex = true;
+          sysexBytes = 0;
+          break;
+      }
+    }
+  }
+  return !sysex && waitForData == 0;
+}
+
+SchedulerFirmata::SchedulerFirmata()
+{
+  taskCount = 0;
+  memoryUsed = 0;
+  runningTask = SCHEDULER_NO_TASK;
+}
+
+boolean SchedulerFirmata::handlePinMode(byte pin, int mode)
+{
+  return false;
+}
+
+void SchedulerFirmata::handleCapability(byte pin)
+{
+}
+
+boolean SchedulerFirmata::handleSysex(byte command, byte argc, byte *argv)
+{
+  if (command != SCHEDULER_DATA) {
+    return false;
+  }
+  if (argc < 1) {
+    return true;
+  }
+
+  switch (argv[0]) {
+    case CREATE_FIRMATA_TASK:
+      if (argc > 3) {
+        createTask(argv[1], argv[2] | (argv[3] << 7));
+      }
+      break;
+    case DELETE_FIRMATA_TASK:
+      if (argc > 1) {
+        deleteTask(argv[1]);
+      }
+      break;
+    case ADD_TO_FIRMATA_TASK:
+      if (argc > 2) {
+        byte len = Firmata.decodePackedBytes(argc - 2, argv + 2);
+        addToTask(argv[1], len, argv + 2);
+      }
+      break;
+    case DELAY_FIRMATA_TASK:
+      if (argc > 1) {
+        delayTask(decodeTime(argc - 1, argv + 1));
+      }
+      break;
+    case SCHEDULE_FIRMATA_TASK:
+      if (argc > 2) {
+        scheduleTask(argv[1], decodeTime(argc - 2, argv + 2));
+      }
+      break;
+    case QUERY_ALL_FIRMATA_TASKS:
+      queryAllTasks();
+      break;
+    case QUERY_FIRMATA_TASK:
+      if (argc > 1) {
+        reportTask(argv[1], findTask(argv[1]) == SCHEDULER_NO_TASK);
+      }
+      break;
+    case RESET_FIRMATA_TASKS:
+      reset();
+      break;
+  }
+  return true;
+}
+
+/*
+ * Run every task that is due. Each task runs at most once per call.
+ */
+void SchedulerFirmata::update()
+{
+  // the task data goes through the same parser as the host messages, so a
+  // partially received host message must be completed first
+  if (taskCount == 0 || runningTask != SCHEDULER_NO_TASK || Firmata.isParsingMessage()) {
+    return;
+  }
+
+  unsigned long now = millis();
+  byte index = 0;
+  while (index < taskCount) {
+    firmata_task *task = &tasks[index];
+    if (task->scheduled && (long)(now - task->time_ms) >= 0) {
+      byte id = task->id;
+      if (!execute(index)) {
+        byte finished = findTask(id);
+        if (finished != SCHEDULER_NO_TASK) {
+          removeTask(finished);
+        }
+        // the tasks after the removed one have moved down
+        index = finished != SCHEDULER_NO_TASK ? finished : index;
+        continue;
+      }
+      // tasks may have been created or deleted while the task ran
+      index = findTask(id);
+      if (index == SCHEDULER_NO_TASK) {
+        return;
+      }
+    }
+    index++;
+  }
+}
+
+void SchedulerFirmata::reset()
+{
+  taskCount = 0;
+  memoryUsed = 0;
+  // stops a task that resets the scheduler from within
+  runningTask = SCHEDULER_NO_TASK;
+}
+
+//******************************************************************************
+//* Private Methods
+//******************************************************************************
+
+byte SchedulerFirmata::findTask(byte id)
+{
+  for (byte i = 0; i < taskCount; i++) {
+    if (tasks[i].id == id) {
+      return i;
+    }
+  }
+  return SCHEDULER_NO_TASK;
+}
+
+void SchedulerFirmata::createTask(byte id, unsigned int len)
+{
+  if (findTask(id) != SCHEDULER_NO_TASK || taskCount >= SCHEDULER_MAX_TASKS
+      || len > SCHEDULER_MEMORY_SIZE - memoryUsed) {
+    reportTask(id, true);
+    return;
+  }
+
+  firmata_task *task = &tasks[taskCount++];
+  task->id = id;
+  task->scheduled = false;
+  task->time_ms = 0;
+  task->offset = memoryUsed;
+  task->len = len;
+  task->pos = 0;
+  memoryUsed += len;
+}
+
+void SchedulerFirmata::deleteTask(byte id)
+{
+  byte index = findTask(id);
+  if (index == SCHEDULER_NO_TASK) {
+    reportTask(id, true);
+    return;
+  }
+  if (index == runningTask) {
+    // removed by execute() once the current message has been handled
+    runningDeleted = true;
+    return;
+  }
+  removeTask(index);
+}
+
+void SchedulerFirmata::addToTask(byte id, byte bytec, byte *bytev)
+{
+  byte index = findTask(id);
+  if (index == SCHEDULER_NO_TASK || tasks[index].pos + bytec > tasks[index].len) {
+    reportTask(id, true);
+    return;
+  }
+
+  firmata_task *task = &tasks[index];
+  memcpy(memory + task->offset + task->pos, bytev, bytec);
+  task->pos += bytec;
+}
+
+/*
+ * Only valid inside a task: suspend the running task. The delay is added to
+ * the time the task was due, so a looping task does not drift.
+ */
+void SchedulerFirmata::delayTask(unsigned long delay_ms)
+{
+  if (runningTask == SCHEDULER_NO_TASK) {
+    return;
+  }
+  tasks[runningTask].time_ms += delay_ms;
+  runningDelayed = true;
+}
+
+void SchedulerFirmata::scheduleTask(byte id, unsigned long delay_ms)
+{
+  byte index = findTask(id);
+  // a task can only be scheduled once its upload is complete, and only if
+  // it holds whole messages
+  if (index == SCHEDULER_NO_TASK || (!tasks[index].scheduled
+      && (tasks[index].pos < tasks[index].len
+          || !holdsWholeMessages(memory + tasks[index].offset, tasks[index].len)))) {
+    reportTask(id, true);
+    return;
+  }
+
+  firmata_task *task = &tasks[index];
+  if (index == runningTask) {
+    // a task rescheduling itself is suspended like a delayed task
+    runningDelayed = true;
+  }
+  task->pos = 0;
+  task->time_ms = millis() + delay_ms;
+  task->scheduled = true;
+}
+
+/*
+ * Replay a task until it is delayed or reaches its end.
+ * @return false if the task has finished and should be removed.
+ */
+boolean SchedulerFirmata::execute(byte index)
+{
+  runningTask = index;
+  runningDelayed = false;
+  runningDeleted = false;
+
+  while (tasks[runningTask].pos < tasks[runningTask].len) {
+    firmata_task *task = &tasks[runningTask];
+    byte value = memory[task->offset + task->pos++];
+    Firmata.parse(value);
+
+    if (runningTask == SCHEDULER_NO_TASK) {
+      // the scheduler was reset by the task
+      return true;
+    }
+    if (runningDeleted) {
+      runningTask = SCHEDULER_NO_TASK;
+      return false;
+    }
+    if (runningDelayed && !Firmata.isParsingMessage()) {
+      task = &tasks[runningTask];
+      // a delay as the last message starts the task over
+      if (task->pos >= task->len) {
+        task->pos = 0;
+      }
+      runningTask = SCHEDULER_NO_TASK;
+      return true;
+    }
+  }
+
+  // scheduleTask() only accepts whole messages, but never leave the parser
+  // waiting for the rest of a task's message from the host
+  if (Firmata.isParsingMessage()) {
+    Firmata.resetParser();
+  }
+  runningTask = SCHEDULER_NO_TASK;
+  return false;
+}
+
+/*
+ * Release a task and move the data of the following tasks down.
+ */
+void SchedulerFirmata::removeTask(byte index)
+{
+  unsigned int offset = tasks[index].offset;
+  unsigned int len = tasks[index].len;
+
+  memmove(memory + offset, memory + offset + len, memoryUsed - offset - len);
+  memoryUsed -= len;
+  for (byte i = index; i + 1 < taskCount; i++) {
+    tasks[i] = tasks[i + 1];
+    tasks[i].offset -= len;
+  }
+  taskCount--;
+
+  if (runningTask != SCHEDULER_NO_TASK && runningTask > index) {
+    runningTask--;
+  }
+}
+
+/*
+ * QUERY_ALL_TASKS_REPLY: the ids of all tasks.
+ */
+void SchedulerFirmata::queryAllTasks()
+{
+  Firmata.startSysex();
+  Firmata.write(SCHEDULER_DATA);
+  Firmata.write(QUERY_ALL_TASKS_REPLY);
+  for (byte i = 0; i < taskCount; i++) {
+    Firmata.write(tasks[i].id);
+  }
+  Firmata.endSysex();
+}
+
+/*
+ * QUERY_TASK_REPLY: task id, then packed: time_ms (4 bytes), len (2 bytes),
+ * pos (2 bytes) and the task data, all little endian. ERROR_TASK_REPLY carries
+ * the same data if the task exists, otherwise just the id.
+ */
+void SchedulerFirmata::reportTask(byte id, boolean error)
+{
+  byte index = findTask(id);
+
+  Firmata.startSysex();
+  Firmata.write(SCHEDULER_DATA);
+  Firmata.write(error ? ERROR_TASK_REPLY : QUERY_TASK_REPLY);
+  Firmata.write(id);
+  if (index != SCHEDULER_NO_TASK) {
+    firmata_task *task = &tasks[index];
+    // 7 data bytes pack into exactly 8 7-bit bytes, so the packed stream
+    // can be written in chunks of 7
+    byte chunk[7];
+    byte count = 0;
+    unsigned int total = 8 + task->len;
+    for (unsigned int i = 0; i < total; i++) {
+      if (i < 4) {
+        chunk[count++] = (task->time_ms >> (8 * i)) & 0xFF;
+      } else if (i < 6) {
+        chunk[count++] = (task->len >> (8 * (i - 4))) & 0xFF;
+      } else if (i < 8) {
+        chunk[count++] = (task->pos >> (8 * (i - 6))) & 0xFF;
+      } else {
+        chunk[count++] = memory[task->offset + i - 8];
+      }
+      if (count == sizeof(chunk)) {
+        Firmata.sendPackedBytes(count, chunk);
+        count = 0;
+      }
+    }
+    if (count > 0) {
+      Firmata.sendPackedBytes(count, chunk);
+    }
+  }
+  Firmata.endSysex();
+}
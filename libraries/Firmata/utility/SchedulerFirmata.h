@@ -0,0 +1,105 @@
+/*
+  SchedulerFirmata.h
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+
+  On-device task scheduler. A task is a sequence of regular Firmata
+  messages uploaded by the host and replayed through Firmata.parse() at
+  the scheduled time, so timed sequences run without a host round trip
+  per step. A DELAY_FIRMATA_TASK message inside a task suspends it for
+  the given number of milliseconds; a delay at the end of a task starts
+  it over, which is how loops are written. A task that runs to its end
+  without a delay is deleted. A task must hold whole messages: scheduling
+  one that ends partway through a message, or holds a sysex message longer
+  than MAX_DATA_BYTES, is answered with ERROR_TASK_REPLY.
+
+  Task data shares one fixed memory block, the protocol is compatible with
+  the ConfigurableFirmata scheduler (binary data is packed 7 bytes into 8).
+*/
+
+#ifndef SchedulerFirmata_h
+#define SchedulerFirmata_h
+
+#include <Firmata.h>
+#include "FirmataFeature.h"
+
+#define FIRMATA_SCHEDULER_FEATURE
+
+// SCHEDULER_DATA sub-commands
+#define CREATE_FIRMATA_TASK         0x00
+#define DELETE_FIRMATA_TASK         0x01
+#define ADD_TO_FIRMATA_TASK         0x02
+#define DELAY_FIRMATA_TASK          0x03
+#define SCHEDULE_FIRMATA_TASK       0x04
+#define QUERY_ALL_FIRMATA_TASKS     0x05
+#define QUERY_FIRMATA_TASK          0x06
+#define RESET_FIRMATA_TASKS         0x07
+#define ERROR_TASK_REPLY            0x08
+#define QUERY_ALL_TASKS_REPLY       0x09
+#define QUERY_TASK_REPLY            0x0A
+
+#ifndef SCHEDULER_MEMORY_SIZE
+#if defined(RAMEND) && RAMEND < 0x900
+#define SCHEDULER_MEMORY_SIZE       128 // bytes of task data
+#else
+#define SCHEDULER_MEMORY_SIZE       1024
+#endif
+#endif
+
+#ifndef SCHEDULER_MAX_TASKS
+#if defined(RAMEND) && RAMEND < 0x900
+#define SCHEDULER_MAX_TASKS         4
+#else
+#define SCHEDULER_MAX_TASKS         16
+#endif
+#endif
+
+#define SCHEDULER_NO_TASK           0xFF
+
+struct firmata_task {
+  byte id;
+  boolean scheduled;
+  unsigned long time_ms;   // millis() of the next run
+  unsigned int offset;     // start of the task data in the scheduler memory
+  unsigned int len;        // reserved length of the task data
+  unsigned int pos;        // end of the data while uploading, resume position when scheduled
+};
+
+class SchedulerFirmata: public FirmataFeature
+{
+  public:
+    SchedulerFirmata();
+    boolean handlePinMode(byte pin, int mode);
+    void handleCapability(byte pin);
+    boolean handleSysex(byte command, byte argc, byte *argv);
+    void update();
+    void reset();
+
+  private:
+    firmata_task tasks[SCHEDULER_MAX_TASKS];
+    byte taskCount;
+    byte memory[SCHEDULER_MEMORY_SIZE];
+    unsigned int memoryUsed;
+    byte runningTask;        // index of the task being replayed
+    boolean runningDelayed;
+    boolean runningDeleted;
+
+    byte findTask(byte id);
+    void createTask(byte id, unsigned int len);
+    void deleteTask(byte id);
+    void addToTask(byte id, byte bytec, byte *bytev);
+    void delayTask(unsigned long delay_ms);
+    void scheduleTask(byte id, unsigned long delay_ms);
+    boolean execute(byte index);
+    void removeTask(byte index);
+    void queryAllTasks();
+    void reportTask(byte id, boolean error);
+};
+
+#endif /* SchedulerFirmata_h */
@@ -119,15 +119,14 @@ boolean SerialFirmata::handleSysex(byte command, byte argc, byte *argv)
         }
       case SERIAL_WRITE:
         {
-          byte data;
+          byte count;
           serialPort = getPortFromId(portId);
-          if (serialPort == NULL) {
+          if (serialPort == NULL || argc < 2) {
             break;
           }
-          for (byte i = 1; i < argc; i += 2) {
-            data = argv[i] + (argv[i + 1] << 7);
-            serialPort->write(data);
-          }
+          // two 7-bit bytes per data byte, or packed if negotiated with BINARY_ENCODING
+          count = Firmata.decodeBinary(argc - 1, argv + 1);
+          serialPort->write(argv + 1, count);
           break; // SERIAL_WRITE
         }
       case SERIAL_READ:
@@ -281,7 +280,9 @@ Stream* SerialFirmata::getPortFromId(byte portId)
 // for each port to the device attached to that port.
 void SerialFirmata::checkSerial()
 {
-  byte portId, serialData;
+  byte portId;
+  byte serialData[7]; // relayed in groups of 7 bytes, the unit of the packed encoding
+  byte count;
   int bytesToRead = 0;
   int numBytesToRead = 0;
   Stream* serialPort;
@@ -315,10 +316,12 @@ void SerialFirmata::checkSerial()
 
         // relay serial data to the serial device
         while (numBytesToRead > 0) {
-          serialData = serialPort->read();
-          Firmata.write(serialData & 0x7F);
-          Firmata.write((serialData >> 7) & 0x7F);
-          numBytesToRead--;
+          count = numBytesToRead < 7 ? numBytesToRead : 7;
+          for (byte j = 0; j < count; j++) {
+            serialData[j] = serialPort->read();
+          }
+          Firmata.sendBinary(count, serialData);
+          numBytesToRead -= count;
         }
         Firmata.write(END_SYSEX);
       }
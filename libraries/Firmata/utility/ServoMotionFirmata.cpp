@@ -0,0 +1,326 @@
+/*
+  ServoMotionFirmata.cpp
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "ServoMotionFirmata.h"
+#include <math.h>
+
+ServoMotionFirmata::ServoMotionFirmata(Servo *servos, byte *servoPinMap)
+{
+  this->servos = servos;
+  this->servoPinMap = servoPinMap;
+  for (byte i = 0; i < SERVO_MOTION_MAX_MOVES; i++) {
+    moves[i].pin = SERVO_MOTION_NO_PIN;
+  }
+  lastUpdate = 0;
+}
+
+boolean ServoMotionFirmata::handlePinMode(byte pin, int mode)
+{
+  // servos are attached by the sketch
+  return false;
+}
+
+void ServoMotionFirmata::handleCapability(byte pin)
+{
+}
+
+boolean ServoMotionFirmata::handleSysex(byte command, byte argc, byte *argv)
+{
+  if (command != SERVO_MOTION_DATA) {
+    return false;
+  }
+  if (argc < 1) {
+    return true;
+  }
+
+  switch (argv[0]) {
+    case SERVO_MOTION_MOVE:
+      queueMove(argc - 1, argv + 1);
+      break;
+    case SERVO_MOTION_START:
+      if (argc > 1) {
+        startGroup(argv[1], millis());
+      }
+      break;
+    case SERVO_MOTION_STOP:
+      stopGroup(argc > 1 ? argv[1] : 0, argc < 2);
+      break;
+  }
+  return true;
+}
+
+/*
+ * Write the positions of the running moves, at most every
+ * SERVO_MOTION_INTERVAL ms.
+ */
+void ServoMotionFirmata::update()
+{
+  unsigned long now = millis();
+  if (now - lastUpdate < SERVO_MOTION_INTERVAL) {
+    return;
+  }
+  lastUpdate = now;
+
+  for (byte i = 0; i < SERVO_MOTION_MAX_MOVES; i++) {
+    servo_motion *move = &moves[i];
+    if (move->pin == SERVO_MOTION_NO_PIN || move->held) {
+      continue;
+    }
+    Servo *servo = servoOf(move->pin);
+    if (servo == NULL) {
+      // the pin was reconfigured without going through the sketch
+      move->pin = SERVO_MOTION_NO_PIN;
+      reportIfDone(move->group);
+      continue;
+    }
+    unsigned long elapsed = now - move->start;
+    if (elapsed >= move->duration) {
+      servo->writeMicroseconds(move->to);
+      release(move, move->to);
+    } else {
+      servo->writeMicroseconds(positionAt(move, elapsed));
+    }
+  }
+}
+
+void ServoMotionFirmata::reset()
+{
+  for (byte i = 0; i < SERVO_MOTION_MAX_MOVES; i++) {
+    moves[i].pin = SERVO_MOTION_NO_PIN;
+  }
+}
+
+void ServoMotionFirmata::cancel(byte pin)
+{
+  servo_motion *move = slotOf(pin);
+  if (move != NULL) {
+    move->pin = SERVO_MOTION_NO_PIN;
+    reportIfDone(move->group);
+  }
+}
+
+//******************************************************************************
+//* Private Methods
+//******************************************************************************
+
+Servo *ServoMotionFirmata::servoOf(byte pin)
+{
+  if (pin >= TOTAL_PINS || Firmata.getPinMode(pin) != PIN_MODE_SERVO) {
+    return NULL;
+  }
+  byte index = servoPinMap[pin];
+  if (index >= MAX_SERVOS || !servos[index].attached()) {
+    return NULL;
+  }
+  return &servos[index];
+}
+
+servo_motion *ServoMotionFirmata::slotOf(byte pin)
+{
+  for (byte i = 0; i < SERVO_MOTION_MAX_MOVES; i++) {
+    if (moves[i].pin == pin) {
+      return &moves[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * group, flags, duration (ms), speed (us/s), accel (SERVO_MOTION_ACCEL_UNIT)
+ * as 14 bit values, then pin and 14 bit target pulse width (us) per servo.
+ * A move replaces the move of a servo in another group or a held move. A
+ * servo that is moving with its group is refused, it would no longer
+ * finish with the rest of the group; stop the group first.
+ */
+void ServoMotionFirmata::queueMove(byte argc, byte *argv)
+{
+  if (argc < 11 || (argc - 8) % 3 != 0) {
+    Firmata.sendString("ServoMotion: invalid move");
+    return;
+  }
+  byte group = argv[0];
+  boolean hold = argv[1] & SERVO_MOTION_HOLD;
+  unsigned int duration = argv[2] | (argv[3] << 7);
+  unsigned int speed = argv[4] | (argv[5] << 7);
+  unsigned int accel = argv[6] | (argv[7] << 7);
+
+  for (byte i = 8; i + 2 < argc; i += 3) {
+    servo_motion *move = slotOf(argv[i]);
+    if (move != NULL && move->group == group && !move->held) {
+      Firmata.sendString("ServoMotion: group is moving");
+      return;
+    }
+  }
+
+  for (byte i = 8; i + 2 < argc; i += 3) {
+    byte pin = argv[i];
+    if (servoOf(pin) == NULL) {
+      Firmata.sendString("ServoMotion: pin is not a servo");
+      continue;
+    }
+    servo_motion *move = slotOf(pin);
+    if (move != NULL && move->group != group) {
+      // the replaced move no longer holds its group back
+      move->pin = SERVO_MOTION_NO_PIN;
+      reportIfDone(move->group);
+    } else if (move == NULL) {
+      move = slotOf(SERVO_MOTION_NO_PIN);
+      if (move == NULL) {
+        Firmata.sendString("ServoMotion: too many moves");
+        return;
+      }
+    }
+    move->pin = pin;
+    move->group = group;
+    move->held = true;
+    move->to = argv[i + 1] | (argv[i + 2] << 7);
+    move->speed = speed;
+    move->accel = accel;
+    move->duration = duration;
+  }
+
+  if (!hold) {
+    startGroup(group, millis());
+  }
+}
+
+/*
+ * Start the held moves of a group from where their servos are now. The
+ * group takes as long as its slowest member, each move then gets the
+ * shortest ramps its acceleration allows in that time.
+ */
+void ServoMotionFirmata::startGroup(byte group, unsigned long now)
+{
+  unsigned long duration = 0;
+  for (byte i = 0; i < SERVO_MOTION_MAX_MOVES; i++) {
+    servo_motion *move = &moves[i];
+    if (move->pin == SERVO_MOTION_NO_PIN || move->group != group || !move->held) {
+      continue;
+    }
+    Servo *servo = servoOf(move->pin);
+    if (servo == NULL) {
+      move->pin = SERVO_MOTION_NO_PIN;
+      continue;
+    }
+    move->from = servo->readMicroseconds();
+    float distance = move->from > move->to ? move->from - move->to : move->to - move->from;
+    float speed = move->speed;
+    float accel = (float)move->accel * SERVO_MOTION_ACCEL_UNIT;
+    float seconds = 0;
+    if (accel > 0) {
+      if (speed == 0 || distance <= speed * speed / accel) {
+        // triangular, the top speed is never reached
+        seconds = 2 * sqrt(distance / accel);
+      } else {
+        seconds = distance / speed + speed / accel;
+      }
+    } else if (speed > 0) {
+      seconds = distance / speed;
+    }
+    unsigned long needed = (unsigned long)(seconds * 1000 + 0.5);
+    if (move->duration > duration) {
+      duration = move->duration;
+    }
+    if (needed > duration) {
+      duration = needed;
+    }
+  }
+
+  for (byte i = 0; i < SERVO_MOTION_MAX_MOVES; i++) {
+    servo_motion *move = &moves[i];
+    if (move->pin == SERVO_MOTION_NO_PIN || move->group != group || !move->held) {
+      continue;
+    }
+    move->held = false;
+    move->start = now;
+    move->duration = duration;
+    move->ramp = 0;
+    if (move->accel > 0 && duration > 0) {
+      // distance = accel * ramp * (duration - ramp), for the shortest ramp
+      float distance = move->from > move->to ? move->from - move->to : move->to - move->from;
+      float accel = (float)move->accel * SERVO_MOTION_ACCEL_UNIT;
+      float seconds = duration / 1000.0;
+      float discriminant = seconds * seconds - 4 * distance / accel;
+      float ramp = (seconds - sqrt(discriminant > 0 ? discriminant : 0)) / 2;
+      move->ramp = (unsigned long)(ramp * 1000 + 0.5);
+      if (move->ramp > duration / 2) {
+        move->ramp = duration / 2;
+      }
+    }
+  }
+  // let update() write the first step or the targets of instant moves
+  lastUpdate = now - SERVO_MOTION_INTERVAL;
+}
+
+void ServoMotionFirmata::stopGroup(byte group, boolean allGroups)
+{
+  unsigned long now = millis();
+  for (byte i = 0; i < SERVO_MOTION_MAX_MOVES; i++) {
+    servo_motion *move = &moves[i];
+    if (move->pin == SERVO_MOTION_NO_PIN || (!allGroups && move->group != group)) {
+      continue;
+    }
+    Servo *servo = servoOf(move->pin);
+    if (servo != NULL && !move->held) {
+      unsigned int position = now - move->start >= move->duration
+                              ? move->to : positionAt(move, now - move->start);
+      servo->writeMicroseconds(position);
+      Firmata.setPinState(move->pin, position);
+    }
+    move->pin = SERVO_MOTION_NO_PIN;
+  }
+}
+
+void ServoMotionFirmata::release(servo_motion *move, unsigned int position)
+{
+  Firmata.setPinState(move->pin, position);
+  move->pin = SERVO_MOTION_NO_PIN;
+  reportIfDone(move->group);
+}
+
+/*
+ * Trapezoidal profile: constant acceleration for ramp ms, constant speed,
+ * then the mirrored deceleration. Without a ramp the speed is constant.
+ */
+unsigned int ServoMotionFirmata::positionAt(servo_motion *move, unsigned long elapsed)
+{
+  float total = move->duration;
+  float ramp = move->ramp;
+  float t = elapsed;
+  float fraction;
+  if (ramp == 0) {
+    fraction = t / total;
+  } else if (t < ramp) {
+    fraction = t * t / (2 * ramp * (total - ramp));
+  } else if (t <= total - ramp) {
+    fraction = (2 * t - ramp) / (2 * (total - ramp));
+  } else {
+    float left = total - t;
+    fraction = 1 - left * left / (2 * ramp * (total - ramp));
+  }
+  float distance = (float)move->to - (float)move->from;
+  return (unsigned int)((float)move->from + distance * fraction + 0.5);
+}
+
+void ServoMotionFirmata::reportIfDone(byte group)
+{
+  for (byte i = 0; i < SERVO_MOTION_MAX_MOVES; i++) {
+    if (moves[i].pin != SERVO_MOTION_NO_PIN && moves[i].group == group) {
+      return;
+    }
+  }
+  Firmata.startSysex();
+  Firmata.write(SERVO_MOTION_DATA);
+  Firmata.write(SERVO_MOTION_DONE);
+  Firmata.write(group);
+  Firmata.endSysex();
+}
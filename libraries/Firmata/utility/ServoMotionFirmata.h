@@ -0,0 +1,103 @@
+/*
+  ServoMotionFirmata.h
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+
+  Servo moves interpolated on the board. The host sends the target pulse
+  width of one or more servos with a duration and/or speed and acceleration
+  limits, and the board writes the intermediate positions every
+  SERVO_MOTION_INTERVAL ms (the Servo library repeats the pulse every 20 ms,
+  so writing faster would not move the servos any smoother).
+
+  All servos of a group start together and finish together: the group
+  takes as long as its slowest servo needs within its limits (or the given
+  duration if that is longer) and every servo ramps its own distance over
+  that time with a trapezoidal speed profile. Moves can be held and started
+  with SERVO_MOTION_START, so groups larger than one sysex message start in
+  sync. A SERVO_MOTION_DONE message is sent when the last servo of a group
+  reaches its target. A servo can not get a new move in its own group while
+  that group is moving.
+
+  The servos themselves belong to the sketch, which passes its Servo array
+  and pin to servo map to the constructor. Only pins in PIN_MODE_SERVO are
+  moved.
+*/
+
+#ifndef ServoMotionFirmata_h
+#define ServoMotionFirmata_h
+
+#include <Servo.h>
+#include <Firmata.h>
+#include "FirmataFeature.h"
+
+#define FIRMATA_SERVO_MOTION_FEATURE
+
+// SERVO_MOTION_DATA sub-commands
+#define SERVO_MOTION_MOVE           0x00 // group, flags, duration, speed, accel, {pin, target}*
+#define SERVO_MOTION_START          0x01 // group, start the held moves of a group
+#define SERVO_MOTION_STOP           0x02 // [group], stop the servos where they are, all groups if omitted
+#define SERVO_MOTION_DONE           0x03 // reply: group, the last servo of the group reached its target
+
+// SERVO_MOTION_MOVE flags
+#define SERVO_MOTION_HOLD           0x01 // wait for SERVO_MOTION_START
+
+#define SERVO_MOTION_INTERVAL       10 // ms between position updates
+#define SERVO_MOTION_ACCEL_UNIT     100 // us/s^2 per unit of the accel field
+
+#if defined(RAMEND) && RAMEND < 0x900
+#define SERVO_MOTION_MAX_MOVES      6
+#else
+#define SERVO_MOTION_MAX_MOVES      16
+#endif
+
+#define SERVO_MOTION_NO_PIN         0xFF
+
+struct servo_motion {
+  byte pin;                 // SERVO_MOTION_NO_PIN if the slot is free
+  byte group;
+  boolean held;
+  unsigned int from;        // us
+  unsigned int to;          // us
+  unsigned int speed;       // us/s, 0 for no limit
+  unsigned int accel;       // SERVO_MOTION_ACCEL_UNIT, 0 for no ramp
+  unsigned long start;      // ms
+  unsigned long duration;   // ms, the requested duration until started
+  unsigned long ramp;       // ms of acceleration and of deceleration
+};
+
+class ServoMotionFirmata: public FirmataFeature
+{
+  public:
+    ServoMotionFirmata(Servo *servos, byte *servoPinMap);
+    boolean handlePinMode(byte pin, int mode);
+    void handleCapability(byte pin);
+    boolean handleSysex(byte command, byte argc, byte *argv);
+    void update();
+    void reset();
+
+    // drop the move of a pin, for direct writes and detached servos
+    void cancel(byte pin);
+
+  private:
+    Servo *servos;
+    byte *servoPinMap;
+    servo_motion moves[SERVO_MOTION_MAX_MOVES];
+    unsigned long lastUpdate;
+
+    Servo *servoOf(byte pin);
+    servo_motion *slotOf(byte pin);
+    void queueMove(byte argc, byte *argv);
+    void startGroup(byte group, unsigned long now);
+    void stopGroup(byte group, boolean allGroups);
+    void release(servo_motion *move, unsigned int position);
+    unsigned int positionAt(servo_motion *move, unsigned long elapsed);
+    void reportIfDone(byte group);
+};
+
+#endif /* ServoMotionFirmata_h */
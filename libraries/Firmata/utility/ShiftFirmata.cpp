@@ -0,0 +1,233 @@
+/*
+  ShiftFirmata.cpp
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "ShiftFirmata.h"
+
+/*
+ * Replaced by the sketch when it defines FIRMATA_SHIFT_SPI, see ShiftFirmata.h.
+ */
+__attribute__((weak)) boolean ShiftFirmata::beginSpi(byte data, byte clock)
+{
+  return false;
+}
+
+__attribute__((weak)) void ShiftFirmata::endSpi()
+{
+}
+
+__attribute__((weak)) void ShiftFirmata::transferSpi(const byte *registers, byte count, byte order)
+{
+}
+
+ShiftFirmata::ShiftFirmata()
+{
+  registerCount = 0;
+  useSpi = false;
+  changed = false;
+}
+
+boolean ShiftFirmata::handlePinMode(byte pin, int mode)
+{
+  if (mode == PIN_MODE_SHIFT && IS_PIN_DIGITAL(pin)) {
+    pinMode(PIN_TO_DIGITAL(pin), OUTPUT);
+    Firmata.setPinMode(pin, PIN_MODE_SHIFT);
+    return true;
+  }
+  return false;
+}
+
+void ShiftFirmata::handleCapability(byte pin)
+{
+  if (IS_PIN_DIGITAL(pin)) {
+    Firmata.write(PIN_MODE_SHIFT);
+    Firmata.write(8); // 8 bits per register
+  }
+}
+
+boolean ShiftFirmata::handleSysex(byte command, byte argc, byte *argv)
+{
+  if (command != SHIFT_DATA) {
+    return false;
+  }
+  if (argc < 1) {
+    return true;
+  }
+
+  switch (argv[0]) {
+    case SHIFT_CONFIG:
+      if (argc > 4) {
+        configure(argv[1], argv[2], argv[3], argv[4], argc > 5 ? argv[5] : SHIFT_MSB_FIRST);
+      }
+      break;
+    case SHIFT_WRITE:
+    case SHIFT_WRITE_PART:
+      if (argc > 2) {
+        byte count = Firmata.decodeBinary(argc - 2, argv + 2);
+        write(argv[1], count, argv + 2, argv[0] == SHIFT_WRITE);
+      }
+      break;
+    case SHIFT_QUERY:
+      sendConfig();
+      break;
+  }
+  return true;
+}
+
+void ShiftFirmata::update()
+{
+}
+
+void ShiftFirmata::reset()
+{
+  if (useSpi) {
+    endSpi();
+  }
+  registerCount = 0;
+  useSpi = false;
+  changed = false;
+}
+
+//******************************************************************************
+//* Private Methods
+//******************************************************************************
+
+void ShiftFirmata::configure(byte data, byte clock, byte latch, byte count, byte order)
+{
+  if (!IS_PIN_DIGITAL(data) || !IS_PIN_DIGITAL(clock) || !IS_PIN_DIGITAL(latch)
+      || data == clock || data == latch || clock == latch) {
+    Firmata.sendString("Shift: invalid pins");
+    return;
+  }
+  if (count == 0 || count > SHIFT_MAX_REGISTERS) {
+    Firmata.sendString("Shift: invalid register count");
+    return;
+  }
+  reset();
+
+  dataPin = data;
+  clockPin = clock;
+  latchPin = latch;
+  registerCount = count;
+  bitOrder = order == SHIFT_LSB_FIRST ? SHIFT_LSB_FIRST : SHIFT_MSB_FIRST;
+  const byte pins[3] = { dataPin, clockPin, latchPin };
+  for (byte i = 0; i < 3; i++) {
+    if (!Firmata.requestPinMode(pins[i], PIN_MODE_SHIFT)) {
+      handlePinMode(pins[i], PIN_MODE_SHIFT);
+    }
+  }
+
+  useSpi = beginSpi(dataPin, clockPin);
+#if defined(ARDUINO_ARCH_AVR)
+  dataOut = portOutputRegister(digitalPinToPort(PIN_TO_DIGITAL(dataPin)));
+  dataMask = digitalPinToBitMask(PIN_TO_DIGITAL(dataPin));
+  clockOut = portOutputRegister(digitalPinToPort(PIN_TO_DIGITAL(clockPin)));
+  clockMask = digitalPinToBitMask(PIN_TO_DIGITAL(clockPin));
+#endif
+  digitalWrite(PIN_TO_DIGITAL(clockPin), LOW);
+
+  memset(framebuffer, 0, sizeof(framebuffer));
+  shiftChain();
+}
+
+/*
+ * Copy register values into the framebuffer. With latch, shift the chain out
+ * if any of them (or of the parts written before) changed.
+ */
+void ShiftFirmata::write(byte first, byte count, const byte *values, boolean latch)
+{
+  if (registerCount == 0) {
+    Firmata.sendString("Shift: not configured");
+    return;
+  }
+  if (first >= registerCount || count > registerCount - first) {
+    Firmata.sendString("Shift: write beyond the chain");
+    return;
+  }
+  for (byte i = 0; i < count; i++) {
+    if (framebuffer[first + i] != values[i]) {
+      framebuffer[first + i] = values[i];
+      changed = true;
+    }
+  }
+  if (latch && changed) {
+    shiftChain();
+    changed = false;
+  }
+}
+
+/*
+ * The number of registers one SHIFT_WRITE can carry: the parser keeps
+ * MAX_DATA_BYTES of a sysex message, of which the command, the sub-command
+ * and the first register take 3.
+ */
+byte ShiftFirmata::registersPerWrite()
+{
+  byte encoded = MAX_DATA_BYTES - 3;
+  if (Firmata.getBinaryEncoding() == BINARY_ENCODING_PACKED) {
+    return (unsigned int)encoded * 7 / 8;
+  }
+  return encoded / 2;
+}
+
+void ShiftFirmata::shiftChain()
+{
+  digitalWrite(PIN_TO_DIGITAL(latchPin), LOW);
+  if (useSpi) {
+    transferSpi(framebuffer, registerCount, bitOrder);
+  } else {
+    for (byte i = registerCount; i > 0; i--) {
+      shiftByte(framebuffer[i - 1]);
+    }
+  }
+  digitalWrite(PIN_TO_DIGITAL(latchPin), HIGH);
+}
+
+void ShiftFirmata::shiftByte(byte value)
+{
+  for (byte i = 0; i < 8; i++) {
+    boolean bit = bitOrder == SHIFT_LSB_FIRST ? (value >> i) & 1 : (value >> (7 - i)) & 1;
+#if defined(ARDUINO_ARCH_AVR)
+    // the registers are shared with other pins, so keep interrupts from modifying them meanwhile
+    uint8_t oldSREG = SREG;
+    cli();
+    if (bit) {
+      *dataOut |= dataMask;
+    } else {
+      *dataOut &= ~dataMask;
+    }
+    *clockOut |= clockMask;
+    *clockOut &= ~clockMask;
+    SREG = oldSREG;
+#else
+    digitalWrite(PIN_TO_DIGITAL(dataPin), bit ? HIGH : LOW);
+    digitalWrite(PIN_TO_DIGITAL(clockPin), HIGH);
+    digitalWrite(PIN_TO_DIGITAL(clockPin), LOW);
+#endif
+  }
+}
+
+void ShiftFirmata::sendConfig()
+{
+  Firmata.startSysex();
+  Firmata.write(SHIFT_DATA);
+  Firmata.write(SHIFT_QUERY);
+  if (registerCount > 0) {
+    Firmata.write(dataPin);
+    Firmata.write(clockPin);
+    Firmata.write(latchPin);
+    Firmata.write(registerCount);
+    Firmata.write(bitOrder);
+    Firmata.write(useSpi ? 1 : 0);
+    Firmata.write(registersPerWrite());
+  }
+  Firmata.endSysex();
+}
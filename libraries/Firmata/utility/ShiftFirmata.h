@@ -0,0 +1,126 @@
+/*
+  ShiftFirmata.h
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+
+  Output shift registers (74HC595 and similar) daisy-chained on a data,
+  clock and latch pin. The board keeps a framebuffer with one byte per
+  register; the host writes any range of it in one SHIFT_WRITE message
+  (with the negotiated binary encoding) and the chain is only shifted out
+  when a byte actually changed.
+
+  One message carries at most 30 registers (53 with the packed encoding),
+  the SHIFT_QUERY reply tells how many. A longer range is written with
+  SHIFT_WRITE_PART messages followed by a SHIFT_WRITE, and the chain is
+  shifted out and latched once, by the SHIFT_WRITE.
+
+  The chain is written with a bit-bang loop on the port registers (AVR) or
+  digitalWrite() (other architectures). A sketch that defines
+  FIRMATA_SHIFT_SPI before including this file, in one file of the sketch,
+  uses the SPI library instead when the data and clock pins are the
+  hardware MOSI and SCK pins. Without it the SPI library is not linked.
+
+  Byte 0 of the framebuffer is the register closest to the board, so it is
+  shifted out last.
+*/
+
+#ifndef ShiftFirmata_h
+#define ShiftFirmata_h
+
+#include <Firmata.h>
+#include "FirmataFeature.h"
+
+#define FIRMATA_SHIFT_FEATURE
+
+// SHIFT_DATA sub-commands
+#define SHIFT_CONFIG                0x00 // data, clock and latch pin, register count, bit order
+#define SHIFT_WRITE                 0x01 // first register, binary encoded register values
+#define SHIFT_QUERY                 0x02 // query: configuration / reply: configuration, output method and registers per write
+#define SHIFT_WRITE_PART            0x03 // like SHIFT_WRITE, shifted out by the next SHIFT_WRITE
+
+#define SHIFT_LSB_FIRST             0x00
+#define SHIFT_MSB_FIRST             0x01
+
+#define SHIFT_SPI_CLOCK             4000000
+
+#if defined(RAMEND) && RAMEND < 0x900
+#define SHIFT_MAX_REGISTERS         16
+#else
+#define SHIFT_MAX_REGISTERS         64
+#endif
+
+class ShiftFirmata: public FirmataFeature
+{
+  public:
+    ShiftFirmata();
+    boolean handlePinMode(byte pin, int mode);
+    void handleCapability(byte pin);
+    boolean handleSysex(byte command, byte argc, byte *argv);
+    void update();
+    void reset();
+
+    // provided by the sketch with FIRMATA_SHIFT_SPI, do not use directly
+    static boolean beginSpi(byte data, byte clock);
+    static void endSpi();
+    static void transferSpi(const byte *registers, byte count, byte order);
+
+  private:
+    byte dataPin;
+    byte clockPin;
+    byte latchPin;
+    byte registerCount;
+    byte bitOrder;
+    boolean useSpi;
+    boolean changed;        // written by SHIFT_WRITE_PART but not shifted out yet
+#if defined(ARDUINO_ARCH_AVR)
+    volatile uint8_t *dataOut;
+    uint8_t dataMask;
+    volatile uint8_t *clockOut;
+    uint8_t clockMask;
+#endif
+
+    byte framebuffer[SHIFT_MAX_REGISTERS];
+
+    void configure(byte data, byte clock, byte latch, byte count, byte order);
+    void write(byte first, byte count, const byte *values, boolean latch);
+    byte registersPerWrite();
+    void shiftChain();
+    void shiftByte(byte value);
+    void sendConfig();
+};
+
+#ifdef FIRMATA_SHIFT_SPI
+#include <SPI.h>
+
+boolean ShiftFirmata::beginSpi(byte data, byte clock)
+{
+  // the SPI peripheral can only drive its own pins
+  if (PIN_TO_DIGITAL(data) != MOSI || PIN_TO_DIGITAL(clock) != SCK) {
+    return false;
+  }
+  SPI.begin();
+  return true;
+}
+
+void ShiftFirmata::endSpi()
+{
+  SPI.end();
+}
+
+void ShiftFirmata::transferSpi(const byte *registers, byte count, byte order)
+{
+  SPI.beginTransaction(SPISettings(SHIFT_SPI_CLOCK, order == SHIFT_LSB_FIRST ? LSBFIRST : MSBFIRST, SPI_MODE0));
+  for (byte i = count; i > 0; i--) {
+    SPI.transfer(registers[i - 1]);
+  }
+  SPI.endTransaction();
+}
+#endif
+
+#endif /* ShiftFirmata_h */
@@ -0,0 +1,531 @@
+/*
+  StepperFirmata.cpp
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "StepperFirmata.h"
+
+// coil patterns, bit n drives the n-th motor pin
+static const byte twoWireSequence[4] = { 0x02, 0x03, 0x01, 0x00 };
+static const byte fourWireSequence[4] = { 0x05, 0x06, 0x0A, 0x09 };
+
+// the timer interrupt can only be routed to a single instance
+static StepperFirmata *activeStepper = NULL;
+
+#if defined(STEPPER_USE_TIMER2)
+void StepperFirmata::timerInterrupt()
+{
+  // the counter restarts on the compare match, so the time since the last
+  // interrupt is the compare value
+  long next = activeStepper->tick((long)OCR2A + 1);
+  byte count = TCNT2;
+  if (next < count + 4) next = count + 4;  // must lie ahead of the counter
+  if (next > 256) next = 256;
+  OCR2A = next - 1;
+}
+#endif
+
+/*
+ * Replaced by the sketch when it defines FIRMATA_STEPPER_ISR, see
+ * StepperFirmata.h.
+ */
+__attribute__((weak)) boolean StepperFirmata::hasTimerInterrupt()
+{
+  return false;
+}
+
+/*
+ * Convert 0.01 rad/s (or rad/s^2) to steps/s: value * stepsPerRev / (200 * PI).
+ */
+static unsigned long radiansToSteps(unsigned int value, unsigned int stepsPerRev)
+{
+  return ((unsigned long)value * stepsPerRev * 5 + 1571) / 3142;
+}
+
+static unsigned int squareRoot(unsigned long value)
+{
+  unsigned long root = 0;
+  unsigned long bit = 1UL << 30;
+
+  while (bit > value) bit >>= 2;
+  while (bit != 0) {
+    if (value >= root + bit) {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return root;
+}
+
+StepperFirmata::StepperFirmata()
+{
+  activeStepper = this;
+  timerRunning = false;
+#if defined(STEPPER_USE_TIMER2)
+  useTimer = hasTimerInterrupt();
+#else
+  useTimer = false;
+#endif
+  // timer counts, or microseconds when stepping from update()
+  clockRate = useTimer ? F_CPU / 8 : 1000000UL;
+  pulseCounts = clockRate / (1000000UL / STEPPER_PULSE_MICROS);
+  for (byte i = 0; i < MAX_STEPPERS; i++) {
+    devices[i].interface = 0;
+    devices[i].remaining = 0;
+    devices[i].interval = 0;
+    devices[i].pulse = false;
+    devices[i].moving = false;
+    devices[i].queueCount = 0;
+  }
+}
+
+boolean StepperFirmata::handlePinMode(byte pin, int mode)
+{
+  if (mode == PIN_MODE_STEPPER && IS_PIN_DIGITAL(pin)) {
+    pinMode(PIN_TO_DIGITAL(pin), OUTPUT);
+    Firmata.setPinMode(pin, PIN_MODE_STEPPER);
+    return true;
+  }
+  return false;
+}
+
+void StepperFirmata::handleCapability(byte pin)
+{
+  if (IS_PIN_DIGITAL(pin)) {
+    Firmata.write(PIN_MODE_STEPPER);
+    Firmata.write(21); // 21 bits of steps per move
+  }
+}
+
+boolean StepperFirmata::handleSysex(byte command, byte argc, byte *argv)
+{
+  if (command != STEPPER_DATA) {
+    return false;
+  }
+  if (argc < 2) {
+    return true;
+  }
+
+  byte deviceNum = argv[1];
+  if (deviceNum >= MAX_STEPPERS) {
+    Firmata.sendString("Stepper: invalid device number");
+    return true;
+  }
+
+  switch (argv[0]) {
+    case STEPPER_CONFIG:
+      configure(deviceNum, argc, argv);
+      break;
+    case STEPPER_STEP:
+      queueMove(deviceNum, argc, argv);
+      break;
+    case STEPPER_STOP:
+      stop(deviceNum);
+      break;
+  }
+  return true;
+}
+
+/*
+ * Start queued moves, report finished ones and follow the speed profiles.
+ */
+void StepperFirmata::update()
+{
+  if (!timerRunning) {
+    return;
+  }
+
+  unsigned long now = micros();
+  unsigned long elapsed = now - lastUpdateMicros;
+  lastUpdateMicros = now;
+
+  if (!useTimer) {
+    noInterrupts();
+    tick(elapsed);
+    interrupts();
+  }
+
+  for (byte i = 0; i < MAX_STEPPERS; i++) {
+    stepper_device *device = &devices[i];
+    if (device->interface == 0) continue;
+
+    if (device->moving && remainingSteps(device) == 0) {
+      device->moving = false;
+      setRate(device, 0);
+      Firmata.startSysex();
+      Firmata.write(STEPPER_DATA);
+      Firmata.write(i);
+      Firmata.endSysex();
+    }
+    if (!device->moving) {
+      startNextMove(device);
+    } else {
+      updateSpeed(device, elapsed);
+    }
+  }
+}
+
+void StepperFirmata::reset()
+{
+  stopTimer();
+  for (byte i = 0; i < MAX_STEPPERS; i++) {
+    if (devices[i].pulse) {
+      writePin(&devices[i], 1, LOW);
+      devices[i].pulse = false;
+    }
+    devices[i].interface = 0;
+    devices[i].remaining = 0;
+    devices[i].interval = 0;
+    devices[i].moving = false;
+    devices[i].queueCount = 0;
+  }
+}
+
+/*
+ * @return true if the pin cannot do PWM because its timer issues the steps.
+ */
+boolean StepperFirmata::isTimerPin(byte pin)
+{
+#if defined(STEPPER_USE_TIMER2)
+  if (useTimer && timerRunning && IS_PIN_PWM(pin)) {
+    byte timer = digitalPinToTimer(PIN_TO_PWM(pin));
+    return timer == TIMER2 || timer == TIMER2A || timer == TIMER2B;
+  }
+#endif
+  return false;
+}
+
+//******************************************************************************
+//* Private Methods
+//******************************************************************************
+
+/*
+ * STEPPER_CONFIG: device number, interface, steps per revolution (2 7-bit
+ * bytes), then the direction and step pins for a driver or the motor pins.
+ */
+void StepperFirmata::configure(byte deviceNum, byte argc, byte *argv)
+{
+  if (argc < 7) {
+    return;
+  }
+  byte interface = argv[2];
+  byte pinCount = interface == STEPPER_FOUR_WIRE ? 4 : 2;
+  if (interface != STEPPER_DRIVER && interface != STEPPER_TWO_WIRE && interface != STEPPER_FOUR_WIRE) {
+    Firmata.sendString("Stepper: unknown interface");
+    return;
+  }
+  if (argc < 5 + pinCount) {
+    return;
+  }
+  for (byte i = 0; i < pinCount; i++) {
+    if (!IS_PIN_DIGITAL(argv[5 + i])) {
+      Firmata.sendString("Stepper: invalid pin");
+      return;
+    }
+  }
+
+  stepper_device *device = &devices[deviceNum];
+  noInterrupts();
+  if (device->pulse) {
+    writePin(device, 1, LOW);
+  }
+  device->interface = 0;
+  device->remaining = 0;
+  interrupts();
+
+  device->stepsPerRev = argv[3] | (argv[4] << 7);
+  device->phase = 0;
+  device->interval = 0;
+  device->pulse = false;
+  device->moving = false;
+  device->queueHead = 0;
+  device->queueCount = 0;
+  for (byte i = 0; i < 4; i++) {
+    device->pins[i] = i < pinCount ? argv[5 + i] : 0;
+    if (i < pinCount) {
+      if (!Firmata.requestPinMode(device->pins[i], PIN_MODE_STEPPER)) {
+        handlePinMode(device->pins[i], PIN_MODE_STEPPER);
+      }
+#if defined(ARDUINO_ARCH_AVR)
+      device->out[i] = portOutputRegister(digitalPinToPort(PIN_TO_DIGITAL(device->pins[i])));
+      device->mask[i] = digitalPinToBitMask(PIN_TO_DIGITAL(device->pins[i]));
+#endif
+    }
+  }
+  device->interface = interface;
+
+  startTimer();
+}
+
+/*
+ * STEPPER_STEP: device number, direction, number of steps (3 7-bit bytes),
+ * speed (2 7-bit bytes) and optionally acceleration and deceleration (2 7-bit
+ * bytes each). The deceleration defaults to the acceleration.
+ */
+void StepperFirmata::queueMove(byte deviceNum, byte argc, byte *argv)
+{
+  stepper_device *device = &devices[deviceNum];
+  if (device->interface == 0) {
+    Firmata.sendString("Stepper: device not configured");
+    return;
+  }
+  if (argc < 8) {
+    return;
+  }
+  if (device->queueCount == STEPPER_QUEUE_SIZE) {
+    Firmata.sendString("Stepper: move queue full");
+    return;
+  }
+
+  stepper_move *move = &device->queue[(device->queueHead + device->queueCount) % STEPPER_QUEUE_SIZE];
+  move->forward = argv[2] == STEPPER_CW;
+  move->steps = (unsigned long)argv[3] | ((unsigned long)argv[4] << 7) | ((unsigned long)argv[5] << 14);
+
+  unsigned long speed = radiansToSteps(argv[6] | (argv[7] << 7), device->stepsPerRev);
+  unsigned long accel = 0;
+  unsigned long decel;
+  if (argc > 9) {
+    accel = radiansToSteps(argv[8] | (argv[9] << 7), device->stepsPerRev);
+  }
+  decel = accel;
+  if (argc > 11) {
+    decel = radiansToSteps(argv[10] | (argv[11] << 7), device->stepsPerRev);
+  }
+  move->speed = speed < 1 ? 1 : (speed > STEPPER_MAX_SPEED ? STEPPER_MAX_SPEED : speed);
+  move->accel = accel > 0xFFFF ? 0xFFFF : accel;
+  move->decel = decel > 0xFFFF ? 0xFFFF : decel;
+  device->queueCount++;
+}
+
+/*
+ * STEPPER_STOP: discard the queued moves and bring the current one to a stop
+ * within its deceleration distance.
+ */
+void StepperFirmata::stop(byte deviceNum)
+{
+  stepper_device *device = &devices[deviceNum];
+  device->queueCount = 0;
+  if (!device->moving) {
+    return;
+  }
+
+  unsigned long distance = device->move.decel > 0 ? stoppingDistance(device) : 0;
+  noInterrupts();
+  if (device->remaining > distance) {
+    device->remaining = distance;
+  }
+  interrupts();
+}
+
+void StepperFirmata::startNextMove(stepper_device *device)
+{
+  if (device->queueCount == 0) {
+    return;
+  }
+  device->move = device->queue[device->queueHead];
+  device->queueHead = (device->queueHead + 1) % STEPPER_QUEUE_SIZE;
+  device->queueCount--;
+
+  stepper_move *move = &device->move;
+  unsigned int ramp = move->accel > 0 ? move->accel : move->decel;
+  // the speed reached after the first step of a ramp, v = sqrt(2 * a * 1 step)
+  device->minSpeed = ramp > 0 ? squareRoot(2UL * ramp) : move->speed;
+  if (device->minSpeed < 1) device->minSpeed = 1;
+  if (device->minSpeed > move->speed) device->minSpeed = move->speed;
+  unsigned int speed = move->accel > 0 ? device->minSpeed : move->speed;
+  device->speed256 = (unsigned long)speed << 8;
+  device->moving = true;
+
+  noInterrupts();
+  device->forward = move->forward;
+  if (device->interface == STEPPER_DRIVER) {
+    writePin(device, 0, move->forward ? HIGH : LOW);
+  }
+  device->interval = clockRate / speed;
+  device->due = device->interval;
+#if defined(STEPPER_USE_TIMER2)
+  if (useTimer) {
+    // the interrupt counts from the last compare match
+    device->due += TCNT2;
+  }
+#endif
+  // a move of 0 steps finishes (and is reported) on the next update
+  device->remaining = move->steps;
+  interrupts();
+}
+
+/*
+ * Follow the trapezoidal profile: accelerate up to the move speed and
+ * decelerate once the remaining steps are within the stopping distance.
+ */
+void StepperFirmata::updateSpeed(stepper_device *device, unsigned long elapsed)
+{
+  stepper_move *move = &device->move;
+  if (move->accel == 0 && move->decel == 0) {
+    return;
+  }
+  // a stalled main loop slows the ramp down rather than making it jump
+  if (elapsed > 10000) elapsed = 10000;
+
+  unsigned long floor256 = (unsigned long)device->minSpeed << 8;
+  unsigned long max256 = (unsigned long)move->speed << 8;
+  if (move->decel > 0 && remainingSteps(device) <= stoppingDistance(device)) {
+    // dv = a * dt with dt in microseconds and 8 fractional bits: 1000000 / 256
+    unsigned long dv = (unsigned long)move->decel * elapsed / 3906;
+    device->speed256 = device->speed256 > floor256 + dv ? device->speed256 - dv : floor256;
+  } else if (move->accel > 0 && device->speed256 < max256) {
+    unsigned long dv = (unsigned long)move->accel * elapsed / 3906;
+    device->speed256 = device->speed256 + dv < max256 ? device->speed256 + dv : max256;
+  }
+  setRate(device, device->speed256 >> 8);
+}
+
+void StepperFirmata::setRate(stepper_device *device, unsigned int rate)
+{
+  long interval = rate > 0 ? clockRate / rate : 0;
+  noInterrupts();
+  device->interval = interval;
+  interrupts();
+}
+
+unsigned long StepperFirmata::remainingSteps(stepper_device *device)
+{
+  noInterrupts();
+  unsigned long remaining = device->remaining;
+  interrupts();
+  return remaining;
+}
+
+/*
+ * @return The number of steps needed to stop from the current speed, v^2 / 2a.
+ */
+unsigned long StepperFirmata::stoppingDistance(stepper_device *device)
+{
+  unsigned long speed = device->speed256 >> 8;
+  return speed * speed / (2UL * device->move.decel);
+}
+
+void StepperFirmata::step(stepper_device *device)
+{
+  byte pattern;
+
+  if (device->interface == STEPPER_DRIVER) {
+    // the next tick ends the pulse
+    writePin(device, 1, HIGH);
+    device->pulse = true;
+    return;
+  }
+
+  device->phase = (device->phase + (device->forward ? 1 : 3)) & 0x03;
+  if (device->interface == STEPPER_TWO_WIRE) {
+    pattern = twoWireSequence[device->phase];
+    writePin(device, 0, pattern & 0x01);
+    writePin(device, 1, pattern & 0x02);
+  } else {
+    pattern = fourWireSequence[device->phase];
+    for (byte i = 0; i < 4; i++) {
+      writePin(device, i, pattern & (1 << i));
+    }
+  }
+}
+
+/*
+ * Only called with interrupts disabled, so the register update cannot be
+ * interleaved with a digitalWrite on another pin of the same port.
+ */
+void StepperFirmata::writePin(stepper_device *device, byte index, byte value)
+{
+#if defined(ARDUINO_ARCH_AVR)
+  if (value) {
+    *device->out[index] |= device->mask[index];
+  } else {
+    *device->out[index] &= ~device->mask[index];
+  }
+#else
+  digitalWrite(PIN_TO_DIGITAL(device->pins[index]), value ? HIGH : LOW);
+#endif
+}
+
+/*
+ * Issue the steps that are due after the elapsed clock counts. Runs in
+ * interrupt context or with interrupts disabled.
+ * @return The clock counts until the next step or the end of a step pulse.
+ */
+long StepperFirmata::tick(long elapsed)
+{
+  long next = 0x7FFFFFFFL;
+
+  for (byte i = 0; i < MAX_STEPPERS; i++) {
+    stepper_device *device = &devices[i];
+    boolean ended = device->pulse;
+    if (ended) {
+      writePin(device, 1, LOW);
+      device->pulse = false;
+    }
+    if (device->remaining == 0) continue;
+
+    device->due -= elapsed;
+    if (device->due <= 0 && !ended) {
+      step(device);
+      device->remaining--;
+      device->due += device->interval;
+      if (device->due <= 0) {
+        // skip the steps missed during a stall rather than stepping in a burst
+        device->due = device->interval;
+      }
+    }
+    // a pulse needs as long low as high before the next one
+    long wait = device->pulse || device->due <= 0 ? pulseCounts : device->due;
+    if (wait < next) next = wait;
+  }
+  return next;
+}
+
+void StepperFirmata::startTimer()
+{
+  if (timerRunning) {
+    return;
+  }
+  lastUpdateMicros = micros();
+#if defined(STEPPER_USE_TIMER2)
+  if (useTimer) {
+    noInterrupts();
+    // CTC mode, clock / 8, the interrupt moves the compare value to the next step
+    TCCR2A = (1 << WGM21);
+    TCCR2B = (1 << CS21);
+    OCR2A = 255;
+    TCNT2 = 0;
+    TIMSK2 |= (1 << OCIE2A);
+    interrupts();
+  }
+#endif
+  timerRunning = true;
+}
+
+void StepperFirmata::stopTimer()
+{
+  if (!timerRunning) {
+    return;
+  }
+#if defined(STEPPER_USE_TIMER2)
+  if (useTimer) {
+    noInterrupts();
+    TIMSK2 &= ~(1 << OCIE2A);
+    // restore the phase correct PWM set up by the Arduino core
+    TCCR2A = (1 << WGM20);
+    TCCR2B = (1 << CS22);
+    interrupts();
+  }
+#endif
+  timerRunning = false;
+}
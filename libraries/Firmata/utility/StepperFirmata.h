@@ -0,0 +1,153 @@
+/*
+  StepperFirmata.h
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+
+  Non-blocking stepper motor driver for step/direction drivers, 2-wire and
+  4-wire motors. Every motor keeps the clock counts until its next step,
+  the step interrupt is scheduled for the earliest of them, so steps are
+  only delayed by the interrupt latency. The trapezoidal speed profile is
+  updated from update() in the main loop. Moves are queued per motor and
+  the completion of each move is reported to the host.
+
+  The protocol follows the legacy Firmata stepper protocol (speeds in
+  0.01 rad/s, accelerations in 0.01 rad/s^2) with an added stop command.
+
+  On AVR boards with a Timer2 the steps are issued from the Timer2 compare
+  interrupt (Timer1 belongs to the Servo library). The handler conflicts
+  with tone(), so it is only compiled into sketches that define
+  FIRMATA_STEPPER_ISR before including this file, in one file of the
+  sketch. While a stepper is configured the Timer2 pins (3 and 11 on an
+  Uno, 9 and 10 on a Mega) cannot do PWM, see isTimerPin(). Without the
+  handler, and on other boards, update() issues at most one step per
+  motor per call.
+*/
+
+#ifndef StepperFirmata_h
+#define StepperFirmata_h
+
+#include <Firmata.h>
+#include "FirmataFeature.h"
+
+#define FIRMATA_STEPPER_FEATURE
+
+// STEPPER_DATA sub-commands
+#define STEPPER_CONFIG              0x00
+#define STEPPER_STEP                0x01
+#define STEPPER_STOP                0x02 // decelerate to a stop and discard queued moves
+
+// STEPPER_CONFIG interfaces
+#define STEPPER_DRIVER              0x01 // step and direction pins
+#define STEPPER_TWO_WIRE            0x02
+#define STEPPER_FOUR_WIRE           0x04
+
+#define STEPPER_CW                  0x01 // STEPPER_STEP direction, 0 is counter clockwise
+
+#define STEPPER_MAX_SPEED           10000 // steps/s
+#define STEPPER_PULSE_MICROS        4     // step pulse, the A4988 needs 1 and the DRV8825 1.9
+
+#if defined(RAMEND) && RAMEND < 0x900
+#define MAX_STEPPERS                3
+#define STEPPER_QUEUE_SIZE          2 // moves queued behind the current one
+#else
+#define MAX_STEPPERS                6
+#define STEPPER_QUEUE_SIZE          8
+#endif
+
+#if defined(ARDUINO_ARCH_AVR) && defined(TCCR2A) && defined(OCIE2A)
+#define STEPPER_USE_TIMER2
+#endif
+
+struct stepper_move {
+  unsigned long steps;
+  boolean forward;
+  unsigned int speed;       // steps/s
+  unsigned int accel;       // steps/s^2, 0 for no ramp
+  unsigned int decel;       // steps/s^2, 0 for an abrupt stop
+};
+
+struct stepper_device {
+  byte interface;           // 0 if the device is not configured
+  byte pins[4];
+#if defined(ARDUINO_ARCH_AVR)
+  volatile uint8_t *out[4]; // pins as output registers and masks for the tick
+  uint8_t mask[4];
+#endif
+  unsigned int stepsPerRev;
+  byte phase;
+
+  // shared with the step interrupt
+  volatile unsigned long remaining;
+  volatile long interval;   // clock counts between steps
+  volatile boolean forward;
+  long due;                 // clock counts until the next step
+  boolean pulse;            // the step pin of a driver is high
+
+  // speed profile of the current move
+  boolean moving;
+  unsigned long speed256;   // current speed in steps/s with 8 fractional bits
+  unsigned int minSpeed;
+  stepper_move move;
+
+  stepper_move queue[STEPPER_QUEUE_SIZE];
+  byte queueHead;
+  byte queueCount;
+};
+
+class StepperFirmata: public FirmataFeature
+{
+  public:
+    StepperFirmata();
+    boolean handlePinMode(byte pin, int mode);
+    void handleCapability(byte pin);
+    boolean handleSysex(byte command, byte argc, byte *argv);
+    void update();
+    void reset();
+    boolean isTimerPin(byte pin);
+
+    // called from the timer interrupt, do not use directly
+    static void timerInterrupt();
+    static boolean hasTimerInterrupt();
+
+  private:
+    stepper_device devices[MAX_STEPPERS];
+    boolean useTimer;
+    boolean timerRunning;
+    unsigned long clockRate;  // clock counts per second
+    long pulseCounts;
+    unsigned long lastUpdateMicros;
+
+    void configure(byte deviceNum, byte argc, byte *argv);
+    void queueMove(byte deviceNum, byte argc, byte *argv);
+    void stop(byte deviceNum);
+    void startNextMove(stepper_device *device);
+    void updateSpeed(stepper_device *device, unsigned long elapsed);
+    void setRate(stepper_device *device, unsigned int rate);
+    unsigned long remainingSteps(stepper_device *device);
+    unsigned long stoppingDistance(stepper_device *device);
+    void step(stepper_device *device);
+    void writePin(stepper_device *device, byte index, byte value);
+    long tick(long elapsed);
+    void startTimer();
+    void stopTimer();
+};
+
+#if defined(FIRMATA_STEPPER_ISR) && defined(STEPPER_USE_TIMER2)
+ISR(TIMER2_COMPA_vect)
+{
+  StepperFirmata::timerInterrupt();
+}
+
+boolean StepperFirmata::hasTimerInterrupt()
+{
+  return true;
+}
+#endif
+
+#endif /* StepperFirmata_h */
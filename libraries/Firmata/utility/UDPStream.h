@@ -0,0 +1,319 @@
+/*
+  UDPStream.h
+  An Arduino-Stream that carries Firmata over UDP datagrams instead of a
+  TCP connection, to avoid head-of-line blocking and Nagle delays.
+
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+
+  Every datagram starts with a 3 byte header followed by Firmata messages:
+
+    0  flags  bit 0: ACK_REQUEST (host -> board), bit 1: ACK (board -> host)
+    1  sequence number LSB
+    2  sequence number MSB
+
+  Board -> host: output is collected and sent on flush() / maintain() or
+  when the buffer is full. A datagram only ends inside a message if that
+  message is larger than UDPSTREAM_MAX_PAYLOAD, in which case it continues
+  in the datagram with the next sequence number. Each datagram gets the next
+  sequence number so the host can detect loss and reordering; there are no
+  retransmissions.
+
+  Host -> board: a datagram with ACK_REQUEST set is answered with an ACK
+  datagram (no payload) carrying the same sequence number. The board
+  remembers which of the last UDPSTREAM_REORDER_WINDOW sequence numbers it
+  accepted: a datagram that arrives late within that window is still
+  executed, a duplicate is dropped but acknowledged again, so the host can
+  safely retry. Late datagrams are executed in arrival order, so commands
+  that depend on each other need an ACK before the next one is sent. A
+  command datagram should not exceed UDPSTREAM_MAX_PAYLOAD bytes and must
+  contain complete messages only.
+
+  Reports go to the host given to the constructor, or to the sender of the
+  last accepted datagram if no host was given.
+ */
+
+#ifndef UDPSTREAM_H
+#define UDPSTREAM_H
+
+#include <inttypes.h>
+#include <Stream.h>
+#include <Udp.h>
+#include "FirmataMessageTracker.h"
+
+#define UDPSTREAM_HEADER_SIZE       3
+#define UDPSTREAM_FLAG_ACK_REQUEST  0x01
+#define UDPSTREAM_FLAG_ACK          0x02
+#define UDPSTREAM_REORDER_WINDOW    32 // at most 32, the bits of rxSeen
+
+#ifndef UDPSTREAM_MAX_PAYLOAD
+#if defined(RAMEND) && RAMEND < 0x900
+#define UDPSTREAM_MAX_PAYLOAD       64
+#else
+#define UDPSTREAM_MAX_PAYLOAD       256
+#endif
+#endif
+
+class UDPStream : public Stream
+{
+  public:
+    UDPStream(UDP &udp, uint16_t localPort);
+    UDPStream(UDP &udp, uint16_t localPort, IPAddress remoteIP, uint16_t remotePort);
+    bool begin();
+    int available();
+    int read();
+    int peek();
+    void flush();
+    size_t write(uint8_t);
+    void maintain();
+    uint16_t staleDatagrams();
+
+  private:
+    UDP &udp;
+    uint16_t localPort;
+    IPAddress remoteIP;
+    uint16_t remotePort;
+    bool fixedRemote;
+    bool remoteKnown;
+
+    uint8_t rxBuffer[UDPSTREAM_MAX_PAYLOAD];
+    uint16_t rxLength;
+    uint16_t rxPosition;
+    uint16_t rxSequence;  // highest sequence number accepted
+    uint32_t rxSeen;      // bit n: rxSequence - 1 - n was accepted
+    bool rxSequenceValid;
+    uint16_t rxStale;
+
+    uint8_t txBuffer[UDPSTREAM_HEADER_SIZE + UDPSTREAM_MAX_PAYLOAD];
+    uint16_t txLength;    // payload bytes buffered
+    uint16_t txComplete;  // payload bytes up to the end of the last complete message
+    uint16_t txSequence;
+    FirmataMessageTracker txMessages;
+
+    bool receive();
+    void sendAck(uint16_t sequence);
+    void send(uint16_t length);
+};
+
+
+/*
+ * UDPStream.cpp
+ * Kept in the header like EthernetClientStream, so sketches for boards without
+ * the Arduino UDP API still compile the library.
+ */
+UDPStream::UDPStream(UDP &udp, uint16_t localPort)
+  : udp(udp),
+    localPort(localPort),
+    remotePort(0),
+    fixedRemote(false),
+    remoteKnown(false),
+    rxLength(0),
+    rxPosition(0),
+    rxSequence(0),
+    rxSeen(0),
+    rxSequenceValid(false),
+    rxStale(0),
+    txLength(0),
+    txComplete(0),
+    txSequence(0)
+{
+}
+
+UDPStream::UDPStream(UDP &udp, uint16_t localPort, IPAddress remoteIP, uint16_t remotePort)
+  : udp(udp),
+    localPort(localPort),
+    remoteIP(remoteIP),
+    remotePort(remotePort),
+    fixedRemote(true),
+    remoteKnown(true),
+    rxLength(0),
+    rxPosition(0),
+    rxSequence(0),
+    rxSeen(0),
+    rxSequenceValid(false),
+    rxStale(0),
+    txLength(0),
+    txComplete(0),
+    txSequence(0)
+{
+}
+
+/**
+ * Start listening on the local port.
+ * @return true if the socket could be opened
+ */
+bool
+UDPStream::begin()
+{
+  return udp.begin(localPort) != 0;
+}
+
+int
+UDPStream::available()
+{
+  if (rxPosition >= rxLength && !receive())
+    return 0;
+  return rxLength - rxPosition;
+}
+
+int
+UDPStream::read()
+{
+  return available() ? rxBuffer[rxPosition++] : -1;
+}
+
+int
+UDPStream::peek()
+{
+  return available() ? rxBuffer[rxPosition] : -1;
+}
+
+/**
+ * Send everything buffered so far.
+ */
+void
+UDPStream::flush()
+{
+  if (txLength > 0)
+    send(txLength);
+}
+
+size_t
+UDPStream::write(uint8_t c)
+{
+  if (!remoteKnown)
+    return 0;
+
+  if (txLength == UDPSTREAM_MAX_PAYLOAD) {
+    // keep messages whole unless a single message fills the datagram
+    send(txComplete > 0 ? txComplete : txLength);
+  }
+  txBuffer[UDPSTREAM_HEADER_SIZE + txLength++] = c;
+  if (txMessages.track(c))
+    txComplete = txLength;
+  return 1;
+}
+
+/**
+ * Send buffered output, call once per loop().
+ */
+void
+UDPStream::maintain()
+{
+  flush();
+}
+
+/**
+ * @return number of host datagrams dropped as duplicates
+ */
+uint16_t
+UDPStream::staleDatagrams()
+{
+  return rxStale;
+}
+
+/**
+ * Read the next datagram from the host into the receive buffer.
+ * @return true if a new datagram with payload is available
+ */
+bool
+UDPStream::receive()
+{
+  while (true) {
+    int size = udp.parsePacket();
+    if (size <= 0)
+      return false;
+    if (size < UDPSTREAM_HEADER_SIZE) {
+      while (udp.available()) udp.read();
+      continue;
+    }
+
+    uint8_t header[UDPSTREAM_HEADER_SIZE];
+    udp.read(header, UDPSTREAM_HEADER_SIZE);
+    uint16_t sequence = header[1] | (header[2] << 8);
+    int16_t distance = (int16_t)(sequence - rxSequence);
+    bool accept;
+
+    if (!rxSequenceValid || distance < -UDPSTREAM_REORDER_WINDOW) {
+      // first datagram, or the host started over
+      accept = true;
+      rxSequence = sequence;
+      rxSeen = 0;
+    } else if (distance > 0) {
+      // slide the window, the previous highest number becomes bit distance - 1
+      if (distance > UDPSTREAM_REORDER_WINDOW) {
+        rxSeen = 0;
+      } else {
+        rxSeen = (distance < 32 ? rxSeen << distance : 0) | (1UL << (distance - 1));
+      }
+      rxSequence = sequence;
+      accept = true;
+    } else if (distance < 0) {
+      // late, unless it has been accepted before
+      uint32_t bit = 1UL << (-distance - 1);
+      accept = !(rxSeen & bit);
+      rxSeen |= bit;
+    } else {
+      accept = false;
+    }
+
+    rxLength = 0;
+    rxPosition = 0;
+    if (accept) {
+      int count = udp.read(rxBuffer, UDPSTREAM_MAX_PAYLOAD);
+      rxLength = count > 0 ? count : 0;
+      rxSequenceValid = true;
+      if (!fixedRemote) {
+        remoteIP = udp.remoteIP();
+        remotePort = udp.remotePort();
+        remoteKnown = true;
+      }
+    } else {
+      rxStale++;
+    }
+    // drop whatever did not fit
+    while (udp.available()) udp.read();
+
+    if (header[0] & UDPSTREAM_FLAG_ACK_REQUEST)
+      sendAck(sequence);
+    if (rxLength > 0)
+      return true;
+  }
+}
+
+void
+UDPStream::sendAck(uint16_t sequence)
+{
+  uint8_t ack[UDPSTREAM_HEADER_SIZE] = {UDPSTREAM_FLAG_ACK, (uint8_t)(sequence & 0xFF), (uint8_t)(sequence >> 8)};
+  udp.beginPacket(udp.remoteIP(), udp.remotePort());
+  udp.write(ack, UDPSTREAM_HEADER_SIZE);
+  udp.endPacket();
+}
+
+/**
+ * Send the first length bytes of the buffered payload as one datagram and
+ * keep the rest for the next one.
+ */
+void
+UDPStream::send(uint16_t length)
+{
+  txBuffer[0] = 0;
+  txBuffer[1] = txSequence & 0xFF;
+  txBuffer[2] = txSequence >> 8;
+  txSequence++;
+  udp.beginPacket(remoteIP, remotePort);
+  udp.write(txBuffer, UDPSTREAM_HEADER_SIZE + length);
+  udp.endPacket();
+
+  txLength -= length;
+  memmove(txBuffer + UDPSTREAM_HEADER_SIZE, txBuffer + UDPSTREAM_HEADER_SIZE + length, txLength);
+  txComplete = (txComplete > length) ? txComplete - length : 0;
+}
+
+#endif /* UDPSTREAM_H */
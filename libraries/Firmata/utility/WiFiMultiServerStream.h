@@ -0,0 +1,300 @@
+/*
+  WiFiMultiServerStream.h
+
+  An Arduino Stream extension for a WiFiServer that accepts several TCP
+  clients at the same time, to be used with the same WiFi libraries as
+  WiFiServerStream.
+
+  Copyright (C) 2016 Firmata Developers. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+
+  Input is read from one client at a time and the stream only switches to
+  another client between complete Firmata messages, so commands from
+  different hosts never interleave. currentClient() tells which connection
+  the message being parsed came from. When that client disconnects before
+  its message is complete, the connection callback is called with
+  HOST_CONNECTION_ABANDONED; the sketch must then call
+  Firmata.resetParser().
+
+  Output (reports as well as replies) is collected in a single buffer that
+  is sent unchanged to every connected client when it is full or when
+  maintain() / flush() is called, so each report is encoded once no matter
+  how many hosts are listening.
+ */
+
+#ifndef WIFI_MULTI_SERVER_STREAM_H
+#define WIFI_MULTI_SERVER_STREAM_H
+
+#include "WiFiStream.h"
+
+#ifndef WIFI_MULTI_SERVER_MAX_CLIENTS
+#define WIFI_MULTI_SERVER_MAX_CLIENTS 4
+#endif
+
+#ifndef WIFI_MULTI_SERVER_TX_BUFFER_SIZE
+#define WIFI_MULTI_SERVER_TX_BUFFER_SIZE 64
+#endif
+
+#define WIFI_MULTI_SERVER_NO_CLIENT -1
+
+class WiFiMultiServerStream : public WiFiStream
+{
+protected:
+  WiFiServer _server = WiFiServer(3030);
+  bool _listening = false;
+
+  WiFiClient _clients[WIFI_MULTI_SERVER_MAX_CLIENTS];
+  bool _clientConnected[WIFI_MULTI_SERVER_MAX_CLIENTS];
+  int _rxClient = WIFI_MULTI_SERVER_NO_CLIENT;  // client the current message is read from
+  bool _rxInSysex = false;
+  uint8_t _rxPending = 0;                       // data bytes still expected by a midi style message
+
+  uint8_t _txBuffer[WIFI_MULTI_SERVER_TX_BUFFER_SIZE];
+  uint8_t _txCount = 0;
+
+  /**
+   * number of data bytes that follow a Firmata command byte
+   */
+  static inline uint8_t message_length(uint8_t command)
+  {
+    if ( command < 0xF0 )
+    {
+      // REPORT_ANALOG (0xC0) and REPORT_DIGITAL (0xD0) carry one data byte
+      uint8_t type = command & 0xF0;
+      return ( type == 0xC0 || type == 0xD0 ) ? 1 : 2;
+    }
+    // SET_PIN_MODE (0xF4) and SET_DIGITAL_PIN_VALUE (0xF5)
+    return ( command == 0xF4 || command == 0xF5 ) ? 2 : 0;
+  }
+
+  /**
+   * follow the message framing of the bytes handed to the parser
+   */
+  inline void track_input(uint8_t value)
+  {
+    if ( value & 0x80 )
+    {
+      _rxInSysex = ( value == 0xF0 );
+      _rxPending = _rxInSysex ? 0 : message_length( value );
+    }
+    else if ( _rxPending > 0 )
+    {
+      _rxPending--;
+    }
+  }
+
+  /**
+   * @return true if the current client is in the middle of a message
+   */
+  inline bool message_in_progress()
+  {
+    return _rxClient != WIFI_MULTI_SERVER_NO_CLIENT && ( _rxInSysex || _rxPending > 0 );
+  }
+
+  /**
+   * drop a client, a message it left unfinished is abandoned
+   */
+  inline void disconnect_client(int index)
+  {
+    bool abandoned = false;
+    _clients[index].stop();
+    _clientConnected[index] = false;
+    if ( _rxClient == index )
+    {
+      abandoned = message_in_progress();
+      _rxClient = WIFI_MULTI_SERVER_NO_CLIENT;
+      _rxInSysex = false;
+      _rxPending = 0;
+    }
+    if ( _currentHostConnectionCallback )
+    {
+      if ( abandoned ) (*_currentHostConnectionCallback)(HOST_CONNECTION_ABANDONED);
+      (*_currentHostConnectionCallback)(HOST_CONNECTION_DISCONNECTED);
+    }
+  }
+
+  /**
+   * drop closed clients and accept new ones
+   * @return true if at least one client is connected
+   */
+  virtual inline bool connect_client()
+  {
+    int freeSlot = WIFI_MULTI_SERVER_NO_CLIENT;
+    _connected = false;
+    for ( int i = 0; i < WIFI_MULTI_SERVER_MAX_CLIENTS; i++ )
+    {
+      if ( _clientConnected[i] && !_clients[i].connected() ) disconnect_client( i );
+      if ( _clientConnected[i] ) _connected = true;
+      else if ( freeSlot == WIFI_MULTI_SERVER_NO_CLIENT ) freeSlot = i;
+    }
+    if ( !_listening ) return _connected;
+
+    // passive TCP connect (accept), some WiFi libraries also return clients
+    // that are already known here
+    WiFiClient newClient = _server.available();
+    if ( !newClient ) return _connected;
+    for ( int i = 0; i < WIFI_MULTI_SERVER_MAX_CLIENTS; i++ )
+    {
+      if ( _clientConnected[i] && _clients[i] == newClient ) return true;
+    }
+    if ( freeSlot == WIFI_MULTI_SERVER_NO_CLIENT )
+    {
+      // no room for another host
+      newClient.stop();
+      return _connected;
+    }
+
+    _clients[freeSlot] = newClient;
+    _clientConnected[freeSlot] = true;
+    _connected = true;
+    if ( _currentHostConnectionCallback )
+    {
+      (*_currentHostConnectionCallback)(HOST_CONNECTION_CONNECTED);
+    }
+
+    return true;
+  }
+
+  /**
+   * choose the client to read from: stay with the current one until its
+   * message is complete, otherwise take the next client with pending data
+   * @return index of the client or WIFI_MULTI_SERVER_NO_CLIENT
+   */
+  inline int select_client()
+  {
+    if ( message_in_progress() )
+    {
+      return _clients[_rxClient].available() > 0 ? _rxClient : WIFI_MULTI_SERVER_NO_CLIENT;
+    }
+    int start = ( _rxClient == WIFI_MULTI_SERVER_NO_CLIENT ) ? 0 : _rxClient + 1;
+    for ( int n = 0; n < WIFI_MULTI_SERVER_MAX_CLIENTS; n++ )
+    {
+      int i = ( start + n ) % WIFI_MULTI_SERVER_MAX_CLIENTS;
+      if ( _clientConnected[i] && _clients[i].available() > 0 ) return i;
+    }
+    return WIFI_MULTI_SERVER_NO_CLIENT;
+  }
+
+public:
+  /**
+   * create a WiFi stream with a TCP server for several clients
+   */
+  WiFiMultiServerStream(uint16_t server_port) : WiFiStream(server_port)
+  {
+    for ( int i = 0; i < WIFI_MULTI_SERVER_MAX_CLIENTS; i++ ) _clientConnected[i] = false;
+  }
+
+  /**
+   * maintain WiFi and TCP connections and send buffered output
+   * @return true if WiFi is up and at least one client is connected
+   */
+  virtual inline bool maintain()
+  {
+    if ( !_listening && WiFi.status() == WL_CONNECTED )
+    {
+      // start TCP server after first WiFi connect
+      _server = WiFiServer(_port);
+      _server.begin();
+      _listening = true;
+    }
+
+    bool connected = connect_client();
+    flush();
+    return connected;
+  }
+
+  /**
+   * close all client connections
+   */
+  virtual inline void stop()
+  {
+    for ( int i = 0; i < WIFI_MULTI_SERVER_MAX_CLIENTS; i++ )
+    {
+      if ( _clientConnected[i] ) disconnect_client( i );
+    }
+    _txCount = 0;
+    _connected = false;
+  }
+
+  /**
+   * @return index of the client the last byte was read from
+   *         or WIFI_MULTI_SERVER_NO_CLIENT
+   */
+  inline int currentClient()
+  {
+    return _rxClient;
+  }
+
+  /**
+   * @return number of connected clients
+   */
+  inline uint8_t clientCount()
+  {
+    uint8_t count = 0;
+    for ( int i = 0; i < WIFI_MULTI_SERVER_MAX_CLIENTS; i++ )
+    {
+      if ( _clientConnected[i] ) count++;
+    }
+    return count;
+  }
+
+/******************************************************************************
+ *             stream functions
+ ******************************************************************************/
+
+  inline int available()
+  {
+    if ( !connect_client() ) return 0;
+    int index = select_client();
+    return index == WIFI_MULTI_SERVER_NO_CLIENT ? 0 : _clients[index].available();
+  }
+
+  inline int peek()
+  {
+    if ( !connect_client() ) return -1;
+    int index = select_client();
+    return index == WIFI_MULTI_SERVER_NO_CLIENT ? -1 : _clients[index].peek();
+  }
+
+  inline int read()
+  {
+    if ( !connect_client() ) return -1;
+    int index = select_client();
+    if ( index == WIFI_MULTI_SERVER_NO_CLIENT ) return -1;
+    int value = _clients[index].read();
+    if ( value < 0 ) return -1;
+    _rxClient = index;
+    track_input( (uint8_t)value );
+    return value;
+  }
+
+  /**
+   * send the buffered output to every connected client
+   */
+  inline void flush()
+  {
+    if ( _txCount == 0 ) return;
+    for ( int i = 0; i < WIFI_MULTI_SERVER_MAX_CLIENTS; i++ )
+    {
+      if ( _clientConnected[i] ) _clients[i].write( _txBuffer, _txCount );
+    }
+    _txCount = 0;
+  }
+
+  inline size_t write(uint8_t byte)
+  {
+    if ( !_connected ) return 0;
+    _txBuffer[_txCount++] = byte;
+    if ( _txCount >= WIFI_MULTI_SERVER_TX_BUFFER_SIZE ) flush();
+    return 1;
+  }
+
+};
+
+#endif //WIFI_MULTI_SERVER_STREAM_H
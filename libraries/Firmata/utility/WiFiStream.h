@@ -26,6 +26,7 @@
 
 #define HOST_CONNECTION_DISCONNECTED 0
 #define HOST_CONNECTION_CONNECTED    1
+#define HOST_CONNECTION_ABANDONED    2  // the host disconnected in the middle of a message
 
 extern "C" {
   // callback function types
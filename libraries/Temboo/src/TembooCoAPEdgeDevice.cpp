@@ -51,34 +51,39 @@ TembooCoAPClient::TembooCoAPClient(TembooCoAPIPStack& ipStack, IPAddress gateway
     m_gatewayAddress(gatewayAddress),
     m_gatewayPort(gatewayPort),
     m_messageID(0),
-    m_state(STATE_IDLE),
-    m_blockSize(MAX_BLOCK_SIZE),
-    m_lastError(NO_ERROR),
-    m_dataLen(0),
-    m_txIndex(0),
-    m_respLen(0),
-    m_txByteCount(0),
-    m_respHttpCode(0) {
+    m_maxBlocksInFlight(1) {
     
-    memset(m_token, 0, sizeof(m_token));
-    memset(m_dataBuffer, 0, sizeof(m_dataBuffer));
-    memset(m_respBuffer, 0, sizeof(m_respBuffer));
+    memset(m_requests, 0, sizeof(m_requests));
+    memset(m_blocks, 0, sizeof(m_blocks));
+    for (int i = 0; i < MAX_OBSERVATIONS; i++) {
+        m_observations[i].path = NULL;
+    }
     
+    // Start with the largest standard block size that fits in
+    // a datagram the IP stack can send.
+    m_maxBlockSize = MAX_BLOCK_SIZE;
+    while (m_maxBlockSize > MIN_BLOCK_SIZE && m_maxBlockSize + PACKET_OVERHEAD > ipStack.getMaxDatagramSize()) {
+        m_maxBlockSize >>= 1;
+    }
+    m_blockSize = m_maxBlockSize;
 }
 
 
-void TembooCoAPClient::resetChoreo() {
-    memset(m_token, 0, sizeof(m_token));
-    memset(m_dataBuffer, 0, sizeof(m_dataBuffer));
-    memset(m_respBuffer, 0, sizeof(m_respBuffer));
-    m_dataLen = 0;
-    m_respLen = 0;
-    m_txIndex = 0;
-    m_txByteCount = 0;
-    m_rxBlockNum = 0;
-    
-    m_rrLayer.setState(CoapRRLayer::STATE_IDLE);
-    m_messageLayer.setState(CoapMessageLayer::STATE_CLOSED);
+void TembooCoAPClient::resetChoreo(Request& request) {
+    cancelBlocks(request);
+    memset(request.dataBuffer, 0, sizeof(request.dataBuffer));
+    memset(request.respBuffer, 0, sizeof(request.respBuffer));
+    request.state = STATE_IDLE;
+    request.lastResult = NO_ERROR;
+    request.blockSize = m_blockSize;
+    request.dataLen = 0;
+    request.respLen = 0;
+    request.respHttpCode = 0;
+    request.txByteCount = 0;
+    request.txAckedByteCount = 0;
+    request.rxNextBlockNum = 0;
+    request.rxBlockCount = 0;
+    request.rxLastBlockNum = -1;
 }
 
 void TembooCoAPClient::begin(long seed){
@@ -89,7 +94,7 @@ void TembooCoAPClient::begin(long seed){
     //with input from an unused analog input if it's important to them.
     randomSeed(seed);
     m_messageID = random(0, UINT16_MAX);
-    
+    m_blockSize = m_maxBlockSize;
 }
 
 
@@ -97,25 +102,86 @@ TembooCoAPClient::~TembooCoAPClient() {
 }
 
 
+TembooCoAPClient::Request* TembooCoAPClient::openRequest(void* owner) {
+    Request* request = NULL;
+    for (int i = 0; i < MAX_REQUESTS; i++) {
+        if (m_requests[i].owner == owner) {
+            return &m_requests[i];
+        }
+        if (NULL == request && NULL == m_requests[i].owner) {
+            request = &m_requests[i];
+        }
+    }
+    
+    // With all requests taken, reuse one that has finished.  Its
+    // response is lost, just as it was when there was only one.
+    for (int i = 0; NULL == request && i < MAX_REQUESTS; i++) {
+        if (!isBusy(m_requests[i])) {
+            request = &m_requests[i];
+        }
+    }
+    
+    if (NULL != request) {
+        request->owner = owner;
+    }
+    return request;
+}
+
+
+void TembooCoAPClient::closeRequest(void* owner) {
+    for (int i = 0; i < MAX_REQUESTS; i++) {
+        if (m_requests[i].owner == owner) {
+            cancelRequest(m_requests[i]);
+            m_requests[i].owner = NULL;
+        }
+    }
+}
+
+
+void TembooCoAPClient::cancelRequest(Request& request) {
+    cancelBlocks(request);
+    request.state = STATE_IDLE;
+}
+
+
+bool TembooCoAPClient::isBusy(Request& request) {
+    return STATE_SEND_REQUEST == request.state
+        || STATE_WAITING_FOR_RESPONSE == request.state
+        || STATE_RESPONSE_STARTED == request.state;
+}
+
+
+void TembooCoAPClient::setMaxBlocksInFlight(uint8_t count) {
+    m_maxBlocksInFlight = count < 1 ? 1 : (count > MAX_BLOCKS ? MAX_BLOCKS : count);
+}
+
+
 
-TembooCoAPClient::Result TembooCoAPClient::write(uint8_t value) {
-    if (m_dataLen < sizeof(m_dataBuffer)) {
-        m_dataBuffer[m_dataLen] = value;
-        m_dataLen++;
-        m_txByteCount = 0;
-        m_txIndex = 0;
+TembooCoAPClient::Result TembooCoAPClient::write(Request& request, uint8_t value) {
+    if (request.dataLen < sizeof(request.dataBuffer)) {
+        request.dataBuffer[request.dataLen] = value;
+        request.dataLen++;
+        request.txByteCount = 0;
         return NO_ERROR;
     }
     return ERROR_BUFFER_FULL;
 }
 
-TembooCoAPClient::Result TembooCoAPClient::saveResponse(uint8_t* values, uint16_t len) {
-    len = len < (sizeof(m_respBuffer) - m_respLen - 1) ? len : (sizeof(m_respBuffer) - m_respLen -1);
+TembooCoAPClient::Result TembooCoAPClient::saveResponse(Request& request, uint32_t offset, uint8_t* values, uint16_t len) {
+    // Blocks may arrive in any order, each one goes at its own offset.
+    // The last byte of the buffer is kept for the terminating nul.
+    uint32_t room = offset < (sizeof(request.respBuffer) - 1) ? (sizeof(request.respBuffer) - 1 - offset) : 0;
+    if (0 == len) {
+        return NO_ERROR;
+    }
+    len = len < room ? len : room;
     TEMBOO_TRACE("DBG: ");
     TEMBOO_TRACELN("Saving payload to the buffer");
     if ( len > 0) {
-        memcpy(&m_respBuffer[m_respLen], values, len);
-        m_respLen += len;
+        memcpy(&request.respBuffer[offset], values, len);
+        if (offset + len > (uint32_t)request.respLen) {
+            request.respLen = offset + len;
+        }
         return NO_ERROR;
     }
     TEMBOO_TRACE("ERROR: ");
@@ -125,10 +191,10 @@ TembooCoAPClient::Result TembooCoAPClient::saveResponse(uint8_t* values, uint16_
 
 
 
-TembooCoAPClient::Result TembooCoAPClient::write(uint8_t* values, uint16_t len) {
+TembooCoAPClient::Result TembooCoAPClient::write(Request& request, uint8_t* values, uint16_t len) {
     Result rc = NO_ERROR;
     while(NO_ERROR == rc && len > 0) {
-        rc = write(*values++);
+        rc = write(request, *values++);
         len--;
     }
     return rc;
@@ -145,77 +211,82 @@ uint16_t TembooCoAPClient::getNextMessageID() {
 }
 
 
-TembooCoAPClient::Result TembooCoAPClient::generateToken() {
+void TembooCoAPClient::generateToken(char* token) {
     // 5.3.1.  Token suggests the tokenID should be a random value
     
     for (int i = 0; i < 8; i++) {
-        m_token[i] = (rand() % 93) + 33;
+        token[i] = (rand() % 93) + 33;
     }
-    m_token[8] = '\0';
-    return NO_ERROR;
+    token[8] = '\0';
 }
 
-TembooCoAPClient::Result TembooCoAPClient::sendBlockRequest(uint16_t msgID, uint32_t blockNum) {
-    
-    CoapMsg msg(m_txBuffer, sizeof (m_txBuffer));
-    msg.setCode(CoapMsg::COAP_POST);
-    
-    if (msg.setToken((uint8_t*)m_token, strlen(m_token))) {
-        TEMBOO_TRACELN("err: setToken");
-        return ERROR_MSG_TOKEN;
+
+TembooCoAPClient::Block* TembooCoAPClient::allocBlock(Request& request) {
+    for (int i = 0; i < MAX_BLOCKS; i++) {
+        if (NULL == m_blocks[i].request) {
+            m_blocks[i].request = &request;
+            request.blocksInFlight++;
+            return &m_blocks[i];
+        }
     }
-    
-    msg.setId(msgID);
-    
-    if (msg.addOption(CoapMsg::COAP_OPTION_URI_PATH, (const uint8_t*)URI_PATH, strlen(URI_PATH))) {
-        TEMBOO_TRACELN("err: setURI");
-        return ERROR_MSG_OPTION;
+    return NULL;
+}
+
+
+TembooCoAPClient::Block* TembooCoAPClient::findBlock(char* token) {
+    for (int i = 0; i < MAX_BLOCKS; i++) {
+        if (NULL != m_blocks[i].request && m_blocks[i].token == token) {
+            return &m_blocks[i];
+        }
     }
-    
-    uint8_t optionValue[3];
-    uint16_t optionLen = 0;
-    
-    // If this is the last block in a series of blocks (or an only block)
-    // include a block2 option to let the server know what our
-    // desired block size is for the response.
-    
+    return NULL;
+}
+
+
+void TembooCoAPClient::freeBlock(Block* block) {
+    block->request->blocksInFlight--;
+    block->request = NULL;
+}
+
+
+void TembooCoAPClient::cancelBlocks(Request& request) {
+    for (int i = 0; i < MAX_BLOCKS; i++) {
+        if (m_blocks[i].request == &request) {
+            m_rrLayer.cancel(m_blocks[i].token);
+            freeBlock(&m_blocks[i]);
+        }
+    }
+}
+
+
+// Encodes a block option value right-aligned in optionValue[3],
+// returns the number of bytes used.
+static uint16_t encodeBlockOption(uint8_t* optionValue, uint32_t blockNum, bool more, uint8_t szx) {
     optionValue[0] = (blockNum & 0xF000) >> 12;
     optionValue[1] = (blockNum & 0x0FF0) >> 4;
     optionValue[2] = (blockNum & 0x000F) << 4;
-    optionValue[2] |= (0 ? 0x08 : 0);
-    optionValue[2] |= (m_blockSize >> 5) & 0x07;
+    optionValue[2] |= (more ? 0x08 : 0);
+    optionValue[2] |= szx;
     
-    optionLen = 1;
     if (optionValue[0] > 0) {
-        optionLen = 3;
+        return 3;
     } else if (optionValue[1] > 0) {
-        optionLen = 2;
-    }
-    if (msg.addOption(CoapMsg::COAP_OPTION_BLOCK2, (const uint8_t*)&optionValue[3 - optionLen], optionLen)) {
-        TEMBOO_TRACELN("err: block2");
-        return ERROR_MSG_OPTION;
-    }
-    
-    if (m_rrLayer.reliableSend(msg, m_token, m_gatewayAddress, m_gatewayPort) != CoapRRLayer::NO_ERROR) {
-        TEMBOO_TRACELN("err: send");
-        return ERROR_SENDING_MSG;
+        return 2;
     }
-    
-    return NO_ERROR;
+    return 1;
 }
 
 
-TembooCoAPClient::Result TembooCoAPClient::sendBlock(uint16_t msgID, uint8_t* payload, size_t len, uint32_t blockNum, bool moreBlocks) {
+TembooCoAPClient::Result TembooCoAPClient::buildBlock(Request& request, Block* block, CoapMsg& msg) {
     
-    CoapMsg msg(m_txBuffer, sizeof (m_txBuffer));
     msg.setCode(CoapMsg::COAP_POST);
     
-    if (msg.setToken((uint8_t*)m_token, strlen(m_token))) {
+    if (msg.setToken((uint8_t*)block->token, strlen(block->token))) {
         TEMBOO_TRACELN("err: setToken");
         return ERROR_MSG_TOKEN;
     }
     
-    msg.setId(msgID);
+    msg.setId(getNextMessageID());
     
     if (msg.addOption(CoapMsg::COAP_OPTION_URI_PATH, (const uint8_t*)URI_PATH, strlen(URI_PATH))) {
         TEMBOO_TRACELN("err: setURI");
@@ -225,11 +296,26 @@ TembooCoAPClient::Result TembooCoAPClient::sendBlock(uint16_t msgID, uint8_t* pa
     uint8_t optionValue[3];
     uint16_t optionLen = 0;
     
+    if (block->response) {
+        // Ask for a block of the response.
+        optionLen = encodeBlockOption(optionValue, block->blockNum, false, getBlockSzx(request.blockSize));
+        if (msg.addOption(CoapMsg::COAP_OPTION_BLOCK2, (const uint8_t*)&optionValue[3 - optionLen], optionLen)) {
+            TEMBOO_TRACELN("err: block2");
+            return ERROR_MSG_OPTION;
+        }
+        return NO_ERROR;
+    }
+    
+    uint16_t offset = block->blockNum * request.blockSize;
+    block->len = (request.dataLen - offset) < request.blockSize ? (request.dataLen - offset) : request.blockSize;
+    bool moreBlocks = (offset + block->len) < request.dataLen;
+    block->last = !moreBlocks;
+    
     // If this is the last block in a series of blocks (or an only block)
     // include a block2 option to let the server know what our
     // desired block size is for the response.
-    if (!moreBlocksToSend()) {
-        optionValue[0] = (m_blockSize >> 5) & 0x07;
+    if (!moreBlocks) {
+        optionValue[0] = getBlockSzx(request.blockSize);
         optionLen = (optionValue[0] > 0) ? 1 : 0;
         if (msg.addOption(CoapMsg::COAP_OPTION_BLOCK2, (const uint8_t*)optionValue, optionLen)) {
             TEMBOO_TRACELN("err: block2");
@@ -239,338 +325,686 @@ TembooCoAPClient::Result TembooCoAPClient::sendBlock(uint16_t msgID, uint8_t* pa
     
     // If this is not the only block in the request,
     // include the block1 option.
-    if (blockNum > 0 || moreBlocks) {
-        
-        optionValue[0] = (blockNum & 0xF000) >> 12;
-        optionValue[1] = (blockNum & 0x0FF0) >> 4;
-        optionValue[2] = (blockNum & 0x000F) << 4;
-        optionValue[2] |= (moreBlocks ? 0x08 : 0);
-        optionValue[2] |= (m_blockSize >> 5) & 0x07;
-        
-        optionLen = 1;
-        if (optionValue[0] > 0) {
-            optionLen = 3;
-        } else if (optionValue[1] > 0) {
-            optionLen = 2;
-        }
-        
+    if (block->blockNum > 0 || moreBlocks) {
+        optionLen = encodeBlockOption(optionValue, block->blockNum, moreBlocks, getBlockSzx(request.blockSize));
         if (msg.addOption(CoapMsg::COAP_OPTION_BLOCK1, (const uint8_t*)&optionValue[3 - optionLen], optionLen)) {
             TEMBOO_TRACELN("err: block1");
             return ERROR_MSG_OPTION;
         }
     }
     
-    if (msg.setPayload((uint8_t*)payload, len)) {
+    if (msg.setPayload(&request.dataBuffer[offset], block->len)) {
         TEMBOO_TRACELN("err: setPayload");
         return ERROR_MSG_PAYLOAD;
     }
     
-    if (m_rrLayer.reliableSend(msg, m_token, m_gatewayAddress, m_gatewayPort) != CoapRRLayer::NO_ERROR) {
+    return NO_ERROR;
+}
+
+
+TembooCoAPClient::Result TembooCoAPClient::sendBlock(Request& request, Block* block, uint32_t blockNum, bool response) {
+    
+    block->blockNum = blockNum;
+    block->response = response;
+    block->len = 0;
+    block->last = false;
+    generateToken(block->token);
+    
+    CoapMsg msg(block->txBuffer, sizeof(block->txBuffer));
+    Result rc = buildBlock(request, block, msg);
+    
+    if (NO_ERROR == rc && m_rrLayer.reliableSend(msg, block->token, m_gatewayAddress, m_gatewayPort) != CoapRRLayer::NO_ERROR) {
         TEMBOO_TRACELN("err: send");
-        return ERROR_SENDING_MSG;
+        rc = ERROR_SENDING_MSG;
     }
     
-    return NO_ERROR;
+    if (NO_ERROR != rc) {
+        freeBlock(block);
+    } else if (!response) {
+        request.txByteCount += block->len;
+    }
+    return rc;
+}
+
+
+uint32_t TembooCoAPClient::getLastRequestBlockNum(Request& request) {
+    return request.dataLen > 0 ? (request.dataLen - 1) / request.blockSize : 0;
+}
+
+
+TembooCoAPClient::Result TembooCoAPClient::sendMoreBlocks(Request& request) {
+    // Send as many blocks as the request may have in flight, as long
+    // as there are free blocks.  The rest are sent from loop() when
+    // blocks are answered.
+    Result rc = NO_ERROR;
+    while (NO_ERROR == rc && request.blocksInFlight < m_maxBlocksInFlight) {
+        uint32_t blockNum = 0;
+        bool response = false;
+        
+        if (STATE_SEND_REQUEST == request.state) {
+            if (0 == request.txByteCount && 0 == request.blocksInFlight) {
+                // The first block goes alone, the gateway's answer
+                // to it may change the block size.
+                blockNum = 0;
+            } else if (request.txByteCount >= request.dataLen || 0 == request.txAckedByteCount) {
+                break;
+            } else {
+                blockNum = request.txByteCount / request.blockSize;
+                
+                // The answer to the last block is the response, so it
+                // goes after all the others have been answered.
+                if (blockNum == getLastRequestBlockNum(request) && request.txAckedByteCount < request.txByteCount) {
+                    break;
+                }
+            }
+        } else if (STATE_RESPONSE_STARTED == request.state) {
+            // Until the size of the response is known, ask for one
+            // block at a time so as not to ask for blocks past its end.
+            if (request.rxLastBlockNum < 0 ? request.blocksInFlight > 0 : (int32_t)request.rxNextBlockNum > request.rxLastBlockNum) {
+                break;
+            }
+            blockNum = request.rxNextBlockNum;
+            response = true;
+        } else {
+            break;
+        }
+        
+        // Observations share the message layer's exchanges with the
+        // blocks.  While they hold all of them (with NSTART 1, a single
+        // registration does) the block waits for loop() like it does
+        // for a free block, which sends it before renewing observations.
+        if (m_messageLayer.getOpenExchangeCount() >= CoapMessageLayer::NSTART) {
+            break;
+        }
+        
+        Block* block = allocBlock(request);
+        if (NULL == block) {
+            break;
+        }
+        
+        rc = sendBlock(request, block, blockNum, response);
+        
+        // If the IP stack can't send a first block this large, try smaller ones.
+        while (NO_ERROR != rc && !response && 0 == blockNum
+               && CoapMessageLayer::ERROR_SENDING_PACKET == m_messageLayer.getLastResult()
+               && shrinkBlockSize(request) && NULL != (block = allocBlock(request))) {
+            rc = sendBlock(request, block, blockNum, response);
+        }
+        
+        if (NO_ERROR == rc && response) {
+            request.rxNextBlockNum++;
+        }
+    }
+    return rc;
 }
 
 
-void TembooCoAPClient::adjustRequestBlockSize(CoapMsg& msg) {
+void TembooCoAPClient::adjustRequestBlockSize(Request& request, CoapMsg& msg) {
     
     // A block1 option in a response means the server is
     // requesting that we use a smaller block size.
     uint16_t newBlockSize = msg.getBlock1Size();
-    if (newBlockSize > 0 && newBlockSize < m_blockSize) {
-        m_blockSize = newBlockSize;
+    if (newBlockSize > 0 && newBlockSize < request.blockSize) {
+        request.blockSize = newBlockSize;
+    }
+    
+    // A block2 option smaller than the size we asked for is the
+    // size the server is sending the response in.  The block numbers
+    // of our requests for the rest of the response count in that size.
+    newBlockSize = msg.getBlock2Size();
+    if (newBlockSize > 0 && newBlockSize < request.blockSize) {
+        request.blockSize = newBlockSize;
+    }
+    
+    // Later requests start with the size this one ended up with.
+    if (request.blockSize < m_blockSize) {
+        m_blockSize = request.blockSize;
+    }
+}
+
+
+bool TembooCoAPClient::shrinkBlockSize(Request& request) {
+    if (request.blockSize <= MIN_BLOCK_SIZE) {
+        return false;
+    }
+    request.blockSize >>= 1;
+    if (request.blockSize < m_blockSize) {
+        m_blockSize = request.blockSize;
+    }
+    TEMBOO_TRACE("DBG: ");
+    TEMBOO_TRACELN("Block size reduced");
+    return true;
+}
+
+
+void TembooCoAPClient::growBlockSize(Request& request) {
+    // A request that completed without going below the current size
+    // lets the next one try twice that, up to the largest size that
+    // fits in a datagram. Whatever made us shrink (a congested path,
+    // a busy server) may be gone, and if not, the next request shrinks
+    // again.
+    if (request.blockSize >= m_blockSize && m_blockSize < m_maxBlockSize) {
+        m_blockSize <<= 1;
+        TEMBOO_TRACE("DBG: ");
+        TEMBOO_TRACELN("Block size increased");
+    }
+}
+
+
+uint8_t TembooCoAPClient::getBlockSzx(uint16_t blockSize) {
+    // SZX encodes the block sizes 16 to 1024 as 0 to 6
+    uint8_t szx = 0;
+    while (szx < 6 && (16 << szx) < blockSize) {
+        szx++;
     }
+    return szx;
+}
+
+
+TembooCoAPClient::Result TembooCoAPClient::restartRequest(Request& request) {
+    // Send the request again from its first block,
+    // with whatever block size is now in effect.
+    return sendChoreoRequest(request);
+}
+
+
+void TembooCoAPClient::failRequest(Request& request, Result result) {
+    cancelBlocks(request);
+    request.lastResult = result;
+    request.state = STATE_IDLE;
 }
 
 
 TembooCoAPClient::Result TembooCoAPClient::loop() {
     
-    m_lastResult = NO_ERROR;
+    Request* request = NULL;
+    CoapRRLayer::Result rrResult = m_rrLayer.loop();
+    char* token = m_rrLayer.getLastToken();
+    
+    // Every block has its own token, so the token tells
+    // which block (and request) the result belongs to.
+    Block* block = (NULL != token) ? findBlock(token) : NULL;
+    if (NULL != block) {
+        request = block->request;
+    }
     
-    switch (m_state) {
+    switch(rrResult) {
             
-        case STATE_IDLE:
-        case STATE_RESPONSE_READY:
-            // Pump the receiver.
-            // We're not serving anything, so unless there's an outstanding
-            // request (which would mean we would be in STATE_WAITING, not STATE_IDLE),
-            // the R/R layer will reject or ignore any incoming traffic.
-            m_rrLayer.loop();
+        case CoapRRLayer::NO_ERROR:
+            // Nothing happened. Nothing to do.
+            break;
             
+        case CoapRRLayer::RESPONSE_RECEIVED: {
+            // A response to one of our blocks was received.
+            // It may have been a piggybacked ACK or a separate response
+            // Otherwise it may be a notification of an observed resource.
+            CoapMsg msg(m_rxBuffer, sizeof(m_rxBuffer), m_messageLayer.getRXByteCount());
+            Observation* observation = (NULL != block) ? NULL : findObservation(token);
+            if (NULL != block) {
+                handleResponse(block, msg);
+            } else if (NULL != observation) {
+                handleNotification(*observation, msg);
+            }
             break;
-        case STATE_SEND_REQUEST:
-        case STATE_RESPONSE_STARTED:
-        case STATE_WAITING_FOR_RESPONSE:
-            // We're waiting for a response to an earlier request.
-            switch(m_rrLayer.loop()) {
-                    
-                case CoapRRLayer::NO_ERROR:
-                    // Nothing happened. Nothing to do.
-                    break;
-                    
-                case CoapRRLayer::RESPONSE_RECEIVED: {
-                    
-                    // A response to our request was received.
-                    // It may have been a piggybacked ACK or a separate response
-                    CoapMsg msg(m_rxBuffer, sizeof(m_rxBuffer), m_messageLayer.getRXByteCount());
-                    
-                    // See if it has a BLOCK1 option.  If so, make sure the
-                    // block number matches the one we just sent. If the block
-                    // numbers don't match, we're FUBAR, so abort the request.
-                    // If they do match, adjust our request block size if the
-                    // server requested a different (smaller) size.
-                    
-                    if (msg.getOptionCount(CoapMsg::COAP_OPTION_BLOCK1)) {
-                        uint32_t ackBlockNum = msg.getBlock1Num();
-                        if (ackBlockNum != m_txBlockNum) {
-                            TEMBOO_TRACE("ERROR: ");
-                            TEMBOO_TRACELN("Block1 message number does not match");
-                            m_lastResult = ERROR_RECEIVING_RESPONSE;
-                            if (msg.getType() == CoapMsg::COAP_CONFIRMABLE) {
-                                m_messageLayer.rejectMsg(msg);
-                            }
-                            resetChoreo();
-                            break;
-                        }
-                        adjustRequestBlockSize(msg);
-                    }
-                    
-                    // Now deal with the response itself.
-                    switch(msg.getCode()) {
-                        case CoapMsg::COAP_CONTINUE:    //2.31
-                            // 2.31 means the server is requesting the next block of the request.
-                            // If there are no more blocks to send, we're FUBAR, so abort the
-                            // request.  Otherwise, send the next block.
-                            if (m_txIndex >= m_dataLen) {
-                                // no more data to send, bad news
-                                resetChoreo();
-                                m_lastResult = ERROR_REQUEST_FAILED;
-                                m_state = STATE_IDLE;
-                                TEMBOO_TRACE("ERROR: ");
-                                TEMBOO_TRACELN("Gateway requested too many blocks");
-                                break;
-                            }
-                            if (sendChoreoRequest() != NO_ERROR) {
-                                resetChoreo();
-                                m_lastResult = ERROR_REQUEST_FAILED;
-                                m_state = STATE_IDLE;
-                                TEMBOO_TRACE("ERROR: ");
-                                TEMBOO_TRACELN("Send Choreo request failed");
-                            }
-                            break;
-                            
-                        case CoapMsg::COAP_REQUEST_ENTITY_INCOMPLETE: //4.08
-                            // 4.08 means the server is missing one or more blocks, so can't
-                            // service the request.
-                            // We're FUBAR, so abort the request.
-                            resetChoreo();
-                            m_lastResult = ERROR_REQUEST_FAILED;
-                            m_state = STATE_IDLE;
-                            TEMBOO_TRACE("ERROR: ");
-                            TEMBOO_TRACELN("Gateway returned 4.08");
-                            break;
-                            
-                        case CoapMsg::COAP_REQUEST_ENTITY_TOO_LARGE: //4.13
-                            // 4.13 means the server ran out of memory when receiving the
-                            // request.
-                            // We're FUBAR, so abort the request.
-                            resetChoreo();
-                            m_lastResult = ERROR_REQUEST_FAILED;
-                            m_state = STATE_IDLE;
-                            TEMBOO_TRACE("ERROR: ");
-                            TEMBOO_TRACELN("Gateway returned 4.13");
-                            break;
-                            
-                        default:
-                            // Any response code other than the special ones above means the
-                            // server has processed the request and is returning the final result,
-                            // which may be in one or more blocks.  If we haven't finished sending
-                            // the request, we're FUBAR, so abort the request.  Otherwise, process
-                            // the response.
-                            m_dataLen = 0;
-                            if (moreBlocksToSend()) {
-                                m_lastResult = ERROR_RECEIVING_RESPONSE;
-                                if (msg.getType() == CoapMsg::COAP_CONFIRMABLE) {
-                                    m_messageLayer.rejectMsg(msg);
-                                }
-                                TEMBOO_TRACE("ERROR: ");
-                                TEMBOO_TRACELN("Response received before request finished");
-                                resetChoreo();
-                                m_state = STATE_IDLE;
-                                break;
-                            } else {
-                                if (msg.getOptionCount(CoapMsg::COAP_OPTION_BLOCK2)) {
-                                    // The server is sending a multi-block response, make sure
-                                    // it's sending the response block we're expecting.
-                                    
-                                    uint32_t respBlockNum = msg.getBlock2Num();
-                                    TEMBOO_TRACE("DBG: ");
-                                    TEMBOO_TRACELN("Block2 opt recv");
-                                    
-                                    if (respBlockNum > m_rxBlockNum) {
-                                        // It sent a newer block than the one we're expecting,
-                                        // (i.e. we've somehow missed a block)
-                                        // that's an error.
-                                        m_lastResult = ERROR_RECEIVING_RESPONSE;
-                                        if (msg.getType() == CoapMsg::COAP_CONFIRMABLE) {
-                                            m_messageLayer.rejectMsg(msg);
-                                        }
-                                        resetChoreo();
-                                        m_state = STATE_IDLE;
-                                        TEMBOO_TRACE("ERROR: ");
-                                        TEMBOO_TRACELN("Received block out of order");
-                                        break;
-                                        
-                                    } else if (respBlockNum < m_rxBlockNum) {
-                                        // It resent a block we've already received,
-                                        // (i.e. it didn't see our ACK),
-                                        // just accept (ACK) it again.
-                                        if (msg.getType() == CoapMsg::COAP_CONFIRMABLE) {
-                                            m_messageLayer.acceptMsg(msg);
-                                        }
-                                        m_lastResult = NO_ERROR;
-                                        sendBlockRequest(m_messageID, m_rxBlockNum);
-                                        m_state = STATE_RESPONSE_STARTED;
-                                        TEMBOO_TRACE("DBG: ");
-                                        TEMBOO_TRACELN("Received previous block");
-                                        
-                                        
-                                    } else {
-                                        // Server sent the next block we are expecting.
-                                        // Accept it and add the payload to our buffer.
-                                        bool block2More = msg.getBlock2More();
-                                        m_respHttpCode = msg.getHTTPStatus();
-                                        m_lastResult = saveResponse(msg.getPayload(), msg.getPayloadLen());
-                                        if (msg.getType() == CoapMsg::COAP_CONFIRMABLE) {
-                                            m_rxBlockNum = respBlockNum;
-                                            m_messageLayer.acceptMsg(msg);
-                                        }
-                                        if (block2More) {
-                                            m_rxBlockNum++;
-                                            m_messageID++;
-                                            TEMBOO_TRACE("DBG: ");
-                                            TEMBOO_TRACELN("Request next block2 msg");
-                                            sendBlockRequest(m_messageID, m_rxBlockNum);
-                                            m_state = STATE_RESPONSE_STARTED;
-                                        } else {
-                                            TEMBOO_TRACE("DBG: ");
-                                            TEMBOO_TRACELN("Final block2 msg recv");
-                                            TEMBOO_TRACE("DBG: ");
-                                            TEMBOO_TRACELN("Response complete");
-                                            m_state = STATE_RESPONSE_READY;
-                                        }
-                                    }
-                                    
-                                } else {
-                                    // There's no Block2 option, so is either
-                                    // the one and only block in the response
-                                    // or an empty ack.
-                                    
-                                    // check if empty to handle final ack. If empty
-                                    // wait for CON with matching token and then
-                                    // request other blocks of response
-                                    
-                                    if (msg.getCode() == CoapMsg::COAP_EMPTY) {
-                                        m_rrLayer.setState(CoapRRLayer::STATE_WAITING);
-                                        m_messageLayer.setState(CoapMessageLayer::STATE_WAITING_FOR_CON);
-                                        m_state = STATE_WAITING_FOR_RESPONSE;
-                                        TEMBOO_TRACE("DBG: ");
-                                        TEMBOO_TRACELN("Empty ACK received, waiting for response");
-                                        
-                                    } else {
-                                        m_respHttpCode = msg.getHTTPStatus();
-                                        m_lastResult = saveResponse(msg.getPayload(), msg.getPayloadLen());
-                                        m_messageLayer.acceptMsg(msg);
-                                        m_state = STATE_RESPONSE_READY;
-                                        TEMBOO_TRACE("DBG: ");
-                                        TEMBOO_TRACELN("Response complete");
-                                    }
-                                }
-                                
-                            }
-                    }
-                    
-                    // Does it have a Block2 option?
-                    
-                    uint32_t responseBlockNum = msg.getBlock2Num();
-                    if (responseBlockNum == m_rxBlockNum && msg.getOptionCount(CoapMsg::COAP_OPTION_BLOCK2)) {
-                        adjustRequestBlockSize(msg);
-                        m_rxBlockNum++;
-                        if (0 == m_rxBlockNum) {
-                            clearData();
-                        }
-                    }
-                    break;
-                }
-                    
-                case CoapRRLayer::ERROR_RECEIVING_RESPONSE:
-                    m_lastResult = ERROR_REQUEST_FAILED;
-                    m_state = STATE_IDLE;
-                    TEMBOO_TRACE("ERROR: ");
-                    TEMBOO_TRACELN("Error receiving response");
-                    break;
-                    
-                case CoapRRLayer::RST_RECEIVED:
-                    m_lastResult = ERROR_REQUEST_FAILED;
-                    m_state = STATE_IDLE;
-                    TEMBOO_TRACE("ERROR: ");
-                    TEMBOO_TRACELN("RST received");
-                    break;
-                    
-                default:
-                    // Anything else indicates a failure of some sort.  Check
-                    // the messageLayer lastResult for specifics.
-                    TEMBOO_TRACE("ERROR: ");
-                    TEMBOO_TRACELN("Request failed");
-                    m_lastResult = ERROR_REQUEST_FAILED;
-                    m_state = STATE_IDLE;
-                    
+        }
+            
+        case CoapRRLayer::ACK_RECEIVED:
+            // An empty ACK.  The response will follow in a CON of its own.
+            if (NULL != block && block->last && !block->response) {
+                request->state = STATE_WAITING_FOR_RESPONSE;
+                TEMBOO_TRACE("DBG: ");
+                TEMBOO_TRACELN("Empty ACK received, waiting for response");
             }
             break;
+            
+        case CoapRRLayer::ERROR_RECEIVING_RESPONSE:
+        case CoapRRLayer::RST_RECEIVED:
+            if (NULL != block) {
+                handleFailure(block, rrResult);
+                break;
+            }
+            if (NULL != token) {
+                // The block has been cancelled, or an observation
+                // wasn't registered.  That one is retried when its
+                // renew timer runs out.
+                break;
+            }
+            // Otherwise the failure isn't limited to one request.
+            
         default:
+            // Anything else indicates a failure of some sort.  Check
+            // the messageLayer lastResult for specifics.
+            TEMBOO_TRACE("ERROR: ");
+            TEMBOO_TRACELN("Request failed");
+            for (int i = 0; i < MAX_REQUESTS; i++) {
+                if (isBusy(m_requests[i])) {
+                    failRequest(m_requests[i], ERROR_REQUEST_FAILED);
+                }
+            }
+            return ERROR_REQUEST_FAILED;
+    }
+    
+    // Blocks freed above may let requests send more of theirs.
+    for (int i = 0; i < MAX_REQUESTS; i++) {
+        if (isBusy(m_requests[i]) && sendMoreBlocks(m_requests[i]) != NO_ERROR) {
+            failRequest(m_requests[i], ERROR_REQUEST_FAILED);
+            TEMBOO_TRACE("ERROR: ");
+            TEMBOO_TRACELN("Send Choreo request failed");
+        }
+    }
+    
+    // Renew the observations that have gone quiet.
+    for (int i = 0; i < MAX_OBSERVATIONS; i++) {
+        if (NULL != m_observations[i].path && m_observations[i].renewTimer.expired()) {
+            sendObserveRequest(m_observations[i]);
+        }
+    }
+    
+    return (NULL != request) ? request->lastResult : NO_ERROR;
+}
+
+
+void TembooCoAPClient::handleResponse(Block* block, CoapMsg& msg) {
+    
+    Request& request = *block->request;
+    uint16_t sentBlockSize = request.blockSize;
+    uint32_t blockNum = block->blockNum;
+    uint16_t len = block->len;
+    bool last = block->last;
+    bool response = block->response;
+    freeBlock(block);
+    
+    // See if it has a BLOCK1 option.  If so, make sure the
+    // block number matches the one it answers. If the block
+    // numbers don't match, we're FUBAR, so abort the request.
+    // If they do match, adjust our request block size if the
+    // server requested a different (smaller) size.
+    
+    if (!response && msg.getOptionCount(CoapMsg::COAP_OPTION_BLOCK1)) {
+        if (msg.getBlock1Num() != blockNum) {
+            TEMBOO_TRACE("ERROR: ");
+            TEMBOO_TRACELN("Block1 message number does not match");
+            if (msg.getType() == CoapMsg::COAP_CONFIRMABLE) {
+                m_messageLayer.rejectMsg(msg);
+            }
+            failRequest(request, ERROR_RECEIVING_RESPONSE);
+            return;
+        }
+        adjustRequestBlockSize(request, msg);
+    }
+    
+    // Now deal with the response itself.
+    switch(msg.getCode()) {
+        case CoapMsg::COAP_CONTINUE:    //2.31
+            // 2.31 means the server is requesting the next block of the request.
+            // If there are no more blocks to send, we're FUBAR, so abort the
+            // request.  Otherwise, the next block goes out below.
+            if (msg.getType() == CoapMsg::COAP_CONFIRMABLE) {
+                m_messageLayer.acceptMsg(msg);
+            }
+            if (response || last) {
+                // no more data to send, bad news
+                failRequest(request, ERROR_REQUEST_FAILED);
+                TEMBOO_TRACE("ERROR: ");
+                TEMBOO_TRACELN("Gateway requested too many blocks");
+                break;
+            }
+            request.txAckedByteCount += len;
+            if (sendMoreBlocks(request) != NO_ERROR) {
+                failRequest(request, ERROR_REQUEST_FAILED);
+                TEMBOO_TRACE("ERROR: ");
+                TEMBOO_TRACELN("Send Choreo request failed");
+            }
+            break;
+            
+        case CoapMsg::COAP_REQUEST_ENTITY_INCOMPLETE: //4.08
+            // 4.08 means the server is missing one or more blocks, so can't
+            // service the request.
+            // We're FUBAR, so abort the request.
+            if (msg.getType() == CoapMsg::COAP_CONFIRMABLE) {
+                m_messageLayer.acceptMsg(msg);
+            }
+            failRequest(request, ERROR_REQUEST_FAILED);
+            TEMBOO_TRACE("ERROR: ");
+            TEMBOO_TRACELN("Gateway returned 4.08");
+            break;
+            
+        case CoapMsg::COAP_REQUEST_ENTITY_TOO_LARGE: //4.13
+            if (msg.getType() == CoapMsg::COAP_CONFIRMABLE) {
+                m_messageLayer.acceptMsg(msg);
+            }
+            // 4.13 with a smaller block1 size means the server can't
+            // take blocks as large as ours.  Start over with that size.
+            if (!response && request.blockSize < sentBlockSize && restartRequest(request) == NO_ERROR) {
+                TEMBOO_TRACE("DBG: ");
+                TEMBOO_TRACELN("Gateway returned 4.13, retrying with smaller blocks");
+                break;
+            }
+            // Otherwise the server ran out of memory when receiving the
+            // request.
+            // We're FUBAR, so abort the request.
+            failRequest(request, ERROR_REQUEST_FAILED);
+            TEMBOO_TRACE("ERROR: ");
+            TEMBOO_TRACELN("Gateway returned 4.13");
             break;
+            
+        default:
+            // Any response code other than the special ones above means the
+            // server has processed the request and is returning the final result,
+            // which may be in one or more blocks.  If we haven't finished sending
+            // the request, we're FUBAR, so abort the request.  Otherwise, process
+            // the response.
+            if (!response && !last) {
+                if (msg.getType() == CoapMsg::COAP_CONFIRMABLE) {
+                    m_messageLayer.rejectMsg(msg);
+                }
+                TEMBOO_TRACE("ERROR: ");
+                TEMBOO_TRACELN("Response received before request finished");
+                failRequest(request, ERROR_RECEIVING_RESPONSE);
+                break;
+            }
+            handleResponseBlock(request, response ? blockNum : 0, msg);
+    }
+}
+
+
+void TembooCoAPClient::handleResponseBlock(Request& request, uint32_t expectedBlockNum, CoapMsg& msg) {
+    
+    if (msg.getOptionCount(CoapMsg::COAP_OPTION_BLOCK2)) {
+        // The server is sending a multi-block response, make sure
+        // it's sending the response block we asked for.
+        
+        uint32_t respBlockNum = msg.getBlock2Num();
+        TEMBOO_TRACE("DBG: ");
+        TEMBOO_TRACELN("Block2 opt recv");
+        
+        if (respBlockNum != expectedBlockNum) {
+            TEMBOO_TRACE("ERROR: ");
+            TEMBOO_TRACELN("Received block out of order");
+            if (msg.getType() == CoapMsg::COAP_CONFIRMABLE) {
+                m_messageLayer.rejectMsg(msg);
+            }
+            failRequest(request, ERROR_RECEIVING_RESPONSE);
+            return;
+        }
+        adjustRequestBlockSize(request, msg);
+        
+        // Add the payload to our buffer at the place of the
+        // block, blocks may arrive in any order.
+        bool block2More = msg.getBlock2More();
+        request.respHttpCode = msg.getHTTPStatus();
+        Result rc = saveResponse(request, respBlockNum * msg.getBlock2Size(), msg.getPayload(), msg.getPayloadLen());
+        if (NO_ERROR != rc) {
+            request.lastResult = rc;
+        }
+        request.rxBlockCount++;
+        if (respBlockNum >= request.rxNextBlockNum) {
+            request.rxNextBlockNum = respBlockNum + 1;
+        }
+        
+        if (!block2More) {
+            request.rxLastBlockNum = respBlockNum;
+        } else if (request.rxLastBlockNum < 0 && msg.getOptionCount(CoapMsg::COAP_OPTION_SIZE2)) {
+            // A Size2 option tells how large the whole response is,
+            // so the rest of its blocks can be asked for at once.
+            uint8_t* size2 = msg.getOptionValue(CoapMsg::COAP_OPTION_SIZE2, 0);
+            uint32_t responseSize = 0;
+            for (uint16_t i = msg.getOptionLen(CoapMsg::COAP_OPTION_SIZE2, 0); i > 0; i--) {
+                responseSize = (responseSize << 8) | *size2++;
+            }
+            if (responseSize > 0) {
+                request.rxLastBlockNum = (responseSize - 1) / msg.getBlock2Size();
+            }
+        }
+        
+        // Accepting the message turns it into our ACK,
+        // so it's done after everything has been read from it.
+        if (msg.getType() == CoapMsg::COAP_CONFIRMABLE) {
+            m_messageLayer.acceptMsg(msg);
+        }
+        
+        if (request.rxLastBlockNum >= 0 && (int32_t)request.rxBlockCount > request.rxLastBlockNum) {
+            TEMBOO_TRACE("DBG: ");
+            TEMBOO_TRACELN("Final block2 msg recv");
+            TEMBOO_TRACE("DBG: ");
+            TEMBOO_TRACELN("Response complete");
+            cancelBlocks(request);
+            request.state = STATE_RESPONSE_READY;
+            growBlockSize(request);
+        } else {
+            TEMBOO_TRACE("DBG: ");
+            TEMBOO_TRACELN("Request next block2 msg");
+            request.state = STATE_RESPONSE_STARTED;
+            if (sendMoreBlocks(request) != NO_ERROR) {
+                failRequest(request, ERROR_REQUEST_FAILED);
+                TEMBOO_TRACE("ERROR: ");
+                TEMBOO_TRACELN("Requesting response block failed");
+            }
+        }
+        
+    } else {
+        // There's no Block2 option, so this is
+        // the one and only block in the response.
+        request.respHttpCode = msg.getHTTPStatus();
+        request.lastResult = saveResponse(request, 0, msg.getPayload(), msg.getPayloadLen());
+        if (msg.getType() == CoapMsg::COAP_CONFIRMABLE) {
+            m_messageLayer.acceptMsg(msg);
+        }
+        request.state = STATE_RESPONSE_READY;
+        growBlockSize(request);
+        TEMBOO_TRACE("DBG: ");
+        TEMBOO_TRACELN("Response complete");
+    }
+}
+
+
+void TembooCoAPClient::handleFailure(Block* block, CoapRRLayer::Result rrResult) {
+    
+    Request& request = *block->request;
+    bool firstBlock = !block->response && 0 == block->blockNum;
+    freeBlock(block);
+    
+    if (CoapRRLayer::RST_RECEIVED == rrResult) {
+        failRequest(request, ERROR_REQUEST_FAILED);
+        TEMBOO_TRACE("ERROR: ");
+        TEMBOO_TRACELN("RST received");
+        return;
+    }
+    
+    // If not even the first block of the request got through,
+    // the network may be dropping datagrams that large.
+    if (STATE_SEND_REQUEST == request.state && firstBlock
+            && (CoapMessageLayer::ERROR_RETRANSMIT_COUNT_EXCEEDED == m_messageLayer.getLastResult()
+                || CoapMessageLayer::ERROR_TX_SPAN_TIME_EXCEEDED == m_messageLayer.getLastResult())
+            && shrinkBlockSize(request) && restartRequest(request) == NO_ERROR) {
+        TEMBOO_TRACE("DBG: ");
+        TEMBOO_TRACELN("No ACK, retrying with smaller blocks");
+        return;
+    }
+    failRequest(request, ERROR_REQUEST_FAILED);
+    TEMBOO_TRACE("ERROR: ");
+    TEMBOO_TRACELN("Error receiving response");
+}
+
+
+TembooCoAPClient::Result TembooCoAPClient::observe(const char* path, TembooCoAPObserveCallback callback) {
+    if (IS_EMPTY(path) || strlen(path) > MAX_OBSERVE_PATH_LENGTH) {
+        return ERROR_MSG_OPTION;
+    }
+    
+    Observation* observation = findObservation(path);
+    if (NULL == observation) {
+        observation = findObservation((const char*)NULL);
+    }
+    if (NULL == observation) {
+        TEMBOO_TRACE("ERROR: ");
+        TEMBOO_TRACELN("Too many observations");
+        return ERROR_REQUEST_FAILED;
     }
     
-    return m_lastResult;
+    m_rrLayer.cancel(observation->token);
+    observation->path = path;
+    observation->callback = callback;
+    observation->notified = false;
+    generateToken(observation->token);
+    return sendObserveRequest(*observation);
+}
+
+
+void TembooCoAPClient::cancelObserve(const char* path) {
+    // Forgetting the token is enough (RFC7641 3.6), the
+    // gateway's next notification will be answered with a RST.
+    Observation* observation = findObservation(path);
+    if (NULL != observation) {
+        m_rrLayer.cancel(observation->token);
+        observation->path = NULL;
+    }
 }
 
-void TembooCoAPClient::cancelWait() {
-    if (STATE_WAITING_FOR_RESPONSE == m_state) {
-        m_messageLayer.cancelReliableSend();
-        m_dataLen = 0;
-        m_state = STATE_IDLE;
+
+TembooCoAPClient::Observation* TembooCoAPClient::findObservation(const char* path) {
+    for (int i = 0; i < MAX_OBSERVATIONS; i++) {
+        if (m_observations[i].path == path
+                || (NULL != path && NULL != m_observations[i].path && 0 == strcmp(m_observations[i].path, path))) {
+            return &m_observations[i];
+        }
     }
+    return NULL;
 }
 
 
-bool TembooCoAPClient::moreBlocksToSend() {
-    uint16_t payloadLength = (m_dataLen - m_txByteCount) < m_blockSize ? (m_dataLen - m_txByteCount) : m_blockSize;
-    return ((m_txByteCount + payloadLength) < m_dataLen);
+TembooCoAPClient::Observation* TembooCoAPClient::findObservation(char* token) {
+    for (int i = 0; i < MAX_OBSERVATIONS; i++) {
+        if (NULL != m_observations[i].path && m_observations[i].token == token) {
+            return &m_observations[i];
+        }
+    }
+    return NULL;
 }
 
-TembooCoAPClient::Result TembooCoAPClient::sendChoreoRequest() {
-    uint16_t payloadLength = 0;
+
+TembooCoAPClient::Result TembooCoAPClient::sendObserveRequest(Observation& observation) {
     
-    generateToken();
+    // If the registration can't be sent now, try again after a while.
+    observation.renewTimer.start(CoapMessageLayer::ACK_TIMEOUT);
     
-    payloadLength = (m_dataLen - m_txByteCount) < m_blockSize ? (m_dataLen - m_txByteCount) : m_blockSize;
-    m_txBlockNum = m_txByteCount/m_blockSize;
-    bool moreBlocks = (m_txByteCount + payloadLength) < m_dataLen;
-    m_lastError = sendBlock(m_messageID, &m_dataBuffer[m_txIndex], payloadLength, m_txBlockNum, moreBlocks);
-    m_messageID++;
-    if (TembooCoAPClient::NO_ERROR == m_lastError) {
-        m_state = STATE_SEND_REQUEST;
-        m_txIndex += payloadLength;
-        m_txByteCount += payloadLength;
-    } else {
-        m_lastError = ERROR_SENDING_MSG;
-        m_state = STATE_ERROR;
+    CoapMsg msg(observation.txBuffer, sizeof(observation.txBuffer));
+    msg.setCode(CoapMsg::COAP_GET);
+    
+    // Registering again uses the same token (RFC7641 3.3.1),
+    // so notifications already on their way are still ours.
+    if (msg.setToken((uint8_t*)observation.token, strlen(observation.token))) {
+        TEMBOO_TRACELN("err: setToken");
+        return ERROR_MSG_TOKEN;
+    }
+    
+    msg.setId(getNextMessageID());
+    
+    // Observe 0 registers, a uint 0 is an empty option value.
+    if (msg.addOption(CoapMsg::COAP_OPTION_OBSERVE, NULL, 0)) {
+        TEMBOO_TRACELN("err: observe");
+        return ERROR_MSG_OPTION;
+    }
+    
+    // Each segment of the path is an option of its own.
+    const char* segment = observation.path;
+    while ('\0' != *segment) {
+        const char* end = strchr(segment, '/');
+        uint16_t len = (NULL != end) ? (end - segment) : strlen(segment);
+        if (len > 0 && msg.addOption(CoapMsg::COAP_OPTION_URI_PATH, (const uint8_t*)segment, len)) {
+            TEMBOO_TRACELN("err: setURI");
+            return ERROR_MSG_OPTION;
+        }
+        segment += (NULL != end) ? len + 1 : len;
     }
     
+    if (m_rrLayer.reliableSend(msg, observation.token, m_gatewayAddress, m_gatewayPort, true) != CoapRRLayer::NO_ERROR) {
+        TEMBOO_TRACELN("err: send");
+        return ERROR_SENDING_MSG;
+    }
+    
+    // Without a notification for this long, register again.
+    observation.renewTimer.start((DEFAULT_MAX_AGE + MAX_AGE_MARGIN) * 1000L);
+    return NO_ERROR;
+}
+
+
+bool TembooCoAPClient::isNewerNotification(Observation& observation, uint32_t seq) {
+    // RFC7641 3.4.  Sequence numbers are 24 bits and wrap around.
+    // After 128 seconds without a notification, any notification is
+    // newer, as the sequence numbers may have wrapped around since.
+    const uint32_t HALF_RANGE = 1UL << 23;
+    if (!observation.notified) {
+        return true;
+    }
+    if (millis() - observation.lastMillis > 128000UL) {
+        return true;
+    }
+    return (observation.lastSeq < seq && seq - observation.lastSeq < HALF_RANGE)
+        || (observation.lastSeq > seq && observation.lastSeq - seq > HALF_RANGE);
+}
+
+
+void TembooCoAPClient::handleNotification(Observation& observation, CoapMsg& msg) {
+    
+    // Read everything from the message before accepting it,
+    // accepting it turns it into our ACK.  The payload itself
+    // is left where it is in the receive buffer.
+    bool observing = msg.getOptionCount(CoapMsg::COAP_OPTION_OBSERVE) > 0;
+    uint32_t seq = msg.getOptionUint(CoapMsg::COAP_OPTION_OBSERVE, 0);
+    uint32_t maxAge = DEFAULT_MAX_AGE;
+    if (msg.getOptionCount(CoapMsg::COAP_OPTION_MAX_AGE)) {
+        maxAge = msg.getOptionUint(CoapMsg::COAP_OPTION_MAX_AGE, 0);
+    }
+    uint16_t httpCode = msg.getHTTPStatus();
+    const uint8_t* payload = msg.getPayload();
+    uint16_t payloadLen = msg.getPayloadLen();
+    
+    if (msg.getType() == CoapMsg::COAP_CONFIRMABLE) {
+        m_messageLayer.acceptMsg(msg);
+    }
+    
+    // A response without an Observe option means the gateway isn't
+    // (or is no longer) keeping us posted.  Its state is still new.
+    // Either way, the state is good for Max-Age and we
+    // register again if nothing new has come by then.
+    bool fresh = !observing || isNewerNotification(observation, seq);
+    observation.renewTimer.start((maxAge + MAX_AGE_MARGIN) * 1000L);
+    if (!fresh) {
+        TEMBOO_TRACE("DBG: ");
+        TEMBOO_TRACELN("Old notification dropped");
+        return;
+    }
+    
+    observation.notified = observing;
+    observation.lastSeq = seq;
+    observation.lastMillis = millis();
+    if (NULL != observation.callback) {
+        observation.callback(observation.path, httpCode, payload, payloadLen);
+    }
+}
+
+
+TembooCoAPClient::Result TembooCoAPClient::sendChoreoRequest(Request& request) {
+    cancelBlocks(request);
+    request.txByteCount = 0;
+    request.txAckedByteCount = 0;
+    request.rxNextBlockNum = 0;
+    request.rxBlockCount = 0;
+    request.rxLastBlockNum = -1;
+    request.lastResult = NO_ERROR;
+    request.state = STATE_SEND_REQUEST;
     
-    return m_lastError;
+    // If all the blocks are taken by other requests, or all the
+    // exchanges by observations, the first block is sent from
+    // loop() later.
+    if (sendMoreBlocks(request) != NO_ERROR) {
+        cancelBlocks(request);
+        request.lastResult = ERROR_SENDING_MSG;
+        request.state = STATE_ERROR;
+        return ERROR_SENDING_MSG;
+    }
+    return NO_ERROR;
 }
 
 
@@ -585,6 +1019,9 @@ TembooCoAPClient::Result TembooCoAPClient::sendChoreoRequest() {
 
 TembooCoAPChoreo::TembooCoAPChoreo(TembooCoAPClient& client) :
 m_client(client),
+m_request(NULL),
+m_attempt(0),
+m_result(SUCCESS),
 m_accountName(NULL),
 m_appKeyName(NULL),
 m_appKeyValue(NULL),
@@ -597,6 +1034,7 @@ m_nextState(END)
 }
 
 TembooCoAPChoreo::~TembooCoAPChoreo() {
+    m_client.closeRequest(this);
 }
 
 
@@ -729,122 +1167,149 @@ void TembooCoAPChoreo::addOutputFilter(const String& outputName, const String& f
     m_outputs.put(outputName.c_str(), filterPath.c_str(), variableName.c_str());
 }
 
-int TembooCoAPChoreo::waitForResponse(TembooTimer& timer) {
-    
-    int rc = SUCCESS;
-    while (m_client.getState() == TembooCoAPClient::STATE_RESPONSE_STARTED || m_client.getState() == TembooCoAPClient::STATE_WAITING_FOR_RESPONSE) {
-        if (timer.expired()) {
-            TEMBOO_TRACELN("ERROR: Choreo timeout");
-            rc = TEMBOO_ERROR_TIMEOUT;
-            break;
-        }
-        m_client.loop();
-        // While the buffer may be full, we need to receive all of the data
-        // from the gateway even though we discard it. We still return
-        // the buffer error code, but the user is still able to see what
-        // data was able to fit in the current buffer
-        if (m_client.getMessageState() != TembooCoAPClient::NO_ERROR && m_client.getMessageState() != TembooCoAPClient::ERROR_BUFFER_FULL) {
-            rc = FAILURE;
-            break;
-        }
+int TembooCoAPChoreo::run(uint16_t timeoutSecs) {
+    int rc = runAsync(timeoutSecs);
+    while (RUNNING == rc) {
+        rc = poll();
     }
-    
     return rc;
 }
 
-int TembooCoAPChoreo::run(uint16_t timeoutSecs) {
+
+int TembooCoAPChoreo::runAsync(uint16_t timeoutSecs) {
     m_nextChar = NULL;
+    m_request = NULL;
     
     if (IS_EMPTY(m_accountName)) {
-        return TEMBOO_ERROR_ACCOUNT_MISSING;
+        return m_result = TEMBOO_ERROR_ACCOUNT_MISSING;
     }
     
     if (IS_EMPTY(m_path)) {
-        return TEMBOO_ERROR_CHOREO_MISSING;
+        return m_result = TEMBOO_ERROR_CHOREO_MISSING;
     }
     
     if (IS_EMPTY(m_appKeyName)) {
-        return TEMBOO_ERROR_APPKEY_NAME_MISSING;
+        return m_result = TEMBOO_ERROR_APPKEY_NAME_MISSING;
     }
     
     if (IS_EMPTY(m_appKeyValue)) {
-        return TEMBOO_ERROR_APPKEY_MISSING;
+        return m_result = TEMBOO_ERROR_APPKEY_MISSING;
     }
-    int rc = 0;
     
-    TembooTimer timer(timeoutSecs * 1000L);
+    m_timer.start(timeoutSecs * 1000L);
+    m_attempt = 0;
+    return finish(sendRequest());
+}
+
+
+int TembooCoAPChoreo::poll() {
+    if (NULL == m_request) {
+        // Not running.
+        return m_result;
+    }
     
-    for (int i = 0; i < 2; i++) {
-        
-        m_client.resetChoreo();
-        
-        TembooCoAPSession session(m_client);
-        m_requestId = s_nextRequestId++;
-        
-        m_respData = NULL;
-        m_availableChars = 0;
-        m_nextState = START;
-        uint16toa(0 , m_httpCodeStr);
-        
-        m_client.getNextMessageID();
-        TEMBOO_TRACE("DBG: ");
-        TEMBOO_TRACELN("Sending request");
-        rc = session.executeChoreo(m_requestId, m_accountName, m_appKeyName, m_appKeyValue, m_path, m_inputs, m_outputs, m_preset);
-        if (SUCCESS != rc) {
-            goto ErrorExit;
-        }
-        
-        // finish sending Choreo request
-        while (m_client.getState() == TembooCoAPClient::STATE_SEND_REQUEST) {
-            if(m_client.loop() == TembooCoAPClient::ERROR_REQUEST_FAILED) {
-                rc = m_client.getMessageState();
-                TEMBOO_TRACE("ERROR: ");
-                TEMBOO_TRACELN("Choreo request failed");
-                goto ErrorExit;
-            }
-        }
-        
-        // choreo request complete, wait for CON from gateway
-        // and then request the rest of the response
-        
-        rc = waitForResponse(timer);
-        if (SUCCESS != rc){
-            rc = m_client.getMessageState();
-            TEMBOO_TRACE("ERROR: ");
-            TEMBOO_TRACELN("Waiting for response failed");
-            goto ErrorExit;
-        } else {
-            
-            m_respData = (char*)m_client.getPacketBuffer();
-            uint16_t httpCode = m_client.getRespHttpCode();
-            if (httpCode >= 700) {
-                httpCode = 0;
+    m_client.loop();
+    
+    int rc = RUNNING;
+    switch (m_client.getState(*m_request)) {
+        case TembooCoAPClient::STATE_SEND_REQUEST:
+        case TembooCoAPClient::STATE_WAITING_FOR_RESPONSE:
+        case TembooCoAPClient::STATE_RESPONSE_STARTED:
+            // While the buffer may be full, we need to receive all of the data
+            // from the gateway even though we discard it. We still return
+            // the buffer error code, but the user is still able to see what
+            // data was able to fit in the current buffer
+            if (m_timer.expired()) {
+                TEMBOO_TRACELN("ERROR: Choreo timeout");
+                m_client.cancelRequest(*m_request);
+                rc = TEMBOO_ERROR_TIMEOUT;
             }
+            break;
             
-            uint16toa(httpCode, m_httpCodeStr);
-            m_availableChars = strlen(m_respData) + strlen(m_httpCodeStr) + strlen(HTTP_CODE_PREFIX) + strlen(HTTP_CODE_SUFFIX);
-            
-            m_nextChar = HTTP_CODE_PREFIX;
+        case TembooCoAPClient::STATE_RESPONSE_READY:
+            rc = handleResponse();
+            break;
             
-            //Unauthroized, need to update the time
-            if (httpCode == 401 && i == 0) {
-                find(HEADER_TIME);
-                TembooCoAPSession::setTime((unsigned long)this->parseInt());
-            } else {
-                TEMBOO_TRACE("DBG: ");
-                TEMBOO_TRACE(m_availableChars);
-                TEMBOO_TRACELN(" CHARS");
-                TEMBOO_TRACE("DBG: ");
-                TEMBOO_TRACELN("Response buffer data:");
-                TEMBOO_TRACELN(m_respData);
-                
-                rc = m_client.getMessageState();
-                break;
+        default:
+            rc = m_client.getMessageState(*m_request);
+            if (SUCCESS == rc) {
+                rc = FAILURE;
             }
-        }
+            TEMBOO_TRACE("ERROR: ");
+            TEMBOO_TRACELN("Choreo request failed");
+    }
+    
+    return finish(rc);
+}
+
+
+int TembooCoAPChoreo::sendRequest() {
+    m_request = m_client.openRequest(this);
+    if (NULL == m_request) {
+        TEMBOO_TRACE("ERROR: ");
+        TEMBOO_TRACELN("All requests are busy");
+        return TEMBOO_ERROR_MEMORY;
+    }
+    
+    m_client.resetChoreo(*m_request);
+    
+    TembooCoAPSession session(m_client, *m_request);
+    m_requestId = s_nextRequestId++;
+    
+    m_respData = NULL;
+    m_availableChars = 0;
+    m_nextState = START;
+    uint16toa(0 , m_httpCodeStr);
+    
+    TEMBOO_TRACE("DBG: ");
+    TEMBOO_TRACELN("Sending request");
+    int rc = session.executeChoreo(m_requestId, m_accountName, m_appKeyName, m_appKeyValue, m_path, m_inputs, m_outputs, m_preset);
+    if (SUCCESS != rc) {
+        return rc;
+    }
+    return RUNNING;
+}
+
+
+int TembooCoAPChoreo::handleResponse() {
+    m_respData = (char*)m_client.getPacketBuffer(*m_request);
+    uint16_t httpCode = m_client.getRespHttpCode(*m_request);
+    if (httpCode >= 700) {
+        httpCode = 0;
+    }
+    
+    uint16toa(httpCode, m_httpCodeStr);
+    m_availableChars = strlen(m_respData) + strlen(m_httpCodeStr) + strlen(HTTP_CODE_PREFIX) + strlen(HTTP_CODE_SUFFIX);
+    
+    m_nextChar = HTTP_CODE_PREFIX;
+    
+    //Unauthroized, need to update the time
+    if (httpCode == 401 && 0 == m_attempt) {
+        m_attempt++;
+        find(HEADER_TIME);
+        TembooCoAPSession::setTime((unsigned long)this->parseInt());
+        return sendRequest();
     }
     
-ErrorExit:
+    TEMBOO_TRACE("DBG: ");
+    TEMBOO_TRACE(m_availableChars);
+    TEMBOO_TRACELN(" CHARS");
+    TEMBOO_TRACE("DBG: ");
+    TEMBOO_TRACELN("Response buffer data:");
+    TEMBOO_TRACELN(m_respData);
+    
+    return m_client.getMessageState(*m_request);
+}
+
+
+int TembooCoAPChoreo::finish(int rc) {
+    if (RUNNING == rc) {
+        return rc;
+    }
+    // The request (and the response in it) stays ours
+    // until another choreo needs it.
+    m_request = NULL;
+    m_result = rc;
     if (SUCCESS != rc) {
         TEMBOO_TRACE(" ERROR:");
         TEMBOO_TRACELN(rc);
@@ -44,8 +44,42 @@
 #define IS_EMPTY(s) (NULL == s || '\0' == *s)
 #define DEFAULT_CHOREO_TIMEOUT 900
 
+// The largest CoAP block size, see TembooCoAPClient::MAX_BLOCK_SIZE.
+// Each doubling of it costs twice as much RAM in packet buffers.
+#ifndef TEMBOO_COAP_MAX_BLOCK_SIZE
+#if defined(__AVR__)
+#define TEMBOO_COAP_MAX_BLOCK_SIZE 64
+#else
+#define TEMBOO_COAP_MAX_BLOCK_SIZE 1024
+#endif
+#endif
+
+// The number of choreos that can be running at the same time.
+// Each one needs its own request and response buffers.
+#ifndef TEMBOO_COAP_MAX_REQUESTS
+#if defined(__AVR__)
+#define TEMBOO_COAP_MAX_REQUESTS 1
+#else
+#define TEMBOO_COAP_MAX_REQUESTS 2
+#endif
+#endif
+
+// The number of resources that can be observed at the same time.
+#ifndef TEMBOO_COAP_MAX_OBSERVATIONS
+#if defined(__AVR__)
+#define TEMBOO_COAP_MAX_OBSERVATIONS 1
+#else
+#define TEMBOO_COAP_MAX_OBSERVATIONS 2
+#endif
+#endif
+
 class TembooCoAPChoreo;
 
+// Called with each new state of an observed resource.  httpCode is the
+// response code in HTTP form (e.g. 205 for 2.05 Content.)  The payload
+// is not nul-terminated and is only valid during the call.
+typedef void (*TembooCoAPObserveCallback)(const char* path, uint16_t httpCode, const uint8_t* payload, uint16_t len);
+
 class TembooCoAPClient {
     public:
         TembooCoAPClient(TembooCoAPIPStack& ipStack, IPAddress gatewayAddress, uint16_t gatewayPort = DEFAULT_COAP_PORT);
@@ -77,33 +111,83 @@ class TembooCoAPClient {
             STATE_ERROR
         };
         
-        Result write(uint8_t value);
-        Result write(uint8_t* value, uint16_t len);
-        void clearData() {m_dataLen = 0;}
+        static const size_t MAX_DATA_SIZE = 1000;
+        
+        // One choreo request and its response.  Several of them can be
+        // in progress at once, each one sends its blocks with its own
+        // tokens and fails on its own.
+        struct Request {
+            void* owner;                // NULL if the request is free
+            State state;
+            Result lastResult;
+            uint16_t blockSize;
+            
+            uint16_t dataLen;
+            uint8_t dataBuffer[MAX_DATA_SIZE];
+            uint8_t respBuffer[MAX_DATA_SIZE];
+            int32_t respLen;
+            int16_t respHttpCode;
+            
+            uint16_t txByteCount;       // request bytes sent
+            uint16_t txAckedByteCount;  // request bytes the gateway asked to continue after
+            uint32_t rxNextBlockNum;    // next response block to ask for
+            uint32_t rxBlockCount;      // response blocks received
+            int32_t rxLastBlockNum;     // -1 until the size of the response is known
+            uint8_t blocksInFlight;
+        };
+        
+        // Claim a request for owner (a choreo.)  Returns the one owner
+        // already has, a free one, or one whose owner is not waiting
+        // for it anymore.  NULL if all of them are busy.
+        Request* openRequest(void* owner);
+        void closeRequest(void* owner);
+        void cancelRequest(Request& request);
+        
+        // The number of blocks a request may have waiting for the
+        // gateway at once.  1 (the default) sends each block after the
+        // previous one is answered, as all gateways expect.
+        void setMaxBlocksInFlight(uint8_t count);
+        
+        // Observe a resource on the gateway (RFC7641.)  The gateway then
+        // sends the resource's state whenever it changes, and callback
+        // is called from loop() with every state newer than the last one.
+        // path (e.g. "sensors/temp") must stay valid until cancelObserve()
+        // is called.  The registration is renewed when no notification
+        // has come for longer than the last one's Max-Age.  A gateway
+        // that doesn't support Observe answers every renewal once.
+        // Until the gateway answers it, a registration holds one of the
+        // message layer's NSTART exchanges; choreos wait for it to close.
+        Result observe(const char* path, TembooCoAPObserveCallback callback);
+        void cancelObserve(const char* path);
+        
+        Result write(Request& request, uint8_t value);
+        Result write(Request& request, uint8_t* value, uint16_t len);
+        void clearData(Request& request) {request.dataLen = 0;}
         Result loop();
-        Result sendChoreoRequest();
-        uint8_t* getPacketBuffer() {return m_respBuffer;}
-        int32_t getPacketBufferSize() {return m_respLen;}
-        int32_t getPacketLength() {return 1000;}
-        int16_t getRespHttpCode() {return m_respHttpCode;}
-        State getState() {return m_state;}
-        Result sendBlockRequest(uint16_t msgID, uint32_t blockNum);
-        void resetChoreo();
-        int getMessageState() {return m_lastResult;}
-        Result requestTime(uint16_t msgID);
+        Result sendChoreoRequest(Request& request);
+        uint8_t* getPacketBuffer(Request& request) {return request.respBuffer;}
+        int32_t getPacketBufferSize(Request& request) {return request.respLen;}
+        int32_t getPacketLength() {return MAX_DATA_SIZE;}
+        int16_t getRespHttpCode(Request& request) {return request.respHttpCode;}
+        State getState(Request& request) {return request.state;}
+        void resetChoreo(Request& request);
+        int getMessageState(Request& request) {return request.lastResult;}
+        bool isBusy(Request& request);
         
     protected:
         static const char URI_PATH[];
-        Result m_lastResult;
-        bool moreBlocksToSend();
         
         // MAX_BLOCK_SIZE *MUST* be one of the standard CoAP block sizes
-        // This size should be set with consideration to any network or
-        // hardware limitations on UDP packet size.
         // (16, 32, 64, 128, 256, 512, or 1024).
-        static const int MAX_BLOCK_SIZE = 64;
-        
-        // MAX_PACKET_SIZE should be at least big enough to hold:
+        // It is the largest block size we will ever use and sizes the
+        // packet buffers.  The block size actually used is chosen at
+        // runtime: it starts at the largest size the IP stack can carry,
+        // follows the size hints in the gateway's Block1 and Block2
+        // options and is halved when a block can't be delivered.
+        static const int MAX_BLOCK_SIZE = TEMBOO_COAP_MAX_BLOCK_SIZE;
+        static const int MIN_BLOCK_SIZE = 16;
+        
+        // PACKET_OVERHEAD should be at least big enough to hold:
         // for outgoing requests:
         // 4 header bytes
         // 6 token bytes (in our case,  Spec says tokens can be up to 8 bytes).
@@ -116,59 +200,99 @@ class TembooCoAPClient {
         // ? 5 bytes for a size1 or size2 option
         // ? 4 bytes for a sizeX option value
         // 1 byte for the FF payload marker
-        // MAX_BLOCK_SIZE for the payload
         //
-        // or 24 + MAX_BLOCK_SIZE
+        // or 24 bytes
         //
         // HOWEVER... we need to consider the possibility that the server may
         // use more options and thus send more bytes.  So we should add as much
         // extra space as we can reasonably afford so as to avoid buffer overflows.
+        static const size_t PACKET_OVERHEAD = 26;
         
-        static const size_t MAX_PACKET_SIZE = 90;
+        static const size_t MAX_PACKET_SIZE = MAX_BLOCK_SIZE + PACKET_OVERHEAD;
         
+        static const uint16_t DEFAULT_COAP_PORT = 5683;
         
-        static const size_t MAX_DATA_SIZE = 1000;
+        static const uint8_t MAX_REQUESTS = TEMBOO_COAP_MAX_REQUESTS;
+        static const uint8_t MAX_BLOCKS = CoapMessageLayer::NSTART;
+        static const uint8_t MAX_OBSERVATIONS = TEMBOO_COAP_MAX_OBSERVATIONS;
+        static const size_t MAX_OBSERVE_PATH_LENGTH = 48;
+        
+        // RFC7252 5.10.5, the Max-Age of a response without one.
+        static const uint32_t DEFAULT_MAX_AGE = 60;
+        
+        // How long after the Max-Age of the last notification
+        // we wait for the next one before registering again.
+        static const uint32_t MAX_AGE_MARGIN = 5;
+        
+        // A block of a request, or a request for a block of a response,
+        // waiting for the gateway's answer.  The message layer
+        // retransmits it from txBuffer.
+        struct Block {
+            Request* request;           // NULL if the block is free
+            uint32_t blockNum;
+            uint16_t len;               // request bytes carried
+            bool last;                  // the last block of the request
+            bool response;              // asks for a block of the response
+            char token[9];
+            uint8_t txBuffer[MAX_PACKET_SIZE];
+        };
         
-        static const uint16_t DEFAULT_COAP_PORT = 5683;
+        // An observed resource.  The registration is a GET that is
+        // retransmitted from txBuffer until the gateway answers it.
+        struct Observation {
+            const char* path;           // NULL if the observation is free
+            TembooCoAPObserveCallback callback;
+            char token[9];
+            bool notified;              // a notification has been delivered
+            uint32_t lastSeq;
+            uint32_t lastMillis;
+            TembooTimer renewTimer;
+            uint8_t txBuffer[PACKET_OVERHEAD + MAX_OBSERVE_PATH_LENGTH];
+        };
         
         CoapMessageLayer m_messageLayer;
         CoapRRLayer m_rrLayer;
         IPAddress m_gatewayAddress;
         uint16_t m_gatewayPort;
         uint16_t m_messageID;
-        State m_state;
         uint16_t m_blockSize;
-        Result m_lastError;
+        uint16_t m_maxBlockSize;
+        uint8_t m_maxBlocksInFlight;
         
-        uint16_t m_dataLen;
-        uint8_t m_dataBuffer[MAX_DATA_SIZE];
-        uint8_t m_respBuffer[MAX_DATA_SIZE];
-        
-        char m_token[9];
-        uint8_t m_txBuffer[MAX_PACKET_SIZE];
+        Request m_requests[MAX_REQUESTS];
+        Block m_blocks[MAX_BLOCKS];
+        Observation m_observations[MAX_OBSERVATIONS];
         uint8_t m_rxBuffer[MAX_PACKET_SIZE];
-        uint32_t m_rxBlockNum;
-        int32_t m_txIndex;
-        int32_t m_txByteCount;
-        int32_t m_respLen;
-        uint32_t m_txBlockNum;
-        int16_t m_respHttpCode;
-        
-        Result generateToken();
-        uint16_t getNextMessageID();
         
-        Result sendBlock(uint16_t msgID, uint8_t* payload, size_t len, uint32_t blockNum, bool moreBlocks);
-        void adjustRequestBlockSize(CoapMsg& msg);
-        void cancelWait();
+        void generateToken(char* token);
+        uint16_t getNextMessageID();
         
-        int send(CoapMsg* msg);
-        int sendResetMsg(CoapMsg& msg);
-        int sendEmptyAckMsg(CoapMsg& msg);
-        int sendBlock2AckMsg(CoapMsg& msg);
-        bool isMsgResponse(CoapMsg& msg);
-        void handleBlockAck(CoapMsg& msg);
-        void handleBlock1InResponse(CoapMsg& msg);
-        Result saveResponse(uint8_t* values, uint16_t len);
+        Block* allocBlock(Request& request);
+        Block* findBlock(char* token);
+        void freeBlock(Block* block);
+        void cancelBlocks(Request& request);
+        
+        Result buildBlock(Request& request, Block* block, CoapMsg& msg);
+        Result sendBlock(Request& request, Block* block, uint32_t blockNum, bool response);
+        Result sendMoreBlocks(Request& request);
+        void adjustRequestBlockSize(Request& request, CoapMsg& msg);
+        bool shrinkBlockSize(Request& request);
+        void growBlockSize(Request& request);
+        Result restartRequest(Request& request);
+        uint32_t getLastRequestBlockNum(Request& request);
+        static uint8_t getBlockSzx(uint16_t blockSize);
+        
+        void handleResponse(Block* block, CoapMsg& msg);
+        void handleResponseBlock(Request& request, uint32_t expectedBlockNum, CoapMsg& msg);
+        void handleFailure(Block* block, CoapRRLayer::Result rrResult);
+        void failRequest(Request& request, Result result);
+        
+        Observation* findObservation(const char* path);
+        Observation* findObservation(char* token);
+        Result sendObserveRequest(Observation& observation);
+        void handleNotification(Observation& observation, CoapMsg& msg);
+        bool isNewerNotification(Observation& observation, uint32_t seq);
+        Result saveResponse(Request& request, uint32_t offset, uint8_t* values, uint16_t len);
         
         friend class TembooCoAPChoreo;
 };
@@ -238,6 +362,14 @@ class TembooCoAPChoreo : public Stream {
         // run the choreo using the current input info
         int run(uint16_t timeoutSecs = DEFAULT_CHOREO_TIMEOUT);
         
+        // start running the choreo and return without waiting for the
+        // response.  Returns RUNNING if the request is on its way.
+        // Call poll() until it returns something other than RUNNING,
+        // which is what run() would have returned.  Other choreos
+        // sharing the client may run at the same time.
+        int runAsync(uint16_t timeoutSecs = DEFAULT_CHOREO_TIMEOUT);
+        int poll();
+        
         char* getResponseData() {return m_respData;}
         char* getHTTPResponseCode() {return m_httpCodeStr;}
         
@@ -255,6 +387,7 @@ class TembooCoAPChoreo : public Stream {
         enum Error {
             SUCCESS = 0,
             FAILURE,
+            RUNNING,
             TEMBOO_ERROR_ACCOUNT_MISSING       = 201,
             TEMBOO_ERROR_CHOREO_MISSING        = 203,
             TEMBOO_ERROR_APPKEY_NAME_MISSING   = 205,
@@ -272,6 +405,10 @@ class TembooCoAPChoreo : public Stream {
         static const size_t MAX_RESPONSE_SIZE = 900;
         
         TembooCoAPClient& m_client;
+        TembooCoAPClient::Request* m_request;
+        TembooTimer m_timer;
+        uint8_t m_attempt;
+        int m_result;
         const char* m_accountName;
         const char* m_appKeyName;
         const char* m_appKeyValue;
@@ -299,7 +436,9 @@ class TembooCoAPChoreo : public Stream {
         State m_nextState;
         
     protected:
-        int waitForResponse(TembooTimer& timer);
+        int sendRequest();
+        int handleResponse();
+        int finish(int rc);
         uint16_t getRequestId() {return m_requestId;}
 };
 
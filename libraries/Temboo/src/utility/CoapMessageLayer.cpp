@@ -27,10 +27,11 @@ CoapMessageLayer::CoapMessageLayer(uint8_t* rxBuffer, uint16_t rxLen, TembooCoAP
     m_rxLen(rxLen),
     m_ipStack(ipStack),
     m_state(STATE_CLOSED),
-    m_prevState(STATE_CLOSED),
-    m_retransmitCount(0),
     m_lastResult(NO_ERROR),
-    m_msgID(0) {
+    m_lastMsgID(0),
+    m_rxByteCount(0) {
+    
+    cancelAll();
 }
 
 
@@ -46,11 +47,9 @@ CoapMessageLayer::Result CoapMessageLayer::rejectMsg(CoapMsg& msg, IPAddress add
         m_lastResult = ERROR_SENDING_PACKET;
     } else {
         m_lastResult = NO_ERROR;
-        if (STATE_ACK_PENDING == m_state) {
-            // go back to previous state since the
-            // message recv'd wasn't what we're expecting
-            m_state = m_prevState;
-        }
+        // the message recv'd wasn't what we're expecting,
+        // go back to receiving.
+        m_state = STATE_CLOSED;
     }
     return m_lastResult;
 }
@@ -83,29 +82,35 @@ CoapMessageLayer::Result CoapMessageLayer::acceptMsg(CoapMsg& msg, IPAddress add
 
 CoapMessageLayer::Result CoapMessageLayer::reliableSend(CoapMsg& msg, IPAddress destAddr, uint16_t destPort) {
     
-    if (m_state != STATE_CLOSED) {
-        m_lastResult = ERROR_IMPROPER_STATE;
+    Exchange* exchange = NULL;
+    for (uint8_t i = 0; i < NSTART; i++) {
+        if (!m_exchanges[i].open) {
+            exchange = &m_exchanges[i];
+            break;
+        }
+    }
+    if (NULL == exchange) {
+        m_lastResult = ERROR_TOO_MANY_EXCHANGES;
         return m_lastResult;
     }
     
-    m_rxByteCount = 0;
-    m_msgID = msg.getId();
-    m_msgBytes = msg.getMsgBytes();
-    m_msgLen = msg.getMsgLen();
-    m_destAddr = destAddr;
-    m_destPort = destPort;
     msg.setType(CoapMsg::COAP_CONFIRMABLE);
-    m_retransmitCount = 0;
-    m_retransmitTimeoutMillis = random(ACK_TIMEOUT, MAX_ACK_TIMEOUT);
+    exchange->msgID = msg.getId();
+    exchange->msgBytes = msg.getMsgBytes();
+    exchange->msgLen = msg.getMsgLen();
+    exchange->destAddr = destAddr;
+    exchange->destPort = destPort;
+    exchange->retransmitCount = 0;
+    exchange->retransmitTimeoutMillis = random(ACK_TIMEOUT, MAX_ACK_TIMEOUT);
+    m_peerAddr = destAddr;
     TEMBOO_TRACE("DBG: ");
     TEMBOO_TRACELN("Sending message");
-    if (m_ipStack.sendDatagram(m_destAddr, m_destPort, msg.getMsgBytes(), msg.getMsgLen())) {
-        m_state = STATE_CLOSED;
+    if (m_ipStack.sendDatagram(destAddr, destPort, exchange->msgBytes, exchange->msgLen)) {
         m_lastResult = ERROR_SENDING_PACKET;
     } else {
-        m_txSpanTimer.start(MAX_TRANSMIT_WAIT);
-        m_retransmitTimer.start(m_retransmitTimeoutMillis);
-        m_state = STATE_RELIABLE_TX;
+        exchange->txSpanTimer.start(MAX_TRANSMIT_WAIT);
+        exchange->retransmitTimer.start(exchange->retransmitTimeoutMillis);
+        exchange->open = true;
         m_lastResult = NO_ERROR;
     }
     
@@ -113,288 +118,201 @@ CoapMessageLayer::Result CoapMessageLayer::reliableSend(CoapMsg& msg, IPAddress
 }
 
 
-CoapMessageLayer::Result CoapMessageLayer::cancelReliableSend() {
-    if (m_state != STATE_RELIABLE_TX) {
+CoapMessageLayer::Result CoapMessageLayer::cancelReliableSend(uint16_t msgID) {
+    Exchange* exchange = findExchange(msgID);
+    if (NULL == exchange) {
         m_lastResult = ERROR_IMPROPER_STATE;
         return m_lastResult;
     }
     
-    m_state = STATE_CLOSED;
+    exchange->open = false;
     m_lastResult = NO_ERROR;
     return m_lastResult;
 }
 
 
+void CoapMessageLayer::cancelAll() {
+    for (uint8_t i = 0; i < NSTART; i++) {
+        m_exchanges[i].open = false;
+    }
+    m_state = STATE_CLOSED;
+}
+
 
-CoapMessageLayer::Result CoapMessageLayer::loop() {
-    
-    m_lastResult = NO_ERROR;
-    
-    switch(m_state) {
-        case STATE_RELIABLE_TX:
-            // We have sent a CON request.
-            // We're expecting an ACK or a response.
-            
-            // See if it's time to give up all hope of getting an ACK.
-            if (m_txSpanTimer.expired()) {
-                m_lastResult = ERROR_TX_SPAN_TIME_EXCEEDED;
-                m_state = STATE_CLOSED;
+uint8_t CoapMessageLayer::getOpenExchangeCount() {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < NSTART; i++) {
+        if (m_exchanges[i].open) {
+            count++;
+        }
+    }
+    return count;
+}
+
+
+CoapMessageLayer::Exchange* CoapMessageLayer::findExchange(uint16_t msgID) {
+    for (uint8_t i = 0; i < NSTART; i++) {
+        if (m_exchanges[i].open && m_exchanges[i].msgID == msgID) {
+            return &m_exchanges[i];
+        }
+    }
+    return NULL;
+}
+
+
+CoapMessageLayer::Result CoapMessageLayer::checkTimers() {
+    // Report at most one failed exchange per call, the
+    // others will be reported by the following calls.
+    for (uint8_t i = 0; i < NSTART; i++) {
+        Exchange* exchange = &m_exchanges[i];
+        if (!exchange->open) {
+            continue;
+        }
+        
+        // See if it's time to give up all hope of getting an ACK.
+        if (exchange->txSpanTimer.expired()) {
+            TEMBOO_TRACE("ERROR: ");
+            TEMBOO_TRACELN("ACK not received within timeout");
+            exchange->open = false;
+            m_lastMsgID = exchange->msgID;
+            return ERROR_TX_SPAN_TIME_EXCEEDED;
+        }
+        
+        // See if it's time to retransmit.
+        if (exchange->retransmitTimer.expired()) {
+            if (exchange->retransmitCount >= MAX_RETRANSMIT) {
+                // We've retried enough. Give up.
                 TEMBOO_TRACE("ERROR: ");
-                TEMBOO_TRACELN("ACK not received within timeout");
-                break;
+                TEMBOO_TRACELN("Maximum retransmit reached");
+                exchange->open = false;
+                m_lastMsgID = exchange->msgID;
+                return ERROR_RETRANSMIT_COUNT_EXCEEDED;
             }
-            
-            // See if any messages have come in.
-            if (m_ipStack.recvDatagram(m_rxBuffer, m_rxLen, m_rxByteCount)) {
-                m_lastResult = ERROR_RECEIVING_PACKET;
-                m_state = STATE_CLOSED;
-                break;
+            TEMBOO_TRACE("DBG: ");
+            TEMBOO_TRACELN("Retransmit message");
+            exchange->retransmitCount++;
+            exchange->retransmitTimeoutMillis *= 2;
+            if (m_ipStack.sendDatagram(exchange->destAddr, exchange->destPort, exchange->msgBytes, exchange->msgLen)) {
+                exchange->open = false;
+                m_lastMsgID = exchange->msgID;
+                return ERROR_SENDING_PACKET;
             }
-            
-            // We've received something.  See if it's relevant.
-            if (m_rxByteCount > 0) {
-                CoapMsg msg(m_rxBuffer, m_rxLen, m_rxByteCount);
-                
-                // Make sure the message is valid
-                if (!msg.isValid()) {
-                    rejectMsg(msg);
-                    
-                    // We're only interested in messages coming from the host
-                    // we sent the original request to.
-                } else if (m_ipStack.getRemoteAddress() == m_destAddr) {
-                    switch (msg.getType()) {
-                        case CoapMsg::COAP_ACK:
-                            TEMBOO_TRACE("DBG: ");
-                            TEMBOO_TRACELN("ACK Received");
-                            // Is it ACK'ing the last request we sent?
-                            if (msg.getId() == m_msgID) {
-                                m_state = STATE_CLOSED;
-                                m_lastResult = ACK_RECEIVED;
-                            } else {
-                                // if not, just ignore it.
-                                TEMBOO_TRACE("ERROR: ");
-                                TEMBOO_TRACELN("MID did not match");
-                            }
-                            
-                            break;
-                            
-                        case CoapMsg::COAP_RESET:
-                            // Is it rejecting the last request we sent?
-                            TEMBOO_TRACE("DBG: ");
-                            TEMBOO_TRACELN("RST Received");
-                            if (msg.getId() == m_msgID) {
-                                m_state = STATE_CLOSED;
-                                m_lastResult = RESET_RECEIVED;
-                            } else {
-                                // if not, just ignore it.
-                                TEMBOO_TRACE("ERROR: ");
-                                TEMBOO_TRACELN("MID did not match");
-                            }
-                            break;
-                            
-                        case CoapMsg::COAP_CONFIRMABLE:
-                            // It COULD be the response to our request, or
-                            // just some unexpected message.
-                            // We'll let the upper layers decide.
-                            m_prevState = m_state;
-                            m_state = STATE_ACK_PENDING;
-                            m_lastResult = CON_RECEIVED;
-                            TEMBOO_TRACE("DBG: ");
-                            TEMBOO_TRACELN("CON Received");
-                            break;
-                            
-                        case CoapMsg::COAP_NON_CONFIRMABLE:
-                            // It COULD be the response to our request, or
-                            // just some unexpected message.
-                            // We'll let the upper layers decide.
-                            
-                            // That's what Kovatsch et al. show in their FSM.
-                            m_state = STATE_CLOSED;
-                            m_lastResult = NON_RECEIVED;
-                            TEMBOO_TRACE("DBG: ");
-                            TEMBOO_TRACELN("NON Received");
-                            break;
-                    }
-                    if (msg.getPayloadLen() > 0) {
-                        TEMBOO_TRACE("DBG: ");
-                        TEMBOO_TRACELN("Payload data:");
-                        uint8_t *payload = msg.getPayload();
-                        uint16_t len = msg.getPayloadLen();
-                        for (uint16_t i = 0; i < len; i++) {
-                            TEMBOO_TRACE((char)payload[i]);
-                        }
-                        TEMBOO_TRACELN();
-                    }
-                } else if (msg.getType() == CoapMsg::COAP_CONFIRMABLE) {
-                    // It's not from the host we sent the request to, but
-                    // the sending host expects a reply, so explicitly reject it.
-                    rejectMsg(msg);
-                }
-                
+            exchange->retransmitTimer.start(exchange->retransmitTimeoutMillis);
+        }
+    }
+    return NO_ERROR;
+}
+
+
+void CoapMessageLayer::handleMsg(CoapMsg& msg) {
+    
+    switch (msg.getType()) {
+        case CoapMsg::COAP_ACK:
+        case CoapMsg::COAP_RESET: {
+            // Is it ACK'ing or rejecting one of the requests we sent?
+            Exchange* exchange = findExchange(msg.getId());
+            if (NULL == exchange || !(m_ipStack.getRemoteAddress() == exchange->destAddr)) {
+                // if not, just ignore it.
+                TEMBOO_TRACE("ERROR: ");
+                TEMBOO_TRACELN("MID did not match");
                 break;
             }
-            
-            // Nothing was received.  See if it's time to retransmit.
-            if (m_retransmitTimer.expired()) {
-                if (m_retransmitCount >= MAX_RETRANSMIT) {
-                    // We've retried enough. Give up.
-                    TEMBOO_TRACE("ERROR: ");
-                    TEMBOO_TRACELN("Maximum retransmit reached");
-                    m_lastResult = ERROR_RETRANSMIT_COUNT_EXCEEDED;
-                    m_state = STATE_CLOSED;
-                } else {
-                    TEMBOO_TRACE("DBG: ");
-                    TEMBOO_TRACELN("Retransmit message");
-                    m_retransmitCount++;
-                    m_retransmitTimeoutMillis *= 2;
-                    if (m_ipStack.sendDatagram(m_destAddr, m_destPort, m_msgBytes, m_msgLen)) {
-                        m_state = STATE_CLOSED;
-                        m_lastResult = ERROR_SENDING_PACKET;
-                    } else {
-                        m_retransmitTimer.start(m_retransmitTimeoutMillis);
-                        m_state = STATE_RELIABLE_TX;
-                        m_lastResult = NO_ERROR;
-                    }
-                }
+            exchange->open = false;
+            m_lastMsgID = exchange->msgID;
+            if (msg.getType() == CoapMsg::COAP_ACK) {
+                TEMBOO_TRACE("DBG: ");
+                TEMBOO_TRACELN("ACK Received");
+                m_lastResult = ACK_RECEIVED;
+            } else {
+                TEMBOO_TRACE("DBG: ");
+                TEMBOO_TRACELN("RST Received");
+                m_lastResult = RESET_RECEIVED;
             }
             break;
+        }
             
-        case STATE_ACK_PENDING:
-            // Nothing to do here but wait for
-            // the higher layer to accept or reject.
-            break;
-            
-        case STATE_WAITING_FOR_CON:
-            // See if any messages have come in.
-            if (m_ipStack.recvDatagram(m_rxBuffer, m_rxLen, m_rxByteCount)) {
-                m_lastResult = ERROR_RECEIVING_PACKET;
-                m_state = STATE_CLOSED;
-                break;
-            }
-            
-            // We've received something.  See if it's relevant.
-            if (m_rxByteCount > 0) {
-                CoapMsg msg(m_rxBuffer, m_rxLen, m_rxByteCount);
-                
-                // Make sure the message is valid
-                if (!msg.isValid()) {
-                    rejectMsg(msg);
-                    
-                    // We're only interested in messages coming from the host
-                    // we sent the original request to.
-                } else if (m_ipStack.getRemoteAddress() == m_destAddr) {
-                    switch (msg.getType()) {
-                        case CoapMsg::COAP_ACK:
-                            TEMBOO_TRACE("DBG: ");
-                            TEMBOO_TRACELN("ACK Received");
-                            // Is it ACK'ing the last request we sent?
-                            if (msg.getId() == m_msgID) {
-                                m_state = STATE_CLOSED;
-                                m_lastResult = ACK_RECEIVED;
-                            } else {
-                                // if not, just ignore it.
-                                TEMBOO_TRACE("ERROR: ");
-                                TEMBOO_TRACELN("MID did not match");
-                            }
-                            break;
-                            
-                        case CoapMsg::COAP_RESET:
-                            // Is it rejecting the last request we sent?
-                            TEMBOO_TRACE("DBG: ");
-                            TEMBOO_TRACELN("RST Received");
-                            if (msg.getId() == m_msgID) {
-                                m_state = STATE_CLOSED;
-                                m_lastResult = RESET_RECEIVED;
-                            } else {
-                                // if not, just ignore it.
-                                TEMBOO_TRACE("ERROR: ");
-                                TEMBOO_TRACELN("MID did not match");
-                            }
-                            break;
-                            
-                        case CoapMsg::COAP_CONFIRMABLE:
-                            // It COULD be the response to our request, or
-                            // just some unexpected message.
-                            // We'll let the upper layers decide.
-                            m_prevState = m_state;
-                            m_state = STATE_ACK_PENDING;
-                            m_lastResult = CON_RECEIVED;
-                            TEMBOO_TRACE("DBG: ");
-                            TEMBOO_TRACELN("CON Received");
-                            break;
-                            
-                        case CoapMsg::COAP_NON_CONFIRMABLE:
-                            // It COULD be the response to our request, or
-                            // just some unexpected message.
-                            // We'll let the upper layers decide.
-                            
-                            // That's what Kovatsch et al. show in their FSM.
-                            m_state = STATE_CLOSED;
-                            m_lastResult = NON_RECEIVED;
-                            TEMBOO_TRACE("DBG: ");
-                            TEMBOO_TRACELN("NON Received");
-                            break;
-                    }
-                    if (msg.getPayloadLen() > 0) {
-                        TEMBOO_TRACE("DBG: ");
-                        TEMBOO_TRACELN("Payload data:");
-                        uint8_t *payload = msg.getPayload();
-                        uint16_t len = msg.getPayloadLen();
-                        for (uint16_t i = 0; i < len; i++) {
-                            TEMBOO_TRACE((char)payload[i]);
-                        }
-                        TEMBOO_TRACELN();
-                    }
-                } else if (msg.getType() == CoapMsg::COAP_CONFIRMABLE) {
-                    // It's not from the host we sent the request to, but
-                    // the sending host expects a reply, so explicitly reject it.
-                    rejectMsg(msg);
-                }
-                
+        case CoapMsg::COAP_CONFIRMABLE:
+            // We're only interested in messages coming from the host
+            // we send our requests to.
+            if (!(m_ipStack.getRemoteAddress() == m_peerAddr)) {
+                // The sending host expects a reply, so explicitly reject it.
+                rejectMsg(msg);
                 break;
             }
+            // It COULD be the response to one of our requests, or
+            // just some unexpected message.
+            // We'll let the upper layers decide.
+            m_state = STATE_ACK_PENDING;
+            m_lastResult = CON_RECEIVED;
+            TEMBOO_TRACE("DBG: ");
+            TEMBOO_TRACELN("CON Received");
             break;
             
-            
-        case STATE_CLOSED:
-            
-            // We haven't sent anything that we're expecting an answer to.
-            // We haven't received anything that requires an answer.
-            // Just pump the receiver.
-            if (m_ipStack.recvDatagram(m_rxBuffer, m_rxLen, m_rxByteCount)) {
-                m_lastResult = ERROR_RECEIVING_PACKET;
+        case CoapMsg::COAP_NON_CONFIRMABLE:
+            if (!(m_ipStack.getRemoteAddress() == m_peerAddr)) {
                 break;
             }
+            // It COULD be the response to one of our requests, or
+            // just some unexpected message.
+            // We'll let the upper layers decide.
             
-            // If we received something, handle it.
-            if (m_rxByteCount > 0) {
-                CoapMsg msg(m_rxBuffer, m_rxLen, m_rxByteCount);
-                switch (msg.getType()) {
-                    case CoapMsg::COAP_ACK:
-                        // Not expecting any ACKS, ignore it.
-                        break;
-                        
-                    case CoapMsg::COAP_RESET:
-                        // Haven't sent any CONs and we don't send NONs, ignore it.
-                        break;
-                        
-                    case CoapMsg::COAP_CONFIRMABLE:
-                        // Let the higher layers deal with this.
-                        m_prevState = m_state;
-                        m_state = STATE_ACK_PENDING;
-                        m_lastResult = CON_RECEIVED;
-                        break;
-                        
-                    case CoapMsg::COAP_NON_CONFIRMABLE:
-                        // Let the higher layers deal with this.
-                        m_lastResult = NON_RECEIVED;
-                        break;
-                }
-            }
-            
+            // That's what Kovatsch et al. show in their FSM.
+            m_lastResult = NON_RECEIVED;
+            TEMBOO_TRACE("DBG: ");
+            TEMBOO_TRACELN("NON Received");
             break;
-            
     }
+    
+    if (m_lastResult != NO_ERROR && msg.getPayloadLen() > 0) {
+        TEMBOO_TRACE("DBG: ");
+        TEMBOO_TRACELN("Payload data:");
+        uint8_t *payload = msg.getPayload();
+        uint16_t len = msg.getPayloadLen();
+        for (uint16_t i = 0; i < len; i++) {
+            TEMBOO_TRACE((char)payload[i]);
+        }
+        TEMBOO_TRACELN();
+    }
+}
+
+
+CoapMessageLayer::Result CoapMessageLayer::loop() {
+    
+    m_lastResult = NO_ERROR;
+    
+    if (STATE_ACK_PENDING == m_state) {
+        // Nothing to do here but wait for
+        // the higher layer to accept or reject.
+        // (The message is still in the receive buffer.)
+        return m_lastResult;
+    }
+    
+    // Retransmit or give up on the exchanges whose time has come.
+    m_lastResult = checkTimers();
+    if (NO_ERROR != m_lastResult) {
+        return m_lastResult;
+    }
+    
+    // See if any messages have come in.
+    if (m_ipStack.recvDatagram(m_rxBuffer, m_rxLen, m_rxByteCount)) {
+        m_lastResult = ERROR_RECEIVING_PACKET;
+        return m_lastResult;
+    }
+    
+    // We've received something.  See if it's relevant.
+    if (m_rxByteCount > 0) {
+        CoapMsg msg(m_rxBuffer, m_rxLen, m_rxByteCount);
+        
+        // Make sure the message is valid
+        if (!msg.isValid()) {
+            if (msg.getType() == CoapMsg::COAP_CONFIRMABLE) {
+                rejectMsg(msg);
+            }
+        } else {
+            handleMsg(msg);
+        }
+    }
+    
     return m_lastResult;
 }
 
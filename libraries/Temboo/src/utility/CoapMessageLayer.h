@@ -27,6 +27,17 @@
 #include "TembooTimer.h"
 #include "CoapMsg.h"
 
+// The number of confirmable messages that may be waiting for their ACK
+// at the same time (NSTART in RFC7252 4.7.)  Every exchange keeps the
+// message bytes it retransmits, so the sender must keep them too.
+#ifndef TEMBOO_COAP_NSTART
+#if defined(__AVR__)
+#define TEMBOO_COAP_NSTART 1
+#else
+#define TEMBOO_COAP_NSTART 4
+#endif
+#endif
+
 /**
  * CoapMessageLayer is the lowest layer of the CoAP stack.  It is responsible for
  * transmitting and receiving messages.  Specifically, this implementation is
@@ -37,6 +48,10 @@
  * It can send reliable (confirmable or CON) messages and will maintain the necessary
  * state information to wait for an acknowledgement.  It will handle any necessary
  * retransmissions and timeouts until a CON message has been ACK'd (or rejected.)
+ * Up to NSTART CON messages can be outstanding at once.  Each one is an exchange
+ * with its own message ID and its own retransmit and transmit span timers, so a
+ * slow exchange does not hold the others back.  ACKs and RESETs are matched to
+ * their exchange by message ID.
  *
  * It can not send unreliable (non-confirmable or NON) messages as currently designed
  * because our application does not use NON messages.
@@ -56,9 +71,7 @@ class CoapMessageLayer {
         
         enum State {
             STATE_CLOSED,
-            STATE_RELIABLE_TX,
-            STATE_ACK_PENDING,
-            STATE_WAITING_FOR_CON
+            STATE_ACK_PENDING
         };
         
         enum Result {
@@ -72,7 +85,8 @@ class CoapMessageLayer {
             ERROR_SENDING_PACKET,
             ERROR_RECEIVING_PACKET,
             ERROR_RETRANSMIT_COUNT_EXCEEDED,
-            ERROR_TX_SPAN_TIME_EXCEEDED
+            ERROR_TX_SPAN_TIME_EXCEEDED,
+            ERROR_TOO_MANY_EXCHANGES
         };
         
         static const uint32_t ACK_TIMEOUT = 2000;
@@ -88,10 +102,13 @@ class CoapMessageLayer {
         // MAX_TRANSMIT_WAIT = ACK_TIMEOUT * (2^(MAX_RETRANSMIT + 1) - 1) * ACK_RANDOM_FACTOR
         static const uint32_t MAX_TRANSMIT_WAIT = 93000;
         
+        static const uint8_t NSTART = TEMBOO_COAP_NSTART;
+        
         
         CoapMessageLayer(uint8_t* rxBuffer, uint16_t rxLen, TembooCoAPIPStack& ipStack);
         Result reliableSend(CoapMsg& msg, IPAddress destAddr, uint16_t destPort);
-        Result cancelReliableSend();
+        Result cancelReliableSend(uint16_t msgID);
+        void cancelAll();
         Result acceptMsg(CoapMsg& msg);
         Result acceptMsg(CoapMsg& msg, IPAddress addr, uint16_t port);
         Result rejectMsg(CoapMsg& msg);
@@ -99,29 +116,47 @@ class CoapMessageLayer {
         Result loop();
         Result getLastResult() {return m_lastResult;}
         uint16_t getRXByteCount() {return m_rxByteCount;}
-        void setState(State state) {m_state = state;}
+        
+        // The message ID of the exchange the last ACK_RECEIVED, RESET_RECEIVED
+        // or error result of loop() belongs to.
+        uint16_t getLastMsgID() {return m_lastMsgID;}
+        
+        bool isExchangeOpen(uint16_t msgID) {return NULL != findExchange(msgID);}
+        uint8_t getOpenExchangeCount();
         
         
     private:
+        struct Exchange {
+            bool open;
+            uint16_t msgID;
+            uint8_t* msgBytes;
+            uint16_t msgLen;
+            IPAddress destAddr;
+            uint16_t destPort;
+            int retransmitCount;
+            TembooTimer txSpanTimer;
+            TembooTimer retransmitTimer;
+            uint32_t retransmitTimeoutMillis;
+        };
+        
         uint8_t* m_rxBuffer;
         uint16_t m_rxLen;
         TembooCoAPIPStack& m_ipStack;
         
         State m_state;
-        State m_prevState;
-        int m_retransmitCount;
         Result m_lastResult;
-        IPAddress m_destAddr;
-        uint16_t m_destPort;
+        uint16_t m_lastMsgID;
+        
+        // The host we send requests to.  CON and NON messages
+        // from any other host are not passed up.
+        IPAddress m_peerAddr;
         
-        uint16_t m_msgID;
-        uint8_t* m_msgBytes;
-        uint16_t m_msgLen;
+        Exchange m_exchanges[NSTART];
         int32_t m_rxByteCount;
-        TembooTimer m_txSpanTimer;
-        TembooTimer m_retransmitTimer;
-        uint32_t m_retransmitTimeoutMillis;
         
+        Exchange* findExchange(uint16_t msgID);
+        Result checkTimers();
+        void handleMsg(CoapMsg& msg);
     
 };
 
@@ -37,6 +37,7 @@ CoapMsg::CoapMsg(uint8_t* buffer, uint16_t bufferLen) : m_buffer(buffer), m_buff
     m_buffer[0] = COAP_VERSION << 6;
     m_buildState = BUILD_BEGIN;
     m_lastOptionCode = 0;
+    clearIndex();
 }
 
 
@@ -45,6 +46,7 @@ CoapMsg::CoapMsg(uint8_t* buffer, uint16_t bufferLen, uint16_t packetLen) : m_bu
     m_msgLen = packetLen;
     m_buildState = BUILD_HAVE_PAYLOAD;
     m_lastOptionCode = 0;
+    indexOptions();
 }
 
 
@@ -156,6 +158,7 @@ CoapMsg::Result CoapMsg::setPayload(const uint8_t* payload, uint16_t payloadLen)
     
     // Add the special payload marker flag.
     m_buffer[m_msgLen++] = 0xFF;
+    m_payloadOffset = m_msgLen;
     memcpy(m_buffer + m_msgLen, payload, payloadLen);
     m_msgLen += payloadLen;
     m_buildState = BUILD_HAVE_PAYLOAD;
@@ -166,27 +169,10 @@ CoapMsg::Result CoapMsg::setPayload(const uint8_t* payload, uint16_t payloadLen)
 
 
 uint8_t* CoapMsg::getPayload() {
-    if (m_buildState < BUILD_HAVE_PAYLOAD) {
+    if (m_buildState < BUILD_HAVE_PAYLOAD || 0 == m_payloadOffset) {
         return NULL;
     }
-    
-    uint8_t* payload = NULL;
-    uint16_t optionDelta = 0;
-    uint16_t optionLen = 0;
-    uint8_t* i = m_buffer + HEADER_LENGTH + getTokenLen();
-    
-    while (i < m_buffer + m_msgLen) {
-        i = decodeOption(i, &optionDelta, &optionLen);
-        if ((optionDelta == 15) || (optionLen == 15)) {
-            //Technically, if either optionDelta or optionLen is 15, then
-            //both MUST be 15, else it's a malformed message.  However,
-            //we're going to be a little loose with the spec here.
-            payload = i;
-            break;
-        }
-    }
-    
-    return payload;
+    return m_buffer + m_payloadOffset;
 }
 
 
@@ -196,11 +182,10 @@ uint16_t CoapMsg::getPayloadLen() {
         return 0;
     }
     
-    uint8_t* payload = getPayload();
-    if (NULL == payload) {
+    if (0 == m_payloadOffset) {
         return 0;
     }
-    return m_buffer + m_msgLen - payload;
+    return m_msgLen - m_payloadOffset;
 }
 
 
@@ -302,6 +287,7 @@ CoapMsg::Result CoapMsg::addOption(CoapMsg::Option optionCode, const uint8_t* op
     }
     
     m_msgLen += byteCount;
+    addToIndex(optionCode, m_msgLen, optionLen);
     if (optionLen > 0) {
         memcpy(m_buffer + m_msgLen, optionValue, optionLen);
     }
@@ -333,9 +319,9 @@ CoapMsg::Result CoapMsg::validateOption(CoapMsg::Option optionCode, const uint8_
             rc = validateOptionValue(0, 0, optionValue, optionLen);
             break;
             
-            //TODO:			case COAP_OPTION_OBSERVE:
-            //                rc = validateOptionValue(0, 0, optionValue, optionLen);
-            //                break;
+        case COAP_OPTION_OBSERVE:
+            rc = validateOptionValue(0, 3, optionValue, optionLen);
+            break;
             
         case COAP_OPTION_URI_PORT:
             rc = validateOptionValue(0, 2, optionValue, optionLen);
@@ -468,6 +454,15 @@ uint16_t CoapMsg::getOptionCount(CoapMsg::Option optionCode) {
     }
     
     uint16_t count = 0;
+    if (m_optionsIndexed) {
+        for (uint8_t i = 0; i < m_optionCount; i++) {
+            if (m_options[i].code == optionCode) {
+                count++;
+            }
+        }
+        return count;
+    }
+    
     uint16_t lastOption = 0;
     uint16_t optionDelta = 0;
     uint16_t optionLen = 0;
@@ -486,23 +481,10 @@ uint16_t CoapMsg::getOptionCount(CoapMsg::Option optionCode) {
 
 
 uint16_t CoapMsg::getOptionLen(CoapMsg::Option optionCode, uint16_t index) {
-    
-    uint16_t count = 0;
-    uint16_t lastOption = 0;
-    uint16_t optionDelta = 0;
-    uint16_t optionLen = 0;
-    uint8_t* i = m_buffer + HEADER_LENGTH + getTokenLen();
-    
-    while (i < (m_buffer + m_msgLen) && *i != 0xFF) {
-        i = decodeOption(i, &optionDelta, &optionLen);
-        lastOption += optionDelta;
-        if (lastOption == optionCode) {
-            if (count == index) {
-                break;
-            }
-            count++;
-        }
-        optionLen = 0;
+    uint8_t* optionValue;
+    uint16_t optionLen;
+    if (getOption(optionCode, index, optionValue, optionLen) != COAP_RESULT_SUCCESS) {
+        return 0;
     }
     return optionLen;
 }
@@ -510,23 +492,12 @@ uint16_t CoapMsg::getOptionLen(CoapMsg::Option optionCode, uint16_t index) {
 
 
 uint8_t* CoapMsg::getOptionValue(CoapMsg::Option optionCode, uint16_t index) {
-    uint16_t count = 0;
-    uint16_t lastOption = 0;
-    uint16_t optionDelta = 0;
-    uint16_t optionLen = 0;
-    uint8_t* i = m_buffer + HEADER_LENGTH + getTokenLen();
-    
-    while (i < (m_buffer + m_msgLen) && *i != 0xFF) {
-        i = decodeOption(i, &optionDelta, &optionLen);
-        lastOption += optionDelta;
-        if (lastOption == optionCode) {
-            if (count == index) {
-                return i - optionLen;
-            }
-            count++;
-        }
+    uint8_t* optionValue;
+    uint16_t optionLen;
+    if (getOption(optionCode, index, optionValue, optionLen) != COAP_RESULT_SUCCESS) {
+        return NULL;
     }
-    return NULL;
+    return optionValue;
 }
 
 
@@ -534,6 +505,20 @@ uint8_t* CoapMsg::getOptionValue(CoapMsg::Option optionCode, uint16_t index) {
 CoapMsg::Result CoapMsg::getOption(CoapMsg::Option optionCode, uint16_t index, uint8_t*& optionValue, uint16_t& optionLen) {
     
     uint16_t count = 0;
+    if (m_optionsIndexed) {
+        for (uint8_t i = 0; i < m_optionCount; i++) {
+            if (m_options[i].code == optionCode) {
+                if (count == index) {
+                    optionValue = m_buffer + m_options[i].offset;
+                    optionLen = m_options[i].len;
+                    return COAP_RESULT_SUCCESS;
+                }
+                count++;
+            }
+        }
+        return COAP_RESULT_OPTION_NOT_FOUND;
+    }
+    
     uint16_t lastOption = 0;
     uint16_t optionDelta = 0;
     uint16_t optLen = 0;
@@ -555,6 +540,24 @@ CoapMsg::Result CoapMsg::getOption(CoapMsg::Option optionCode, uint16_t index, u
     
 }
 
+
+
+uint32_t CoapMsg::getOptionUint(CoapMsg::Option optionCode, uint16_t index) {
+    // uint options are big-endian with leading zero bytes left out,
+    // so an empty (or missing) option is 0.
+    uint8_t* optionValue;
+    uint16_t optionLen;
+    if (getOption(optionCode, index, optionValue, optionLen) != COAP_RESULT_SUCCESS) {
+        return 0;
+    }
+    uint32_t value = 0;
+    for (; optionLen > 0; optionLen--) {
+        value <<= 8;
+        value += *optionValue++;
+    }
+    return value;
+}
+
 uint16_t CoapMsg::getBlock1Size() {
     return getBlockSize(COAP_OPTION_BLOCK1);
 }
@@ -658,6 +661,7 @@ void CoapMsg::convertToReset() {
     m_buffer[0] &= 0xF0;
     
     m_msgLen = HEADER_LENGTH;
+    clearIndex();
 }
 
 void CoapMsg::convertToEmptyAck() {
@@ -665,6 +669,7 @@ void CoapMsg::convertToEmptyAck() {
     setCode(COAP_EMPTY);
     m_buffer[0] &= 0xF0;
     m_msgLen = HEADER_LENGTH;
+    clearIndex();
 }
 
 bool CoapMsg::isValid() {
@@ -686,29 +691,76 @@ bool CoapMsg::isValid() {
         return false;
     }
     
-    if (HEADER_LENGTH + getTokenLen() == m_msgLen) {
-        // nothing else in the packet
-        return true;
+    if (!m_optionsValid) {
+        TEMBOO_TRACE("Invalid option\n");
+        return false;
+    }
+    
+    return true;
+}
+
+
+
+void CoapMsg::clearIndex() {
+    m_optionCount = 0;
+    m_optionsIndexed = true;
+    m_optionsValid = true;
+    m_payloadOffset = 0;
+}
+
+
+
+/**
+ * Walk the options of a received message once, validating them and
+ * noting where each option value and the payload start.
+ */
+void CoapMsg::indexOptions() {
+    clearIndex();
+    
+    uint16_t start = HEADER_LENGTH + getTokenLen();
+    if (m_msgLen < start) {
+        // the token runs past the end of the packet
+        m_optionsValid = false;
+        return;
     }
     
-    uint16_t count =0;
     uint16_t lastOption = 0;
     uint16_t optionDelta = 0;
     uint16_t optionLen = 0;
-    uint8_t* i = m_buffer + HEADER_LENGTH + getTokenLen();
-    // validate options
-    while (i < (m_buffer + m_msgLen) && *i != 0xFF) {
+    uint8_t* i = m_buffer + start;
+    uint8_t* end = m_buffer + m_msgLen;
+    while (i < end && *i != 0xFF) {
+        if ((*i >> 4) == 15 || (*i & 0x0F) == 15) {
+            // reserved for the payload marker
+            m_optionsValid = false;
+            return;
+        }
         i = decodeOption(i, &optionDelta, &optionLen);
+        if (i > end) {
+            // the option runs past the end of the packet
+            m_optionsValid = false;
+            return;
+        }
         lastOption += optionDelta;
         if (validateOption((Option)lastOption, i - optionLen, optionLen)) {
-            TEMBOO_TRACE("Invalid option\n");
-            return false;
+            m_optionsValid = false;
         }
+        addToIndex(lastOption, i - optionLen - m_buffer, optionLen);
     }
-    // if payload marker exists, make sure there is payload data
-    if (*i == 0xFF && (i - m_buffer) > m_msgLen) {
-        return false;
+    if (i < end) {
+        m_payloadOffset = i + 1 - m_buffer;
     }
-    
-    return true;
+}
+
+
+
+void CoapMsg::addToIndex(uint16_t optionCode, uint16_t offset, uint16_t optionLen) {
+    if (m_optionCount >= TEMBOO_COAP_MAX_INDEXED_OPTIONS) {
+        m_optionsIndexed = false;
+        return;
+    }
+    m_options[m_optionCount].code = optionCode;
+    m_options[m_optionCount].offset = offset;
+    m_options[m_optionCount].len = optionLen;
+    m_optionCount++;
 }
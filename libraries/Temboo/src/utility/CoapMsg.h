@@ -41,6 +41,18 @@
 
 #define RESPONSE_CODE(class, detail) ((class << 5) + detail)
 
+// The number of option occurrences a message indexes so its option and
+// payload getters don't have to walk the option list again.  A message
+// with more options is still handled, the getters then walk the options
+// of that message.  0 always walks.
+#ifndef TEMBOO_COAP_MAX_INDEXED_OPTIONS
+#if defined(__AVR__)
+#define TEMBOO_COAP_MAX_INDEXED_OPTIONS 6
+#else
+#define TEMBOO_COAP_MAX_INDEXED_OPTIONS 8
+#endif
+#endif
+
 class CoapMsg {
     
     public:
@@ -90,7 +102,7 @@ class CoapMsg {
             COAP_OPTION_URI_HOST       = 3,
             COAP_OPTION_ETAG           = 4,
             COAP_OPTION_IF_NONE_MATCH  = 5,
-            //TODO:			COAP_OPTION_OBSERVE        = 6,
+            COAP_OPTION_OBSERVE        = 6,
             COAP_OPTION_URI_PORT       = 7,
             COAP_OPTION_LOCATION_PATH  = 8,
             COAP_OPTION_URI_PATH       = 11,
@@ -144,6 +156,7 @@ class CoapMsg {
         uint16_t getOptionCount(CoapMsg::Option optionCode);
         uint16_t getOptionLen(CoapMsg::Option optionCode, uint16_t index);
         uint8_t* getOptionValue(CoapMsg::Option optionCode, uint16_t index);
+        uint32_t getOptionUint(CoapMsg::Option optionCode, uint16_t index);
         
         CoapMsg::Result setPayload(const uint8_t* payload, uint16_t payloadLen);
         uint8_t* getPayload();
@@ -179,7 +192,24 @@ class CoapMsg {
         CoapMsg::BuildState m_buildState;
         uint16_t m_lastOptionCode;
         
+        // Where each option value and the payload start in m_buffer,
+        // filled in by indexOptions() for received messages and by
+        // addOption() and setPayload() for messages being built.
+        struct OptionIndexEntry {
+            uint16_t code;
+            uint16_t offset;
+            uint16_t len;
+        };
+        OptionIndexEntry m_options[TEMBOO_COAP_MAX_INDEXED_OPTIONS > 0 ? TEMBOO_COAP_MAX_INDEXED_OPTIONS : 1];
+        uint8_t m_optionCount;
+        bool m_optionsIndexed;  // false if there were more options than index entries
+        bool m_optionsValid;
+        uint16_t m_payloadOffset; // 0 if there is no payload marker
+        
     protected:
+        void clearIndex();
+        void indexOptions();
+        void addToIndex(uint16_t optionCode, uint16_t offset, uint16_t optionLen);
         CoapMsg::Result validateOption(CoapMsg::Option optionCode, const uint8_t* optionValue, uint16_t optionLen);
         CoapMsg::Result validateOptionValue(uint16_t minLen, uint16_t maxLen, const uint8_t* optionValue, uint16_t optionLen);
         uint8_t* decodeOption(uint8_t* buffer, uint16_t* optionDelta, uint16_t* optionLen);
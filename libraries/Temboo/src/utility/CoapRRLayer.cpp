@@ -24,40 +24,125 @@
 
 CoapRRLayer::CoapRRLayer(CoapMessageLayer& messageLayer, uint8_t* rxBuffer, uint16_t rxBufferLen) :
     m_messageLayer(messageLayer),
-    m_state(STATE_IDLE),
     m_lastResult(NO_ERROR),
-    m_token(NULL),
+    m_lastToken(NULL),
     m_rxBuffer(rxBuffer),
     m_rxBufferLen(rxBufferLen) {
+    
+    for (uint8_t i = 0; i < MAX_REQUESTS; i++) {
+        m_requests[i].token = NULL;
+    }
 }
 
 
 
-CoapRRLayer::Result CoapRRLayer::reliableSend(CoapMsg& msg, char* token, IPAddress addr, uint16_t port) {
-    if (m_state != STATE_IDLE) {
+CoapRRLayer::Result CoapRRLayer::reliableSend(CoapMsg& msg, char* token, IPAddress addr, uint16_t port, bool observe) {
+    // A request sent again with the same token replaces the earlier one.
+    Request* request = findRequest(token);
+    if (NULL == request) {
+        request = findRequest((char*)NULL);
+    } else if (m_messageLayer.isExchangeOpen(request->msgID)) {
+        m_messageLayer.cancelReliableSend(request->msgID);
+    }
+    if (NULL == request) {
         return ERROR_IMPROPER_STATE;
     }
     
+    // A request that can't be sent again keeps its token, so the
+    // responses already on their way (e.g. the notifications of an
+    // observation being renewed) still find it.  A new one was never
+    // given one.
     if (CoapMessageLayer::NO_ERROR != m_messageLayer.reliableSend(msg, addr, port)) {
         return ERROR_SENDING_MSG;
     }
     
-    m_token = token;
-    m_state = STATE_WAITING;
+    request->token = token;
+    request->msgID = msg.getId();
+    request->observe = observe;
     return NO_ERROR;
 }
 
 
+void CoapRRLayer::cancel(char* token) {
+    Request* request = findRequest(token);
+    if (NULL != request) {
+        if (m_messageLayer.isExchangeOpen(request->msgID)) {
+            m_messageLayer.cancelReliableSend(request->msgID);
+        }
+        request->token = NULL;
+    }
+}
+
 
-bool CoapRRLayer::rxTokenMatches(CoapMsg& msg) {
-    if (msg.getTokenLen() != strlen(m_token)) {
-        return false;
+void CoapRRLayer::cancelAll() {
+    for (uint8_t i = 0; i < MAX_REQUESTS; i++) {
+        m_requests[i].token = NULL;
     }
-    
-    if (0 != memcmp(msg.getToken(), m_token, strlen(m_token))) {
-        return false;
+    m_messageLayer.cancelAll();
+}
+
+
+uint8_t CoapRRLayer::getWaitingCount() {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < MAX_REQUESTS; i++) {
+        if (NULL != m_requests[i].token) {
+            count++;
+        }
+    }
+    return count;
+}
+
+
+CoapRRLayer::Request* CoapRRLayer::findRequest(char* token) {
+    for (uint8_t i = 0; i < MAX_REQUESTS; i++) {
+        if (m_requests[i].token == token) {
+            return &m_requests[i];
+        }
+    }
+    return NULL;
+}
+
+
+CoapRRLayer::Request* CoapRRLayer::findRequest(CoapMsg& msg) {
+    // The response to a request carries the request's token.
+    for (uint8_t i = 0; i < MAX_REQUESTS; i++) {
+        char* token = m_requests[i].token;
+        if (NULL != token && msg.getTokenLen() == strlen(token)
+                && 0 == memcmp(msg.getToken(), token, strlen(token))) {
+            return &m_requests[i];
+        }
+    }
+    return NULL;
+}
+
+
+CoapRRLayer::Request* CoapRRLayer::findRequest(uint16_t msgID) {
+    for (uint8_t i = 0; i < MAX_REQUESTS; i++) {
+        if (NULL != m_requests[i].token && m_requests[i].msgID == msgID) {
+            return &m_requests[i];
+        }
+    }
+    return NULL;
+}
+
+
+void CoapRRLayer::finish(Request* request, Result result) {
+    m_lastToken = request->token;
+    m_lastResult = result;
+    request->token = NULL;
+}
+
+
+void CoapRRLayer::respond(Request* request, CoapMsg& msg) {
+    // An observation stays registered for as long as the
+    // server keeps sending notifications (responses with an
+    // Observe option.)  Any other response ends the request.
+    if (request->observe && msg.getOptionCount(CoapMsg::COAP_OPTION_OBSERVE)) {
+        m_lastToken = request->token;
+        m_lastResult = RESPONSE_RECEIVED;
+    } else {
+        finish(request, RESPONSE_RECEIVED);
     }
-    return true;
 }
 
 
@@ -65,111 +150,106 @@ bool CoapRRLayer::rxTokenMatches(CoapMsg& msg) {
 CoapRRLayer::Result CoapRRLayer::loop() {
     
     m_lastResult = NO_ERROR;
+    m_lastToken = NULL;
     
-    switch (m_state) {
+    switch(m_messageLayer.loop()) {
             
-        case STATE_IDLE:
+        case CoapMessageLayer::NO_ERROR:
+            // Nothing happened. Nothing to do.
+            break;
             
-            // Pump the receiver.
-            // We're not serving anything, so unless there's an outstanding
-            // request (which would mean we would be in STATE_WAITING, not STATE_IDLE),
-            // we're going to reject or ignore any incoming traffic.
-            switch(m_messageLayer.loop()) {
-                case CON_RECEIVED:
-                {
-                    // Explicitly reject any CON messages so the sender will
-                    // quit bugging us with retransmissions.
-                    CoapMsg msg(m_rxBuffer, m_rxBufferLen, m_messageLayer.getRXByteCount());
-                    m_messageLayer.rejectMsg(msg);
-                    break;
-                }
-                default:
-                    // Just ignore anything else.
-                    break;
+        case CoapMessageLayer::ACK_RECEIVED:
+        {
+            // The message layer matched the ACK to one of our CONs.
+            Request* request = findRequest(m_messageLayer.getLastMsgID());
+            if (NULL == request) {
+                // The request has been cancelled.
+                break;
             }
+            CoapMsg msg(m_rxBuffer, m_rxBufferLen, m_messageLayer.getRXByteCount());
             
+            // If it wasn't an empty ack, it's a response.
+            // And if the token matches, then it's the response we're waiting for.
+            if (findRequest(msg) == request) {
+                respond(request, msg);
+            } else if (msg.getTokenLen() == 0) {
+                // An empty ACK, the response will follow in a CON of its own.
+                m_lastToken = request->token;
+                m_lastResult = ACK_RECEIVED;
+            } else {
+                // if ACK is not empty and tokens don't match, an error has occurred
+                finish(request, ERROR_RECEIVING_RESPONSE);
+                TEMBOO_TRACE("Error: ");
+                TEMBOO_TRACELN("Msg token did not match");
+            }
             break;
+        }
             
-        case STATE_WAITING:
-            // We're waiting for a response to an earlier request.
-            switch(m_messageLayer.loop()) {
-                    
-                case CoapMessageLayer::NO_ERROR:
-                    // Nothing happened. Nothing to do.
-                    break;
-                    
-                case CoapMessageLayer::ACK_RECEIVED:
-                {
-                    CoapMsg msg(m_rxBuffer, m_rxBufferLen, m_messageLayer.getRXByteCount());
-                    
-                    // If it wasn't an empty ack, it's a response.
-                    // And if the token matches, then it's the response we're waiting for.
-                    if (rxTokenMatches(msg)) {
-                        m_lastResult = RESPONSE_RECEIVED;
-                        m_state = STATE_IDLE;
-                    } else {
-                        // if ACK is not empty and tokens don't match, an error has occurred
-                        if (msg.getTokenLen() != 0) {
-                            m_lastResult = ERROR_RECEIVING_RESPONSE;
-                            m_state = STATE_IDLE;
-                            TEMBOO_TRACE("Error: ");
-                            TEMBOO_TRACELN("Msg token did not match");
-                        }
-                    }
-                    break;
-                }
-                    
-                case CoapMessageLayer::RESET_RECEIVED:
-                {
-                    // If it was a reset, the message should be empty
-                    // and there will be no token
-                    m_lastResult = RST_RECEIVED;
-                    m_state = STATE_IDLE;
-                    break;
-                }
-                    
-                case CoapMessageLayer::CON_RECEIVED:
-                {
-                    // See if this is our response or just some random message.
-                    // The message layer has already confirmed it's from the right host.
-                    CoapMsg msg(m_rxBuffer, m_rxBufferLen, m_messageLayer.getRXByteCount());
-                    
-                    // We only accept responses for the current request (i.e. the tokens must match)
-                    if (rxTokenMatches(msg)) {
-                        m_lastResult = RESPONSE_RECEIVED;
-                        m_state = STATE_IDLE;
-                    } else {
-                        m_messageLayer.rejectMsg(msg);
-                        TEMBOO_TRACE("Error: ");
-                        TEMBOO_TRACELN("Msg token did not match");
-                    }
-                    break;
-                }
-                    
-                case CoapMessageLayer::NON_RECEIVED:
-                {
-                    CoapMsg msg(m_rxBuffer, m_rxBufferLen, m_messageLayer.getRXByteCount());
-                    if (rxTokenMatches(msg)) {
-                        m_lastResult = RESPONSE_RECEIVED;
-                        m_state = STATE_IDLE;
-                    } else {
-                        // if the token does not match, then an error occurred
-                        m_lastResult = ERROR_RECEIVING_RESPONSE;
-                        m_state = STATE_IDLE;
-                        TEMBOO_TRACE("Error: ");
-                        TEMBOO_TRACELN("Msg token did not match");
-                    }
-                    break;
-                }
-                    
-                default:
-                    // Anything else indicates a failure of some sort.  Check
-                    // the messageLayer lastResult for specifics.
-                    m_lastResult = ERROR_RECEIVING_RESPONSE;
-                    m_state = STATE_IDLE;
-                    
+        case CoapMessageLayer::RESET_RECEIVED:
+        {
+            // If it was a reset, the message should be empty
+            // and there will be no token
+            Request* request = findRequest(m_messageLayer.getLastMsgID());
+            if (NULL != request) {
+                finish(request, RST_RECEIVED);
             }
             break;
+        }
+            
+        case CoapMessageLayer::CON_RECEIVED:
+        {
+            // See if this is one of our responses or just some random message.
+            // The message layer has already confirmed it's from the right host.
+            CoapMsg msg(m_rxBuffer, m_rxBufferLen, m_messageLayer.getRXByteCount());
+            
+            // We only accept responses for outstanding requests (i.e. the tokens must match)
+            Request* request = findRequest(msg);
+            if (NULL != request) {
+                respond(request, msg);
+            } else {
+                // Explicitly reject any other CON messages so the sender will
+                // quit bugging us with retransmissions.
+                m_messageLayer.rejectMsg(msg);
+                TEMBOO_TRACE("Error: ");
+                TEMBOO_TRACELN("Msg token did not match");
+            }
+            break;
+        }
+            
+        case CoapMessageLayer::NON_RECEIVED:
+        {
+            CoapMsg msg(m_rxBuffer, m_rxBufferLen, m_messageLayer.getRXByteCount());
+            Request* request = findRequest(msg);
+            if (NULL != request) {
+                respond(request, msg);
+            } else {
+                // Not for any of our requests, just ignore it.
+                TEMBOO_TRACE("Error: ");
+                TEMBOO_TRACELN("Msg token did not match");
+            }
+            break;
+        }
+            
+        case CoapMessageLayer::ERROR_RETRANSMIT_COUNT_EXCEEDED:
+        case CoapMessageLayer::ERROR_TX_SPAN_TIME_EXCEEDED:
+        case CoapMessageLayer::ERROR_SENDING_PACKET:
+        {
+            // One exchange failed, so did its request.
+            // Check the messageLayer lastResult for specifics.
+            Request* request = findRequest(m_messageLayer.getLastMsgID());
+            if (NULL != request) {
+                finish(request, ERROR_RECEIVING_RESPONSE);
+            }
+            break;
+        }
+            
+        default:
+            // Anything else indicates a failure of some sort that
+            // is not limited to one request.  Check the
+            // messageLayer lastResult for specifics.
+            cancelAll();
+            m_lastResult = ERROR_RECEIVING_RESPONSE;
+            
     }
     
     return m_lastResult;
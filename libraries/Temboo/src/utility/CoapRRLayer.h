@@ -34,6 +34,15 @@
  * This class is intended to implement the CoAP Client Request/Response Layer FSM as described
  * by Kovatsch et al. in https://tools.ietf.org/html/draft-kovatsch-lwig-coap-01
  *
+ * Up to MAX_REQUESTS requests can wait for their responses at the same time.  Each is
+ * identified by its token (and by the message ID of its CON while that is waiting
+ * for its ACK.)  loop() reports which request a response or a failure belongs to
+ * with getLastToken().
+ *
+ * A request sent with observe set registers for notifications (RFC7641.)  It keeps its
+ * token for as long as its responses carry an Observe option, so every notification
+ * is reported as a RESPONSE_RECEIVED for that token until it is cancelled.
+ *
  * Note that this design only implements the client functionality as our application does not
  * serve anything.
  */
@@ -52,31 +61,51 @@ class CoapRRLayer {
             RST_RECEIVED
         };
         
-        enum State {
-            STATE_IDLE,
-            STATE_WAITING
-        };
+        // A request waiting for a separate response, or for the
+        // notifications of an observed resource, no longer has an
+        // exchange open in the message layer, so there can be more
+        // requests than exchanges.
+        static const uint8_t MAX_REQUESTS = CoapMessageLayer::NSTART * 2;
         
         CoapRRLayer(CoapMessageLayer& messageLayer, uint8_t* rxBuffer, uint16_t rxBufferLen);
         
-        Result reliableSend(CoapMsg& msg, char* token, IPAddress addr, uint16_t port);
-        Result send(CoapMsg& msg, char* token, IPAddress addr, uint16_t port);
+        // token must stay valid until the response is received or the request is cancelled.
+        // Sending a request again with its token replaces it.  If that fails, it is still
+        // waiting for responses with the token.
+        Result reliableSend(CoapMsg& msg, char* token, IPAddress addr, uint16_t port, bool observe = false);
         Result loop();
         Result getLastResult() {return m_lastResult;}
-        void setState(State state) {m_state = state;}
         int16_t getRxByteCount() {return m_rxByteCount;}
         
+        // The token of the request the last result of loop() belongs to,
+        // NULL if it concerns all requests (e.g. the IP stack failed.)
+        char* getLastToken() {return m_lastToken;}
+        
+        void cancel(char* token);
+        void cancelAll();
+        bool isWaiting(char* token) {return NULL != findRequest(token);}
+        uint8_t getWaitingCount();
+        
     protected:
+        struct Request {
+            char* token;            // NULL if the slot is free
+            uint16_t msgID;
+            bool observe;
+        };
         
         CoapMessageLayer& m_messageLayer;
-        State m_state;
         Result m_lastResult;
-        char* m_token;
+        char* m_lastToken;
         uint8_t* m_rxBuffer;
         int16_t m_rxByteCount;
         uint16_t m_rxBufferLen;
+        Request m_requests[MAX_REQUESTS];
         
-        bool rxTokenMatches(CoapMsg& msg);
+        Request* findRequest(char* token);
+        Request* findRequest(CoapMsg& msg);
+        Request* findRequest(uint16_t msgID);
+        void finish(Request* request, Result result);
+        void respond(Request* request, CoapMsg& msg);
 };
 
 #endif
@@ -40,7 +40,15 @@ public:
     };
     
     
-    TembooCoAPIPStack(UDP& udp) : m_udp(udp) {}
+    // RFC7252 4.6: without knowledge of the path MTU, CoAP messages
+    // should fit in 1152 bytes (the IPv6 minimum MTU less the headers).
+    static const uint16_t DEFAULT_MAX_DATAGRAM_SIZE = 1152;
+    
+    // maxDatagramSize is the largest UDP payload the hardware and the
+    // network path can carry.  Lower it for UDP stacks with small buffers.
+    TembooCoAPIPStack(UDP& udp, uint16_t maxDatagramSize = DEFAULT_MAX_DATAGRAM_SIZE) :
+        m_udp(udp),
+        m_maxDatagramSize(maxDatagramSize) {}
     
     
     int sendDatagram(IPAddress address, uint16_t port, uint8_t* data, size_t len) {
@@ -92,9 +100,14 @@ public:
         return m_udp.remotePort();
     }
     
+    uint16_t getMaxDatagramSize() {
+        return m_maxDatagramSize;
+    }
+    
     
 protected:
     UDP& m_udp;
+    uint16_t m_maxDatagramSize;
 };
 
 #endif
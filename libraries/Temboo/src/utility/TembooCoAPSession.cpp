@@ -51,7 +51,9 @@ const char SDK_ID[]                  = "?source_id=CoAPGateway_1";
 
 unsigned long TembooCoAPSession::s_timeOffset = 0;
 
-TembooCoAPSession::TembooCoAPSession(TembooCoAPClient& client) : m_client(client) {
+TembooCoAPSession::TembooCoAPSession(TembooCoAPClient& client, TembooCoAPClient::Request& request) :
+    m_client(client),
+    m_request(request) {
 }
 
 
@@ -90,7 +92,7 @@ int TembooCoAPSession::executeChoreo(
     
     getAuth(fmt, appKeyValue, timeStr, auth);
     
-    m_client.clearData();
+    m_client.clearData(m_request);
     
     QSEND(TAG_REQUEST_ID);
     QSEND(requestIdStr);
@@ -130,7 +132,7 @@ int TembooCoAPSession::executeChoreo(
     
     QSEND(TAG_END_REQUEST);
     
-    return m_client.sendChoreoRequest();
+    return m_client.sendChoreoRequest(m_request);
     
 SendFailed:
     TEMBOO_TRACELN("FAIL");
@@ -190,7 +192,7 @@ bool TembooCoAPSession::qsend(const char* s) {
 bool TembooCoAPSession::qsend(char c) {
     // Never send a nul character.
     if ('\0' != c) {
-        if (TembooCoAPClient::NO_ERROR == m_client.write(c)) {
+        if (TembooCoAPClient::NO_ERROR == m_client.write(m_request, c)) {
             return true;
         }
     }
@@ -42,7 +42,8 @@ class TembooCoAPSession {
         
         //TembooSession constructor
         //client: REQUIRED TembooCoAPClient client object.
-        TembooCoAPSession(TembooCoAPClient& client);
+        //request: REQUIRED the client request to send the choreo execution request with.
+        TembooCoAPSession(TembooCoAPClient& client, TembooCoAPClient::Request& request);
         
         //executeChoreo sends a choreo execution request to the Temboo system.
         //              Does not wait for a response (that's a job for whoever owns the Client.)
@@ -88,6 +89,7 @@ class TembooCoAPSession {
         
     private:
         TembooCoAPClient& m_client;
+        TembooCoAPClient::Request& m_request;
         static unsigned long s_timeOffset;
         
         // calculate the authentication code value of the formatted request body
@@ -0,0 +1,171 @@
+/*
+ ###############################################################################
+ #
+ # Temboo CoAP Edge Device library
+ #
+ # Copyright (C) 2015, Temboo Inc.
+ #
+ # Licensed under the Apache License, Version 2.0 (the "License");
+ # you may not use this file except in compliance with the License.
+ # You may obtain a copy of the License at
+ #
+ # http://www.apache.org/licenses/LICENSE-2.0
+ #
+ # Unless required by applicable law or agreed to in writing,
+ # software distributed under the License is distributed on an
+ # "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ # either express or implied. See the License for the specific
+ # language governing permissions and limitations under the License.
+ #
+ ###############################################################################
+ */
+
+/*
+ * Times the handling of received messages the way the CoAP stack handles
+ * them: the message layer, the request/response layer and the client each
+ * wrap the packet in a CoapMsg and call the getters they use for it.
+ * Reports the host CPU time per message for a few typical gateway
+ * messages.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "CoapMsg.h"
+
+#define BENCH_MESSAGES 2000000UL // handled per message kind
+
+static const uint8_t TOKEN[] = {0x3A, 0x91, 0x0C, 0x7E};
+static uint32_t sink = 0;
+
+struct Packet {
+    const char* name;
+    uint8_t bytes[1152];
+    uint16_t len;
+};
+
+static uint16_t addUint(CoapMsg& msg, CoapMsg::Option optionCode, uint32_t value) {
+    uint8_t bytes[4];
+    uint16_t len = 0;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        if (len > 0 || (value >> shift) & 0xFF) {
+            bytes[len++] = (value >> shift) & 0xFF;
+        }
+    }
+    return msg.addOption(optionCode, bytes, len);
+}
+
+static void fillPayload(uint8_t* payload, uint16_t len) {
+    for (uint16_t i = 0; i < len; i++) {
+        payload[i] = 'a' + i % 26;
+    }
+}
+
+// One block of a large choreo response: the last upload block is
+// acknowledged and the response comes back in blocks of 512.
+static void buildBlockResponse(Packet& packet) {
+    uint8_t payload[512];
+    fillPayload(payload, sizeof(payload));
+    CoapMsg msg(packet.bytes, sizeof(packet.bytes));
+    msg.setType(CoapMsg::COAP_ACK);
+    msg.setCode(CoapMsg::COAP_CHANGED);
+    msg.setId(0x1234);
+    msg.setToken(TOKEN, sizeof(TOKEN));
+    addUint(msg, CoapMsg::COAP_OPTION_CONTENT_FORMAT, 0);
+    addUint(msg, CoapMsg::COAP_OPTION_BLOCK2, (3 << 4) | 0x08 | 5);
+    addUint(msg, CoapMsg::COAP_OPTION_BLOCK1, (7 << 4) | 5);
+    addUint(msg, CoapMsg::COAP_OPTION_SIZE2, 4000);
+    msg.setPayload(payload, sizeof(payload));
+    packet.name = "block response";
+    packet.len = msg.getMsgLen();
+}
+
+// A notification for an observed resource.
+static void buildNotification(Packet& packet) {
+    const char* payload = "{\"temperature\":22.1}";
+    CoapMsg msg(packet.bytes, sizeof(packet.bytes));
+    msg.setType(CoapMsg::COAP_NON_CONFIRMABLE);
+    msg.setCode(CoapMsg::COAP_CONTENT);
+    msg.setId(0x1235);
+    msg.setToken(TOKEN, sizeof(TOKEN));
+    addUint(msg, CoapMsg::COAP_OPTION_OBSERVE, 0x012345);
+    addUint(msg, CoapMsg::COAP_OPTION_CONTENT_FORMAT, 50);
+    addUint(msg, CoapMsg::COAP_OPTION_MAX_AGE, 60);
+    msg.setPayload((const uint8_t*)payload, strlen(payload));
+    packet.name = "notification";
+    packet.len = msg.getMsgLen();
+}
+
+// A short choreo response that fits into one message.
+static void buildShortResponse(Packet& packet) {
+    const char* payload = "HTTP_CODE\x0A\x1F" "200";
+    CoapMsg msg(packet.bytes, sizeof(packet.bytes));
+    msg.setType(CoapMsg::COAP_ACK);
+    msg.setCode(CoapMsg::COAP_CONTENT);
+    msg.setId(0x1236);
+    msg.setToken(TOKEN, sizeof(TOKEN));
+    msg.setPayload((const uint8_t*)payload, strlen(payload));
+    packet.name = "short response";
+    packet.len = msg.getMsgLen();
+}
+
+static void handle(const Packet& packet, uint8_t* rxBuffer) {
+    {
+        // CoapMessageLayer
+        CoapMsg msg(rxBuffer, sizeof(packet.bytes), packet.len);
+        if (!msg.isValid()) {
+            return;
+        }
+        sink += msg.getType() + msg.getId();
+        sink += msg.getPayload() != NULL ? msg.getPayloadLen() : 0;
+    }
+    {
+        // CoapRRLayer
+        CoapMsg msg(rxBuffer, sizeof(packet.bytes), packet.len);
+        sink += msg.getTokenLen() + msg.getToken()[0];
+        sink += msg.getOptionCount(CoapMsg::COAP_OPTION_OBSERVE);
+    }
+    {
+        // TembooCoAPClient and its observations
+        CoapMsg msg(rxBuffer, sizeof(packet.bytes), packet.len);
+        if (msg.getOptionCount(CoapMsg::COAP_OPTION_OBSERVE) > 0) {
+            sink += msg.getOptionUint(CoapMsg::COAP_OPTION_OBSERVE, 0);
+            if (msg.getOptionCount(CoapMsg::COAP_OPTION_MAX_AGE) > 0) {
+                sink += msg.getOptionUint(CoapMsg::COAP_OPTION_MAX_AGE, 0);
+            }
+        } else {
+            if (msg.getOptionCount(CoapMsg::COAP_OPTION_BLOCK1) > 0) {
+                sink += msg.getBlock1Num() + msg.getBlock1Size();
+            }
+            if (msg.getOptionCount(CoapMsg::COAP_OPTION_BLOCK2) > 0) {
+                sink += msg.getBlock2Num() + msg.getBlock2More() + msg.getBlock2Size();
+            }
+            if (msg.getOptionCount(CoapMsg::COAP_OPTION_SIZE2) > 0) {
+                sink += msg.getOptionLen(CoapMsg::COAP_OPTION_SIZE2, 0);
+                sink += msg.getOptionValue(CoapMsg::COAP_OPTION_SIZE2, 0)[0];
+            }
+        }
+        sink += msg.getHTTPStatus() + msg.getType();
+        sink += msg.getPayload() != NULL ? msg.getPayloadLen() : 0;
+    }
+}
+
+int main() {
+    static Packet packets[3];
+    buildBlockResponse(packets[0]);
+    buildNotification(packets[1]);
+    buildShortResponse(packets[2]);
+
+#ifdef TEMBOO_COAP_MAX_INDEXED_OPTIONS
+    printf("option index entries: %d\n", TEMBOO_COAP_MAX_INDEXED_OPTIONS);
+#endif
+    for (size_t p = 0; p < sizeof(packets) / sizeof(packets[0]); p++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (unsigned long i = 0; i < BENCH_MESSAGES; i++) {
+            handle(packets[p], packets[p].bytes);
+        }
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        printf("  %-16s %4u bytes  %6.1f ns/message\n", packets[p].name, packets[p].len, elapsed.count() / BENCH_MESSAGES);
+    }
+    return sink == 0;
+}
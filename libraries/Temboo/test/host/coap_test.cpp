@@ -0,0 +1,558 @@
+/*
+ ###############################################################################
+ #
+ # Temboo CoAP Edge Device library
+ #
+ # Copyright (C) 2015, Temboo Inc.
+ #
+ # Licensed under the Apache License, Version 2.0 (the "License");
+ # you may not use this file except in compliance with the License.
+ # You may obtain a copy of the License at
+ #
+ # http://www.apache.org/licenses/LICENSE-2.0
+ #
+ # Unless required by applicable law or agreed to in writing,
+ # software distributed under the License is distributed on an
+ # "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ # either express or implied. See the License for the specific
+ # language governing permissions and limitations under the License.
+ #
+ ###############################################################################
+ */
+
+
+/*
+ * Runs the CoAP client against a gateway played by the tests: every
+ * datagram the client sends is queued for the test, which answers it
+ * (or doesn't) with datagrams it builds itself.  millis() only moves
+ * when a test moves it, so nothing is retransmitted unless a test
+ * waits for it.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "TembooCoAPEdgeDevice.h"
+
+typedef std::vector<uint8_t> Datagram;
+
+static const IPAddress GATEWAY(10, 0, 0, 1);
+static const uint16_t GATEWAY_PORT = 5683;
+
+class GatewayUDP : public UDP {
+    public:
+        std::deque<Datagram> fromClient;
+        std::deque<Datagram> toClient;
+        bool down;                      // fails every send
+        
+        GatewayUDP() : down(false) {}
+        
+        int beginPacket(IPAddress ip, uint16_t port) {m_packet.clear(); return down ? 0 : 1;}
+        int endPacket() {fromClient.push_back(m_packet); return 1;}
+        size_t write(uint8_t c) {m_packet.push_back(c); return 1;}
+        size_t write(const uint8_t* buffer, size_t size) {m_packet.insert(m_packet.end(), buffer, buffer + size); return size;}
+        int parsePacket() {
+            if (toClient.empty()) {
+                return 0;
+            }
+            m_packet = toClient.front();
+            toClient.pop_front();
+            return m_packet.size();
+        }
+        int read(unsigned char* buffer, size_t len) {
+            len = len < m_packet.size() ? len : m_packet.size();
+            memcpy(buffer, m_packet.data(), len);
+            return len;
+        }
+        int read() {return -1;}
+        int available() {return 0;}
+        int peek() {return -1;}
+        IPAddress remoteIP() {return GATEWAY;}
+        uint16_t remotePort() {return GATEWAY_PORT;}
+        
+    private:
+        Datagram m_packet;
+};
+
+// Opens the parts of the client the tests look into.
+class TestClient : public TembooCoAPClient {
+    public:
+        TestClient(TembooCoAPIPStack& ipStack) : TembooCoAPClient(ipStack, GATEWAY, GATEWAY_PORT) {}
+        using TembooCoAPClient::MAX_BLOCKS;
+        using TembooCoAPClient::m_messageLayer;
+};
+
+// A datagram from the client, readable as a CoAP message.
+class Sent {
+    public:
+        Sent(const Datagram& datagram) : m_bytes(datagram), m_msg(&m_bytes[0], m_bytes.size(), m_bytes.size()) {}
+        Sent(const Sent& other) : m_bytes(other.m_bytes), m_msg(&m_bytes[0], m_bytes.size(), m_bytes.size()) {}
+        CoapMsg& msg() {return m_msg;}
+    private:
+        Datagram m_bytes;
+        CoapMsg m_msg;
+};
+
+// A message from the gateway.  Options have to be added in the
+// order of their numbers: observe, block2, block1, size2.
+class Reply {
+    public:
+        // A response piggybacked on the ACK of request.
+        Reply(Sent& request, CoapMsg::Code code) : m_msg(m_bytes, sizeof(m_bytes)) {
+            m_msg.setType(CoapMsg::COAP_ACK);
+            m_msg.setCode(code);
+            m_msg.setId(request.msg().getId());
+            m_msg.setToken(request.msg().getToken(), request.msg().getTokenLen());
+        }
+        
+        // A message of its own carrying token.
+        Reply(CoapMsg::Type type, CoapMsg::Code code, uint16_t id, const uint8_t* token, uint8_t tokenLen) : m_msg(m_bytes, sizeof(m_bytes)) {
+            m_msg.setType(type);
+            m_msg.setCode(code);
+            m_msg.setId(id);
+            m_msg.setToken(token, tokenLen);
+        }
+        
+        Reply& observe(uint32_t seq) {
+            uint8_t value[3] = {(uint8_t)(seq >> 16), (uint8_t)(seq >> 8), (uint8_t)seq};
+            m_msg.addOption(CoapMsg::COAP_OPTION_OBSERVE, value, sizeof(value));
+            return *this;
+        }
+        
+        Reply& block2(uint32_t num, bool more, uint16_t size) {return block(CoapMsg::COAP_OPTION_BLOCK2, num, more, size);}
+        Reply& block1(uint32_t num, bool more, uint16_t size) {return block(CoapMsg::COAP_OPTION_BLOCK1, num, more, size);}
+        
+        Reply& size2(uint16_t size) {
+            uint8_t value[2] = {(uint8_t)(size >> 8), (uint8_t)size};
+            m_msg.addOption(CoapMsg::COAP_OPTION_SIZE2, value, sizeof(value));
+            return *this;
+        }
+        
+        Reply& payload(const char* payload, uint16_t len) {
+            m_msg.setPayload((const uint8_t*)payload, len);
+            return *this;
+        }
+        
+        Datagram bytes() {return Datagram(m_msg.getMsgBytes(), m_msg.getMsgBytes() + m_msg.getMsgLen());}
+        
+    private:
+        uint8_t m_bytes[1152];
+        CoapMsg m_msg;
+        
+        Reply(const Reply&);
+        
+        Reply& block(CoapMsg::Option option, uint32_t num, bool more, uint16_t size) {
+            uint8_t szx = 0;
+            while ((16 << szx) < size) {
+                szx++;
+            }
+            uint8_t value[2] = {(uint8_t)(num >> 4), (uint8_t)((num & 0x0F) << 4 | (more ? 0x08 : 0) | szx)};
+            if (num < 16) {
+                m_msg.addOption(option, &value[1], 1);
+            } else {
+                m_msg.addOption(option, value, 2);
+            }
+            return *this;
+        }
+};
+
+static int s_failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            s_failures++; \
+        } \
+    } while (0)
+
+// The gateway and a client talking to it, new for every test.
+struct Fixture {
+    GatewayUDP udp;
+    TembooCoAPIPStack stack;
+    TestClient client;
+    
+    Fixture() : stack(udp), client(stack) {
+        setMillis(1000);
+        client.begin(1);
+    }
+    
+    // Opens a request and sends len bytes of data with it.
+    TembooCoAPClient::Request& send(void* owner, uint16_t len) {
+        TembooCoAPClient::Request& request = *client.openRequest(owner);
+        client.resetChoreo(request);
+        for (uint16_t i = 0; i < len; i++) {
+            client.write(request, 'a' + i % 26);
+        }
+        client.sendChoreoRequest(request);
+        return request;
+    }
+    
+    // Lets the client handle everything the gateway has sent.
+    void deliver() {
+        while (!udp.toClient.empty()) {
+            client.loop();
+        }
+    }
+    
+    void answer(const Datagram& reply) {
+        udp.toClient.push_back(reply);
+        deliver();
+    }
+    
+    Sent next() {
+        CHECK(!udp.fromClient.empty());
+        if (udp.fromClient.empty()) {
+            return Sent(Datagram(4, 0));
+        }
+        Datagram datagram = udp.fromClient.front();
+        udp.fromClient.pop_front();
+        return Sent(datagram);
+    }
+};
+
+static const char RESPONSE[] =
+    "HTTP_CODE\x0A\x1F" "200\x0A\x1E" "Response\x0A\x1F"
+    "The quick brown fox jumps over the lazy dog, again and again, "
+    "until the response is long enough to need a handful of blocks "
+    "of 64 bytes each, which is the size the gateway sends it in here.";
+static const uint16_t RESPONSE_BLOCK = 64;
+static const uint32_t RESPONSE_BLOCKS = (sizeof(RESPONSE) - 1 + RESPONSE_BLOCK - 1) / RESPONSE_BLOCK;
+
+// Answers a request for a block of RESPONSE.
+static Datagram responseBlock(Sent& request, bool withSize) {
+    uint32_t num = request.msg().getBlock2Num();
+    uint16_t offset = num * RESPONSE_BLOCK;
+    uint16_t len = sizeof(RESPONSE) - 1 - offset < RESPONSE_BLOCK ? sizeof(RESPONSE) - 1 - offset : RESPONSE_BLOCK;
+    Reply reply(request, CoapMsg::COAP_CONTENT);
+    reply.block2(num, num + 1 < RESPONSE_BLOCKS, RESPONSE_BLOCK);
+    if (withSize) {
+        reply.size2(sizeof(RESPONSE) - 1);
+    }
+    return reply.payload(&RESPONSE[offset], len).bytes();
+}
+
+static std::vector<std::string> s_notifications;
+
+static void notified(const char* path, uint16_t httpCode, const uint8_t* payload, uint16_t len) {
+    s_notifications.push_back(std::string((const char*)payload, len));
+}
+
+// Registers an observation the gateway accepts with sequence number seq.
+static Sent observe(Fixture& f, uint32_t seq) {
+    s_notifications.clear();
+    f.client.observe("sensors/temp", notified);
+    Sent registration = f.next();
+    Reply registered(registration, CoapMsg::COAP_CONTENT);
+    f.answer(registered.observe(seq).payload("20", 2).bytes());
+    return registration;
+}
+
+// Sends a notification for the observation registered with registration,
+// returns the type of the client's answer.
+static CoapMsg::Type notify(Fixture& f, Sent& registration, uint32_t seq, const char* payload) {
+    static uint16_t id = 0x6000;
+    Reply notification(CoapMsg::COAP_CONFIRMABLE, CoapMsg::COAP_CONTENT, id++,
+                       registration.msg().getToken(), registration.msg().getTokenLen());
+    f.answer(notification.observe(seq).payload(payload, strlen(payload)).bytes());
+    return f.next().msg().getType();
+}
+
+static bool hasResponse(TembooCoAPClient& client, TembooCoAPClient::Request& request, const char* expected) {
+    return TembooCoAPClient::STATE_RESPONSE_READY == client.getState(request)
+        && client.getPacketBufferSize(request) == (int32_t)strlen(expected)
+        && 0 == memcmp(client.getPacketBuffer(request), expected, strlen(expected));
+}
+
+
+// Every request has its own token, so separate responses find their
+// request in any order, and a response with another token is refused.
+static void separateResponsesAreMatchedByToken() {
+    // With a single block, as with NSTART 1, the second request
+    // waits until the first one has its response.
+    if (TestClient::MAX_BLOCKS < 2) {
+        return;
+    }
+    Fixture f;
+    int one, two;
+    
+    // Empty ACKs, the responses follow later.
+    TembooCoAPClient::Request& first = f.send(&one, 10);
+    Sent firstSent = f.next();
+    Reply firstAck(CoapMsg::COAP_ACK, CoapMsg::COAP_EMPTY, firstSent.msg().getId(), NULL, 0);
+    f.answer(firstAck.bytes());
+    TembooCoAPClient::Request& second = f.send(&two, 10);
+    Sent secondSent = f.next();
+    Reply secondAck(CoapMsg::COAP_ACK, CoapMsg::COAP_EMPTY, secondSent.msg().getId(), NULL, 0);
+    f.answer(secondAck.bytes());
+    CHECK(firstSent.msg().getTokenLen() > 0);
+    CHECK(firstSent.msg().getTokenLen() != secondSent.msg().getTokenLen()
+          || 0 != memcmp(firstSent.msg().getToken(), secondSent.msg().getToken(), firstSent.msg().getTokenLen()));
+    CHECK(TembooCoAPClient::STATE_WAITING_FOR_RESPONSE == f.client.getState(first));
+    CHECK(TembooCoAPClient::STATE_WAITING_FOR_RESPONSE == f.client.getState(second));
+    
+    const uint8_t stranger[] = {'n', 'o', 'b', 'o', 'd', 'y'};
+    Reply unknown(CoapMsg::COAP_CONFIRMABLE, CoapMsg::COAP_CONTENT, 0x7000, stranger, sizeof(stranger));
+    unknown.payload("lost", 4);
+    f.answer(unknown.bytes());
+    CHECK(1 == f.udp.fromClient.size() && CoapMsg::COAP_RESET == f.next().msg().getType());
+    CHECK(TembooCoAPClient::STATE_WAITING_FOR_RESPONSE == f.client.getState(first));
+    
+    Reply secondResponse(CoapMsg::COAP_CONFIRMABLE, CoapMsg::COAP_CONTENT, 0x7001,
+                         secondSent.msg().getToken(), secondSent.msg().getTokenLen());
+    secondResponse.payload("second", 6);
+    f.answer(secondResponse.bytes());
+    CHECK(1 == f.udp.fromClient.size() && CoapMsg::COAP_ACK == f.next().msg().getType());
+    CHECK(hasResponse(f.client, second, "second"));
+    CHECK(TembooCoAPClient::STATE_WAITING_FOR_RESPONSE == f.client.getState(first));
+    
+    Reply firstResponse(CoapMsg::COAP_CONFIRMABLE, CoapMsg::COAP_CONTENT, 0x7002,
+                        firstSent.msg().getToken(), firstSent.msg().getTokenLen());
+    firstResponse.payload("first", 5);
+    f.answer(firstResponse.bytes());
+    CHECK(hasResponse(f.client, first, "first"));
+}
+
+// A piggybacked response must carry the token of the request it acknowledges.
+static void piggybackedResponseWithAnotherTokenFailsTheRequest() {
+    Fixture f;
+    int owner;
+    TembooCoAPClient::Request& request = f.send(&owner, 10);
+    Sent sent = f.next();
+    const uint8_t stranger[] = {'n', 'o', 'b', 'o', 'd', 'y'};
+    Reply reply(CoapMsg::COAP_ACK, CoapMsg::COAP_CONTENT, sent.msg().getId(), stranger, sizeof(stranger));
+    reply.payload("lost", 4);
+    f.answer(reply.bytes());
+    CHECK(TembooCoAPClient::STATE_RESPONSE_READY != f.client.getState(request));
+    CHECK(!f.client.isBusy(request));
+}
+
+// The message layer keeps at most NSTART exchanges open (RFC7252 4.7.)
+static void messageLayerOpensAtMostNstartExchanges() {
+    GatewayUDP udp;
+    TembooCoAPIPStack stack(udp);
+    uint8_t rxBuffer[128];
+    CoapMessageLayer layer(rxBuffer, sizeof(rxBuffer), stack);
+    setMillis(1000);
+    
+    static uint8_t txBuffers[CoapMessageLayer::NSTART + 1][16];
+    for (uint16_t i = 0; i <= CoapMessageLayer::NSTART; i++) {
+        CoapMsg msg(txBuffers[i], sizeof(txBuffers[i]));
+        msg.setCode(CoapMsg::COAP_GET);
+        msg.setId(100 + i);
+        CoapMessageLayer::Result expected = i < CoapMessageLayer::NSTART
+            ? CoapMessageLayer::NO_ERROR : CoapMessageLayer::ERROR_TOO_MANY_EXCHANGES;
+        CHECK(expected == layer.reliableSend(msg, GATEWAY, GATEWAY_PORT));
+    }
+    CHECK(CoapMessageLayer::NSTART == udp.fromClient.size());
+    CHECK(CoapMessageLayer::NSTART == layer.getOpenExchangeCount());
+    
+    // An ACK closes its exchange and makes room for another one.
+    Reply ack(CoapMsg::COAP_ACK, CoapMsg::COAP_EMPTY, 100, NULL, 0);
+    udp.toClient.push_back(ack.bytes());
+    CHECK(CoapMessageLayer::ACK_RECEIVED == layer.loop());
+    CHECK(CoapMessageLayer::NSTART - 1 == layer.getOpenExchangeCount());
+    CoapMsg msg(txBuffers[CoapMessageLayer::NSTART], sizeof(txBuffers[0]));
+    msg.setCode(CoapMsg::COAP_GET);
+    msg.setId(100 + CoapMessageLayer::NSTART);
+    CHECK(CoapMessageLayer::NO_ERROR == layer.reliableSend(msg, GATEWAY, GATEWAY_PORT));
+}
+
+// The block window asks for that many response blocks at once, never
+// for more than the message layer has exchanges, and the response is
+// put together from blocks answered in any order.
+static void blocksAnsweredOutOfOrderMakeTheResponse() {
+    Fixture f;
+    f.client.setMaxBlocksInFlight(255);
+    int owner;
+    TembooCoAPClient::Request& request = f.send(&owner, 10);
+    
+    // The first block of the response tells its size.
+    Sent sent = f.next();
+    f.answer(responseBlock(sent, true));
+    uint32_t expected = RESPONSE_BLOCKS - 1 < TestClient::MAX_BLOCKS ? RESPONSE_BLOCKS - 1 : TestClient::MAX_BLOCKS;
+    CHECK(expected == f.udp.fromClient.size());
+    CHECK(f.client.m_messageLayer.getOpenExchangeCount() <= CoapMessageLayer::NSTART);
+    
+    // Answer the newest request first, every answer makes room for another one.
+    while (!f.udp.fromClient.empty()) {
+        Sent blockRequest(f.udp.fromClient.back());
+        f.udp.fromClient.pop_back();
+        f.answer(responseBlock(blockRequest, false));
+        CHECK(f.udp.fromClient.size() <= TestClient::MAX_BLOCKS);
+    }
+    CHECK(hasResponse(f.client, request, RESPONSE));
+}
+
+// The blocks are asked for one at a time with a window of one, or
+// while the size of the response is unknown.
+static void blockWindowLimitsBlocksInFlight() {
+    struct {
+        uint8_t window;
+        bool withSize;
+        uint8_t inFlight;
+    } cases[] = {{1, true, 1}, {3, false, 1}, {3, true, 3 < TestClient::MAX_BLOCKS ? 3 : TestClient::MAX_BLOCKS}};
+    
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        Fixture f;
+        f.client.setMaxBlocksInFlight(cases[i].window);
+        int owner;
+        TembooCoAPClient::Request& request = f.send(&owner, 10);
+        Sent sent = f.next();
+        f.answer(responseBlock(sent, cases[i].withSize));
+        CHECK(cases[i].inFlight == f.udp.fromClient.size());
+        while (!f.udp.fromClient.empty()) {
+            CHECK(f.udp.fromClient.size() <= cases[i].inFlight);
+            Sent blockRequest = f.next();
+            f.answer(responseBlock(blockRequest, false));
+        }
+        CHECK(hasResponse(f.client, request, RESPONSE));
+    }
+}
+
+// A block size the gateway asked for is kept for the following requests,
+// but each one that completes lets the next one try twice that.
+static void blockSizeGrowsBackAfterCompleteRequests() {
+    Fixture f;
+    int owner;
+    TembooCoAPClient::Request& request = f.send(&owner, 100);
+    Sent sent = f.next();
+    uint16_t largest = sent.msg().getBlock2Size();
+    
+    Reply tooLarge(sent, CoapMsg::COAP_REQUEST_ENTITY_TOO_LARGE);
+    tooLarge.block1(0, false, largest / 4);
+    f.answer(tooLarge.bytes());
+    Sent retry = f.next();
+    CHECK(largest / 4 == retry.msg().getBlock2Size());
+    Reply done(retry, CoapMsg::COAP_CONTENT);
+    done.payload("ok", 2);
+    f.answer(done.bytes());
+    CHECK(hasResponse(f.client, request, "ok"));
+    
+    for (uint16_t size = largest / 2; size <= largest; size *= 2) {
+        f.send(&owner, 100);
+        Sent next = f.next();
+        CHECK(size == next.msg().getBlock2Size());
+        Reply reply(next, CoapMsg::COAP_CONTENT);
+        reply.payload("ok", 2);
+        f.answer(reply.bytes());
+    }
+    f.send(&owner, 100);
+    CHECK(largest == f.next().msg().getBlock2Size());
+}
+
+// An observation waiting for the answer to its registration doesn't make
+// a choreo fail, even when it holds the only exchange (NSTART 1 on AVR.)
+// A renewal that can't be sent while the choreo holds it is sent later.
+static void observationDoesNotStarveChoreos() {
+    Fixture f;
+    CHECK(TembooCoAPClient::NO_ERROR == f.client.observe("sensors/temp", NULL));
+    Sent registration = f.next();
+    int owner;
+    TembooCoAPClient::Request& request = f.send(&owner, 10);
+    CHECK(f.client.isBusy(request));
+    f.client.loop();
+    CHECK(f.client.isBusy(request));
+    
+    Reply registered(registration, CoapMsg::COAP_CONTENT);
+    f.answer(registered.observe(1).payload("21", 2).bytes());
+    f.client.loop();
+    CHECK(1 == f.udp.fromClient.size());
+    Sent sent = f.next();
+    CHECK(sent.msg().getCode() == CoapMsg::COAP_POST);
+    
+    // The renewal falls due while the choreo's block holds the exchange.
+    setMillis(millis() + 70000UL);
+    f.client.loop();
+    if (CoapMessageLayer::NSTART == 1) {
+        // Only the block's retransmission goes out.
+        for (size_t i = 0; i < f.udp.fromClient.size(); i++) {
+            CHECK(Sent(f.udp.fromClient[i]).msg().getCode() == CoapMsg::COAP_POST);
+        }
+    }
+    Reply response(sent, CoapMsg::COAP_CONTENT);
+    f.answer(response.payload("ok", 2).bytes());
+    CHECK(hasResponse(f.client, request, "ok"));
+    
+    setMillis(millis() + CoapMessageLayer::ACK_TIMEOUT);
+    f.client.loop();
+    CHECK(!f.udp.fromClient.empty());
+    Sent renewal(f.udp.fromClient.back());
+    CHECK(renewal.msg().getCode() == CoapMsg::COAP_GET);
+    CHECK(renewal.msg().getTokenLen() == registration.msg().getTokenLen()
+          && 0 == memcmp(renewal.msg().getToken(), registration.msg().getToken(), renewal.msg().getTokenLen()));
+}
+
+// RFC7641 3.4: sequence numbers are 24 bits and wrap around, and after
+// 128 seconds any notification is newer than the last one.
+static void notificationsAreOrderedBySequenceNumber() {
+    Fixture f;
+    Sent registration = observe(f, 0xFFFFFE);
+    
+    CHECK(CoapMsg::COAP_ACK == notify(f, registration, 0x000001, "21"));
+    CHECK(CoapMsg::COAP_ACK == notify(f, registration, 0xFFFFFF, "old"));
+    CHECK(CoapMsg::COAP_ACK == notify(f, registration, 0x000002, "22"));
+    CHECK(CoapMsg::COAP_ACK == notify(f, registration, 0x000002, "again"));
+    CHECK(CoapMsg::COAP_ACK == notify(f, registration, 0x800002, "half way"));
+    
+    setMillis(millis() + 128001UL);
+    CHECK(CoapMsg::COAP_ACK == notify(f, registration, 0x000001, "23"));
+    
+    const char* expected[] = {"20", "21", "22", "23"};
+    CHECK(4 == s_notifications.size());
+    for (size_t i = 0; i < 4 && i < s_notifications.size(); i++) {
+        CHECK(s_notifications[i] == expected[i]);
+    }
+}
+
+// A renewal that can't be sent doesn't end the observation: the
+// notifications the gateway keeps sending are still taken.
+static void failedRenewalKeepsTheObservation() {
+    Fixture f;
+    Sent registration = observe(f, 1);
+    
+    f.udp.down = true;
+    setMillis(millis() + 70000UL);
+    f.client.loop();
+    f.udp.down = false;
+    CHECK(f.udp.fromClient.empty());
+    
+    CHECK(CoapMsg::COAP_ACK == notify(f, registration, 2, "21"));
+    CHECK(2 == s_notifications.size() && "21" == s_notifications.back());
+}
+
+
+struct Test {
+    const char* name;
+    void (*run)();
+};
+
+#define TEST(name) {#name, name}
+
+static const Test TESTS[] = {
+    TEST(separateResponsesAreMatchedByToken),
+    TEST(piggybackedResponseWithAnotherTokenFailsTheRequest),
+    TEST(messageLayerOpensAtMostNstartExchanges),
+    TEST(blocksAnsweredOutOfOrderMakeTheResponse),
+    TEST(blockWindowLimitsBlocksInFlight),
+    TEST(blockSizeGrowsBackAfterCompleteRequests),
+    TEST(observationDoesNotStarveChoreos),
+    TEST(notificationsAreOrderedBySequenceNumber),
+    TEST(failedRenewalKeepsTheObservation),
+};
+
+int main() {
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(TESTS) / sizeof(TESTS[0]); i++) {
+        int failures = s_failures;
+        TESTS[i].run();
+        bool passed = failures == s_failures;
+        printf("Test %s %s.\n", TESTS[i].name, passed ? "passed" : "failed");
+        failed += passed ? 0 : 1;
+    }
+    printf("Test summary: %d passed, %d failed, and 0 skipped, out of %d test(s).\n",
+           (int)(sizeof(TESTS) / sizeof(TESTS[0])) - failed, failed, (int)(sizeof(TESTS) / sizeof(TESTS[0])));
+    return failed > 0 ? 1 : 0;
+}
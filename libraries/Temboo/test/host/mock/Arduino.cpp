@@ -0,0 +1,43 @@
+/*
+ ###############################################################################
+ #
+ # Temboo CoAP Edge Device library
+ #
+ # Copyright (C) 2015, Temboo Inc.
+ #
+ # Licensed under the Apache License, Version 2.0 (the "License");
+ # you may not use this file except in compliance with the License.
+ # You may obtain a copy of the License at
+ #
+ # http://www.apache.org/licenses/LICENSE-2.0
+ #
+ # Unless required by applicable law or agreed to in writing,
+ # software distributed under the License is distributed on an
+ # "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ # either express or implied. See the License for the specific
+ # language governing permissions and limitations under the License.
+ #
+ ###############################################################################
+ */
+
+#include "Arduino.h"
+
+HardwareSerial Serial;
+
+static unsigned long s_millis = 0;
+
+unsigned long millis() {
+    return s_millis;
+}
+
+void setMillis(unsigned long ms) {
+    s_millis = ms;
+}
+
+long random(long min, long max) {
+    return min + rand() % (max - min);
+}
+
+void randomSeed(unsigned long seed) {
+    srand(seed);
+}
@@ -0,0 +1,104 @@
+/*
+ ###############################################################################
+ #
+ # Temboo CoAP Edge Device library
+ #
+ # Copyright (C) 2015, Temboo Inc.
+ #
+ # Licensed under the Apache License, Version 2.0 (the "License");
+ # you may not use this file except in compliance with the License.
+ # You may obtain a copy of the License at
+ #
+ # http://www.apache.org/licenses/LICENSE-2.0
+ #
+ # Unless required by applicable law or agreed to in writing,
+ # software distributed under the License is distributed on an
+ # "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ # either express or implied. See the License for the specific
+ # language governing permissions and limitations under the License.
+ #
+ ###############################################################################
+ */
+
+#ifndef ARDUINO_H_
+#define ARDUINO_H_
+
+// Only what the CoAP client needs for the host tests and benchmark, which
+// build it without TEMBOO_VERBOSE.  millis() returns a clock the tests
+// advance themselves.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+
+#ifdef __cplusplus
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+unsigned long millis();
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+// Sets the clock millis() returns.
+void setMillis(unsigned long ms);
+
+class Print {
+    public:
+        virtual ~Print() {}
+        virtual size_t write(uint8_t c) = 0;
+        virtual size_t write(const uint8_t* buffer, size_t size) {
+            size_t n = 0;
+            while (n < size && write(buffer[n])) {
+                n++;
+            }
+            return n;
+        }
+};
+
+class Stream : public Print {
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+        virtual void flush() {}
+        bool find(const char* target) {return false;}
+        long parseInt() {return 0;}
+};
+
+class String {
+    public:
+        String(const char* s = "") : m_s(s) {}
+        const char* c_str() const {return m_s;}
+    private:
+        const char* m_s;
+};
+
+// Discards everything printed.
+class HardwareSerial : public Stream {
+    public:
+        size_t write(uint8_t c) {return 1;}
+        int available() {return 0;}
+        int read() {return -1;}
+        int peek() {return -1;}
+        template<typename T> size_t print(T value) {return 0;}
+        template<typename T> size_t println(T value) {return 0;}
+};
+
+extern HardwareSerial Serial;
+
+class IPAddress {
+    public:
+        IPAddress(uint32_t address = 0) : m_address(address) {}
+        IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) :
+            m_address((uint32_t)a << 24 | (uint32_t)b << 16 | (uint32_t)c << 8 | d) {}
+        bool operator==(const IPAddress& other) const {return m_address == other.m_address;}
+        bool operator!=(const IPAddress& other) const {return m_address != other.m_address;}
+    private:
+        uint32_t m_address;
+};
+
+#endif // __cplusplus
+
+#endif